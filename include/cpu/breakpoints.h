@@ -0,0 +1,115 @@
+// breakpoints.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <memory>
+#include <vector>
+
+#include "cpu/mem.h"
+
+namespace z86
+{
+	struct CPU;
+
+	/*
+		breakpoints and watchpoints for a single cpu, made so that the normal path pays nothing for
+		them. while there are none, the cpu runs its usual loop, which never looks at any of this.
+
+		breakpoints are on linear addresses (cs base + ip), and stop the cpu before the instruction
+		there executes. with any set, the cpu runs a separate loop that consults a bitmap (one bit per
+		page) only when execution moves to a different page, and compares against the breakpoints
+		themselves only while it is on a page that has one.
+
+		watchpoints are on physical addresses (but remember the linear address they were set on, for
+		reporting hits), and stop the cpu after the instruction that made the access. while the
+		checkpoints replay the cpu, they can also record hits without stopping it (see setReplaying).
+		each memory region with a watched page in it is swapped (in the memory controller's
+		map) for a proxy that checks accesses against the watched pages before forwarding them;
+		every other region is left alone. only the guest's own accesses count -- not instruction
+		fetches, and not anything done while the cpu isn't running (eg. by a debugger).
+	*/
+	struct Breakpoints
+	{
+		enum class Watch { Write, Read, Access };
+
+		// what stopped the cpu.
+		struct Hit
+		{
+			enum class Kind { None, Breakpoint, Watchpoint };
+
+			Kind kind = Kind::None;
+
+			// the linear address of the breakpoint, or of the watchpoint.
+			uint64_t addr = 0;
+			Watch watch = Watch::Access;
+		};
+
+		Breakpoints(CPU& cpu);
+		~Breakpoints();
+
+		Breakpoints(const Breakpoints&) = delete;
+		Breakpoints& operator= (const Breakpoints&) = delete;
+
+	private:
+		struct Watchpoint
+		{
+			uint64_t addr;
+			uint64_t linear;
+			size_t len;
+			Watch kind;
+		};
+
+		struct WatchedRegion;
+
+		CPU& m_cpu;
+		Hit m_hit;
+		bool m_replaying = false;
+
+		std::vector<uint64_t> m_breakpoints;
+		std::vector<Watchpoint> m_watchpoints;
+
+		// one bit per page of the (32-bit) address space.
+		std::vector<uint64_t> m_breakpoint_pages;
+		std::vector<uint64_t> m_watched_pages;
+
+		std::vector<std::unique_ptr<WatchedRegion>> m_regions;
+
+		static bool test_bit(const std::vector<uint64_t>& bitmap, uint64_t page);
+		static void set_bit(std::vector<uint64_t>& bitmap, uint64_t page, bool value);
+
+		bool is_watched(uint64_t addr, size_t len) const;
+		void update_regions();
+
+	public:
+		void addBreakpoint(uint64_t linear);
+		bool removeBreakpoint(uint64_t linear);
+
+		// `linear` is the address that `addr` was translated from.
+		bool addWatchpoint(uint64_t linear, PhysAddr addr, size_t len, Watch kind);
+		bool removeWatchpoint(PhysAddr addr, size_t len, Watch kind);
+
+		void clear();
+
+		bool empty() const { return m_breakpoints.empty() && m_watchpoints.empty(); }
+
+		const Hit& lastHit() const { return m_hit; }
+		void clearHit() { m_hit = Hit { }; }
+
+		// while set, watchpoint hits are recorded even though the breakpoints have been taken off
+		// the cpu (as the checkpoints do when they replay it), and they don't stop it.
+		void setReplaying(bool replaying) { m_replaying = replaying; }
+
+		// used by the cpu.
+		bool pageHasBreakpoint(uint64_t linear) const;
+		bool isBreakpoint(uint64_t linear) const;
+		void breakpointHit(uint64_t linear);
+
+		// used by the watched regions.
+		void access(PhysAddr addr, size_t len, bool write);
+	};
+}
@@ -0,0 +1,89 @@
+// checkpoint.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <deque>
+#include <vector>
+#include <functional>
+
+#include "cpu/cpu.h"
+
+namespace z86
+{
+	/*
+		periodic snapshots of a single cpu, for going backwards in time. every `interval` instructions
+		(at the end of a run of instructions) the cpu's state is saved, which is small; memory is
+		not copied at all. instead, the memory controller saves the old contents of each page the
+		first time it is written after a checkpoint, and those pages are kept with the checkpoint
+		that they belong to -- an undo log. going back to checkpoint k means applying the undo logs
+		of every later checkpoint (newest first), then those of k itself.
+
+		to get to an arbitrary instruction count, we restore the nearest checkpoint at or before it,
+		and re-execute forward; this is deterministic as long as the devices are (ie. no --realtime,
+		and no port reads whose values depend on the host), or if everything is replayed.
+
+		the oldest checkpoints are dropped to keep the saved pages under the memory budget.
+	*/
+	struct Checkpoints
+	{
+		// `budget` is in bytes.
+		Checkpoints(CPU& cpu, uint64_t interval, size_t budget);
+		~Checkpoints();
+
+		Checkpoints(const Checkpoints&) = delete;
+		Checkpoints& operator= (const Checkpoints&) = delete;
+
+	private:
+		struct Checkpoint
+		{
+			CPU::State state;
+
+			// the contents of pages before they were first written after this checkpoint.
+			std::vector<MemoryController::SavedPage> undo;
+		};
+
+		CPU& m_cpu;
+		uint64_t m_interval;
+		size_t m_budget;
+		size_t m_used = 0;
+
+		std::deque<Checkpoint> m_checkpoints;
+
+		static size_t undo_size(const std::vector<MemoryController::SavedPage>& pages);
+
+		size_t latest_before(uint64_t icount);
+		void restore(size_t idx);
+
+	public:
+		// the instruction count at which the cpu should take the next one.
+		uint64_t nextCheckpoint() const;
+
+		// called by the cpu between runs of instructions.
+		void take();
+
+		size_t count() const { return m_checkpoints.size(); }
+		size_t memoryUsed() const { return m_used; }
+
+		// the earliest instruction count that we can go back to.
+		uint64_t earliest() const;
+
+		// puts the cpu into the state it was in after `icount` instructions. going backwards needs
+		// a checkpoint at or before `icount`; going forwards just runs the cpu. false if the
+		// point can't be reached.
+		bool seek(uint64_t icount);
+
+		// one instruction back.
+		bool reverseStep();
+
+		// goes back to the last point before the current one where `stop` returns true, checked
+		// before each instruction (eg. a breakpoint on cs:ip), or where `after` returns true once
+		// the instruction there has run (eg. it touched a watchpoint); if there is none, ends up
+		// at the earliest checkpoint and returns false.
+		bool reverseContinue(const std::function<bool (CPU&)>& stop, const std::function<bool (CPU&)>& after = nullptr);
+	};
+}
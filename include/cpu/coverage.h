@@ -0,0 +1,101 @@
+// coverage.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstddef>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "cpu/mem.h"
+
+namespace z86
+{
+	/*
+		which bytes of guest code have run, as one bit per byte of the (32-bit) physical address
+		space. the bitmap is made of 64 KB chunks, allocated the first time anything in them runs,
+		so it only takes memory for the code that actually ran. any number of cpus can share one.
+
+		the cpu marks an instruction when it decodes it, not every time it runs it. with the decode
+		cache, that is once for every instruction that stays cached, so a loop (or any other code
+		that runs more than once) costs nothing after its first time around; only code that can't be
+		cached (with paging or segment limit checks) is marked on every run. without a Coverage set
+		on the cpu, the cost is a test of a pointer on a cache miss.
+
+		the bitmap is turned into something readable with nasm listings (nasm -l) of the code: each
+		listing line that assembled to an instruction is covered if the first byte of it ran. lines
+		that are only data (db, times, resb, ...), labels, comments and directives don't count, and
+		neither do lines from macros or included files. the result is either an lcov tracefile (for
+		genhtml or anything else that reads them), or a single page of html with the listings.
+	*/
+	struct Coverage
+	{
+		Coverage();
+		~Coverage();
+
+		Coverage(const Coverage&) = delete;
+		Coverage& operator= (const Coverage&) = delete;
+
+		// the `len` bytes of an instruction at `addr` ran.
+		void mark(PhysAddr addr, size_t len);
+
+		bool covered(PhysAddr addr) const;
+
+		// reads a listing of code loaded at physical address `base`; false if it can't be read.
+		bool addListing(const std::string& path, uint64_t base);
+
+		// writes an lcov tracefile, or html if the name ends in ".html"; false if it can't.
+		bool write(const std::string& path) const;
+
+		// logs how many of the lines of each listing ran.
+		void summarise() const;
+
+	private:
+		static constexpr size_t CHUNK_SHIFT = 16;
+		static constexpr size_t NUM_CHUNKS = (1ULL << (32 - CHUNK_SHIFT));
+		static constexpr size_t CHUNK_WORDS = (1ULL << CHUNK_SHIFT) / 64;
+
+		struct Chunk
+		{
+			std::atomic<uint64_t> words[CHUNK_WORDS];
+		};
+
+		struct Line
+		{
+			size_t number = 0;
+			std::string text;
+
+			// only for lines of code.
+			bool code = false;
+			uint64_t offset = 0;
+		};
+
+		struct Listing
+		{
+			std::string path;
+			std::string source;
+			uint64_t base = 0;
+			std::vector<Line> lines;
+		};
+
+		std::unique_ptr<std::atomic<Chunk*>[]> m_chunks;
+		std::vector<Listing> m_listings;
+
+		Chunk* chunk(uint64_t addr);
+		void set_bits(uint64_t addr, size_t len);
+
+		bool line_covered(const Listing& listing, const Line& line) const;
+
+		// lines of code, and how many of them ran.
+		std::pair<size_t, size_t> count_lines(const Listing& listing) const;
+		void write_lcov(FILE* f) const;
+		void write_html(FILE* f) const;
+	};
+}
@@ -8,13 +8,28 @@
 #include <cstddef>
 #include <cassert>
 
+#include <atomic>
+
 #include "misc.h"
 
+#include "io.h"
 #include "mmu.h"
 #include "exec.h"
+#include "sched.h"
+#include "replay.h"
+#include "timing.h"
+#include "decodecache.h"
+
+#include "devices/pic.h"
+#include "devices/pit.h"
 
 namespace z86
 {
+	struct Checkpoints;
+	struct Breakpoints;
+	struct Coverage;
+	struct BiosHLE;
+
 	struct GeneralPurposeReg
 	{
 		union {
@@ -86,14 +101,14 @@ namespace z86
 
 		ALWAYS_INLINE void setFrom(uint16_t word)
 		{
-			// bits 5, 3, and 1 are ignored -- hence 0xD5.
-			this->m_flags = (word & 0xD5) | 0x2;
+			// bits 5, 3, and 1 are ignored -- hence 0xD5; the high byte has TF, IF, DF and OF.
+			this->m_flags = (word & 0x0FD5) | 0x2;
 		}
 
 		ALWAYS_INLINE void setFrom(uint32_t dword)
 		{
-			// bits 5, 3, and 1 are ignored -- hence 0xD5.
-			this->m_eflags = (dword & 0xD5) | 0x2;
+			// bits 5, 3, and 1 are ignored -- hence 0xD5; the high byte has TF, IF, DF and OF.
+			this->m_eflags = (dword & 0x0FD5) | 0x2;
 		}
 
 		// bit 1 is supposed to be always 1.
@@ -118,7 +133,21 @@ namespace z86
 		};
 	};
 
+	// xmm registers are the low half of the corresponding ymm register. this is aligned
+	// so that the simd kernels (see simd.h) can use aligned host loads and stores directly
+	// on the register file.
+	struct alignas(32) VectorReg
+	{
+		union {
+			uint8_t  bytes[32];
+			uint16_t u16[16];
+			uint32_t u32[8];
+			uint64_t u64[4];
+		};
+	};
+
 	static_assert(sizeof(FlagsReg) == 8);
+	static_assert(sizeof(VectorReg) == 32);
 	static_assert(sizeof(GeneralPurposeReg) == 8);
 
 	enum class CPUMode
@@ -131,25 +160,21 @@ namespace z86
 	template <typename T>
 	struct RegWrapper
 	{
-		ALWAYS_INLINE RegWrapper(T& x) : cpu(nullptr), idx(0), x(x), fn([](CPU*, short, T){}) { }
-		ALWAYS_INLINE RegWrapper(CPU* cpu, short idx, T& x, void (*fn)(CPU*, short, T))
-			: cpu(cpu), idx(idx), x(x), fn(fn) { }
+		ALWAYS_INLINE RegWrapper(T& x) : x(x) { }
 
-		ALWAYS_INLINE T& operator=(T v) { x = v; fn(cpu, idx, v); return x; }
+		ALWAYS_INLINE T& operator=(T v) { x = v; return x; }
 		ALWAYS_INLINE operator T() { return x; }
 		ALWAYS_INLINE T get() { return x; }
 		ALWAYS_INLINE operator Value() { return Value(x); }
 
 	private:
-		CPU* cpu;
-		short idx;
 		T& x;
-		void (*fn)(CPU*, short, T);
 	};
 
 	struct CPU
 	{
-		CPU();
+		// the memory controller is shared with any other cpus in the machine.
+		CPU(MemoryController& memory, size_t id = 0);
 
 	private:
 		// order is in terms of "standard" indices:
@@ -157,9 +182,12 @@ namespace z86
 		// R8, R9, R10, R11, R12, R13, R14, R15
 		GeneralPurposeReg m_gprs[16] = { };
 
-		// CS, DS, ES, FS, GS, SS
+		// CS, DS, ES, FS, GS, SS -- same order as SegReg
 		uint16_t m_segment_regs[6] = { };
 
+		// XMM0-15 / YMM0-15
+		VectorReg m_vregs[16] = { };
+
 		// instruction pointer
 		uint64_t m_ip = 0;
 
@@ -172,10 +200,81 @@ namespace z86
 	public:
 		Executor m_exec;
 	private:
-		MemoryController m_memory;
+		MemoryController& m_memory;
 		PagedMMU m_pmmu;
 		SegmentedMMU m_smmu;
 
+		// only used while the code segment needs no limit checks.
+		DecodeCache m_dcache;
+
+		IOPortController m_io;
+		Scheduler m_sched;
+		PIC m_pic;
+		PIT m_pit;
+
+		// the current run of instructions (see start()); both count instructions.
+		uint64_t m_slice_pos = 0;
+		uint64_t m_slice_end = 0;
+
+		// the cycles taken by the instructions of the current run that have finished, and the most
+		// it can take before the next scheduled event. these count ticks of the scheduler's clock.
+		uint64_t m_slice_cycles = 0;
+		uint64_t m_slice_cycles_end = 0;
+
+		// how much of the current run the scheduler's clock has already been advanced by.
+		uint64_t m_slice_synced = 0;
+
+		// instructions retired, and the cycles they took, before the current run.
+		uint64_t m_instructions = 0;
+		uint64_t m_cycles = 0;
+
+		// see timing.h; the cost of every instruction is worked out when it is decoded.
+		CPUModel m_model = CPUModel::Flat;
+
+		// reads and writes of guest memory through the cpu (not counting instruction fetches).
+		uint64_t m_memory_accesses = 0;
+
+		// if set, every nondeterministic input goes through here (see replay.h).
+		ReplayLog* m_replay = nullptr;
+
+		// if set, takes a checkpoint between runs of instructions whenever one is due.
+		Checkpoints* m_checkpoints = nullptr;
+
+		// if set (and not empty), instructions are run through run_checked() instead.
+		Breakpoints* m_breakpoints = nullptr;
+
+		// if set, every instruction is marked in it as it is decoded.
+		Coverage* m_coverage = nullptr;
+
+		// if set, does the bios calls that trap with a ud2 (see devices/bios.h).
+		BiosHLE* m_bios = nullptr;
+
+		// true inside start() and runUntil(); m_fetching only while decoding in run_checked().
+		bool m_running = false;
+		bool m_fetching = false;
+
+		// set when a breakpoint or watchpoint is hit; ends the run of instructions, and then start()
+		// or runUntil() returns.
+		bool m_debug_stop = false;
+
+		// set by HLT; cleared when an interrupt is delivered.
+		bool m_halted = false;
+
+		// interrupts are not delivered before this instruction count (for the sti shadow).
+		uint64_t m_interrupts_after = 0;
+
+		bool m_realtime = false;
+		bool m_halt_exits = false;
+
+		size_t m_id = 0;
+
+		// set from other threads by stop(); only looked at between runs of instructions.
+		std::atomic<bool> m_stop_requested = false;
+
+		// the longest run of instructions, so that stop() is noticed even when nothing is
+		// scheduled.
+		static constexpr uint64_t MAX_SLICE = 0x10000;
+
 		static constexpr size_t IDX_A   = 0;
 		static constexpr size_t IDX_C   = 1;
 		static constexpr size_t IDX_D   = 2;
@@ -200,12 +299,25 @@ namespace z86
 		static constexpr size_t IDX_GS = 4;
 		static constexpr size_t IDX_SS = 5;
 
-		instrad::x86::Instruction decode();
-		bool run(instrad::x86::Instruction instr);
+		instrad::x86::Instruction decode(InstrCost& cost);
+		bool run(const instrad::x86::Instruction& instr, InstrCost cost);
+		bool idle();
+		void check_interrupts();
+		void take_interrupt(uint8_t vector);
+		bool main_loop(uint64_t until);
+		bool run_checked(uint64_t resume);
+		void sync_clock();
 
 	public:
-		void memLock();
-		void memUnlock();
+		// the physical address of seg:address, going through segmentation (including the
+		// limit and access checks for `len` bytes) and paging.
+		PhysAddr translate(SegReg seg, uint64_t address, size_t len,
+			SegmentedMMU::Access access = SegmentedMMU::Access::Read);
+
+		// the host memory behind `len` bytes at seg:address, or null if it isn't plain
+		// ram (see MemoryController::hostPointer).
+		uint8_t* hostPointer(SegReg seg, uint64_t address, size_t len,
+			SegmentedMMU::Access access = SegmentedMMU::Access::Read);
 
 		uint8_t read8(uint64_t address);
 		uint16_t read16(uint64_t address);
@@ -223,6 +335,7 @@ namespace z86
 		void write64(SegReg seg, uint64_t address, uint64_t value);
 
 		CPUMode mode() const { return this->m_mode; }
+		void setMode(CPUMode mode) { this->m_mode = mode; }
 		bool isProtected() const { return this->m_mode >= CPUMode::Prot; }
 
 		// A, C, D, B, SP, BP, etc.
@@ -231,12 +344,139 @@ namespace z86
 		RegWrapper<uint32_t> reg32(const instrad::x86::Register& reg);
 		RegWrapper<uint64_t> reg64(const instrad::x86::Register& reg);
 
+		// XMM or YMM; they share the same storage.
+		VectorReg& vreg(const instrad::x86::Register& reg);
+
 		void start();
 		void reset();
 		void jump(uint64_t ip);
 
+		// like start(), but begins at cs:ip (in real mode) instead of the reset vector.
+		void start(uint16_t cs, uint64_t ip);
+
+		// makes start() return at the end of the current run of instructions. this is the
+		// only method that is safe to call from another thread.
+		void stop();
+
+		// the request stays until it is cleared, so that a stop() that races with the cpu
+		// starting isn't lost.
+		bool stopRequested() const { return m_stop_requested.load(std::memory_order_relaxed); }
+		void clearStopRequest() { m_stop_requested.store(false, std::memory_order_relaxed); }
+
+		// continues from wherever the cpu is (without a reset) until `icount` instructions have
+		// been retired; false if it stopped before that.
+		bool runUntil(uint64_t icount);
+
+		// everything needed to put the cpu and its devices back to an earlier point. memory
+		// is not included; see checkpoint.h.
+		struct State
+		{
+			GeneralPurposeReg gprs[16];
+			uint16_t segment_regs[6];
+			VectorReg vregs[16];
+			uint64_t ip;
+			FlagsReg flags;
+			CPUMode mode;
+
+			bool paging;
+			SegmentedMMU::State smmu;
+
+			Scheduler sched;
+			PIC::State pic;
+			PIT::State pit;
+
+			uint64_t instructions;
+			uint64_t cycles;
+			uint64_t interrupts_after;
+			bool halted;
+		};
+
+		// only valid between runs of instructions.
+		State saveState();
+		void restoreState(const State& st);
+
+		void setCheckpoints(Checkpoints* checkpoints) { m_checkpoints = checkpoints; }
+
+		// after a breakpoint or watchpoint is hit, start() or runUntil() returns; calling either
+		// again resumes without stopping at the same breakpoint. see breakpoints.h.
+		void setBreakpoints(Breakpoints* breakpoints) { m_breakpoints = breakpoints; }
+		Breakpoints* breakpoints() { return m_breakpoints; }
+
+		// records which code runs; see coverage.h.
+		void setCoverage(Coverage* coverage) { m_coverage = coverage; }
+
+		bool running() const { return m_running; }
+		bool fetching() const { return m_fetching; }
+
+		// stops at the end of the current instruction.
+		void requestDebugStop();
+
+		size_t id() const { return m_id; }
+
+		// the number of instructions retired so far (including the current one, if called
+		// while executing an instruction).
+		uint64_t instructionCount() const { return m_instructions + m_slice_pos; }
+
+		// the number of cycles taken by the instructions retired so far (not including the current
+		// one), according to the model; time spent halted doesn't count.
+		uint64_t cycleCount() const { return m_cycles + m_slice_cycles; }
+
+		// which cpu's timings to use; not while it is running.
+		void setModel(CPUModel model);
+		CPUModel model() const { return m_model; }
+
+		// the number of reads and writes of memory the guest has made so far; a locked access
+		// counts once, and instruction fetches don't count (they are mostly cached anyway).
+		uint64_t memoryAccessCount() const { return m_memory_accesses; }
+
+		// the bios emulation can be shared by all the cpus.
+		void setBios(BiosHLE* bios) { m_bios = bios; }
+
+		// for a ud2: true if it was a trap into the bios emulation (which has done the call).
+		bool biosTrap();
+
+		// records to, or replays from, `log`. only meaningful for a single cpu.
+		void setReplayLog(ReplayLog* log) { m_replay = log; }
+
+		// io port reads, and reads of the host's clock (in nanoseconds), by the guest. these are
+		// the nondeterministic inputs, so they go through the replay log if there is one.
+		uint32_t portIn(uint16_t port, int bits);
+		uint64_t hostTime();
+
+		// devices see the clock as of the start of the instruction doing the io, whatever
+		// the run of instructions looks like.
+		void portOut(uint16_t port, int bits, uint32_t value);
+
+		bool halted() const { return m_halted; }
+
+		// stops at the end of the current instruction until the next interrupt, as if by HLT
+		// (but the emulator keeps going, even with halt-exits). for the bios, to wait for input.
+		void halt();
+
+		// while halted, sleep the host thread until the next event is due (instead of
+		// skipping straight to it).
+		void setRealtime(bool realtime) { m_realtime = realtime; }
+
+		// stop the emulator at the first HLT (for test programs).
+		void setHaltExits(bool exits) { m_halt_exits = exits; }
+
 		MemoryController& memory() { return m_memory; }
 		SegmentedMMU& smmu() { return m_smmu; }
+		PagedMMU& pmmu() { return m_pmmu; }
+		IOPortController& ports() { return m_io; }
+		Scheduler& scheduler() { return m_sched; }
+		PIC& pic() { return m_pic; }
+		PIT& pit() { return m_pit; }
+
+		// transfers control to the handler for `vector`, as if by INT n.
+		void interrupt(uint8_t vector);
+
+		// ends the current run of instructions after `delay` more, so that pending interrupts
+		// (and anything else that only happens between runs) are looked at.
+		void requestInterruptCheck(uint64_t delay = 0);
+
+		// holds off interrupts for the next `count` instructions, then checks for them.
+		void inhibitInterrupts(uint64_t count);
 
 		// accessor spam.
 		// flags register
@@ -253,13 +493,17 @@ namespace z86
 			return 0;
 		}
 
-		// segment registers
-		RegWrapper<uint16_t> cs();
-		RegWrapper<uint16_t> ds();
-		RegWrapper<uint16_t> es();
-		RegWrapper<uint16_t> fs();
-		RegWrapper<uint16_t> gs();
-		RegWrapper<uint16_t> ss();
+		// segment registers. these are read-only; writes must go through setSegment(),
+		// which also reloads the cached descriptor in the smmu.
+		inline uint16_t cs() const      { return this->m_segment_regs[IDX_CS]; }
+		inline uint16_t ds() const      { return this->m_segment_regs[IDX_DS]; }
+		inline uint16_t es() const      { return this->m_segment_regs[IDX_ES]; }
+		inline uint16_t fs() const      { return this->m_segment_regs[IDX_FS]; }
+		inline uint16_t gs() const      { return this->m_segment_regs[IDX_GS]; }
+		inline uint16_t ss() const      { return this->m_segment_regs[IDX_SS]; }
+
+		inline uint16_t segment(SegReg sr) const { return this->m_segment_regs[static_cast<size_t>(sr)]; }
+		void setSegment(SegReg sr, uint16_t sel);
 
 		void push8(uint8_t x);
 		void push16(uint16_t x);
@@ -361,7 +605,7 @@ namespace z86
 
 		uint8_t peek() const
 		{
-			return m_cpu.read8(SegReg::CS, m_cpu.ip() + m_idx);
+			return m_cpu.smmu().fetch8(SegmentedAddr::cs(m_cpu.ip() + m_idx));
 		}
 
 		uint8_t pop()
@@ -0,0 +1,87 @@
+// decodecache.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "cpu/mem.h"
+#include "cpu/timing.h"
+#include "instrad/x86/decode.h"
+
+namespace z86
+{
+	/*
+		decoded instructions, keyed by the physical address of their first byte, so that a loop
+		doesn't decode the same bytes over and over. it is direct-mapped: each address has exactly
+		one slot, and a new instruction replaces whatever was in it.
+
+		the bytes of every cached instruction are marked as code in the memory controller, which
+		then tells us about writes to those pages (see MemoryController::markCode). a write from the
+		owning cpu's thread drops just the entries it overlaps, so the very next instruction sees it.
+		a write from any other thread only raises a flag, and the owner drops everything at its next
+		sync() -- the start of its next run of instructions. (as on real hardware, another cpu's
+		write that races with the first decode of the same bytes might not be seen.)
+	*/
+	struct DecodeCache
+	{
+		DecodeCache(MemoryController& memory);
+		~DecodeCache();
+
+		DecodeCache(const DecodeCache&) = delete;
+		DecodeCache& operator= (const DecodeCache&) = delete;
+
+		// each entry is a little over half a kilobyte.
+		static constexpr size_t NUM_ENTRIES = 1024;
+
+	private:
+		static constexpr uint64_t EMPTY = UINT64_MAX;
+
+		// the longest possible x86 instruction.
+		static constexpr size_t MAX_LENGTH = 15;
+
+		struct Entry
+		{
+			uint64_t addr = EMPTY;
+			instrad::x86::Instruction instr = instrad::x86::Instruction(instrad::x86::ops::INVALID);
+			InstrCost cost;
+		};
+
+		MemoryController& m_memory;
+		size_t m_listener;
+
+		std::unique_ptr<Entry[]> m_entries;
+
+		std::thread::id m_owner;
+		std::atomic<bool> m_flush_pending = false;
+
+		Entry& slot(uint64_t addr) { return m_entries[addr % NUM_ENTRIES]; }
+
+		void code_written(PhysAddr addr, size_t len);
+
+	public:
+		// null if there's nothing cached at `addr`; otherwise, `cost` is what it was inserted with.
+		const instrad::x86::Instruction* lookup(PhysAddr addr, InstrCost& cost)
+		{
+			auto& e = this->slot(addr.addr);
+			if(e.addr != addr.addr)
+				return nullptr;
+
+			cost = e.cost;
+			return &e.instr;
+		}
+
+		void insert(PhysAddr addr, const instrad::x86::Instruction& instr, InstrCost cost);
+		void clear();
+
+		// writes from threads other than `owner` are deferred until the next sync().
+		void setOwner(std::thread::id owner) { m_owner = owner; }
+		void sync();
+	};
+}
@@ -0,0 +1,109 @@
+// instrument.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "cpu/mem.h"
+#include "instrad/x86/decode.h"
+
+// 1 to build in the hooks for plugins (eg. `make clean && make DEFINES=-DZ86_INSTRUMENT=1`).
+#ifndef Z86_INSTRUMENT
+	#define Z86_INSTRUMENT 0
+#endif
+
+namespace z86
+{
+	struct CPU;
+
+	/*
+		hooks for tracing and profiling the guest, chosen when z86 is built. the cpu calls them
+		through `Instrumentation`, a policy with an `enabled` flag and a static function for each
+		hook, and every call is inside an `if constexpr(Instrumentation::enabled)` -- so with the
+		default policy (NoInstrumentation) there is no trace of them in the binary, not even at -O0,
+		and the hot paths are exactly what they would be without them.
+
+		with Z86_INSTRUMENT, the policy is PluginInstrumentation, which passes everything on to the
+		plugins added with add_plugin(), in the order they were added. there are three hooks:
+
+			retire      after an instruction has run, with the instruction and its address
+			memory      after each read or write of guest memory by an instruction, with the
+			            segment, offset, size and value; cpu.translate() gives the physical address.
+			            a locked access is one event, without the value (see MemoryAccess)
+			transfer    after an instruction that didn't fall through to the next one (a jump, call,
+			            return, int, iret...), and when an interrupt is taken between instructions
+
+		for each instruction, its memory accesses come first, then its retire, then its transfer
+		(if any). instruction fetches aren't memory accesses here, and neither is anything done
+		while the cpu isn't running (eg. by a debugger or a device). the hooks run on the thread
+		of the cpu they are given, so with more than one cpu a plugin has to be thread-safe.
+	*/
+	struct MemoryAccess
+	{
+		// a locked access reads and writes with one host atomic, so there's no value to report.
+		enum class Kind { Read, Write, Locked };
+
+		Kind kind;
+		SegReg seg;
+		uint64_t offset;
+		size_t bytes;
+		uint64_t value;
+	};
+
+	struct ControlTransfer
+	{
+		enum class Kind { Instruction, Interrupt };
+
+		Kind kind;
+		uint16_t from_cs;
+		uint64_t from_ip;
+		uint16_t to_cs;
+		uint64_t to_ip;
+
+		// the instruction that made the transfer; null for interrupts.
+		const instrad::x86::Instruction* instr;
+	};
+
+	struct NoInstrumentation
+	{
+		static constexpr bool enabled = false;
+
+		static void retire(CPU& cpu, const instrad::x86::Instruction& instr, uint16_t cs, uint64_t ip) { }
+		static void memory(CPU& cpu, const MemoryAccess& access) { }
+		static void transfer(CPU& cpu, const ControlTransfer& transfer) { }
+	};
+
+#if Z86_INSTRUMENT
+
+	struct InstrumentationPlugin
+	{
+		virtual ~InstrumentationPlugin() { }
+
+		virtual void retire(CPU& cpu, const instrad::x86::Instruction& instr, uint16_t cs, uint64_t ip) { }
+		virtual void memory(CPU& cpu, const MemoryAccess& access) { }
+		virtual void transfer(CPU& cpu, const ControlTransfer& transfer) { }
+	};
+
+	struct PluginInstrumentation
+	{
+		static constexpr bool enabled = true;
+
+		// only before any cpu starts; the plugin has to outlive them.
+		static void add_plugin(InstrumentationPlugin* plugin);
+
+		static void retire(CPU& cpu, const instrad::x86::Instruction& instr, uint16_t cs, uint64_t ip);
+		static void memory(CPU& cpu, const MemoryAccess& access);
+		static void transfer(CPU& cpu, const ControlTransfer& transfer);
+	};
+
+	using Instrumentation = PluginInstrumentation;
+
+#else
+
+	using Instrumentation = NoInstrumentation;
+
+#endif
+}
@@ -0,0 +1,45 @@
+// io.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <vector>
+
+namespace z86
+{
+	// anything that sits on the io port bus. `bits` is 8, 16 or 32; devices that only
+	// care about byte accesses can just look at the low byte.
+	struct IODevice
+	{
+		virtual ~IODevice() { }
+
+		virtual uint32_t in(uint16_t port, int bits) = 0;
+		virtual void out(uint16_t port, int bits, uint32_t value) = 0;
+	};
+
+	/*
+		the io port controller maps each of the 65536 ports directly to the device that owns
+		it, so an in/out is a single table lookup. it does not own the devices.
+
+		reads from unmapped ports return all ones (like a floating bus), and writes to them
+		are ignored.
+	*/
+	struct IOPortController
+	{
+		IOPortController();
+
+	private:
+		std::vector<IODevice*> m_ports;
+
+	public:
+		void attach(uint16_t first, size_t count, IODevice* device);
+		void detach(uint16_t first, size_t count);
+
+		uint32_t in(uint16_t port, int bits);
+		void out(uint16_t port, int bits, uint32_t value);
+	};
+}
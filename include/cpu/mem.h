@@ -9,6 +9,12 @@
 #include <cstddef>
 #include <cassert>
 
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <functional>
+
 namespace z86
 {
 	enum class SegReg { CS, DS, ES, FS, GS, SS };
@@ -66,6 +72,23 @@ namespace z86
 		virtual void read(uint64_t offset, void* buf, size_t len) = 0;
 		virtual void write(uint64_t offset, const void* buf, size_t len) = 0;
 
+		// regions backed by plain host memory return a pointer to it, so it can be accessed
+		// directly (eg. with host atomics). devices, and read-only regions, return null.
+		virtual uint8_t* hostPointer(uint64_t offset, size_t len) { return nullptr; }
+
+		// a region that wraps another (eg. to watch accesses) returns the wrapped one, for the
+		// emulator's own accesses that the guest didn't make.
+		virtual MemoryRegion* inner() { return this; }
+
+		// how much of the region actually takes up host memory; for those that are allocated
+		// lazily, this is only the parts that have been touched.
+		virtual size_t committed() { return m_size; }
+
+		// regions backed by plain host memory can have it moved to `host` (page-aligned), or
+		// anywhere else if that is null, returning where it ended up; for the memory controller's
+		// flat mapping (see setFlatMapping). everything else returns null, and stays put.
+		virtual uint8_t* relocate(uint8_t* host) { return nullptr; }
+
 	protected:
 		size_t m_size;
 
@@ -86,14 +109,25 @@ namespace z86
 		}
 	};
 
+	/*
+		plain host memory. it is only reserved up front, and the host commits each page the first
+		time it is touched, so even a large region costs nothing until it's used. where the host
+		supports it, the region is backed by transparent huge pages (which means fewer host TLB
+		misses); with `hugetlb`, it comes from the preallocated pool in hugetlbfs instead -- which
+		needs a size that is a multiple of HUGE_PAGE_SIZE, and falls back to ordinary pages if the
+		pool is too small.
+	*/
 	struct HostMmapMemoryRegion : MemoryRegion
 	{
-		HostMmapMemoryRegion(size_t size, bool writable);
+		HostMmapMemoryRegion(size_t size, bool writable, bool hugetlb = false);
 		~HostMmapMemoryRegion();
 
+		static constexpr size_t HUGE_PAGE_SIZE = 0x200000;
+
 	private:
 		uint8_t* m_ptr = 0;
 		bool m_writable = false;
+		bool m_hugetlb = false;
 
 	public:
 		virtual void read(uint64_t offset, void* buf, size_t len) override
@@ -109,29 +143,193 @@ namespace z86
 
 			memcpy(m_ptr + offset, buf, len);
 		}
+
+		virtual uint8_t* hostPointer(uint64_t offset, size_t len) override
+		{
+			assert(offset + len <= m_size);
+			return m_writable ? m_ptr + offset : nullptr;
+		}
+
+		virtual uint8_t* relocate(uint8_t* host) override;
+		virtual size_t committed() override;
+
+		bool hugetlb() const { return m_hugetlb; }
 	};
 
 	struct MemoryController
 	{
-		MemoryController();
+		// `ram_size` bytes of ram (a multiple of PAGE_SIZE) are mapped at physical address 0;
+		// see HostMmapMemoryRegion for `hugetlb`.
+		MemoryController(size_t ram_size = DEFAULT_RAM_SIZE, bool hugetlb = false);
 		~MemoryController();
 
+		// `length` bytes of `region`, from `offset` into it, mapped at `start`. a region is usually
+		// mapped whole; it ends up in pieces when another region is added inside it.
 		struct RegionMapping
 		{
 			PhysAddr start;
 			size_t length;
+			size_t offset;
 
 			MemoryRegion* region;
 		};
 
+		// the contents of a page before it was first written (see setWriteTracking()).
+		struct SavedPage
+		{
+			uint64_t addr;
+			std::vector<uint8_t> data;
+		};
+
+		// a piece of a dma transfer (see dmaSpans()). `host` is null when the piece can't be
+		// accessed directly -- because it's a device, or read-only, or nothing is mapped there --
+		// and then it has to go through read() or write() instead.
+		struct DmaSpan
+		{
+			PhysAddr addr;
+			size_t length;
+
+			uint8_t* host;
+
+			bool direct() const { return host != nullptr; }
+		};
+
+		static constexpr size_t PAGE_SIZE = 0x1000;
+		static constexpr size_t DEFAULT_RAM_SIZE = 0x100000;
+
+		// the rom sits in the last 64k of the 4GB physical address space, so ram has to end before it.
+		static constexpr size_t MAX_RAM_SIZE = 0xFFFF0000;
+
 	private:
 		std::vector<RegionMapping> m_regions;
+		HostMmapMemoryRegion* m_ram = nullptr;
+
+		// locked accesses that can't be done with host atomics (because they are misaligned,
+		// or not in plain ram) take a lock for each cache line they touch, instead of one
+		// lock for the whole bus. lines share locks modulo LOCK_STRIPES.
+		static constexpr size_t LOCK_STRIPES = 64;
+		static constexpr size_t LOCK_LINE_SIZE = 64;
+
+		std::mutex m_stripes[LOCK_STRIPES];
+
+		// for checkpoints: one bit per page of the 4GB physical address space, set when the page
+		// is first written after takeUndoLog(), at which point its old contents are saved.
+		bool m_tracking = false;
+		std::vector<uint64_t> m_written;
+		std::vector<SavedPage> m_undo;
+
+		inline void track_write(PhysAddr addr, size_t len) { if(m_tracking) this->save_pages(addr, len); }
+		void save_pages(PhysAddr addr, size_t len);
+
+		// for self-modifying code: one bit per page of the 4GB physical address space, set (and
+		// never cleared) by markCode(). pages past 4GB share bits with the ones below, which can
+		// only cause needless notifications. written by any cpu, so the words are atomic.
+		static constexpr uint64_t CODE_PAGES = (1ull << 32) / PAGE_SIZE;
+
+		std::unique_ptr<std::atomic<uint64_t>[]> m_code_pages;
+		std::vector<std::pair<size_t, std::function<void (PhysAddr, size_t)>>> m_code_listeners;
+		size_t m_next_listener = 0;
+
+		inline bool is_code(uint64_t page)
+		{
+			page %= CODE_PAGES;
+			return m_code_pages[page / 64].load(std::memory_order_relaxed) & (1ull << (page % 64));
+		}
+
+		// an ordinary data write costs one bit test (two, if it straddles pages).
+		inline void check_code(PhysAddr addr, size_t len)
+		{
+			auto first = addr.addr / PAGE_SIZE;
+			auto last = (addr.addr + len - 1) / PAGE_SIZE;
+
+			if(is_code(first) || (last != first && is_code(last)))
+				this->code_written(addr, len);
+		}
+
+		void code_written(PhysAddr addr, size_t len);
+
+		// see setFlatMapping(). a segment base plus an offset (both 32 bits) reaches just short of
+		// 8GB, so that much is reserved; plus a guard for accesses that run off the end.
+		static constexpr uint64_t FLAT_SIZE = (1ull << 33);
+		static constexpr uint64_t FLAT_GUARD = 0x10000;
+
+		uint8_t* m_flat = nullptr;
+
+		void map_flat(const RegionMapping& r);
+		void unmap_flat(const RegionMapping& r);
+		void unreserve_flat();
+
+		// the region lookup, for accesses that can't be done through the flat mapping.
+		uint64_t region_read(PhysAddr addr, size_t bytes);
+		void region_write(PhysAddr addr, size_t bytes, uint64_t value);
+
 
 	public:
+		// regions must all be added before any cpu starts running. a region can't overlap another,
+		// unless it lies entirely inside it -- then it takes that part over (eg. a device in the
+		// middle of ram), and the rest of the outer one stays mapped around it.
 		void addRegion(PhysAddr start, MemoryRegion* region);
 
-		void lock();
-		void unlock();
+		// reserves the guest's whole physical address space as one inaccessible host mapping,
+		// and moves every region backed by plain memory into it at its physical address (the
+		// rest stay where they are). reads and writes (but not read() and write()) then become a
+		// plain load or store from that base; those that land anywhere else fault, and the signal
+		// handler does them through the regions instead. this is a one-way switch, made before
+		// any cpu starts running; false if the host can't do it.
+		bool setFlatMapping();
+		bool flatMapped() const { return m_flat != nullptr; }
+
+		// for the SIGSEGV handler: does the access that faulted at `addr` (with `context` being the
+		// handler's ucontext_t) if it was in a flat mapping, and returns false otherwise.
+		static bool handleFault(void* addr, void* context);
+
+		// the guest's ram: how big it is, and how much of it the host has actually had to provide.
+		size_t ramSize() const { return m_ram->size(); }
+		size_t ramCommitted() const { return m_ram->committed(); }
+
+		// null if nothing is mapped at `addr`.
+		const RegionMapping* findRegion(PhysAddr addr);
+
+		// replaces the region mapped at `start` (where a mapping must begin) with one of the same
+		// size, in that mapping only, returning the old one. the controller deletes whatever is mapped when it is destroyed, so
+		// swap the old one back before then. like addRegion(), not while other cpus are running.
+		MemoryRegion* swapRegion(PhysAddr start, MemoryRegion* region);
+
+		// lock and unlock the stripes covering [addr, addr + len).
+		void lock(PhysAddr addr, size_t len);
+		void unlock(PhysAddr addr, size_t len);
+
+		// null if the range is not entirely inside one region, or if that region isn't
+		// backed by host memory. the range counts as written.
+		uint8_t* hostPointer(PhysAddr addr, size_t len);
+
+		// splits [addr, addr + len) at region boundaries into `spans` (which is cleared first), so
+		// that a device can transfer straight to or from guest memory (eg. with preadv) rather than
+		// through a buffer. with `write`, the whole range counts as written, as with hostPointer();
+		// so make the call just before the transfer, not ahead of time. the spans stay valid until
+		// the next addRegion() or swapRegion().
+		void dmaSpans(PhysAddr addr, size_t len, bool write, std::vector<DmaSpan>& spans);
+
+		// while enabled, the first write to each page of ram saves its previous contents, so that
+		// the writes can be undone. this is not thread-safe, so only use it with a single cpu.
+		void setWriteTracking(bool enable);
+
+		// the saved pages since the last call, after which tracking starts afresh.
+		std::vector<SavedPage> takeUndoLog();
+
+		// puts the saved contents back (without tracking the writes).
+		void applyUndoLog(const std::vector<SavedPage>& pages);
+
+		// marks the pages covering [addr, addr + len) as holding code that someone has decoded or
+		// translated. from then on, every write to those pages (including ones through host pointers
+		// and undo logs) calls the code-write listeners with the written range, on the writing
+		// thread -- which need not be the thread of the cpu that owns the listener.
+		void markCode(PhysAddr addr, size_t len);
+
+		// like addRegion(), listeners must be added and removed while no cpu is running. the
+		// returned id is for removing it.
+		size_t addCodeWriteListener(std::function<void (PhysAddr addr, size_t len)> listener);
+		void removeCodeWriteListener(size_t id);
 
 		uint8_t read8(PhysAddr addr);
 		uint16_t read16(PhysAddr addr);
@@ -7,6 +7,7 @@
 #include <cstdint>
 #include <cstddef>
 
+#include "misc.h"
 #include "cpu/mem.h"
 
 namespace z86
@@ -29,7 +30,7 @@ namespace z86
 		void enable();
 		void disable();
 
-		bool enabled();
+		bool enabled() const { return m_enabled; }
 
 		uint8_t read8(VirtAddr addr);
 		uint16_t read16(VirtAddr addr);
@@ -46,11 +47,42 @@ namespace z86
 		struct SystemDescriptor
 		{
 			uint64_t base;
-			uint32_t limit;
+			uint32_t limit;     // in bytes, ie. already scaled by the granularity bit
 			uint8_t access;
 			uint8_t flags;
+
+			// precomputed when the descriptor is loaded, so resolve() doesn't need to look at
+			// the access bits. a flat segment has base 0 and a 4GB expand-up limit, so there is
+			// nothing to check; the same goes for every segment in real mode. only segments with
+			// `checked` set go through the limit checks. reads from an execute-only code segment
+			// and writes to anything but a writable data segment also fault, so those segments
+			// have `read_checked` or `write_checked` set even when they are flat.
+			bool flat;
+			bool usable;
+			bool checked;
+			bool read_checked;
+			bool write_checked;
+
+			static constexpr uint8_t ACCESS_PRESENT     = 0x80;
+			static constexpr uint8_t ACCESS_NON_SYSTEM  = 0x10;
+			static constexpr uint8_t ACCESS_CODE        = 0x08;
+			static constexpr uint8_t ACCESS_EXPAND_DOWN = 0x04;     // for data segments only
+			static constexpr uint8_t ACCESS_WRITABLE    = 0x02;     // for data segments only
+			static constexpr uint8_t ACCESS_READABLE    = 0x02;     // for code segments only
+
+			static constexpr uint8_t FLAG_GRANULARITY   = 0x8;
+			static constexpr uint8_t FLAG_DEFAULT_32    = 0x4;
+			static constexpr uint8_t FLAG_LONG          = 0x2;
+
+			static constexpr uint8_t TYPE_LDT           = 0x2;
+
+			static SystemDescriptor parse(uint64_t raw);
 		};
 
+		// instruction fetches are checked against the limit, but not the type of the segment
+		// (cs can only hold a code segment anyway).
+		enum class Access { Read, Write, Execute };
+
 		SegmentedMMU(CPU& cpu, PagedMMU& pmmu) : m_cpu(cpu), m_pagedMMU(pmmu) { }
 
 	private:
@@ -64,17 +96,33 @@ namespace z86
 		uint64_t m_ldt_address = 0;
 		uint16_t m_ldt_limit = 0;
 
-		SystemDescriptor m_cached_cs = { };
-		SystemDescriptor m_cached_ds = { };
-		SystemDescriptor m_cached_es = { };
-		SystemDescriptor m_cached_fs = { };
-		SystemDescriptor m_cached_gs = { };
-		SystemDescriptor m_cached_ss = { };
+		// indexed by SegReg
+		SystemDescriptor m_segments[6] = { };
+
+		SystemDescriptor fetch_descriptor(uint16_t sel);
+		VirtAddr resolve_checked(const SystemDescriptor& desc, SegmentedAddr addr, size_t size, Access access);
 
 	public:
+		// the descriptor tables and the cached segments, for checkpoints.
+		struct State
+		{
+			uint64_t gdt_address;
+			uint16_t gdt_limit;
+			uint64_t ldt_address;
+			uint16_t ldt_limit;
+
+			SystemDescriptor segments[6];
+		};
+
+		State saveState() const;
+		void restoreState(const State& st);
+
 		void reset();
 		void load(SegReg sr, uint16_t sel);
 
+		void loadGDT(uint64_t base, uint16_t limit);
+		void loadLDT(uint16_t sel);
+
 		void loadCS(uint16_t sel);
 		void loadDS(uint16_t sel);
 		void loadES(uint16_t sel);
@@ -82,7 +130,22 @@ namespace z86
 		void loadGS(uint16_t sel);
 		void loadSS(uint16_t sel);
 
-		VirtAddr resolve(SegmentedAddr addr);
+		ALWAYS_INLINE VirtAddr resolve(SegmentedAddr addr, size_t size = 1, Access access = Access::Read)
+		{
+			auto& desc = m_segments[static_cast<size_t>(addr.reg)];
+			auto check = (access == Access::Read) ? desc.read_checked
+				: (access == Access::Write) ? desc.write_checked
+				: desc.checked;
+
+			if(!check)
+				return VirtAddr(desc.base + addr.offset);
+
+			return this->resolve_checked(desc, addr, size, access);
+		}
+
+		const SystemDescriptor& descriptor(SegReg sr) const { return m_segments[static_cast<size_t>(sr)]; }
+
+		uint8_t fetch8(SegmentedAddr addr);
 
 		uint8_t read8(SegmentedAddr addr);
 		uint16_t read16(SegmentedAddr addr);
@@ -127,4 +190,9 @@ namespace z86
 	the main purpose of this is to resolve segmented accesses (well in actuality all accesses
 	are segmented), and it is responsible for the GDT (global descriptor table) and the LDT (local
 	descriptor table).
+
+	descriptors are parsed once, when a selector is loaded into a segment register, and the
+	result is cached. every memory access then only needs the cached descriptor; in the common
+	case of a flat segment (base 0, 4GB limit) the offset is passed through unchanged, and the
+	base/limit/usability checks are only done for the other segments.
 */
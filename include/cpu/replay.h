@@ -0,0 +1,108 @@
+// replay.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+
+#include <vector>
+
+namespace z86
+{
+	/*
+		a log of everything that a single cpu sees from the outside world that isn't a function of
+		its own state: values read from io ports, the points at which external interrupts were
+		delivered, and reads of the host clock. each event is tagged with the number of instructions
+		the cpu had retired when it happened.
+
+		when recording, events are appended to a file as they happen (through a buffer). when
+		replaying, the whole log is read up front; port reads return the logged values, and the
+		cpu ends its runs of instructions exactly at the logged interrupt points, so nothing is
+		done per instruction in either mode.
+
+		the format is a short header, then one record per event:
+
+			tag             kind in the low bits; flags for "same port" / "same value as the last read"
+			varint          instruction count, as a delta from the previous record
+			payload         port and value (unless flagged), vector, or zigzag delta of the host time
+
+		polling loops, which read the same port and get the same value over and over, come out to
+		two or three bytes per read.
+	*/
+	struct ReplayLog
+	{
+		enum class Mode { Record, Replay };
+
+		~ReplayLog();
+
+		static constexpr uint64_t NEVER = UINT64_MAX;
+
+	private:
+		struct PortIn
+		{
+			uint64_t icount;
+			uint16_t port;
+			uint32_t value;
+		};
+
+		struct Interrupt
+		{
+			uint64_t icount;
+			uint8_t vector;
+		};
+
+		struct HostTime
+		{
+			uint64_t icount;
+			uint64_t time;
+		};
+
+		Mode m_mode = Mode::Record;
+		FILE* m_file = nullptr;
+
+		// recording
+		std::vector<uint8_t> m_buffer;
+		uint64_t m_last_icount = 0;
+		uint16_t m_last_port = 0;
+		uint32_t m_last_value = 0;
+		uint64_t m_last_time = 0;
+
+		// replaying
+		std::vector<PortIn> m_port_ins;
+		std::vector<Interrupt> m_interrupts;
+		std::vector<HostTime> m_host_times;
+		size_t m_port_in_idx = 0;
+		size_t m_interrupt_idx = 0;
+		size_t m_host_time_idx = 0;
+
+		void write_record(uint8_t tag, uint64_t icount);
+		void write_varint(uint64_t value);
+		void flush();
+		bool decode(const std::vector<uint8_t>& data);
+
+	public:
+		bool openForRecording(const char* path);
+		bool openForReplay(const char* path);
+
+		// flushes and closes the log; called by the destructor too.
+		void finish();
+
+		bool replaying() const { return m_mode == Mode::Replay; }
+
+		void recordPortIn(uint64_t icount, uint16_t port, uint32_t value);
+		void recordInterrupt(uint64_t icount, uint8_t vector);
+		void recordHostTime(uint64_t icount, uint64_t time);
+
+		// these die if the guest has diverged from the recording.
+		uint32_t replayPortIn(uint64_t icount, uint16_t port);
+		uint64_t replayHostTime(uint64_t icount);
+
+		// the instruction count of the next interrupt, or NEVER.
+		uint64_t nextInterrupt() const;
+		uint8_t replayInterrupt(uint64_t icount);
+	};
+}
@@ -0,0 +1,82 @@
+// sched.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <vector>
+#include <functional>
+#include <unordered_set>
+
+namespace z86
+{
+	/*
+		the scheduler keeps the virtual clock of the machine, and a min-heap of deadlines (in
+		the same units). devices that need to do something at some point in the future (eg. a
+		timer firing) schedule a callback, instead of being polled by the cpu.
+
+		the cpu loop asks for the next deadline, runs that many ticks worth of instructions
+		without looking at any device, then advances the clock and runs whatever is due. until
+		there is a cost model, one tick is one instruction.
+	*/
+	struct Scheduler
+	{
+		using EventId = uint64_t;
+		using Callback = std::function<void (uint64_t now)>;
+
+		static constexpr uint64_t NEVER = UINT64_MAX;
+
+		// the nominal rate of the virtual clock (that of the original PC), used to convert
+		// between ticks and wall-clock time -- for device timings, and for --realtime.
+		static constexpr uint64_t TICKS_PER_SECOND = 4'772'727;
+
+	private:
+		struct Event
+		{
+			uint64_t deadline;
+			EventId id;
+			Callback callback;
+		};
+
+		// ordering for std::push_heap and friends; we want the smallest deadline on top,
+		// and events with the same deadline to run in the order they were scheduled.
+		struct Later
+		{
+			bool operator() (const Event& a, const Event& b) const
+			{
+				return a.deadline > b.deadline || (a.deadline == b.deadline && a.id > b.id);
+			}
+		};
+
+		uint64_t m_now = 0;
+		EventId m_next_id = 1;
+
+		std::vector<Event> m_events;
+		std::unordered_set<EventId> m_cancelled;
+
+		void discard_cancelled();
+
+	public:
+		void reset();
+
+		uint64_t now() const { return m_now; }
+
+		// returns an id that can be passed to cancel(). callbacks run with the clock
+		// set to (at least) the deadline, and may schedule more events.
+		EventId schedule(uint64_t deadline, Callback callback);
+		EventId scheduleIn(uint64_t delay, Callback callback);
+		void cancel(EventId id);
+
+		// NEVER if nothing is scheduled.
+		uint64_t nextDeadline();
+
+		void advance(uint64_t ticks);
+		void advanceTo(uint64_t time);
+
+		// runs every event whose deadline has passed.
+		void runDue();
+	};
+}
@@ -0,0 +1,75 @@
+// simd.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace z86::simd
+{
+	/*
+		kernels operate on raw little-endian bytes of either 16 (xmm) or 32 (ymm) bytes.
+		all pointers point into 32-byte aligned storage (ie. a VectorReg), so backends are
+		free to use aligned loads and stores. `dst` may alias either source.
+	*/
+	using BinaryKernel = void (*)(uint8_t* dst, const uint8_t* a, const uint8_t* b, size_t bytes);
+	using ShiftKernel  = void (*)(uint8_t* dst, const uint8_t* a, uint64_t count, size_t bytes);
+
+	enum class Binary
+	{
+		PADDB, PADDW, PADDD, PADDQ,
+		PSUBB, PSUBW, PSUBD, PSUBQ,
+		PADDSB, PADDSW, PADDUSB, PADDUSW,
+		PSUBSB, PSUBSW, PSUBUSB, PSUBUSW,
+
+		PAND, PANDN, POR, PXOR,
+
+		PCMPEQB, PCMPEQW, PCMPEQD, PCMPEQQ,
+		PCMPGTB, PCMPGTW, PCMPGTD, PCMPGTQ,
+
+		PMULLW, PMULHW, PMULHUW, PMULUDQ, PMULLD,
+
+		PMINUB, PMINUW, PMINUD, PMINSB, PMINSW, PMINSD,
+		PMAXUB, PMAXUW, PMAXUD, PMAXSB, PMAXSW, PMAXSD,
+		PAVGB, PAVGW,
+
+		ADDPS, SUBPS, MULPS, DIVPS, MINPS, MAXPS, SQRTPS,
+		ADDPD, SUBPD, MULPD, DIVPD, MINPD, MAXPD, SQRTPD,
+
+		Count
+	};
+
+	enum class Shift
+	{
+		PSLLW, PSLLD, PSLLQ,
+		PSRLW, PSRLD, PSRLQ,
+		PSRAW, PSRAD,
+
+		// these shift bytes, within each 128-bit lane.
+		PSLLDQ, PSRLDQ,
+
+		Count
+	};
+
+	struct KernelTable
+	{
+		const char* name = nullptr;
+
+		BinaryKernel binary[static_cast<size_t>(Binary::Count)] = { };
+		ShiftKernel shift[static_cast<size_t>(Shift::Count)] = { };
+
+		BinaryKernel get(Binary k) const { return this->binary[static_cast<size_t>(k)]; }
+		ShiftKernel get(Shift k) const { return this->shift[static_cast<size_t>(k)]; }
+	};
+
+	// returns the best table for the host cpu; this is computed once.
+	const KernelTable& kernels();
+
+	// each backend only overrides the kernels that it can actually accelerate, so the
+	// table is built by installing them in increasing order of capability.
+	void install_scalar(KernelTable& table);
+	void install_sse2(KernelTable& table);
+	void install_avx2(KernelTable& table);
+}
@@ -0,0 +1,69 @@
+// timing.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "instrad/x86/decode.h"
+
+namespace z86
+{
+	/*
+		how long instructions take, in clock cycles of the cpu being pretended to be. each cycle is
+		one tick of the scheduler's clock, so the model decides how much virtual time (and so how
+		many timer interrupts) a piece of code takes -- whatever the model, the clock runs at the
+		pc's 4.77 MHz.
+
+			Flat        every instruction is one cycle (the default)
+			I8086       the 8086's tables, plus the cost of working out the effective address
+			            (5 to 12 cycles, depending on base, index and displacement, and 2 for a
+			            segment override)
+			I80186      the 80186's tables, which include the effective address
+			I80386      the 80386's tables (real mode), plus one cycle for base + index
+
+		the cost depends only on the instruction (its op, the kinds of operands, and the shape of the
+		memory operand), so it's worked out when the instruction is decoded, and cached with it.
+		what can't be known then is whether a conditional branch (or LOOP) is taken, which costs
+		`taken` more cycles if it is, and the counts that some instructions take longer for: shifts
+		and rotates by cl cost `per` more cycles for each bit, and REP string instructions `per`
+		more for each repetition (the change in cx). the rest is averaged or left out: operand
+		values (for multiplies and divides), unaligned word accesses, the prefetch queue, and (on the
+		80386) the size of the instruction being jumped to.
+
+		anything that isn't in the tables -- instructions that the model's cpu doesn't have (eg.
+		sse), and the rarer ones that it does (eg. xlat, lds) -- takes the time of a simple alu op.
+	*/
+	enum class CPUModel
+	{
+		Flat,
+		I8086,
+		I80186,
+		I80386,
+	};
+
+	struct InstrCost
+	{
+		// what `per` is multiplied by when the instruction runs. the 80186 and later only use
+		// the bottom 5 bits of a shift count.
+		enum class Count : uint8_t
+		{
+			None,
+			CL,
+			MaskedCL,
+			Rep,
+		};
+
+		uint32_t cycles = 1;
+		uint32_t taken = 0;
+		uint32_t per = 0;
+		Count count = Count::None;
+	};
+
+	InstrCost instruction_cost(CPUModel model, const instrad::x86::Instruction& instr);
+
+	// "flat", "8086", "80186" or "80386"; false if it's none of those.
+	bool parse_cpu_model(const char* name, CPUModel* model);
+}
@@ -0,0 +1,82 @@
+// bench.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+
+#include "cpu/io.h"
+
+namespace z86
+{
+	struct CPU;
+
+	/*
+		markers for timing regions of guest code, at ports 0xEC-0xEE:
+
+			out 0xEC, n     begin region n (0-255)
+			out 0xED, n     end region n
+			out 0xEE, c     add c to the name of the next region that begins (without one yet)
+			in  0xEC        0xEC, so that the guest can tell it's there
+
+		for every run of a region (from its begin to its end), this adds up the instructions retired,
+		the ticks of the virtual clock, the host's time (in nanoseconds), and the number of memory
+		accesses (see CPU::memoryAccessCount). each of them includes the `out` that began the run,
+		and not the one that ended it; an empty region is one instruction. regions can nest and
+		overlap, but a region can't begin again before it has ended. the summary is printed at
+		the end, by summarise().
+
+		a marker costs an io port write and a few reads of counters, so they can be left in code
+		that runs often. only the cpu whose ports it is attached to is measured.
+	*/
+	struct BenchMarkers : IODevice
+	{
+		BenchMarkers(CPU& cpu) : m_cpu(cpu) { }
+
+		static constexpr uint16_t BASE_PORT = 0xEC;
+		static constexpr size_t NUM_REGIONS = 256;
+
+	private:
+		struct Counters
+		{
+			uint64_t instructions = 0;
+			uint64_t ticks = 0;
+			uint64_t nanos = 0;
+			uint64_t accesses = 0;
+		};
+
+		struct Region
+		{
+			std::string name;
+			bool open = false;
+
+			Counters start;
+			Counters total;
+			uint64_t runs = 0;
+
+			// the fastest run, in ticks.
+			uint64_t min_ticks = UINT64_MAX;
+		};
+
+		CPU& m_cpu;
+		Region m_regions[NUM_REGIONS];
+		std::string m_next_name;
+
+		Counters now();
+		void begin(uint8_t id);
+		void end(uint8_t id);
+
+	public:
+		void attach(IOPortController& io);
+
+		// logs a line for every region that ran (or is still open).
+		void summarise();
+
+		virtual uint32_t in(uint16_t port, int bits) override;
+		virtual void out(uint16_t port, int bits, uint32_t value) override;
+	};
+}
@@ -0,0 +1,120 @@
+// bios.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <mutex>
+#include <bitset>
+
+#include "cpu/mem.h"
+
+namespace z86
+{
+	struct CPU;
+	struct VgaText;
+	struct BlockDevice;
+
+	/*
+		high-level emulation of the bios: instead of running a handler in the rom, an INT for one
+		of the selected services is done here, in one call, straight on the cpu's registers and
+		guest memory. services that aren't selected are left to the rom, as usual.
+
+		each selected vector is pointed at its own 4-byte stub in the trap area (at TRAP_SEGMENT:
+		TRAP_OFFSET + 4 * vector), which is `ud2; iret; nop`. the ud2 ends up in trap(), which
+		works out the vector from where it is, does the call, and sets the carry (and zero) flag in
+		the flags that the iret then restores. a ud2 anywhere else is still an invalid opcode.
+		the vectors are installed before the rom runs, and the rom leaves them alone.
+
+		the services (real-mode callers only):
+
+			10h     video: the 80x25 colour text mode at 0xB8000, with the cursor in the bios data
+			        area (and the vga's crt controller, if there is one). without a vga to show
+			        it, teletype output (0Eh and 13h) is also copied to the host's stdout.
+			13h     disk: passed on to the BlockDevice, if there is one.
+			16h     keyboard: keys are read from the host's stdin, without blocking the emulator.
+			        waiting for a key (00h) runs the ud2 again until there is one, halted with
+			        interrupts enabled in between.
+			1Ah     time: the tick count follows the virtual clock (one tick every 65536 counts of
+			        the pit), and the date and time come from the host's clock.
+
+		the keyboard is the only one that isn't deterministic, so it can't be used with --record
+		or --replay. the tick count set by 1Ah/01h is not part of a checkpoint.
+	*/
+	struct BiosHLE
+	{
+		BiosHLE(MemoryController& memory);
+
+		BiosHLE(const BiosHLE&) = delete;
+		BiosHLE& operator= (const BiosHLE&) = delete;
+
+		static constexpr uint16_t TRAP_SEGMENT = 0xF000;
+		static constexpr uint16_t TRAP_OFFSET = 0xF000;
+		static constexpr size_t TRAP_SIZE = 4;
+
+		static constexpr uint8_t VIDEO = 0x10;
+		static constexpr uint8_t DISK = 0x13;
+		static constexpr uint8_t KEYBOARD = 0x16;
+		static constexpr uint8_t TIME = 0x1A;
+
+		static constexpr uint32_t TEXT_BUFFER = 0xB8000;
+		static constexpr size_t TEXT_COLUMNS = 80;
+		static constexpr size_t TEXT_ROWS = 25;
+
+	private:
+		MemoryController& m_memory;
+		BlockDevice* m_disk = nullptr;
+		VgaText* m_display = nullptr;
+
+		std::bitset<256> m_services;
+
+		// the cpus can make calls at the same time.
+		std::mutex m_lock;
+
+		// a key that was read from stdin, but not taken yet (-1 if there isn't one).
+		int m_key = -1;
+		bool m_eof = false;
+
+		// what 1Ah/01h set the tick count to, and when.
+		uint64_t m_ticks_base = 0;
+		uint64_t m_ticks_set_at = 0;
+
+		// for the midnight flag: the number of days that 1Ah/00h has seen go by.
+		uint64_t m_days_seen = 0;
+
+		void video(CPU& cpu);
+		void disk(CPU& cpu);
+		void keyboard(CPU& cpu);
+		void time(CPU& cpu);
+
+		// for the video services. an attribute of -1 leaves the one on the screen alone.
+		void write_chars(uint8_t page, uint8_t ch, int attr, size_t count);
+		void teletype(uint8_t page, uint8_t ch, int attr);
+		void scroll(uint8_t top, uint8_t left, uint8_t bottom, uint8_t right, int lines, uint8_t attr);
+		void set_mode(uint8_t mode, bool clear);
+		void set_cursor(uint8_t page, uint16_t pos);
+
+		// for the keyboard; true if there is a key in m_key.
+		bool poll_key();
+
+	public:
+		// takes a comma-separated list of vectors in hex (eg. "10,13,1a"), or "all". false (and
+		// nothing changes) if any of them isn't one of the services above.
+		bool select(const char* list);
+		bool selected(uint8_t vector) const { return m_services.test(vector); }
+
+		void setDisk(BlockDevice* disk) { m_disk = disk; }
+		void setDisplay(VgaText* display) { m_display = display; }
+
+		// writes the trap area, and points the selected vectors at it. this must be done after
+		// ram is set up, and before any cpu starts.
+		void install();
+
+		// called for a ud2 at the cpu's cs:ip (which is just past it); true if it was in the trap
+		// area (and the call has been done), false if it's a real invalid opcode.
+		bool trap(CPU& cpu);
+	};
+}
@@ -0,0 +1,175 @@
+// disk.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <vector>
+
+#include "cpu/io.h"
+#include "cpu/mem.h"
+
+namespace z86
+{
+	/*
+		a hard disk, backed by an image file that is mmap-ed (shared) in its entirety. the host's
+		page cache is the sector cache: a read is a copy from the mapping straight into guest ram
+		(through MemoryController::dmaSpans), and a write is a copy the other way, which the host
+		writes back whenever it likes. there are no syscalls per sector. sequential reads make the
+		disk ask the host to read ahead, in a window that doubles (up to READ_AHEAD_MAX) for as long
+		as the reads stay sequential. dirty data is handed to the host for writing in batches of
+		WRITE_BATCH bytes, and is only waited for on a flush (and when the disk is destroyed).
+
+		it sits at ports 0x1E0-0x1FF, as two sets of 16-bit registers. the first is the controller:
+
+			0x1E0, 0x1E2    lba (low, high) -- reads give the size of the disk, in sectors
+			0x1E4           number of sectors
+			0x1E6, 0x1E8    physical address of the buffer (low, high)
+			0x1EA           write: 1 = read, 2 = write, 3 = flush; read: 0 if the last one worked
+			0x1EC           read: 1 if the rom should boot from the disk
+
+		registers are accessed at their (even) port with 16-bit ins and outs, or 8-bit ones for the
+		low byte. transfers happen entirely during the `out` that starts them, so there's no
+		interrupt.
+
+		the second set is how the rom's INT 13h handler gets to the disk: it writes the caller's
+		ax, bx, cx, dx, si, es and ds to 0x1F0-0x1FC, then 0x13 to 0x1FE; the call is done then and
+		there (see biosDisk()), and it reads back ax, bx, cx and dx from the same ports, and the
+		carry flag from 0x1FE. the disk is drive 0x80, and is given a geometry of 16 heads with 63
+		sectors per track. only real-mode callers are supported.
+
+		instead of writing to the image, the disk can write to an overlay (see openWithOverlay()),
+		so that any number of instances can share one read-only base image. the overlay is a sparse
+		file, laid out as:
+
+			0x0000          header (see disk.cpp), in host byte order
+			0x1000          one bit per cluster, set once the cluster has been written
+			data_offset     clusters, each at data_offset + index * CLUSTER_SIZE
+
+		a cluster is read from the overlay if its bit is set, and from the base otherwise. the first
+		write to a cluster copies the rest of it up from the base (unless the write covers all of it)
+		before setting its bit. nothing is allocated in the overlay until then, so making one costs
+		the same however big the base is; and every instance reads the base's unwritten clusters
+		through the same pages in the host's page cache.
+
+		the disk is only attached to the bootstrap processor's io ports. writes change the image
+		(or the overlay), so replaying a recorded run needs it as it was at the start of the
+		recording.
+	*/
+	struct BlockDevice : IODevice
+	{
+		BlockDevice(MemoryController& memory);
+		~BlockDevice();
+
+		BlockDevice(const BlockDevice&) = delete;
+		BlockDevice& operator= (const BlockDevice&) = delete;
+
+		static constexpr uint16_t BASE_PORT = 0x1E0;
+		static constexpr size_t NUM_PORTS = 0x20;
+
+		static constexpr size_t SECTOR_SIZE = 512;
+
+		static constexpr size_t HEADS = 16;
+		static constexpr size_t SECTORS_PER_TRACK = 63;
+
+		static constexpr size_t READ_AHEAD_MIN = 128 * 1024;
+		static constexpr size_t READ_AHEAD_MAX = 4 * 1024 * 1024;
+		static constexpr size_t WRITE_BATCH = 4 * 1024 * 1024;
+
+		static constexpr size_t CLUSTER_SIZE = 64 * 1024;
+
+		// the registers of an INT 13h call, in the order of their ports.
+		struct BiosCall
+		{
+			enum { AX, BX, CX, DX, SI, ES, DS, NUM_REGS };
+
+			uint16_t regs[NUM_REGS];
+			bool carry;
+		};
+
+	private:
+		MemoryController& m_memory;
+
+		int m_fd = -1;
+		uint8_t* m_image = nullptr;
+		size_t m_size = 0;
+		bool m_readonly = false;
+		bool m_boot = false;
+
+		// with an overlay, m_image is the (read-only) base.
+		int m_overlay_fd = -1;
+		uint8_t* m_overlay = nullptr;
+		size_t m_overlay_size = 0;
+		uint64_t* m_bitmap = nullptr;
+		uint8_t* m_clusters = nullptr;
+
+		// the controller's registers.
+		uint32_t m_lba = 0;
+		uint16_t m_count = 0;
+		uint32_t m_buffer = 0;
+		bool m_error = false;
+
+		// the rom's bios call, and the status of the last one (for function 01h).
+		BiosCall m_bios = { };
+		uint8_t m_bios_status = 0;
+
+		// where the next sequential read would start, and how far ahead of it to read.
+		uint64_t m_next_sector = UINT64_MAX;
+		size_t m_read_ahead = READ_AHEAD_MIN;
+		uint64_t m_read_ahead_end = 0;
+
+		// the bytes written since they were last handed to the host, and whether anything has been
+		// written since the last flush.
+		size_t m_dirty_start = SIZE_MAX;
+		size_t m_dirty_end = 0;
+		bool m_unflushed = false;
+
+		std::vector<MemoryController::DmaSpan> m_spans;
+
+		bool map_image(const char* path, bool readonly);
+		bool map_overlay(const char* path);
+
+		// where the disk's bytes from `ofs` live, for reading or writing; shortens `len` to how many
+		// of them are contiguous there.
+		uint8_t* locate(size_t ofs, size_t& len, bool write);
+
+		bool transfer(uint64_t lba, size_t count, PhysAddr buffer, bool write);
+		void read_ahead(uint64_t lba, size_t count);
+		void write_back();
+
+	public:
+		// maps the image at `path`. it is opened read-only (and writes fail) if it can't be
+		// written to. false if it can't be used at all.
+		bool open(const char* path);
+
+		// uses the image at `base` (read-only), and writes to the overlay at `overlay` -- which is
+		// created (empty) if it doesn't exist, and must have been made for the same base otherwise.
+		bool openWithOverlay(const char* base, const char* overlay);
+
+		// whether the rom should boot from sector 0 of the disk, instead of running what is already
+		// in memory.
+		void setBoot(bool boot) { m_boot = boot; }
+
+		void attach(IOPortController& io);
+
+		// waits until everything written so far is in the image.
+		void flush();
+
+		uint64_t sectors() const { return m_size / SECTOR_SIZE; }
+		bool readonly() const { return m_readonly; }
+
+		// false if the sectors are past the end of the disk (or, for writes, if it is read-only).
+		bool readSectors(uint64_t lba, size_t count, PhysAddr buffer) { return this->transfer(lba, count, buffer, false); }
+		bool writeSectors(uint64_t lba, size_t count, PhysAddr buffer) { return this->transfer(lba, count, buffer, true); }
+
+		// does an INT 13h call, changing the registers to what it returns. this is what the rom's
+		// handler ends up in, and what the bios emulation (see devices/bios.h) calls directly.
+		void biosDisk(BiosCall& call);
+
+		virtual uint32_t in(uint16_t port, int bits) override;
+		virtual void out(uint16_t port, int bits, uint32_t value) override;
+	};
+}
@@ -0,0 +1,83 @@
+// pic.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "cpu/io.h"
+
+namespace z86
+{
+	struct CPU;
+
+	/*
+		a pair of cascaded 8259As, wired up like they are in a PC: the master at ports 0x20-0x21,
+		and the slave at 0xA0-0xA1 with its output on the master's IRQ2. irqs 0-7 go to the master,
+		and 8-15 go to the slave.
+
+		only what PC software actually uses is implemented: the ICW1-4 initialisation sequence,
+		the interrupt mask, specific and non-specific EOI, auto-EOI, and reading the IRR/ISR.
+		priorities are fixed (IRQ0 highest); rotation and special mask mode are ignored.
+
+		the pic never interrupts the cpu by itself. when a request becomes deliverable, it
+		asks the cpu to check for interrupts (which ends the cpu's current run of instructions),
+		and the cpu then calls pending() and acknowledge() when IF is set.
+	*/
+	struct PIC : IODevice
+	{
+		PIC(CPU& cpu);
+
+		static constexpr uint16_t MASTER_PORT   = 0x20;
+		static constexpr uint16_t SLAVE_PORT    = 0xA0;
+
+	private:
+		struct Chip
+		{
+			uint8_t irr = 0;        // interrupt request
+			uint8_t isr = 0;        // in service
+			uint8_t imr = 0xFF;     // masked
+			uint8_t base = 0;       // vector of IRQ0 on this chip
+
+			int init_step = 0;      // which ICW we expect next; 0 if not initialising
+			bool need_icw4 = false;
+			bool auto_eoi = false;
+			bool read_isr = false;
+		};
+
+		CPU& m_cpu;
+
+		Chip m_master;
+		Chip m_slave;
+
+		void update();
+		uint32_t chip_in(Chip& chip, uint16_t port);
+		void chip_out(Chip& chip, uint16_t port, uint8_t value);
+
+	public:
+		struct State
+		{
+			Chip master;
+			Chip slave;
+		};
+
+		State saveState() const { return State { m_master, m_slave }; }
+		void restoreState(const State& st) { m_master = st.master; m_slave = st.slave; }
+
+		void reset();
+		void attach(IOPortController& io);
+
+		// edge-triggered; raise() latches the request, lower() withdraws it if it
+		// hasn't been acknowledged yet.
+		void raise(int irq);
+		void lower(int irq);
+
+		bool pending();
+		uint8_t acknowledge();
+
+		virtual uint32_t in(uint16_t port, int bits) override;
+		virtual void out(uint16_t port, int bits, uint32_t value) override;
+	};
+}
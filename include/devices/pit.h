@@ -0,0 +1,95 @@
+// pit.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+
+#include "cpu/io.h"
+#include "cpu/sched.h"
+
+namespace z86
+{
+	struct PIC;
+
+	/*
+		an 8254 programmable interval timer at ports 0x40-0x43, with channel 0 wired to IRQ0.
+
+		nothing here ticks. each channel remembers when it was loaded, and its current count is
+		computed from the virtual clock whenever the guest reads it. for channel 0, the edges that
+		raise IRQ0 are scheduled as events, so a running timer costs one event per interrupt and
+		nothing per instruction.
+
+		modes 0, 2, 3 and 4 are supported. there's no gate input, so modes 1 and 5 behave like
+		0 and 4. BCD counting is not supported.
+	*/
+	struct PIT : IODevice
+	{
+		PIT(Scheduler& sched, PIC& pic);
+
+		static constexpr uint16_t BASE_PORT = 0x40;
+
+		// on the PC, the pit runs at exactly a quarter of the cpu clock (~1.19318 MHz).
+		static constexpr uint64_t TICKS_PER_COUNT = 4;
+		static constexpr uint64_t FREQUENCY = Scheduler::TICKS_PER_SECOND / TICKS_PER_COUNT;
+
+	private:
+		struct Channel
+		{
+			uint8_t mode = 0;
+			uint8_t access = 0;         // 1: lsb only, 2: msb only, 3: lsb then msb
+			uint32_t reload = 0;        // 1 to 65536
+			uint64_t start = 0;         // in scheduler ticks
+			bool loaded = false;
+
+			bool write_msb = false;     // for access mode 3, which byte comes next
+			bool read_msb = false;
+			uint8_t write_lsb = 0;
+
+			uint16_t latch = 0;
+			int latched_bytes = 0;
+
+			bool status_latched = false;
+			uint8_t status = 0;
+
+			bool event_pending = false;
+			Scheduler::EventId event = 0;
+		};
+
+		Scheduler& m_sched;
+		PIC& m_pic;
+
+		Channel m_channels[3];
+
+		uint64_t elapsed(const Channel& ch);
+		void load(int idx, uint32_t value);
+		void latch_count(int idx);
+		void latch_status(int idx);
+		void schedule_irq(uint64_t deadline);
+		void command(uint8_t value);
+
+	public:
+		// the channels' pending irq events are part of the scheduler's state, so the two
+		// must be restored together.
+		struct State
+		{
+			Channel channels[3];
+		};
+
+		State saveState() const;
+		void restoreState(const State& st);
+
+		void reset();
+		void attach(IOPortController& io);
+
+		// the counter value and the output pin, as they are right now.
+		uint16_t count(int channel);
+		bool output(int channel);
+
+		virtual uint32_t in(uint16_t port, int bits) override;
+		virtual void out(uint16_t port, int bits, uint32_t value) override;
+	};
+}
@@ -0,0 +1,192 @@
+// serial.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstddef>
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+
+#include "cpu/io.h"
+#include "cpu/sched.h"
+
+namespace z86
+{
+	struct PIC;
+
+	/*
+		where guest output goes on its way to a host file (or stdout). the guest's side of an
+		`out` is a store into a ring buffer; a thread of its own empties the ring with one
+		write (of everything in it) every FLUSH_INTERVAL_MS, or sooner once it is half full, and
+		once more when it is closed. the guest only ever waits if the ring is completely full.
+
+		there is one producer: the cpu whose ports the devices are attached to.
+	*/
+	struct HostOutput
+	{
+		HostOutput();
+		~HostOutput();
+
+		HostOutput(const HostOutput&) = delete;
+		HostOutput& operator= (const HostOutput&) = delete;
+
+		static constexpr size_t CAPACITY = 1024 * 1024;
+		static constexpr uint64_t FLUSH_INTERVAL_MS = 20;
+
+	private:
+		int m_fd = -1;
+		bool m_owned = false;
+		const char* m_name = nullptr;
+
+		std::unique_ptr<uint8_t[]> m_ring;
+
+		// both only ever increase; the ring holds [tail, head), modulo its size.
+		std::atomic<uint64_t> m_head = 0;
+		std::atomic<uint64_t> m_tail = 0;
+
+		std::thread m_thread;
+		std::mutex m_lock;
+		std::condition_variable m_wake;
+		bool m_stopping = false;
+
+		uint64_t m_host_writes = 0;
+		std::chrono::steady_clock::time_point m_first_byte;
+
+		void flush_loop();
+		void write_out();
+
+	public:
+		// "-" is stdout. `name` is for the summary that close() prints.
+		bool open(const char* path, const char* name);
+
+		// writes out whatever is left, and stops the thread.
+		void close();
+
+		bool isOpen() const { return m_fd >= 0; }
+
+		inline void put(uint8_t byte)
+		{
+			auto head = m_head.load(std::memory_order_relaxed);
+			if(head - m_tail.load(std::memory_order_acquire) == CAPACITY)
+				this->wait_for_space();
+
+			if(head == 0)
+				m_first_byte = std::chrono::steady_clock::now();
+
+			m_ring[head % CAPACITY] = byte;
+			m_head.store(head + 1, std::memory_order_release);
+
+			if(head + 1 - m_tail.load(std::memory_order_relaxed) == CAPACITY / 2)
+				m_wake.notify_one();
+		}
+
+		void wait_for_space();
+
+		uint64_t bytes() const { return m_head.load(std::memory_order_relaxed); }
+		uint64_t hostWrites() const { return m_host_writes; }
+	};
+
+	/*
+		a 16550 uart, as COM1: ports 0x3F8-0x3FF, on IRQ4. transmitting is instantaneous -- the
+		byte goes straight into a HostOutput -- so the transmitter is always empty. received bytes
+		come from a host file (or stdin), which a thread of its own reads into a ring whenever
+		there is something to read, so the guest never waits for the host either.
+
+		the line settings (divisor, word length, parity) are remembered but change nothing, and
+		the fifo control register only changes what IIR says. loopback mode works. the receive
+		interrupt is noticed by looking at the ring every RX_POLL_TICKS (only while it's enabled).
+
+		what the guest reads is recorded like any other port read, so --record and --replay work;
+		reverse execution only works with input when it's being replayed.
+	*/
+	struct SerialPort : IODevice
+	{
+		SerialPort(Scheduler& sched, PIC& pic, HostOutput& output);
+		~SerialPort();
+
+		SerialPort(const SerialPort&) = delete;
+		SerialPort& operator= (const SerialPort&) = delete;
+
+		static constexpr uint16_t BASE_PORT = 0x3F8;
+		static constexpr int IRQ = 4;
+
+		static constexpr size_t INPUT_CAPACITY = 4096;
+		static constexpr uint64_t RX_POLL_TICKS = Scheduler::TICKS_PER_SECOND / 1000;
+
+	private:
+		Scheduler& m_sched;
+		PIC& m_pic;
+		HostOutput& m_output;
+
+		// the registers.
+		uint16_t m_divisor = 12;
+		uint8_t m_ier = 0;
+		uint8_t m_lcr = 0x03;
+		uint8_t m_mcr = 0;
+		uint8_t m_fcr = 0;
+		uint8_t m_scratch = 0;
+		bool m_thre_pending = false;
+		bool m_irq = false;
+
+		// in loopback mode, transmitted bytes come back here instead.
+		uint8_t m_loopback[16] = { };
+		size_t m_loopback_count = 0;
+
+		// from the input thread: [tail, head), modulo the size.
+		int m_input_fd = -1;
+		bool m_input_owned = false;
+		uint8_t m_input[INPUT_CAPACITY] = { };
+		std::atomic<uint64_t> m_input_head = 0;
+		std::atomic<uint64_t> m_input_tail = 0;
+		std::atomic<bool> m_input_stopping = false;
+		std::atomic<bool> m_input_eof = false;
+		std::thread m_input_thread;
+
+		bool m_rx_polling = false;
+		Scheduler::EventId m_rx_event = 0;
+
+		bool data_ready();
+		uint8_t receive();
+		uint8_t interrupt_id();
+		void update_irq();
+		void update_rx_polling();
+		void input_loop();
+
+	public:
+		void attach(IOPortController& io);
+
+		// "-" is stdin.
+		bool openInput(const char* path);
+
+		virtual uint32_t in(uint16_t port, int bits) override;
+		virtual void out(uint16_t port, int bits, uint32_t value) override;
+	};
+
+	/*
+		bochs' debug console: a byte written to port 0xE9 goes to a HostOutput, and reading the
+		port gives 0xE9 (so that the guest can tell it's there).
+	*/
+	struct DebugConsole : IODevice
+	{
+		DebugConsole(HostOutput& output) : m_output(output) { }
+
+		static constexpr uint16_t PORT = 0xE9;
+
+	private:
+		HostOutput& m_output;
+
+	public:
+		void attach(IOPortController& io);
+
+		virtual uint32_t in(uint16_t port, int bits) override;
+		virtual void out(uint16_t port, int bits, uint32_t value) override;
+	};
+}
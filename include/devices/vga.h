@@ -0,0 +1,111 @@
+// vga.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <condition_variable>
+
+#include "cpu/io.h"
+#include "cpu/mem.h"
+
+namespace z86
+{
+	/*
+		the text mode of a colour vga: 32k of text memory at 0xB8000, shown as 80x25 cells of
+		(character, attribute), and the crt controller's start address and cursor registers at
+		ports 0x3D4 (index) and 0x3D5 (data).
+
+		the guest's side is cheap: a write to text memory is a copy, and setting a bit (per line of
+		80 cells) to say that the line changed. there are no host pointers to text memory, so every
+		write goes through here (with the flat mapping, that means every write faults). everything
+		else happens on a thread of its own, which every REFRESH_INTERVAL takes the dirty bits, and
+		writes the cells that actually changed since the last frame to the host terminal (or a
+		file), as ansi escape sequences; nothing is written if nothing changed. the two sides don't
+		share a lock, so the emulator never waits for the terminal -- a frame can catch a line
+		half-written, and the next frame fixes it.
+
+		text memory is not part of checkpoints, so reverse execution doesn't undo what's on screen.
+	*/
+	struct VgaText : MemoryRegion, IODevice
+	{
+		VgaText();
+		~VgaText();
+
+		VgaText(const VgaText&) = delete;
+		VgaText& operator= (const VgaText&) = delete;
+
+		static constexpr uint32_t BASE_ADDR = 0xB8000;
+		static constexpr size_t MEMORY_SIZE = 0x8000;
+
+		static constexpr uint16_t CRTC_INDEX = 0x3D4;
+		static constexpr uint16_t CRTC_DATA = 0x3D5;
+
+		static constexpr size_t COLUMNS = 80;
+		static constexpr size_t ROWS = 25;
+		static constexpr size_t LINE_SIZE = COLUMNS * 2;
+		static constexpr size_t NUM_LINES = (MEMORY_SIZE + LINE_SIZE - 1) / LINE_SIZE;
+
+		static constexpr uint64_t REFRESH_INTERVAL_MS = 33;
+
+	private:
+		uint8_t m_text[MEMORY_SIZE] = { };
+		std::atomic<uint64_t> m_dirty[(NUM_LINES + 63) / 64] = { };
+
+		// the crt controller's registers; the ones the renderer looks at are atomic.
+		uint8_t m_crtc_index = 0;
+		uint8_t m_crtc[0x19] = { };
+		std::atomic<uint16_t> m_start = 0;     // in cells
+		std::atomic<uint16_t> m_cursor = 0;    // in cells, from the start of text memory
+		std::atomic<bool> m_cursor_hidden = false;
+
+		// the renderer's side: what the terminal shows, and where its cursor is.
+		FILE* m_out = nullptr;
+		std::thread m_thread;
+		std::mutex m_lock;
+		std::condition_variable m_wake;
+		bool m_stopping = false;
+
+		uint16_t m_shown[ROWS * COLUMNS] = { };
+		uint16_t m_shown_start = 0;
+		int m_shown_cursor = -1;
+		bool m_redraw = true;
+
+		std::string m_frame;
+
+		uint64_t m_frames = 0;
+		uint64_t m_cells_drawn = 0;
+
+		void mark_dirty(uint64_t offset, size_t len);
+		void render();
+		void render_loop();
+
+	public:
+		void attach(IOPortController& io);
+
+		// draws the screen on `out` from now on; stopRendering() draws the last frame, and leaves
+		// the terminal's cursor below the screen.
+		void startRendering(FILE* out);
+		void stopRendering();
+
+		// for the bios, which keeps the cursor in the crt controller like a real one would.
+		void setCursor(uint16_t cell);
+
+		uint64_t frames() const { return m_frames; }
+		uint64_t cellsDrawn() const { return m_cells_drawn; }
+
+		virtual void read(uint64_t offset, void* buf, size_t len) override;
+		virtual void write(uint64_t offset, const void* buf, size_t len) override;
+
+		virtual uint32_t in(uint16_t port, int bits) override;
+		virtual void out(uint16_t port, int bits, uint32_t value) override;
+	};
+}
@@ -0,0 +1,74 @@
+// gdbstub.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+
+#include "cpu/cpu.h"
+#include "cpu/breakpoints.h"
+
+namespace z86
+{
+	struct Checkpoints;
+
+	/*
+		a gdb remote serial protocol server for a single cpu, on a loopback tcp port or a unix
+		socket. connect with `target remote :port` (and `set architecture i8086` for real mode).
+
+		the cpu runs on the thread that called serve(), only when gdb asks it to continue or step;
+		while it runs, another thread waits for gdb's interrupt (^C) and calls CPU::stop(), which is
+		only looked at between runs of instructions. nothing is added to the run loop itself -- and
+		breakpoints and watchpoints cost nothing until gdb sets one (see breakpoints.h).
+
+		registers are the 16 from gdb's i386 layout (eax-edi, eip, eflags, cs-gs). memory addresses
+		are linear: gdb adds the segment base itself (eg. `x/i $cs*16+$eip`), and we translate
+		through paging. with checkpoints, reverse-step and reverse-continue work too (`rs`, `rc`).
+	*/
+	struct GdbStub
+	{
+		GdbStub(CPU& cpu, Checkpoints* checkpoints = nullptr);
+		~GdbStub();
+
+		GdbStub(const GdbStub&) = delete;
+		GdbStub& operator= (const GdbStub&) = delete;
+
+	private:
+		CPU& m_cpu;
+		Checkpoints* m_checkpoints;
+		Breakpoints m_breakpoints;
+
+		int m_listener = -1;
+		int m_conn = -1;
+
+		bool m_ack = true;
+		std::string m_inbuf;
+		size_t m_inpos = 0;
+
+		int read_char();
+		bool read_packet(std::string& packet);
+		void send_packet(const std::string& data);
+
+		std::string handle(const std::string& packet, bool& detach);
+		std::string resume(bool step);
+		std::string reverse(bool step);
+		std::string stop_reply(bool ran_out, const Breakpoints::Hit& hit);
+
+		std::string read_registers();
+		bool write_register(size_t idx, uint32_t value);
+		std::string read_memory(uint64_t addr, size_t len);
+		bool write_memory(uint64_t addr, const std::string& hex);
+
+	public:
+		// a port number listens on 127.0.0.1; anything else is the path of a unix socket.
+		bool listen(const char* where);
+
+		// waits for gdb to connect, then serves it until it detaches or kills the target, or the
+		// cpu stops for good. the cpu must already be reset.
+		void serve();
+	};
+}
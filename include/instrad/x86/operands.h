@@ -41,7 +41,8 @@ namespace instrad::x86
 				if(mods.rex.W() || bits == 64)
 					return regs::get64Bit(index);
 
-				else if(mods.legacyAddressingMode || mods.operandSizeOverride)
+				// legacy && !override -> 16; !legacy && override -> 16
+				else if(mods.legacyAddressingMode != mods.operandSizeOverride)
 					return regs::get16Bit(index);
 
 				else
@@ -70,6 +71,7 @@ namespace instrad::x86
 			{
 				case 64:    return regs::getMMX(index);
 				case 128:   return regs::getXMM(index);
+				case 256:   return regs::getYMM(index);
 			}
 		}
 
@@ -103,7 +105,7 @@ namespace instrad::x86
 			else if(mods.modrm.mod() == 1)
 			{
 				mem.setBase(mods.rex.B() ? regs::R13 : ((compat || mods.addressSizeOverride) ? regs::EBP : regs::RBP));
-				mem.setDisplacement(readUnsignedImm8(buf));
+				mem.setDisplacement(readSignedImm8(buf));
 				*didReadDisplacement = true;
 			}
 			else if(mods.modrm.mod() == 2)
@@ -162,7 +164,7 @@ namespace instrad::x86
 		}
 		else if(mods.modrm.mod() == 1)
 		{
-			mem.setDisplacement(readUnsignedImm8(buf));
+			mem.setDisplacement(readSignedImm8(buf));
 			mem.setBase(mods.compatibilityMode
 				? regs::get32Bit(base)
 				: regs::get64Bit(base)
@@ -283,7 +285,7 @@ namespace instrad::x86
 				// if 16-bit addressing:
 				if(mods.legacyAddressingMode)
 				{
-					auto imm = readUnsignedImm8(buf);
+					auto imm = readSignedImm8(buf);
 					switch(mods.modrm.rm())
 					{
 						// note: scale should be 1
@@ -303,13 +305,13 @@ namespace instrad::x86
 					{
 						bool disp = false;
 						auto ret = decodeSIB(buf, mods, &disp).setBits(bits);
-						if(!disp) ret.setDisplacement(readUnsignedImm8(buf));
+						if(!disp) ret.setDisplacement(readSignedImm8(buf));
 
 						return ret;
 					}
 					else
 					{
-						auto imm = readUnsignedImm8(buf);
+						auto imm = readSignedImm8(buf);
 
 						if(compat || mods.addressSizeOverride)
 							return MemoryRef(bits, regs::get32Bit(baseRegIndex), imm);
@@ -397,6 +399,16 @@ namespace instrad::x86
 		else                            return 64;
 	}
 
+	// the size of a native-sized memory operand: in 16 and 32-bit modes, the operand size
+	// override switches between the two (like it does for registers); long mode is left alone.
+	constexpr int getNativeMemoryBits(InstrModifiers& mods)
+	{
+		if(!mods.legacyAddressingMode && !mods.compatibilityMode)
+			return 64;
+
+		return (mods.legacyAddressingMode != mods.operandSizeOverride) ? 16 : 32;
+	}
+
 	template <typename Buffer>
 	constexpr Operand getOperand(Buffer& buf, OpKind kind, InstrModifiers& mods)
 	{
@@ -491,8 +503,8 @@ namespace instrad::x86
 			case OpKind::Imm16:
 			case OpKind::Imm32:
 			case OpKind::Imm64: {
-				// need to promote/demote
-				if(mods.operandSizeOverride || mods.legacyAddressingMode)
+				// need to promote/demote. in 16-bit mode, the operand size override bumps to 32.
+				if(mods.operandSizeOverride != mods.legacyAddressingMode)
 					return readSignedImm16(buf);
 
 				else if(kind == OpKind::Imm64 && mods.rex.W())
@@ -529,7 +541,7 @@ namespace instrad::x86
 				return getRegisterOperand(getCurrentBits(mods), mods, RegKind::GPR);
 
 			case OpKind::RegMemNative:
-				return getRegisterOrMemoryOperand(buf, getCurrentBits(mods), getCurrentBits(mods),
+				return getRegisterOrMemoryOperand(buf, getCurrentBits(mods), getNativeMemoryBits(mods),
 					mods, RegKind::GPR);
 
 			case OpKind::SignExtImm32: {
@@ -618,18 +630,30 @@ namespace instrad::x86
 				if(bits == 32 && mods.rex.W())
 					bits = 64;
 
+				// the size of the offset follows the address size, not the operand size.
 				auto seg = getSegmentOfOverride(mods.segmentOverride);
-				if(mods.compatibilityMode)
-					return MemoryRef(bits, readUnsignedImm32(buf)).setSegment(seg);
-
+				if(mods.legacyAddressingMode)
+				{
+					return MemoryRef(bits, mods.addressSizeOverride ? readUnsignedImm32(buf) : readUnsignedImm16(buf))
+						.setSegment(seg);
+				}
+				else if(mods.compatibilityMode)
+				{
+					return MemoryRef(bits, mods.addressSizeOverride ? readUnsignedImm16(buf) : readUnsignedImm32(buf))
+						.setSegment(seg);
+				}
 				else
-					return MemoryRef(bits, readUnsignedImm64(buf)).setSegment(seg);
+				{
+					return MemoryRef(bits, mods.addressSizeOverride ? readUnsignedImm32(buf) : readUnsignedImm64(buf))
+						.setSegment(seg);
+				}
 			}
 
 			case OpKind::MemoryOfsNative: {
 				int bits = getCurrentBits(mods);
 
-				int membits = bits;
+				// the operand follows the operand size, and the offset follows the address size.
+				int membits = (mods.legacyAddressingMode != mods.operandSizeOverride) ? 16 : 32;
 				if(membits == 32 && mods.rex.W())
 					membits = 64;
 
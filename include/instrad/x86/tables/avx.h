@@ -109,22 +109,22 @@ namespace instrad::x86
 		constexpr VE& pF3_W1_L0(TE e)       { return pF3_W1_L0_mod3(e).pF3_W1_L0_mod0(e); }
 		constexpr VE& pF3_W1_L1(TE e)       { return pF3_W1_L1_mod3(e).pF3_W1_L1_mod0(e); }
 
-		constexpr VE& pNN_L0(TE e)          { return pNN_W0_L0_mod3(e).pNN_W1_L0_mod0(e); }
-		constexpr VE& pNN_L1(TE e)          { return pNN_W0_L1_mod3(e).pNN_W1_L1_mod0(e); }
-		constexpr VE& pNN_W0(TE e)          { return pNN_W0_L0_mod3(e).pNN_W0_L1_mod0(e); }
-		constexpr VE& pNN_W1(TE e)          { return pNN_W1_L0_mod3(e).pNN_W1_L1_mod0(e); }
-		constexpr VE& p66_L0(TE e)          { return p66_W0_L0_mod3(e).p66_W1_L0_mod0(e); }
-		constexpr VE& p66_L1(TE e)          { return p66_W0_L1_mod3(e).p66_W1_L1_mod0(e); }
-		constexpr VE& p66_W0(TE e)          { return p66_W0_L0_mod3(e).p66_W0_L1_mod0(e); }
-		constexpr VE& p66_W1(TE e)          { return p66_W1_L0_mod3(e).p66_W1_L1_mod0(e); }
-		constexpr VE& pF2_L0(TE e)          { return pF2_W0_L0_mod3(e).pF2_W1_L0_mod0(e); }
-		constexpr VE& pF2_L1(TE e)          { return pF2_W0_L1_mod3(e).pF2_W1_L1_mod0(e); }
-		constexpr VE& pF2_W0(TE e)          { return pF2_W0_L0_mod3(e).pF2_W0_L1_mod0(e); }
-		constexpr VE& pF2_W1(TE e)          { return pF2_W1_L0_mod3(e).pF2_W1_L1_mod0(e); }
-		constexpr VE& pF3_L0(TE e)          { return pF3_W0_L0_mod3(e).pF3_W1_L0_mod0(e); }
-		constexpr VE& pF3_L1(TE e)          { return pF3_W0_L1_mod3(e).pF3_W1_L1_mod0(e); }
-		constexpr VE& pF3_W0(TE e)          { return pF3_W0_L0_mod3(e).pF3_W0_L1_mod0(e); }
-		constexpr VE& pF3_W1(TE e)          { return pF3_W1_L0_mod3(e).pF3_W1_L1_mod0(e); }
+		constexpr VE& pNN_L0(TE e)          { return pNN_L0_mod3(e).pNN_L0_mod0(e); }
+		constexpr VE& pNN_L1(TE e)          { return pNN_L1_mod3(e).pNN_L1_mod0(e); }
+		constexpr VE& pNN_W0(TE e)          { return pNN_W0_mod3(e).pNN_W0_mod0(e); }
+		constexpr VE& pNN_W1(TE e)          { return pNN_W1_mod3(e).pNN_W1_mod0(e); }
+		constexpr VE& p66_L0(TE e)          { return p66_L0_mod3(e).p66_L0_mod0(e); }
+		constexpr VE& p66_L1(TE e)          { return p66_L1_mod3(e).p66_L1_mod0(e); }
+		constexpr VE& p66_W0(TE e)          { return p66_W0_mod3(e).p66_W0_mod0(e); }
+		constexpr VE& p66_W1(TE e)          { return p66_W1_mod3(e).p66_W1_mod0(e); }
+		constexpr VE& pF2_L0(TE e)          { return pF2_L0_mod3(e).pF2_L0_mod0(e); }
+		constexpr VE& pF2_L1(TE e)          { return pF2_L1_mod3(e).pF2_L1_mod0(e); }
+		constexpr VE& pF2_W0(TE e)          { return pF2_W0_mod3(e).pF2_W0_mod0(e); }
+		constexpr VE& pF2_W1(TE e)          { return pF2_W1_mod3(e).pF2_W1_mod0(e); }
+		constexpr VE& pF3_L0(TE e)          { return pF3_L0_mod3(e).pF3_L0_mod0(e); }
+		constexpr VE& pF3_L1(TE e)          { return pF3_L1_mod3(e).pF3_L1_mod0(e); }
+		constexpr VE& pF3_W0(TE e)          { return pF3_W0_mod3(e).pF3_W0_mod0(e); }
+		constexpr VE& pF3_W1(TE e)          { return pF3_W1_mod3(e).pF3_W1_mod0(e); }
 
 		constexpr VE& pNN_mod3(TE e)        { return pNN_W0_L0_mod3(e).pNN_W0_L1_mod3(e).pNN_W1_L0_mod3(e).pNN_W1_L1_mod3(e); }
 		constexpr VE& p66_mod3(TE e)        { return p66_W0_L0_mod3(e).p66_W0_L1_mod3(e).p66_W1_L0_mod3(e).p66_W1_L1_mod3(e); }
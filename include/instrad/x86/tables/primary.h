@@ -56,7 +56,7 @@ namespace instrad::x86::tables
 	};
 
 	constexpr TableEntry ModRMExt_8F[] = {
-		/*0*/ entry_1(0x8F, ops::POP, OpKind::RegMem64),
+		/*0*/ entry_1(0x8F, ops::POP, OpKind::RegMemNative),
 
 		/*1*/ entry_blank,
 		/*2*/ entry_blank,
@@ -195,11 +195,11 @@ namespace instrad::x86::tables
 	constexpr TableEntry ModRMExt_FF[] = {
 		/*0*/ entry_1(0xFF, ops::INC,  OpKind::RegMemNative),
 		/*1*/ entry_1(0xFF, ops::DEC,  OpKind::RegMemNative),
-		/*2*/ entry_1(0xFF, ops::CALL, OpKind::RegMem64),
+		/*2*/ entry_1(0xFF, ops::CALL, OpKind::RegMemNative),
 		/*3*/ entry_1(0xFF, ops::CALL, OpKind::MemSegOfs),
-		/*4*/ entry_1(0xFF, ops::JMP,  OpKind::RegMem64),
+		/*4*/ entry_1(0xFF, ops::JMP,  OpKind::RegMemNative),
 		/*5*/ entry_1(0xFF, ops::JMP,  OpKind::MemSegOfs),
-		/*6*/ entry_1(0xFF, ops::PUSH, OpKind::RegMem64),
+		/*6*/ entry_1(0xFF, ops::PUSH, OpKind::RegMemNative),
 
 		/*7*/ entry_blank,
 	};
@@ -0,0 +1,78 @@
+// machine.h
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "cpu/cpu.h"
+
+namespace z86
+{
+	/*
+		a machine is a set of cpus sharing one MemoryController, each running its own start()
+		loop on its own host thread. only memory is shared; every cpu still has its own io ports,
+		scheduler, pic and pit.
+
+		cpu 0 (the bootstrap processor) starts at the reset vector when run() is called. the
+		others (application processors) wait until the guest starts them through the smp control
+		ports, which stand in for the INIT-SIPI sequence:
+
+			in  0xB0        number of cpus
+			in  0xB1        id of the cpu doing the read
+			out 0xB0, n     select cpu n
+			out 0xB1, v     start the selected cpu in real mode at (v << 8):0000
+
+		run() returns once the bootstrap processor stops; application processors that are still
+		running by then are stopped at the end of their current run of instructions.
+	*/
+	struct Machine
+	{
+		// see MemoryController for `ram_size` and `hugetlb`.
+		Machine(size_t num_cpus, size_t ram_size = MemoryController::DEFAULT_RAM_SIZE, bool hugetlb = false);
+		~Machine();
+
+		static constexpr uint16_t SMP_PORT = 0xB0;
+
+	private:
+		// one per cpu, so that reads can tell which cpu is asking.
+		struct SmpControl : IODevice
+		{
+			SmpControl(Machine& machine, size_t cpu) : m_machine(machine), m_cpu(cpu) { }
+
+			virtual uint32_t in(uint16_t port, int bits) override;
+			virtual void out(uint16_t port, int bits, uint32_t value) override;
+
+		private:
+			Machine& m_machine;
+			size_t m_cpu;
+			size_t m_target = 0;
+		};
+
+		MemoryController m_memory;
+
+		std::vector<std::unique_ptr<CPU>> m_cpus;
+		std::vector<std::unique_ptr<SmpControl>> m_smp;
+
+		// indexed by cpu; a thread is joinable once its cpu has been started.
+		std::mutex m_lock;
+		std::vector<std::thread> m_threads;
+		bool m_stopping = false;
+
+	public:
+		MemoryController& memory() { return m_memory; }
+
+		size_t cpuCount() const { return m_cpus.size(); }
+		CPU& cpu(size_t idx) { return *m_cpus[idx]; }
+
+		void run();
+		void startProcessor(size_t idx, uint8_t vector);
+	};
+}
@@ -5,3 +5,4 @@
 #pragma once
 
 #define ALWAYS_INLINE __attribute__((always_inline)) inline
+#define NEVER_INLINE __attribute__((noinline))
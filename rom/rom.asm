@@ -1,20 +1,82 @@
 [bits 16]
 [org 0xFFFF0000]
 
+; the disk controller's ports (see devices/disk.h).
+DISK_LBA        equ 0x1E0
+DISK_COUNT      equ 0x1E4
+DISK_BUFFER     equ 0x1E6
+DISK_COMMAND    equ 0x1EA
+DISK_BOOT       equ 0x1EC
+DISK_AX         equ 0x1F0
+DISK_BX         equ 0x1F2
+DISK_CX         equ 0x1F4
+DISK_DX         equ 0x1F6
+DISK_SI         equ 0x1F8
+DISK_ES         equ 0x1FA
+DISK_DS         equ 0x1FC
+DISK_CALL       equ 0x1FE
+
+; real-mode code can't reach up here, so the INT 13h handler is copied to where a real bios would
+; be, at the top of the first megabyte.
+INT13_SEG       equ 0xF000
+INT13_OFS       equ 0xE000
+
 begin:
-; 	mov bx, 0
-; 	mov ax, 1
-; 	mov cx, 20
+	; if INT 13h is already taken (by the emulator's own bios), leave it be.
+	xor ax, ax
+	mov es, ax
+	cmp word [es:0x13 * 4 + 2], 0
+	jne boot
+
+	mov ax, INT13_SEG
+	mov es, ax
+	mov si, int13 - $$
+	mov di, INT13_OFS
+	mov cx, int13_end - int13
+
+.copy:
+	mov al, [cs:si]
+	mov [es:di], al
+	inc si
+	inc di
+	dec cx
+	jnz .copy
 
-; .l:
-; 	mov dx, bx
-; 	mov bx, ax
-; 	add ax, dx
+	xor ax, ax
+	mov es, ax
+	mov word [es:0x13 * 4], INT13_OFS
+	mov word [es:0x13 * 4 + 2], INT13_SEG
 
-; 	dec cx
-; 	jnz .l
+boot:
+	; boot from the disk if we're told to; otherwise, the program is already in memory.
+	mov dx, DISK_BOOT
+	in al, dx
+	cmp al, 1
+	jne end
 
-	; jmp end
+	; read sector 0 to 0x7C00. this can't use INT 13h: the iret would go back to f000:xxxx, which
+	; isn't here.
+	xor ax, ax
+	mov dx, DISK_LBA
+	out dx, ax
+	mov dx, DISK_LBA + 2
+	out dx, ax
+	mov dx, DISK_BUFFER + 2
+	out dx, ax
+	mov ax, 0x7C00
+	mov dx, DISK_BUFFER
+	out dx, ax
+	mov ax, 1
+	mov dx, DISK_COUNT
+	out dx, ax
+	mov dx, DISK_COMMAND
+	out dx, al
+	in al, dx
+	test al, al
+	jnz fail
+
+	; like a real bios, tell the boot sector which drive it came from.
+	mov dl, 0x80
 
 end:
 	; setup some fake code to halt
@@ -23,9 +85,75 @@ end:
 	add ax, 1
 	hlt
 
+fail:
+	hlt
+	jmp fail
+
 owo:
 	dw 0xC00
 	dw 0x700
 
+
+; hands the caller's registers to the disk controller, which does the whole call; then gives
+; back what it returns, with the carry flag set in the flags that iret restores.
+int13:
+	push bp
+	mov bp, sp
+	push dx
+
+	mov dx, DISK_AX
+	out dx, ax
+	mov ax, bx
+	mov dx, DISK_BX
+	out dx, ax
+	mov ax, cx
+	mov dx, DISK_CX
+	out dx, ax
+	mov ax, [bp - 2]
+	mov dx, DISK_DX
+	out dx, ax
+	mov ax, si
+	mov dx, DISK_SI
+	out dx, ax
+	mov ax, es
+	mov dx, DISK_ES
+	out dx, ax
+	mov ax, ds
+	mov dx, DISK_DS
+	out dx, ax
+
+	mov dx, DISK_CALL
+	mov al, 0x13
+	out dx, al
+	in al, dx
+	test al, al
+	jz .ok
+
+	or word [bp + 6], 1
+	jmp .done
+
+.ok:
+	and word [bp + 6], 0xFFFE
+
+.done:
+	mov dx, DISK_BX
+	in ax, dx
+	mov bx, ax
+	mov dx, DISK_CX
+	in ax, dx
+	mov cx, ax
+	mov dx, DISK_DX
+	in ax, dx
+	mov [bp - 2], ax
+	mov dx, DISK_AX
+	in ax, dx
+	mov dx, [bp - 2]
+
+	mov sp, bp
+	pop bp
+	iret
+int13_end:
+
+
 times 0xFFF0-($-$$) db 0
 jmp begin
@@ -0,0 +1,251 @@
+// breakpoints.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include <algorithm>
+
+#include "defs.h"
+#include "cpu/cpu.h"
+#include "cpu/breakpoints.h"
+
+namespace z86
+{
+	static constexpr size_t PAGE_SIZE = MemoryController::PAGE_SIZE;
+	static constexpr uint64_t NUM_PAGES = (1ull << 32) / PAGE_SIZE;
+
+	struct Breakpoints::WatchedRegion : MemoryRegion
+	{
+		// offsets are into the whole region, which starts at `base` (before `start`, if the region
+		// was split up and this is not its first piece).
+		WatchedRegion(Breakpoints& bps, PhysAddr start, PhysAddr base, MemoryRegion* inner)
+			: MemoryRegion(inner->size()), m_bps(bps), m_start(start), m_base(base), m_inner(inner) { }
+
+		PhysAddr start() const { return m_start; }
+		MemoryRegion* wrapped() { return m_inner; }
+
+		virtual void read(uint64_t offset, void* buf, size_t len) override
+		{
+			m_inner->read(offset, buf, len);
+			m_bps.access(PhysAddr(m_base.addr + offset), len, /* write: */ false);
+		}
+
+		virtual void write(uint64_t offset, const void* buf, size_t len) override
+		{
+			m_inner->write(offset, buf, len);
+			m_bps.access(PhysAddr(m_base.addr + offset), len, /* write: */ true);
+		}
+
+		// accesses to watched pages must come through here, so no host pointers to them.
+		virtual uint8_t* hostPointer(uint64_t offset, size_t len) override
+		{
+			if(m_bps.is_watched(m_base.addr + offset, len))
+				return nullptr;
+
+			return m_inner->hostPointer(offset, len);
+		}
+
+		virtual MemoryRegion* inner() override { return m_inner->inner(); }
+
+	private:
+		Breakpoints& m_bps;
+		PhysAddr m_start;
+		PhysAddr m_base;
+		MemoryRegion* m_inner;
+	};
+
+
+	Breakpoints::Breakpoints(CPU& cpu) : m_cpu(cpu)
+	{
+		m_breakpoint_pages.resize(NUM_PAGES / 64);
+		m_watched_pages.resize(NUM_PAGES / 64);
+
+		m_cpu.setBreakpoints(this);
+	}
+
+	Breakpoints::~Breakpoints()
+	{
+		this->clear();
+		m_cpu.setBreakpoints(nullptr);
+	}
+
+	// anything past 4GB doesn't have a bit, so it always needs the slow check.
+	bool Breakpoints::test_bit(const std::vector<uint64_t>& bitmap, uint64_t page)
+	{
+		if(page >= NUM_PAGES)
+			return true;
+
+		return bitmap[page / 64] & (1ull << (page % 64));
+	}
+
+	void Breakpoints::set_bit(std::vector<uint64_t>& bitmap, uint64_t page, bool value)
+	{
+		if(page >= NUM_PAGES)
+			return;
+
+		if(value)   bitmap[page / 64] |= (1ull << (page % 64));
+		else        bitmap[page / 64] &= ~(1ull << (page % 64));
+	}
+
+	void Breakpoints::addBreakpoint(uint64_t linear)
+	{
+		if(this->isBreakpoint(linear))
+			return;
+
+		m_breakpoints.push_back(linear);
+		set_bit(m_breakpoint_pages, linear / PAGE_SIZE, true);
+	}
+
+	bool Breakpoints::removeBreakpoint(uint64_t linear)
+	{
+		auto it = std::find(m_breakpoints.begin(), m_breakpoints.end(), linear);
+		if(it == m_breakpoints.end())
+			return false;
+
+		m_breakpoints.erase(it);
+
+		auto page = linear / PAGE_SIZE;
+		bool others = std::any_of(m_breakpoints.begin(), m_breakpoints.end(), [page](uint64_t bp) {
+			return bp / PAGE_SIZE == page;
+		});
+
+		set_bit(m_breakpoint_pages, page, others);
+		return true;
+	}
+
+	bool Breakpoints::pageHasBreakpoint(uint64_t linear) const
+	{
+		return test_bit(m_breakpoint_pages, linear / PAGE_SIZE);
+	}
+
+	bool Breakpoints::isBreakpoint(uint64_t linear) const
+	{
+		return std::find(m_breakpoints.begin(), m_breakpoints.end(), linear) != m_breakpoints.end();
+	}
+
+	void Breakpoints::breakpointHit(uint64_t linear)
+	{
+		m_hit = Hit { .kind = Hit::Kind::Breakpoint, .addr = linear };
+	}
+
+
+
+	bool Breakpoints::addWatchpoint(uint64_t linear, PhysAddr addr, size_t len, Watch kind)
+	{
+		if(len == 0 || m_cpu.memory().findRegion(addr) == nullptr)
+			return false;
+
+		m_watchpoints.push_back(Watchpoint { addr.addr, linear, len, kind });
+		this->update_regions();
+
+		return true;
+	}
+
+	bool Breakpoints::removeWatchpoint(PhysAddr addr, size_t len, Watch kind)
+	{
+		auto it = std::find_if(m_watchpoints.begin(), m_watchpoints.end(), [&](const Watchpoint& wp) {
+			return wp.addr == addr.addr && wp.len == len && wp.kind == kind;
+		});
+
+		if(it == m_watchpoints.end())
+			return false;
+
+		m_watchpoints.erase(it);
+		this->update_regions();
+
+		return true;
+	}
+
+	void Breakpoints::clear()
+	{
+		m_breakpoints.clear();
+		m_watchpoints.clear();
+
+		std::fill(m_breakpoint_pages.begin(), m_breakpoint_pages.end(), 0);
+		this->update_regions();
+	}
+
+	bool Breakpoints::is_watched(uint64_t addr, size_t len) const
+	{
+		for(auto page = addr / PAGE_SIZE; page <= (addr + len - 1) / PAGE_SIZE; page++)
+		{
+			if(test_bit(m_watched_pages, page))
+				return true;
+		}
+
+		return false;
+	}
+
+	void Breakpoints::update_regions()
+	{
+		auto& mem = m_cpu.memory();
+
+		std::fill(m_watched_pages.begin(), m_watched_pages.end(), 0);
+
+		// the regions (by starting address) that have a watched page.
+		std::vector<uint64_t> needed;
+		for(auto& wp : m_watchpoints)
+		{
+			for(auto page = wp.addr / PAGE_SIZE; page <= (wp.addr + wp.len - 1) / PAGE_SIZE; page++)
+			{
+				set_bit(m_watched_pages, page, true);
+
+				auto r = mem.findRegion(PhysAddr(std::max(page * PAGE_SIZE, wp.addr)));
+				if(r && std::find(needed.begin(), needed.end(), r->start.addr) == needed.end())
+					needed.push_back(r->start.addr);
+			}
+		}
+
+		// put back the regions that no longer need watching, then wrap the new ones.
+		for(auto it = m_regions.begin(); it != m_regions.end(); )
+		{
+			auto start = (*it)->start();
+			if(std::find(needed.begin(), needed.end(), start.addr) == needed.end())
+			{
+				mem.swapRegion(start, (*it)->wrapped());
+				it = m_regions.erase(it);
+			}
+			else
+			{
+				needed.erase(std::find(needed.begin(), needed.end(), start.addr));
+				++it;
+			}
+		}
+
+		for(auto start : needed)
+		{
+			auto r = mem.findRegion(PhysAddr(start));
+			assert(r != nullptr);
+
+			auto wr = std::make_unique<WatchedRegion>(*this, r->start, PhysAddr(r->start.addr - r->offset), r->region);
+			mem.swapRegion(r->start, wr.get());
+
+			m_regions.push_back(std::move(wr));
+		}
+	}
+
+	void Breakpoints::access(PhysAddr addr, size_t len, bool write)
+	{
+		// only the guest's own data accesses count.
+		bool attached = (m_cpu.breakpoints() == this);
+		if(!m_cpu.running() || m_cpu.fetching() || !(attached || m_replaying))
+			return;
+
+		if(!this->is_watched(addr.addr, len))
+			return;
+
+		for(auto& wp : m_watchpoints)
+		{
+			if(addr.addr + len <= wp.addr || wp.addr + wp.len <= addr.addr)
+				continue;
+
+			if((wp.kind == Watch::Write && !write) || (wp.kind == Watch::Read && write))
+				continue;
+
+			m_hit = Hit { .kind = Hit::Kind::Watchpoint, .addr = wp.linear, .watch = wp.kind };
+			if(attached)
+				m_cpu.requestDebugStop();
+
+			return;
+		}
+	}
+}
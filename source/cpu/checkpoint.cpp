@@ -0,0 +1,190 @@
+// checkpoint.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "defs.h"
+#include "cpu/checkpoint.h"
+
+namespace z86
+{
+	static constexpr size_t NONE = SIZE_MAX;
+
+	// re-executing what already happened shouldn't stop at breakpoints along the way.
+	struct NoBreakpoints
+	{
+		NoBreakpoints(CPU& cpu) : m_cpu(cpu), m_saved(cpu.breakpoints()) { m_cpu.setBreakpoints(nullptr); }
+		~NoBreakpoints() { m_cpu.setBreakpoints(m_saved); }
+
+	private:
+		CPU& m_cpu;
+		Breakpoints* m_saved;
+	};
+
+	Checkpoints::Checkpoints(CPU& cpu, uint64_t interval, size_t budget) : m_cpu(cpu), m_interval(interval), m_budget(budget)
+	{
+		assert(interval > 0);
+
+		m_cpu.memory().setWriteTracking(true);
+		m_cpu.setCheckpoints(this);
+	}
+
+	Checkpoints::~Checkpoints()
+	{
+		m_cpu.setCheckpoints(nullptr);
+		m_cpu.memory().setWriteTracking(false);
+	}
+
+	size_t Checkpoints::undo_size(const std::vector<MemoryController::SavedPage>& pages)
+	{
+		size_t ret = 0;
+		for(auto& p : pages)
+			ret += sizeof(p) + p.data.size();
+
+		return ret;
+	}
+
+	uint64_t Checkpoints::nextCheckpoint() const
+	{
+		if(m_checkpoints.empty())
+			return 0;
+
+		return m_checkpoints.back().state.instructions + m_interval;
+	}
+
+	uint64_t Checkpoints::earliest() const
+	{
+		if(m_checkpoints.empty())
+			return m_cpu.instructionCount();
+
+		return m_checkpoints.front().state.instructions;
+	}
+
+	void Checkpoints::take()
+	{
+		// the pages written since the last checkpoint belong to it. anything written before the
+		// first one can't be undone anyway.
+		auto undo = m_cpu.memory().takeUndoLog();
+		if(!m_checkpoints.empty())
+		{
+			m_used += undo_size(undo);
+			m_checkpoints.back().undo = std::move(undo);
+		}
+
+		m_checkpoints.push_back(Checkpoint { m_cpu.saveState(), { } });
+		m_used += sizeof(Checkpoint);
+
+		// always keep the newest one, even if it alone is over budget.
+		while(m_used > m_budget && m_checkpoints.size() > 1)
+		{
+			m_used -= sizeof(Checkpoint) + undo_size(m_checkpoints.front().undo);
+			m_checkpoints.pop_front();
+		}
+	}
+
+	size_t Checkpoints::latest_before(uint64_t icount)
+	{
+		for(size_t i = m_checkpoints.size(); i-- > 0; )
+		{
+			if(m_checkpoints[i].state.instructions <= icount)
+				return i;
+		}
+
+		return NONE;
+	}
+
+	void Checkpoints::restore(size_t idx)
+	{
+		assert(idx < m_checkpoints.size());
+		auto& mem = m_cpu.memory();
+
+		// undo the writes since the newest checkpoint, then each interval in turn going back.
+		mem.applyUndoLog(mem.takeUndoLog());
+
+		for(size_t i = m_checkpoints.size(); i-- > idx; )
+		{
+			auto& cp = m_checkpoints[i];
+
+			mem.applyUndoLog(cp.undo);
+			m_used -= undo_size(cp.undo);
+
+			if(i > idx)
+			{
+				m_checkpoints.pop_back();
+				m_used -= sizeof(Checkpoint);
+			}
+			else
+			{
+				cp.undo.clear();
+			}
+		}
+
+		m_cpu.restoreState(m_checkpoints[idx].state);
+	}
+
+	bool Checkpoints::seek(uint64_t icount)
+	{
+		auto _ = NoBreakpoints(m_cpu);
+
+		if(icount < m_cpu.instructionCount())
+		{
+			auto idx = this->latest_before(icount);
+			if(idx == NONE)
+				return false;
+
+			this->restore(idx);
+		}
+
+		return m_cpu.runUntil(icount);
+	}
+
+	bool Checkpoints::reverseStep()
+	{
+		auto now = m_cpu.instructionCount();
+		if(now == 0)
+			return false;
+
+		return this->seek(now - 1);
+	}
+
+	bool Checkpoints::reverseContinue(const std::function<bool (CPU&)>& stop, const std::function<bool (CPU&)>& after)
+	{
+		// scan one interval at a time, newest first, stepping through it and remembering the
+		// last point where `stop` matched. the first interval with a match has the answer.
+		auto _ = NoBreakpoints(m_cpu);
+
+		auto end = m_cpu.instructionCount();
+		while(end > 0)
+		{
+			auto idx = this->latest_before(end - 1);
+			if(idx == NONE)
+				break;
+
+			this->restore(idx);
+			auto start = m_cpu.instructionCount();
+
+			auto found = Scheduler::NEVER;
+			while(m_cpu.instructionCount() < end)
+			{
+				auto now = m_cpu.instructionCount();
+				if(stop(m_cpu))
+					found = now;
+
+				if(!m_cpu.runUntil(now + 1))
+					break;
+
+				if(after && after(m_cpu))
+					found = now;
+			}
+
+			if(found != Scheduler::NEVER)
+				return this->seek(found);
+
+			end = start;
+		}
+
+		if(!m_checkpoints.empty())
+			this->seek(this->earliest());
+
+		return false;
+	}
+}
@@ -0,0 +1,322 @@
+// coverage.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include <fstream>
+#include <algorithm>
+
+#include "defs.h"
+#include "cpu/coverage.h"
+
+namespace z86
+{
+	Coverage::Coverage()
+	{
+		m_chunks = std::make_unique<std::atomic<Chunk*>[]>(NUM_CHUNKS);
+		for(size_t i = 0; i < NUM_CHUNKS; i++)
+			m_chunks[i].store(nullptr, std::memory_order_relaxed);
+	}
+
+	Coverage::~Coverage()
+	{
+		for(size_t i = 0; i < NUM_CHUNKS; i++)
+			delete m_chunks[i].load(std::memory_order_relaxed);
+	}
+
+	Coverage::Chunk* Coverage::chunk(uint64_t addr)
+	{
+		auto& slot = m_chunks[addr >> CHUNK_SHIFT];
+		if(auto c = slot.load(std::memory_order_acquire); c != nullptr)
+			return c;
+
+		auto fresh = new Chunk();
+		for(size_t i = 0; i < CHUNK_WORDS; i++)
+			fresh->words[i].store(0, std::memory_order_relaxed);
+
+		// if another cpu got there first, use theirs.
+		Chunk* expected = nullptr;
+		if(slot.compare_exchange_strong(expected, fresh, std::memory_order_acq_rel))
+			return fresh;
+
+		delete fresh;
+		return expected;
+	}
+
+	void Coverage::set_bits(uint64_t addr, size_t len)
+	{
+		// the caller keeps this within one word.
+		auto bit = addr % 64;
+		auto mask = (len == 64 ? UINT64_MAX : ((1ULL << len) - 1)) << bit;
+
+		auto& word = this->chunk(addr)->words[(addr % (1ULL << CHUNK_SHIFT)) / 64];
+		if((word.load(std::memory_order_relaxed) & mask) != mask)
+			word.fetch_or(mask, std::memory_order_relaxed);
+	}
+
+	void Coverage::mark(PhysAddr addr, size_t len)
+	{
+		auto a = addr.addr;
+		auto end = std::min(a + len, uint64_t(1) << 32);
+
+		while(a < end)
+		{
+			auto n = std::min(end - a, 64 - (a % 64));
+			this->set_bits(a, n);
+			a += n;
+		}
+	}
+
+	bool Coverage::covered(PhysAddr addr) const
+	{
+		if(addr.addr >= (1ULL << 32))
+			return false;
+
+		auto c = m_chunks[addr.addr >> CHUNK_SHIFT].load(std::memory_order_acquire);
+		if(c == nullptr)
+			return false;
+
+		auto word = c->words[(addr.addr % (1ULL << CHUNK_SHIFT)) / 64].load(std::memory_order_relaxed);
+		return (word >> (addr.addr % 64)) & 1;
+	}
+
+
+
+
+	static bool is_word_char(char c)
+	{
+		return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == '$' || c == '@' || c == '?';
+	}
+
+	// whether the source of a line (with bytes) is data rather than an instruction.
+	static bool is_data(const std::string& text)
+	{
+		constexpr const char* directives[] = {
+			"db", "dw", "dd", "dq", "dt", "do", "dy", "dz",
+			"resb", "resw", "resd", "resq", "rest", "reso", "resy", "resz",
+			"rb", "rw", "rd", "rq",
+			"times", "incbin", "align", "alignb",
+		};
+
+		// the first word, after a label if there is one.
+		auto word = [&](size_t& i) -> std::string {
+			while(i < text.size() && isspace(static_cast<unsigned char>(text[i])))
+				i++;
+
+			auto start = i;
+			while(i < text.size() && is_word_char(text[i]))
+				i++;
+
+			auto ret = text.substr(start, i - start);
+			for(auto& c : ret)
+				c = tolower(static_cast<unsigned char>(c));
+
+			return ret;
+		};
+
+		size_t i = 0;
+		auto w = word(i);
+		if(i < text.size() && text[i] == ':')
+		{
+			i++;
+			w = word(i);
+		}
+
+		for(auto d : directives)
+		{
+			if(w == d)
+				return true;
+		}
+
+		return false;
+	}
+
+	/*
+		a line of a nasm listing is laid out like this:
+
+		     5 00000003 B80100                  start: mov ax, 1
+		     6 00000006 <res 000000FA>          resb 250
+		     7                              <1> some_macro_line
+
+		the line number takes 6 columns, and the offset (if the line made any bytes) 8. the bytes
+		take the next 19, with a '-' at the end if they carry on in a line below, which has the same
+		number and no source. macros and included files are marked with <n>; the source starts at
+		the 41st column.
+	*/
+	static constexpr size_t LST_OFFSET = 7;
+	static constexpr size_t LST_BYTES = 16;
+	static constexpr size_t LST_LEVEL = 35;
+	static constexpr size_t LST_SOURCE = 40;
+
+	bool Coverage::addListing(const std::string& path, uint64_t base)
+	{
+		auto in = std::ifstream(path);
+		if(!in.good())
+			return false;
+
+		auto listing = Listing();
+		listing.path = path;
+		listing.base = base;
+
+		// if there's a .asm next to it, that's the source; genhtml wants to read it.
+		listing.source = path;
+		if(auto dot = path.rfind('.'); dot != std::string::npos && path.find('/', dot) == std::string::npos)
+		{
+			auto asm_path = path.substr(0, dot) + ".asm";
+			if(std::ifstream(asm_path).good())
+				listing.source = asm_path;
+		}
+
+		std::string str;
+		while(std::getline(in, str))
+		{
+			if(!str.empty() && str.back() == '\r')
+				str.pop_back();
+
+			char* end = nullptr;
+			auto number = strtoul(str.c_str(), &end, 10);
+			if(end == str.c_str() || number == 0)
+				continue;
+
+			auto level = (str.size() > LST_LEVEL ? str.substr(LST_LEVEL, LST_SOURCE - LST_LEVEL) : "");
+			if(level.find('<') != std::string::npos)
+				continue;
+
+			auto line = Line();
+			line.number = number;
+			line.text = (str.size() > LST_SOURCE ? str.substr(LST_SOURCE) : "");
+
+			// the rest of a long instruction's bytes.
+			if(!listing.lines.empty() && listing.lines.back().number == number)
+				continue;
+
+			auto offset = (str.size() > LST_BYTES ? str.substr(LST_OFFSET, LST_BYTES - LST_OFFSET - 1) : "");
+			auto has_offset = (offset.size() == 8 && str[LST_BYTES - 1] == ' ')
+				&& std::all_of(offset.begin(), offset.end(), [](char c) { return isxdigit(static_cast<unsigned char>(c)); });
+
+			// reserved and repeated bytes (<res ..>, <rep ..>) aren't code either.
+			if(has_offset && str[LST_BYTES] != '<' && !is_data(line.text))
+			{
+				line.code = true;
+				line.offset = strtoull(offset.c_str(), nullptr, 16);
+			}
+
+			listing.lines.push_back(std::move(line));
+		}
+
+		m_listings.push_back(std::move(listing));
+		return true;
+	}
+
+	bool Coverage::line_covered(const Listing& listing, const Line& line) const
+	{
+		return line.code && this->covered(PhysAddr(listing.base + line.offset));
+	}
+
+	std::pair<size_t, size_t> Coverage::count_lines(const Listing& listing) const
+	{
+		size_t found = 0;
+		size_t hit = 0;
+		for(auto& line : listing.lines)
+		{
+			found += (line.code ? 1 : 0);
+			hit += (this->line_covered(listing, line) ? 1 : 0);
+		}
+
+		return { found, hit };
+	}
+
+	void Coverage::write_lcov(FILE* f) const
+	{
+		for(auto& listing : m_listings)
+		{
+			fputs("TN:\n", f);
+			zpr::fprintln(f, "SF:{}", listing.source);
+
+			for(auto& line : listing.lines)
+			{
+				if(line.code)
+					zpr::fprintln(f, "DA:{},{}", line.number, this->line_covered(listing, line) ? 1 : 0);
+			}
+
+			auto [ found, hit ] = this->count_lines(listing);
+			zpr::fprintln(f, "LF:{}", found);
+			zpr::fprintln(f, "LH:{}", hit);
+			fputs("end_of_record\n", f);
+		}
+	}
+
+	static std::string html_escape(const std::string& s)
+	{
+		std::string ret;
+		for(char c : s)
+		{
+			switch(c)
+			{
+				case '&': ret += "&amp;"; break;
+				case '<': ret += "&lt;"; break;
+				case '>': ret += "&gt;"; break;
+				case '"': ret += "&quot;"; break;
+				default:  ret += c; break;
+			}
+		}
+
+		return ret;
+	}
+
+	static constexpr const char* HTML_HEADER =
+		"<!DOCTYPE html>\n"
+		"<html><head><meta charset=\"utf-8\"><title>coverage</title><style>\n"
+		"body { font-family: sans-serif; }\n"
+		".hit { background: #cfc; }\n"
+		".miss { background: #fcc; }\n"
+		".num { color: #888; }\n"
+		"</style></head><body>\n";
+
+	void Coverage::write_html(FILE* f) const
+	{
+		fputs(HTML_HEADER, f);
+
+		for(auto& listing : m_listings)
+		{
+			auto [ found, hit ] = this->count_lines(listing);
+
+			zpr::fprintln(f, "<h2>{}</h2>", html_escape(listing.source));
+			zpr::fprintln(f, "<p>{} of {} lines ran (at {#x})</p>", hit, found, listing.base);
+			fputs("<pre>\n", f);
+
+			for(auto& line : listing.lines)
+			{
+				auto cls = (!line.code ? "" : this->line_covered(listing, line) ? " class=\"hit\"" : " class=\"miss\"");
+				zpr::fprintln(f, "<span class=\"num\">{5}</span> <span{}>{}</span>", line.number, cls,
+					html_escape(line.text));
+			}
+
+			fputs("</pre>\n", f);
+		}
+
+		fputs("</body></html>\n", f);
+	}
+
+	bool Coverage::write(const std::string& path) const
+	{
+		auto f = fopen(path.c_str(), "w");
+		if(f == nullptr)
+			return false;
+
+		auto html = (path.size() >= 5 && path.compare(path.size() - 5, 5, ".html") == 0);
+		if(html) this->write_html(f);
+		else     this->write_lcov(f);
+
+		return fclose(f) == 0;
+	}
+
+	void Coverage::summarise() const
+	{
+		for(auto& listing : m_listings)
+		{
+			auto [ found, hit ] = this->count_lines(listing);
+
+			lg::log("coverage", "{}: {} of {} lines ran", listing.source, hit, found);
+		}
+	}
+}
@@ -2,8 +2,17 @@
 // Copyright (c) 2020, zhiayang
 // Licensed under the Apache License Version 2.0.
 
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
 #include "defs.h"
 #include "cpu/cpu.h"
+#include "cpu/checkpoint.h"
+#include "cpu/coverage.h"
+#include "cpu/instrument.h"
+#include "cpu/breakpoints.h"
+#include "devices/bios.h"
 
 namespace z86
 {
@@ -15,10 +24,10 @@ namespace z86
 			zpr::println("cx:    {4.2x}    dx:    {4.2x}", cpu.cx(), cpu.dx());
 			zpr::println("di:    {4.2x}    si:    {4.2x}", cpu.di(), cpu.si());
 			zpr::println("bp:    {4.2x}    sp:    {4.2x}", cpu.bp(), cpu.sp());
-			zpr::println("cs:    {4.2x}    ip:    {4.2x}", cpu.cs().get(), cpu.ip());
-			zpr::println("ds:    {4.2x}    ss:    {4.2x}", cpu.ds().get(), cpu.ss().get());
-			zpr::println("es:    {4.2x}    fs:    {4.2x}", cpu.es().get(), cpu.fs().get());
-			zpr::println("gs:    {4.2x}", cpu.gs().get());
+			zpr::println("cs:    {4.2x}    ip:    {4.2x}", cpu.cs(), cpu.ip());
+			zpr::println("ds:    {4.2x}    ss:    {4.2x}", cpu.ds(), cpu.ss());
+			zpr::println("es:    {4.2x}    fs:    {4.2x}", cpu.es(), cpu.fs());
+			zpr::println("gs:    {4.2x}", cpu.gs());
 			zpr::println("flags: {016b}", cpu.flags().flags());
 			zpr::println("           ODITSZ A P C");
 			zpr::println("");
@@ -26,8 +35,12 @@ namespace z86
 	}
 
 
-	CPU::CPU() : m_exec(*this), m_pmmu(*this, m_memory), m_smmu(*this, m_pmmu)
+	CPU::CPU(MemoryController& memory, size_t id) : m_exec(*this), m_memory(memory), m_pmmu(*this, m_memory), m_smmu(*this, m_pmmu), m_dcache(m_memory),
+		m_pic(*this),
+		m_pit(m_sched, m_pic), m_id(id)
 	{
+		m_pic.attach(m_io);
+		m_pit.attach(m_io);
 	}
 
 	void CPU::reset()
@@ -39,6 +52,11 @@ namespace z86
 		// cr2-4 = 0
 
 		m_mode = CPUMode::Real;
+		m_halted = false;
+		m_instructions = 0;
+		m_cycles = 0;
+		m_memory_accesses = 0;
+		m_interrupts_after = 0;
 
 		// first we reset the smmu
 		m_smmu.reset();
@@ -59,6 +77,9 @@ namespace z86
 		for(size_t i = 0; i < 16; i++)
 			m_gprs[i].low_64 = 0;
 
+		for(size_t i = 0; i < 16; i++)
+			m_vregs[i] = { };
+
 		// for some reason, EDX is special.
 		// it's some cpuid stuff: edx[3:0] = stepping
 		// edx[19:16] = extended model
@@ -90,73 +111,622 @@ namespace z86
 	void CPU::start()
 	{
 		this->reset();
+		this->main_loop(Scheduler::NEVER);
+	}
+
+	void CPU::start(uint16_t cs, uint64_t ip)
+	{
+		this->reset();
+
+		this->setSegment(SegReg::CS, cs);
+		this->jump(ip);
+
+		this->main_loop(Scheduler::NEVER);
+	}
+
+	bool CPU::runUntil(uint64_t icount)
+	{
+		return this->main_loop(icount);
+	}
+
+	CPU::State CPU::saveState()
+	{
+		assert(m_slice_pos == 0);
+
+		auto st = State { };
+		std::copy(std::begin(m_gprs), std::end(m_gprs), std::begin(st.gprs));
+		std::copy(std::begin(m_segment_regs), std::end(m_segment_regs), std::begin(st.segment_regs));
+		std::copy(std::begin(m_vregs), std::end(m_vregs), std::begin(st.vregs));
+
+		st.ip = m_ip;
+		st.flags = m_flags;
+		st.mode = m_mode;
+		st.paging = m_pmmu.enabled();
+		st.smmu = m_smmu.saveState();
+		st.sched = m_sched;
+		st.pic = m_pic.saveState();
+		st.pit = m_pit.saveState();
+		st.instructions = m_instructions;
+		st.cycles = m_cycles;
+		st.interrupts_after = m_interrupts_after;
+		st.halted = m_halted;
+
+		return st;
+	}
+
+	void CPU::restoreState(const State& st)
+	{
+		assert(m_slice_pos == 0);
+
+		std::copy(std::begin(st.gprs), std::end(st.gprs), std::begin(m_gprs));
+		std::copy(std::begin(st.segment_regs), std::end(st.segment_regs), std::begin(m_segment_regs));
+		std::copy(std::begin(st.vregs), std::end(st.vregs), std::begin(m_vregs));
+
+		m_ip = st.ip;
+		m_flags = st.flags;
+		m_mode = st.mode;
+
+		if(st.paging)   m_pmmu.enable();
+		else            m_pmmu.disable();
+
+		m_smmu.restoreState(st.smmu);
+		m_sched = st.sched;
+		m_pic.restoreState(st.pic);
+		m_pit.restoreState(st.pit);
+
+		m_instructions = st.instructions;
+		m_cycles = st.cycles;
+		m_interrupts_after = st.interrupts_after;
+		m_halted = st.halted;
+	}
+
+	void CPU::stop()
+	{
+		m_stop_requested.store(true, std::memory_order_relaxed);
+	}
+
+	bool CPU::main_loop(uint64_t until)
+	{
+		// when resuming from a breakpoint, don't stop at it again straight away.
+		auto resume = m_instructions;
+
+		m_running = true;
+		m_debug_stop = false;
+
+		// whether the cpu stopped by itself (eg. at a HLT with halt-exits), even if that happened
+		// at exactly the instruction count we were running until.
+		bool stopped = false;
+
+		// writes to code from this thread invalidate decoded instructions straight away.
+		m_dcache.setOwner(std::this_thread::get_id());
 
-		while(true)
+		while(m_instructions < until && !m_debug_stop && !m_stop_requested.load(std::memory_order_relaxed))
 		{
-			if(!this->run(this->decode()))
+			if(m_checkpoints && m_instructions >= m_checkpoints->nextCheckpoint())
+				m_checkpoints->take();
+
+			if(m_halted)
+			{
+				if(!this->idle())
+					break;
+
+				continue;
+			}
+
+			// run up to the next scheduled event without looking at any devices; the run can
+			// be cut short by requestInterruptCheck(). every instruction takes at least a cycle.
+			m_slice_pos = 0;
+			m_slice_cycles = 0;
+			m_slice_synced = 0;
+
+			// a debugger stop can leave the loop after the clock passed a deadline but before
+			// runDue(); that event runs after an empty slice instead of wrapping the length.
+			auto next = m_sched.nextDeadline();
+			auto now = m_sched.now();
+			m_slice_cycles_end = (next > now ? next - now : 0);
+			m_slice_end = std::min(m_slice_cycles_end, MAX_SLICE);
+
+			// other cpus' writes to code we decoded are seen from here.
+			m_dcache.sync();
+
+			// when replaying, interrupts must arrive at exactly the instruction they did before.
+			if(m_replay && m_replay->replaying())
+				m_slice_end = std::min(m_slice_end, m_replay->nextInterrupt() - m_instructions);
+
+			// the run also ends wherever something else needs to happen between instructions. none
+			// of these change where interrupts are delivered, so the guest can't tell.
+			m_slice_end = std::min(m_slice_end, until - m_instructions);
+
+			if(m_checkpoints)
+				m_slice_end = std::min(m_slice_end, m_checkpoints->nextCheckpoint() - m_instructions);
+
+			if(m_interrupts_after > m_instructions)
+				m_slice_end = std::min(m_slice_end, m_interrupts_after - m_instructions);
+
+			bool stop = false;
+			if(m_breakpoints && !m_breakpoints->empty())
+			{
+				stop = !this->run_checked(resume);
+			}
+			else
+			{
+				while(m_slice_pos < m_slice_end && m_slice_cycles < m_slice_cycles_end)
+				{
+					m_slice_pos++;
+
+					auto cost = InstrCost();
+					auto instr = this->decode(cost);
+					if(!this->run(instr, cost))
+					{
+						stop = true;
+						break;
+					}
+				}
+			}
+
+			m_sched.advance(m_slice_cycles - m_slice_synced);
+			m_instructions += m_slice_pos;
+			m_cycles += m_slice_cycles;
+			m_slice_pos = 0;
+			m_slice_cycles = 0;
+			m_slice_synced = 0;
+
+			if(stop || m_debug_stop)
+			{
+				stopped = stop;
 				break;
+			}
+
+			m_sched.runDue();
+			this->check_interrupts();
+		}
+
+		m_running = false;
+		return !stopped && m_instructions >= until;
+	}
+
+	// the same as the loop in main_loop(), but stops before an instruction at a breakpoint (except
+	// the one at `resume`). the bitmap is only consulted when execution moves to another page.
+	bool CPU::run_checked(uint64_t resume)
+	{
+		auto page = UINT64_MAX;
+		bool check = false;
+
+		while(m_slice_pos < m_slice_end && m_slice_cycles < m_slice_cycles_end)
+		{
+			auto linear = m_smmu.descriptor(SegReg::CS).base + this->ip();
+			if(linear / MemoryController::PAGE_SIZE != page)
+			{
+				page = linear / MemoryController::PAGE_SIZE;
+				check = m_breakpoints->pageHasBreakpoint(linear);
+			}
+
+			if(check && this->instructionCount() != resume && m_breakpoints->isBreakpoint(linear))
+			{
+				m_breakpoints->breakpointHit(linear);
+				m_debug_stop = true;
+				break;
+			}
+
+			m_slice_pos++;
+
+			auto cost = InstrCost();
+
+			m_fetching = true;
+			auto instr = this->decode(cost);
+			m_fetching = false;
+
+			if(!this->run(instr, cost))
+				return false;
+		}
+
+		return true;
+	}
+
+	void CPU::requestDebugStop()
+	{
+		m_debug_stop = true;
+		this->requestInterruptCheck();
+	}
+
+	bool CPU::idle()
+	{
+		// when replaying, the only thing that can end the halt is the next logged interrupt, and
+		// no instructions are retired while halted -- so it must be due right now.
+		if(m_replay && m_replay->replaying())
+		{
+			if(m_replay->nextInterrupt() != m_instructions)
+			{
+				lg::log("cpu", "halted at {04x}:{04x} with no more interrupts in the replay log; stopping",
+					this->cs(), this->ip());
+				return false;
+			}
+
+			this->check_interrupts();
+			return true;
+		}
+
+		// while halted, nothing happens until the next event -- so skip straight to it. only
+		// a maskable interrupt can wake us up (there's no NMI or INIT), so if they're disabled
+		// or nothing is scheduled, we're never going to wake up.
+		auto next = m_sched.nextDeadline();
+		if(!m_flags.IF() || next == Scheduler::NEVER)
+		{
+			lg::log("cpu", "halted with {} at {04x}:{04x}; stopping",
+				m_flags.IF() ? "nothing scheduled" : "interrupts disabled", this->cs(), this->ip());
+			return false;
+		}
+
+		if(m_realtime)
+		{
+			auto ticks = next - m_sched.now();
+			std::this_thread::sleep_for(std::chrono::duration<double>(static_cast<double>(ticks) / Scheduler::TICKS_PER_SECOND));
+		}
+
+		m_sched.advanceTo(next);
+		m_sched.runDue();
+		this->check_interrupts();
+
+		return true;
+	}
+
+	void CPU::halt()
+	{
+		m_halted = true;
+		this->requestInterruptCheck();
+	}
+
+	void CPU::check_interrupts()
+	{
+		// when replaying, the devices still run, but they don't get to interrupt us.
+		if(m_replay && m_replay->replaying())
+		{
+			if(m_replay->nextInterrupt() == m_instructions)
+			{
+				m_halted = false;
+				this->take_interrupt(m_replay->replayInterrupt(m_instructions));
+			}
+
+			return;
+		}
+
+		if(m_flags.IF() && m_instructions >= m_interrupts_after && m_pic.pending())
+		{
+			m_halted = false;
+
+			auto vector = m_pic.acknowledge();
+			if(m_replay)
+				m_replay->recordInterrupt(m_instructions, vector);
+
+			this->take_interrupt(vector);
+		}
+	}
+
+	void CPU::take_interrupt(uint8_t vector)
+	{
+		if constexpr (Instrumentation::enabled)
+		{
+			auto cs = this->cs();
+			auto ip = this->ip();
+			this->interrupt(vector);
+
+			Instrumentation::transfer(*this, ControlTransfer { ControlTransfer::Kind::Interrupt, cs, ip,
+				this->cs(), this->ip(), nullptr });
+		}
+		else
+		{
+			this->interrupt(vector);
+		}
+	}
+
+	void CPU::sync_clock()
+	{
+		// m_slice_cycles doesn't count the instruction that's executing, so this is the clock as
+		// of its start.
+		if(m_slice_cycles > m_slice_synced)
+		{
+			m_sched.advance(m_slice_cycles - m_slice_synced);
+			m_slice_synced = m_slice_cycles;
+		}
+	}
+
+	uint32_t CPU::portIn(uint16_t port, int bits)
+	{
+		if(m_replay && m_replay->replaying())
+			return m_replay->replayPortIn(this->instructionCount(), port);
+
+		this->sync_clock();
+
+		auto value = m_io.in(port, bits);
+		if(m_replay)
+			m_replay->recordPortIn(this->instructionCount(), port, value);
+
+		return value;
+	}
+
+	void CPU::portOut(uint16_t port, int bits, uint32_t value)
+	{
+		this->sync_clock();
+		m_io.out(port, bits, value);
+
+		// the device might have scheduled something before the end of this run. the clock was
+		// synced, so the run started m_slice_synced cycles ago.
+		auto next = m_sched.nextDeadline();
+		if(next != Scheduler::NEVER)
+		{
+			auto start = m_sched.now() - m_slice_synced;
+			m_slice_cycles_end = std::min(m_slice_cycles_end, next > start ? next - start : 0);
 		}
 	}
 
-	instrad::x86::Instruction CPU::decode()
+	bool CPU::biosTrap()
+	{
+		if(m_bios == nullptr)
+			return false;
+
+		// like io, the call sees the clock as of the start of the instruction.
+		this->sync_clock();
+		return m_bios->trap(*this);
+	}
+
+	uint64_t CPU::hostTime()
+	{
+		if(m_replay && m_replay->replaying())
+			return m_replay->replayHostTime(this->instructionCount());
+
+		auto now = std::chrono::system_clock::now().time_since_epoch();
+		auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+
+		if(m_replay)
+			m_replay->recordHostTime(this->instructionCount(), time);
+
+		return time;
+	}
+
+	void CPU::requestInterruptCheck(uint64_t delay)
+	{
+		m_slice_end = std::min(m_slice_end, m_slice_pos + delay);
+	}
+
+	void CPU::inhibitInterrupts(uint64_t count)
+	{
+		m_interrupts_after = this->instructionCount() + count;
+		this->requestInterruptCheck(count);
+	}
+
+	void CPU::interrupt(uint8_t vector)
+	{
+		if(m_mode != CPUMode::Real)
+			lg::fatal("cpu", "interrupt {02x}: only real mode interrupts are supported", vector);
+
+		this->push16(m_flags.flags());
+		this->push16(this->cs());
+		this->push16(this->ip());
+
+		m_flags.clearIF();
+		m_flags.clearTF();
+
+		// the real-mode ivt is always at physical address 0 (we don't support LIDT).
+		auto ofs = m_memory.read16(PhysAddr(vector * 4));
+		auto seg = m_memory.read16(PhysAddr(vector * 4 + 2));
+
+		this->setSegment(SegReg::CS, seg);
+		this->jump(ofs);
+	}
+
+	instrad::x86::Instruction CPU::decode(InstrCost& cost)
 	{
+		// without limit checks or paging, the physical address of the instruction is just the
+		// linear one, and fetching it can't fault -- so it can come from the cache.
+		auto& cs = m_smmu.descriptor(SegReg::CS);
+		auto cacheable = !cs.checked && !m_pmmu.enabled();
+		auto addr = PhysAddr(cs.base + this->ip());
+
+		if(cacheable)
+		{
+			if(auto instr = m_dcache.lookup(addr, cost); instr != nullptr)
+			{
+				m_ip += instr->length();
+				return *instr;
+			}
+		}
+
+		auto ip = this->ip();
 		auto buf = Buffer(*this);
 		auto begin = buf.position();
 
 		auto ret = instrad::x86::read(buf, instrad::x86::ExecMode::Legacy);
 
 		m_ip += (buf.position() - begin);
+
+		// the fetch didn't fault, so neither can translating its address.
+		if(m_coverage)
+			m_coverage->mark(cacheable ? addr : this->translate(SegReg::CS, ip, 1, SegmentedMMU::Access::Execute), ret.length());
+
+		cost = instruction_cost(m_model, ret);
+		if(cacheable)
+			m_dcache.insert(addr, ret, cost);
+
 		return ret;
 	}
 
-	bool CPU::run(instrad::x86::Instruction instr)
+	bool CPU::run(const instrad::x86::Instruction& instr, InstrCost cost)
 	{
 		if(instr.op() == instrad::x86::ops::HLT)
-			return false;
+		{
+			if constexpr (Instrumentation::enabled)
+				Instrumentation::retire(*this, instr, this->cs(), m_ip - instr.length());
+
+			if(m_halt_exits)
+				return false;
+
+			// stop at the end of this instruction; the main loop takes care of the rest.
+			m_halted = true;
+			m_slice_cycles += cost.cycles;
+			this->requestInterruptCheck();
+			return true;
+		}
 
 		// zpr::println("{}", print_intel(instr, this->ip(), 0, 1));
 
-		m_exec.execute(instr);
+		// the counts that the cost depends on are the ones before the instruction changes them.
+		uint32_t count = 0;
+		switch(cost.count)
+		{
+			case InstrCost::Count::None:        break;
+			case InstrCost::Count::CL:          count = this->cl(); break;
+			case InstrCost::Count::MaskedCL:    count = this->cl() & 0x1F; break;
+			case InstrCost::Count::Rep:         count = this->cx(); break;
+		}
+
+		// a branch is taken if it didn't fall through to the next instruction.
+		auto next = m_ip;
+		if constexpr (Instrumentation::enabled)
+		{
+			auto cs = this->cs();
+			auto ip = next - instr.length();
+			m_exec.execute(instr);
+
+			Instrumentation::retire(*this, instr, cs, ip);
+			if(m_ip != next || this->cs() != cs)
+			{
+				Instrumentation::transfer(*this, ControlTransfer { ControlTransfer::Kind::Instruction, cs, ip,
+					this->cs(), m_ip, &instr });
+			}
+		}
+		else
+		{
+			m_exec.execute(instr);
+		}
+
+		// a repe or repne can stop before cx runs out, so it's charged for the repetitions it did.
+		if(cost.count == InstrCost::Count::Rep)
+			count = static_cast<uint16_t>(count - this->cx());
+
+		m_slice_cycles += cost.cycles + cost.per * count;
+		if(cost.taken > 0 && m_ip != next)
+			m_slice_cycles += cost.taken;
 
 		// dump(*this);
 		return true;
 	}
 
+	void CPU::setModel(CPUModel model)
+	{
+		assert(!m_running);
+
+		// the cached costs are for the old model.
+		m_model = model;
+		m_dcache.clear();
+	}
+
 
 	void CPU::jump(uint64_t ip)
 	{
 		m_ip = ip;
 	}
 
-	void CPU::memLock() { m_memory.lock(); }
-	void CPU::memUnlock() { m_memory.unlock(); }
+	PhysAddr CPU::translate(SegReg seg, uint64_t address, size_t len, SegmentedMMU::Access access)
+	{
+		return m_pmmu.resolve(m_smmu.resolve(SegmentedAddr(seg, address), len, access));
+	}
+
+	uint8_t* CPU::hostPointer(SegReg seg, uint64_t address, size_t len, SegmentedMMU::Access access)
+	{
+		m_memory_accesses++;
+		return m_memory.hostPointer(this->translate(seg, address, len, access), len);
+	}
 
 	uint8_t  CPU::read8(uint64_t address)  { return this->read8(SegReg::DS, address); }
 	uint16_t CPU::read16(uint64_t address) { return this->read16(SegReg::DS, address); }
 	uint32_t CPU::read32(uint64_t address) { return this->read32(SegReg::DS, address); }
 	uint64_t CPU::read64(uint64_t address) { return this->read64(SegReg::DS, address); }
 
-	uint8_t CPU::read8(SegReg seg, uint64_t address)    { return m_smmu.read8(SegmentedAddr(seg, address)); }
-	uint16_t CPU::read16(SegReg seg, uint64_t address)  { return m_smmu.read16(SegmentedAddr(seg, address)); }
-	uint32_t CPU::read32(SegReg seg, uint64_t address)  { return m_smmu.read32(SegmentedAddr(seg, address)); }
-	uint64_t CPU::read64(SegReg seg, uint64_t address)  { return m_smmu.read64(SegmentedAddr(seg, address)); }
+	uint8_t CPU::read8(SegReg seg, uint64_t address)
+	{
+		m_memory_accesses++;
+		auto value = m_smmu.read8(SegmentedAddr(seg, address));
+
+		if constexpr (Instrumentation::enabled)
+			Instrumentation::memory(*this, MemoryAccess { MemoryAccess::Kind::Read, seg, address, 1, value });
+
+		return value;
+	}
+
+	uint16_t CPU::read16(SegReg seg, uint64_t address)
+	{
+		m_memory_accesses++;
+		auto value = m_smmu.read16(SegmentedAddr(seg, address));
+
+		if constexpr (Instrumentation::enabled)
+			Instrumentation::memory(*this, MemoryAccess { MemoryAccess::Kind::Read, seg, address, 2, value });
+
+		return value;
+	}
+
+	uint32_t CPU::read32(SegReg seg, uint64_t address)
+	{
+		m_memory_accesses++;
+		auto value = m_smmu.read32(SegmentedAddr(seg, address));
+
+		if constexpr (Instrumentation::enabled)
+			Instrumentation::memory(*this, MemoryAccess { MemoryAccess::Kind::Read, seg, address, 4, value });
+
+		return value;
+	}
+
+	uint64_t CPU::read64(SegReg seg, uint64_t address)
+	{
+		m_memory_accesses++;
+		auto value = m_smmu.read64(SegmentedAddr(seg, address));
+
+		if constexpr (Instrumentation::enabled)
+			Instrumentation::memory(*this, MemoryAccess { MemoryAccess::Kind::Read, seg, address, 8, value });
 
-	void CPU::write8(SegReg seg, uint64_t address, uint8_t value)   { return m_smmu.write8(SegmentedAddr(seg, address), value); }
-	void CPU::write16(SegReg seg, uint64_t address, uint16_t value) { return m_smmu.write16(SegmentedAddr(seg, address), value); }
-	void CPU::write32(SegReg seg, uint64_t address, uint32_t value) { return m_smmu.write32(SegmentedAddr(seg, address), value); }
-	void CPU::write64(SegReg seg, uint64_t address, uint64_t value) { return m_smmu.write64(SegmentedAddr(seg, address), value); }
+		return value;
+	}
 
-	static void segment_loader(CPU* cpu, short idx, uint16_t val)
+	void CPU::write8(SegReg seg, uint64_t address, uint8_t value)
 	{
-		cpu->smmu().load(static_cast<SegReg>(idx & 0x7), val);
+		m_memory_accesses++;
+		m_smmu.write8(SegmentedAddr(seg, address), value);
+
+		if constexpr (Instrumentation::enabled)
+			Instrumentation::memory(*this, MemoryAccess { MemoryAccess::Kind::Write, seg, address, 1, value });
 	}
 
-	RegWrapper<uint16_t> CPU::cs() { return RegWrapper<uint16_t>(this, IDX_CS, m_segment_regs[IDX_CS], &segment_loader); }
-	RegWrapper<uint16_t> CPU::ds() { return RegWrapper<uint16_t>(this, IDX_DS, m_segment_regs[IDX_DS], &segment_loader); }
-	RegWrapper<uint16_t> CPU::es() { return RegWrapper<uint16_t>(this, IDX_ES, m_segment_regs[IDX_ES], &segment_loader); }
-	RegWrapper<uint16_t> CPU::fs() { return RegWrapper<uint16_t>(this, IDX_FS, m_segment_regs[IDX_FS], &segment_loader); }
-	RegWrapper<uint16_t> CPU::gs() { return RegWrapper<uint16_t>(this, IDX_GS, m_segment_regs[IDX_GS], &segment_loader); }
-	RegWrapper<uint16_t> CPU::ss() { return RegWrapper<uint16_t>(this, IDX_SS, m_segment_regs[IDX_SS], &segment_loader); }
+	void CPU::write16(SegReg seg, uint64_t address, uint16_t value)
+	{
+		m_memory_accesses++;
+		m_smmu.write16(SegmentedAddr(seg, address), value);
+
+		if constexpr (Instrumentation::enabled)
+			Instrumentation::memory(*this, MemoryAccess { MemoryAccess::Kind::Write, seg, address, 2, value });
+	}
+
+	void CPU::write32(SegReg seg, uint64_t address, uint32_t value)
+	{
+		m_memory_accesses++;
+		m_smmu.write32(SegmentedAddr(seg, address), value);
+
+		if constexpr (Instrumentation::enabled)
+			Instrumentation::memory(*this, MemoryAccess { MemoryAccess::Kind::Write, seg, address, 4, value });
+	}
+
+	void CPU::write64(SegReg seg, uint64_t address, uint64_t value)
+	{
+		m_memory_accesses++;
+		m_smmu.write64(SegmentedAddr(seg, address), value);
+
+		if constexpr (Instrumentation::enabled)
+			Instrumentation::memory(*this, MemoryAccess { MemoryAccess::Kind::Write, seg, address, 8, value });
+	}
+
+	void CPU::setSegment(SegReg sr, uint16_t sel)
+	{
+		m_segment_regs[static_cast<size_t>(sr)] = sel;
+		m_smmu.load(sr, sel);
+	}
 
 	RegWrapper<uint8_t> CPU::reg8(const instrad::x86::Register& reg)
 	{
@@ -183,7 +753,8 @@ namespace z86
 		auto idx = reg.index();
 		if(idx & regs::REG_FLAG_SEGMENT)
 		{
-			return RegWrapper<uint16_t>(this, idx, m_segment_regs[idx & 0x7], &segment_loader);
+			// only for reading; writes to segment registers need to go through setSegment().
+			return m_segment_regs[idx & 0x7];
 		}
 		else if(idx >= 0 && idx < 16)
 		{
@@ -222,6 +793,16 @@ namespace z86
 		return this->rax();
 	}
 
+	VectorReg& CPU::vreg(const instrad::x86::Register& reg)
+	{
+		using namespace instrad::x86;
+
+		auto idx = reg.index();
+		assert((idx & regs::REG_FLAG_SSE) && "invalid register");
+
+		return m_vregs[idx & 0xF];
+	}
+
 	ALWAYS_INLINE static uint64_t decr_sp(CPU& cpu, int n)
 	{
 		switch(cpu.mode())
@@ -230,6 +811,9 @@ namespace z86
 			case CPUMode::Prot: cpu.esp() -= n; return static_cast<uint64_t>(cpu.esp());
 			case CPUMode::Long: cpu.rsp() -= n; return static_cast<uint64_t>(cpu.rsp());
 		}
+
+		assert(false && "invalid cpu mode");
+		return 0;
 	}
 
 	ALWAYS_INLINE static uint64_t incr_sp(CPU& cpu, int n)
@@ -240,6 +824,9 @@ namespace z86
 			case CPUMode::Prot: { auto ret = cpu.esp(); cpu.esp() += n; return static_cast<uint64_t>(ret); }
 			case CPUMode::Long: { auto ret = cpu.rsp(); cpu.rsp() += n; return static_cast<uint64_t>(ret); }
 		}
+
+		assert(false && "invalid cpu mode");
+		return 0;
 	}
 
 	void CPU::push8(uint8_t x)      { auto ofs = decr_sp(*this, 1); this->write8(SegReg::SS, ofs, x); }
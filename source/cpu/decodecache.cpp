@@ -0,0 +1,70 @@
+// decodecache.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "defs.h"
+#include "cpu/decodecache.h"
+
+namespace z86
+{
+	DecodeCache::DecodeCache(MemoryController& memory) : m_memory(memory), m_owner(std::this_thread::get_id())
+	{
+		m_entries = std::make_unique<Entry[]>(NUM_ENTRIES);
+		m_listener = m_memory.addCodeWriteListener([this](PhysAddr addr, size_t len) {
+			this->code_written(addr, len);
+		});
+	}
+
+	DecodeCache::~DecodeCache()
+	{
+		m_memory.removeCodeWriteListener(m_listener);
+	}
+
+	void DecodeCache::insert(PhysAddr addr, const instrad::x86::Instruction& instr, InstrCost cost)
+	{
+		assert(instr.length() > 0);
+
+		m_memory.markCode(addr, instr.length());
+
+		auto& e = this->slot(addr.addr);
+		e.addr = addr.addr;
+		e.instr = instr;
+		e.cost = cost;
+	}
+
+	void DecodeCache::clear()
+	{
+		for(size_t i = 0; i < NUM_ENTRIES; i++)
+			m_entries[i].addr = EMPTY;
+	}
+
+	void DecodeCache::sync()
+	{
+		if(m_flush_pending.load(std::memory_order_relaxed) && m_flush_pending.exchange(false, std::memory_order_acquire))
+			this->clear();
+	}
+
+	void DecodeCache::code_written(PhysAddr addr, size_t len)
+	{
+		if(std::this_thread::get_id() != m_owner)
+		{
+			m_flush_pending.store(true, std::memory_order_release);
+			return;
+		}
+
+		if(len >= NUM_ENTRIES)
+		{
+			this->clear();
+			return;
+		}
+
+		// an instruction starting up to MAX_LENGTH - 1 bytes before the write might overlap it.
+		auto first = addr.addr - std::min(addr.addr, uint64_t(MAX_LENGTH - 1));
+		for(auto a = first; a < addr.addr + len; a++)
+		{
+			auto& e = this->slot(a);
+			if(e.addr == a && a + e.instr.length() > addr.addr)
+				e.addr = EMPTY;
+		}
+	}
+}
@@ -36,40 +36,33 @@ namespace z86
 	}
 
 
-	void op_arithmetic(CPU& cpu, const instrad::x86::Op& op, const InstrMods& mods, const Operand& dst, const Operand& src)
+	Value compute_arithmetic(CPU& cpu, const instrad::x86::Op& op, Value dst_val, Value src_val)
 	{
 		using namespace instrad::x86;
 
-		auto dst_val = get_operand(cpu, mods, dst);
-		auto src_val = get_operand(cpu, mods, src);
-
-		bool dont_set_result = false;
-		Value result = static_cast<uint64_t>(0);
-
 		switch(op.id())
 		{
 			using namespace ops;
 
-			case ADD.id():  result = op_add(cpu, dst_val, src_val); break;
-			case ADC.id():  result = op_adc(cpu, dst_val, src_val); break;
-			case SUB.id():  result = op_sub(cpu, dst_val, src_val); break;
-			case SBB.id():  result = op_sbb(cpu, dst_val, src_val); break;
-			case XOR.id():  result = op_xor(cpu, dst_val, src_val); break;
-			case AND.id():  result = op_and(cpu, dst_val, src_val); break;
-			case OR.id():   result = op_or(cpu, dst_val, src_val); break;
-			case CMP.id():  result = op_sub(cpu, dst_val, src_val); dont_set_result = true; break;
-			case TEST.id(): result = op_and(cpu, dst_val, src_val); dont_set_result = true; break;
+			case ADD.id():  return op_add(cpu, dst_val, src_val);
+			case ADC.id():  return op_adc(cpu, dst_val, src_val);
+			case SUB.id():  return op_sub(cpu, dst_val, src_val);
+			case SBB.id():  return op_sbb(cpu, dst_val, src_val);
+			case XOR.id():  return op_xor(cpu, dst_val, src_val);
+			case AND.id():  return op_and(cpu, dst_val, src_val);
+			case OR.id():   return op_or(cpu, dst_val, src_val);
+			case CMP.id():  return op_sub(cpu, dst_val, src_val);
+			case TEST.id(): return op_and(cpu, dst_val, src_val);
 		}
 
-		if(!dont_set_result)
-			set_operand(cpu, mods, dst, result);
+		assert(false && "invalid arithmetic op");
+		return static_cast<uint64_t>(0);
 	}
 
-	void op_inc_dec(CPU& cpu, const instrad::x86::Op& op, const InstrMods& mods, const Operand& dst)
+	Value compute_inc_dec(CPU& cpu, const instrad::x86::Op& op, Value a)
 	{
 		using namespace instrad::x86;
 
-		auto a = get_operand(cpu, mods, dst);
 		auto b = Value(a.bits(), (op == ops::INC ? 1 : -1));
 
 		auto same_sign  = !(a.sign() ^ b.sign());
@@ -77,9 +70,79 @@ namespace z86
 		auto ret        = Value(a.bits(), a.u64() + b.u64());
 
 		set_OPZSA(cpu, a, b, ret, sign, same_sign);
+		return ret;
+	}
+
+	void op_arithmetic(CPU& cpu, const instrad::x86::Op& op, const InstrMods& mods, const Operand& dst, const Operand& src)
+	{
+		using namespace instrad::x86;
+
+		auto dst_val = get_operand(cpu, mods, dst);
+		auto src_val = get_operand(cpu, mods, src);
+
+		auto result = compute_arithmetic(cpu, op, dst_val, src_val);
+
+		if(op != ops::CMP && op != ops::TEST)
+			set_operand(cpu, mods, dst, result);
+	}
+
+	void op_inc_dec(CPU& cpu, const instrad::x86::Op& op, const InstrMods& mods, const Operand& dst)
+	{
+		auto ret = compute_inc_dec(cpu, op, get_operand(cpu, mods, dst));
 		set_operand(cpu, mods, dst, ret);
 	}
 
+	Value get_accumulator(CPU& cpu, int bits)
+	{
+		switch(bits)
+		{
+			case 8:  return cpu.al();
+			case 16: return cpu.ax();
+			case 32: return cpu.eax();
+			case 64: return cpu.rax();
+		}
+
+		assert(false && "invalid operand size");
+		return static_cast<uint64_t>(0);
+	}
+
+	void set_accumulator(CPU& cpu, Value value)
+	{
+		switch(value.bits())
+		{
+			case 8:  cpu.al() = value.u8(); return;
+			case 16: cpu.ax() = value.u16(); return;
+			case 32: cpu.eax() = value.u32(); return;
+			case 64: cpu.rax() = value.u64(); return;
+		}
+
+		assert(false && "invalid operand size");
+	}
+
+	void op_xadd(CPU& cpu, const InstrMods& mods, const Operand& dst, const Operand& src)
+	{
+		auto dst_val = get_operand(cpu, mods, dst);
+		auto src_val = get_operand(cpu, mods, src);
+
+		auto result = op_add(cpu, dst_val, src_val);
+
+		set_operand(cpu, mods, src, dst_val);
+		set_operand(cpu, mods, dst, result);
+	}
+
+	void op_cmpxchg(CPU& cpu, const InstrMods& mods, const Operand& dst, const Operand& src)
+	{
+		auto dst_val = get_operand(cpu, mods, dst);
+		auto acc = get_accumulator(cpu, dst_val.bits());
+
+		op_sub(cpu, acc, dst_val);
+
+		if(cpu.flags().ZF())
+			set_operand(cpu, mods, dst, get_operand(cpu, mods, src));
+		else
+			set_accumulator(cpu, dst_val);
+	}
+
 
 
 
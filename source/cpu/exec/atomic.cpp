@@ -0,0 +1,192 @@
+// atomic.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "defs.h"
+#include "cpu/cpu.h"
+#include "cpu/exec.h"
+#include "cpu/instrument.h"
+
+namespace z86
+{
+	using Op = instrad::x86::Op;
+	using Operand = instrad::x86::Operand;
+	using InstrMods = instrad::x86::InstrModifiers;
+
+	// arithmetic.cpp
+	Value compute_arithmetic(CPU& cpu, const Op& op, Value dst_val, Value src_val);
+	Value compute_inc_dec(CPU& cpu, const Op& op, Value a);
+	Value get_accumulator(CPU& cpu, int bits);
+	void set_accumulator(CPU& cpu, Value value);
+
+	void op_inc_dec(CPU& cpu, const Op& op, const InstrMods& mods, const Operand& dst);
+	void op_arithmetic(CPU& cpu, const Op& op, const InstrMods& mods, const Operand& dst, const Operand& src);
+	void op_xadd(CPU& cpu, const InstrMods& mods, const Operand& dst, const Operand& src);
+	void op_cmpxchg(CPU& cpu, const InstrMods& mods, const Operand& dst, const Operand& src);
+
+	/*
+		every locked instruction is a single host atomic on the guest's memory; the flags are then
+		computed from the old value that the atomic returns, exactly as if the instruction had read
+		that value itself. adc and sbb fold the carry into the operand, so they can use fetch_add
+		and fetch_sub too.
+	*/
+	template <typename T>
+	static void atomic_op(CPU& cpu, const Op& op, const InstrMods& mods, T* ptr, const Operand& other)
+	{
+		using namespace instrad::x86;
+		constexpr auto SEQ_CST = __ATOMIC_SEQ_CST;
+
+		auto src = [&]() -> T {
+			return static_cast<T>(get_operand(cpu, mods, other).get());
+		};
+
+		auto carry = [&]() -> T {
+			return (cpu.flags().CF() ? 1 : 0);
+		};
+
+		switch(op.id())
+		{
+			case ops::XCHG.id():
+				set_operand(cpu, mods, other, Value(__atomic_exchange_n(ptr, src(), SEQ_CST)));
+				break;
+
+			case ops::XADD.id(): {
+				auto s = src();
+				auto old = __atomic_fetch_add(ptr, s, SEQ_CST);
+
+				compute_arithmetic(cpu, ops::ADD, Value(old), Value(s));
+				set_operand(cpu, mods, other, Value(old));
+			} break;
+
+			case ops::CMPXCHG.id(): {
+				auto acc = static_cast<T>(get_accumulator(cpu, sizeof(T) * 8).get());
+				auto old = acc;
+
+				// on failure, `old` gets the current value.
+				__atomic_compare_exchange_n(ptr, &old, src(), /* weak: */ false, SEQ_CST, SEQ_CST);
+
+				compute_arithmetic(cpu, ops::CMP, Value(acc), Value(old));
+				if(!cpu.flags().ZF())
+					set_accumulator(cpu, Value(old));
+			} break;
+
+			case ops::INC.id():
+				compute_inc_dec(cpu, op, Value(__atomic_fetch_add(ptr, 1, SEQ_CST)));
+				break;
+
+			case ops::DEC.id():
+				compute_inc_dec(cpu, op, Value(__atomic_fetch_sub(ptr, 1, SEQ_CST)));
+				break;
+
+			default: {
+				auto s = src();
+				T old = 0;
+
+				switch(op.id())
+				{
+					case ops::ADD.id(): old = __atomic_fetch_add(ptr, s, SEQ_CST); break;
+					case ops::ADC.id(): old = __atomic_fetch_add(ptr, static_cast<T>(s + carry()), SEQ_CST); break;
+					case ops::SUB.id(): old = __atomic_fetch_sub(ptr, s, SEQ_CST); break;
+					case ops::SBB.id(): old = __atomic_fetch_sub(ptr, static_cast<T>(s + carry()), SEQ_CST); break;
+					case ops::AND.id(): old = __atomic_fetch_and(ptr, s, SEQ_CST); break;
+					case ops::OR.id():  old = __atomic_fetch_or(ptr, s, SEQ_CST); break;
+					case ops::XOR.id(): old = __atomic_fetch_xor(ptr, s, SEQ_CST); break;
+
+					default:
+						assert(false && "invalid locked op");
+				}
+
+				// note: this reads CF before it's updated, which is what adc and sbb need.
+				compute_arithmetic(cpu, op, Value(old), Value(s));
+			} break;
+		}
+	}
+
+	// the normal implementations, for when the operand is not plain ram.
+	static void plain_op(CPU& cpu, const Op& op, const InstrMods& mods, const Operand& dst, const Operand& src)
+	{
+		using namespace instrad::x86;
+
+		switch(op.id())
+		{
+			case ops::XCHG.id(): {
+				auto s = get_operand(cpu, mods, src);
+				auto d = get_operand(cpu, mods, dst);
+
+				set_operand(cpu, mods, dst, s);
+				set_operand(cpu, mods, src, d);
+			} break;
+
+			case ops::INC.id():
+			case ops::DEC.id():
+				op_inc_dec(cpu, op, mods, dst);
+				break;
+
+			case ops::XADD.id():    op_xadd(cpu, mods, dst, src); break;
+			case ops::CMPXCHG.id(): op_cmpxchg(cpu, mods, dst, src); break;
+
+			default:
+				op_arithmetic(cpu, op, mods, dst, src);
+				break;
+		}
+	}
+
+	void op_locked(CPU& cpu, const Op& op, const InstrMods& mods, const Operand& dst, const Operand& src)
+	{
+		using namespace instrad::x86;
+
+		switch(op.id())
+		{
+			case ops::ADD.id():
+			case ops::ADC.id():
+			case ops::SUB.id():
+			case ops::SBB.id():
+			case ops::AND.id():
+			case ops::OR.id():
+			case ops::XOR.id():
+			case ops::INC.id():
+			case ops::DEC.id():
+			case ops::XCHG.id():
+			case ops::XADD.id():
+			case ops::CMPXCHG.id():
+				break;
+
+			default:
+				lg::fatal("exec", "#UD: lock prefix on '{}'", op.mnemonic());
+		}
+
+		// xchg can have its memory operand on either side.
+		auto& mem = (dst.isMemory() ? dst : src);
+		auto& other = (dst.isMemory() ? src : dst);
+
+		if(!mem.isMemory() || (&mem == &src && op != ops::XCHG))
+			lg::fatal("exec", "#UD: lock prefix without a memory destination");
+
+		size_t bytes = mem.mem().bits() / 8;
+		auto [ seg, ofs ] = resolve_memory_access(cpu, mem.mem());
+
+		// host atomics need naturally aligned host memory.
+		auto ptr = cpu.hostPointer(seg, ofs, bytes, SegmentedMMU::Access::Write);
+		if(ptr != nullptr && (reinterpret_cast<uintptr_t>(ptr) & (bytes - 1)) == 0)
+		{
+			if constexpr (Instrumentation::enabled)
+				Instrumentation::memory(cpu, MemoryAccess { MemoryAccess::Kind::Locked, seg, ofs, bytes, 0 });
+
+			switch(bytes)
+			{
+				case 1: return atomic_op(cpu, op, mods, reinterpret_cast<uint8_t*>(ptr), other);
+				case 2: return atomic_op(cpu, op, mods, reinterpret_cast<uint16_t*>(ptr), other);
+				case 4: return atomic_op(cpu, op, mods, reinterpret_cast<uint32_t*>(ptr), other);
+				case 8: return atomic_op(cpu, op, mods, reinterpret_cast<uint64_t*>(ptr), other);
+			}
+		}
+
+		// anything else (a split access, or mmio) holds the locks for the lines it touches.
+		// note that this only excludes other locked accesses that also take the slow path.
+		auto phys = cpu.translate(seg, ofs, bytes, SegmentedMMU::Access::Write);
+
+		cpu.memory().lock(phys, bytes);
+		plain_op(cpu, op, mods, dst, src);
+		cpu.memory().unlock(phys, bytes);
+	}
+}
@@ -33,6 +33,8 @@ namespace z86
 	// arithmetic.cpp
 	void op_inc_dec(CPU& cpu, const instrad::x86::Op& op, const InstrMods& mods, const Operand& dst);
 	void op_arithmetic(CPU& cpu, const instrad::x86::Op& op, const InstrMods& mods, const Operand& dst, const Operand& src);
+	void op_xadd(CPU& cpu, const InstrMods& mods, const Operand& dst, const Operand& src);
+	void op_cmpxchg(CPU& cpu, const InstrMods& mods, const Operand& dst, const Operand& src);
 
 	// adjust.cpp
 	void op_daa(CPU& cpu);
@@ -42,6 +44,20 @@ namespace z86
 	void op_aad(CPU& cpu, uint8_t base);
 	void op_aam(CPU& cpu, uint8_t base);
 
+	// system.cpp
+	void op_in(CPU& cpu, const InstrMods& mods, const Operand& dst, const Operand& src);
+	void op_out(CPU& cpu, const InstrMods& mods, const Operand& dst, const Operand& src);
+	void op_int(CPU& cpu, uint8_t vector);
+	void op_into(CPU& cpu);
+	void op_iret(CPU& cpu, const InstrMods& mods);
+	void op_sti(CPU& cpu);
+
+	// vector.cpp
+	bool op_vector(CPU& cpu, const Instruction& instr);
+
+	// atomic.cpp
+	void op_locked(CPU& cpu, const instrad::x86::Op& op, const InstrMods& mods, const Operand& dst, const Operand& src);
+
 	static void op_xchg(CPU& cpu, const InstrMods& mods, const Operand& dst, const Operand& src);
 	static void op_mov(CPU& cpu, const InstrMods& mods, const Operand& dst, const Operand& src);
 	static void op_pop(CPU& cpu, const InstrMods& mods, const Operand& dst);
@@ -52,7 +68,7 @@ namespace z86
 		using namespace instrad::x86;
 
 		if(instr.lockPrefix())
-			m_cpu.memLock();
+			return op_locked(m_cpu, instr.op(), instr.mods(), instr.dst(), instr.src());
 
 		auto& op = instr.op();
 		switch(op.id())
@@ -82,6 +98,8 @@ namespace z86
 			case ops::PUSH.id():    op_push(m_cpu, instr.mods(), instr.dst());              break;
 			case ops::POP.id():     op_pop(m_cpu, instr.mods(), instr.dst());               break;
 			case ops::XCHG.id():    op_xchg(m_cpu, instr.mods(), instr.dst(), instr.src()); break;
+			case ops::XADD.id():    op_xadd(m_cpu, instr.mods(), instr.dst(), instr.src()); break;
+			case ops::CMPXCHG.id(): op_cmpxchg(m_cpu, instr.mods(), instr.dst(), instr.src()); break;
 
 			case ops::DAA.id():     op_daa(m_cpu);                                          break;
 			case ops::DAS.id():     op_das(m_cpu);                                          break;
@@ -108,8 +126,15 @@ namespace z86
 			case ops::JNP.id():     op_jp(m_cpu, instr.dst(), false);                       break;
 			case ops::JCXZ.id():    op_jcxz(m_cpu, instr.mods(), instr.dst());              break;
 
+			case ops::IN.id():      op_in(m_cpu, instr.mods(), instr.dst(), instr.src());   break;
+			case ops::OUT.id():     op_out(m_cpu, instr.mods(), instr.dst(), instr.src());  break;
+			case ops::INT.id():     op_int(m_cpu, instr.dst().imm() & 0xFF);                break;
+			case ops::INT3.id():    op_int(m_cpu, 3);                                       break;
+			case ops::INTO.id():    op_into(m_cpu);                                         break;
+			case ops::IRET.id():    op_iret(m_cpu, instr.mods());                           break;
+
 			// TODO: check privs
-			case ops::STI.id():     m_cpu.flags().setIF(true);                              break;
+			case ops::STI.id():     op_sti(m_cpu);                                          break;
 			case ops::CLI.id():     m_cpu.flags().clearIF();                                break;
 
 			case ops::CMC.id():     m_cpu.flags().setCF(!m_cpu.flags().CF());               break;
@@ -144,21 +169,32 @@ namespace z86
 			case ops::POPF.id(): {
 				assert(m_cpu.mode() == CPUMode::Real);
 
+				bool was_enabled = m_cpu.flags().IF();
 				switch(get_operand_size(m_cpu, instr.mods()))
 				{
 					case 16: m_cpu.flags().setFrom(m_cpu.pop16()); break;
 					case 32: m_cpu.flags().setFrom(m_cpu.pop32()); break;
 					default: assert(false);
 				}
+
+				if(!was_enabled && m_cpu.flags().IF())
+					m_cpu.requestInterruptCheck();
 			} break;
 
+			// the bios emulation's traps (see devices/bios.h); otherwise, it's just invalid.
+			case ops::UD2.id():
+				if(!m_cpu.biosTrap())
+					lg::fatal("exec", "invalid opcode: {}", print_att(instr, m_cpu.ip(), 0, 1));
+
+				break;
+
 			default:
-				lg::fatal("exec", "invalid opcode: {}", print_att(instr, m_cpu.ip(), 0, 1));
+				// sse/avx instructions are handled separately, to keep this switch sane.
+				if(!op_vector(m_cpu, instr))
+					lg::fatal("exec", "invalid opcode: {}", print_att(instr, m_cpu.ip(), 0, 1));
+
 				break;
 		}
-
-		if(instr.lockPrefix())
-			m_cpu.memUnlock();
 	}
 
 	int get_operand_size(CPU& cpu, const InstrMods& mods, bool default64)
@@ -305,7 +341,12 @@ namespace z86
 
 	void set_operand(CPU& cpu, const InstrMods& mods, const Operand& op, Value value)
 	{
-		if(op.isRegister())
+		if(op.isRegister() && (op.reg().index() & instrad::x86::regs::REG_FLAG_SEGMENT))
+		{
+			cpu.setSegment(convert_sreg(op.reg()), value.u16());
+			return;
+		}
+		else if(op.isRegister())
 		{
 			switch(op.reg().width())
 			{
@@ -348,16 +389,15 @@ namespace z86
 
 	static void op_xchg(CPU& cpu, const InstrMods& mods, const Operand& dst, const Operand& src)
 	{
-		// xchg always asserts the lock signal
-		cpu.memLock();
+		// xchg with memory always asserts the lock signal
+		if(dst.isMemory() || src.isMemory())
+			return op_locked(cpu, instrad::x86::ops::XCHG, mods, dst, src);
 
 		auto s = get_operand(cpu, mods, src);
 		auto d = get_operand(cpu, mods, dst);
 
 		set_operand(cpu, mods, dst, s);
 		set_operand(cpu, mods, src, d);
-
-		cpu.memUnlock();
 	}
 
 	static void op_push(CPU& cpu, const InstrMods& mods, const Operand& src)
@@ -376,13 +416,12 @@ namespace z86
 
 	static void op_pop(CPU& cpu, const InstrMods& mods, const Operand& dst)
 	{
-		auto bits = get_operand_size(cpu, mods) / 8;
+		auto bits = get_operand_size(cpu, mods);
 		switch(bits)
 		{
-			case 8:  set_operand(cpu, mods, dst, cpu.pop8());
-			case 16: set_operand(cpu, mods, dst, cpu.pop16());
-			case 32: set_operand(cpu, mods, dst, cpu.pop32());
-			case 64: set_operand(cpu, mods, dst, cpu.pop64());
+			case 16: return set_operand(cpu, mods, dst, cpu.pop16());
+			case 32: return set_operand(cpu, mods, dst, cpu.pop32());
+			case 64: return set_operand(cpu, mods, dst, cpu.pop64());
 		}
 
 		assert(false && "owo");
@@ -47,7 +47,7 @@ namespace z86
 			if(cpu.mode() == CPUMode::Real)
 			{
 				// load CS, then jump.
-				cpu.cs() = seg;
+				cpu.setSegment(SegReg::CS, seg);
 				cpu.jump(static_cast<uint16_t>(ofs));
 			}
 			else if(cpu.mode() == CPUMode::Prot)
@@ -119,7 +119,7 @@ namespace z86
 			if(cpu.mode() == CPUMode::Real)
 			{
 				// load CS, then jump.
-				cpu.cs() = seg;
+				cpu.setSegment(SegReg::CS, seg);
 				cpu.jump(static_cast<uint16_t>(ofs));
 			}
 			else if(cpu.mode() == CPUMode::Prot)
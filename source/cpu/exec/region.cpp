@@ -10,13 +10,44 @@
 
 namespace z86
 {
-	HostMmapMemoryRegion::HostMmapMemoryRegion(size_t size, bool writable) : MemoryRegion(size), m_writable(writable)
+	HostMmapMemoryRegion::HostMmapMemoryRegion(size_t size, bool writable, bool hugetlb) : MemoryRegion(size),
+		m_writable(writable)
 	{
-		auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
-			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		// nothing is committed until it's touched, so don't have the host account for it up front either.
+		constexpr int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
 
-		if(ptr == (void*) -1)
-			lg::fatal("mem", "failed to mmap host region (size {} bytes)", size);
+		void* ptr = MAP_FAILED;
+		if(hugetlb)
+		{
+			if(size % HUGE_PAGE_SIZE != 0)
+			{
+				lg::warn("mem", "size {} is not a multiple of the huge page size, not using hugetlbfs", size);
+			}
+			else
+			{
+				// without a reservation, running out of huge pages is a SIGBUS on first touch, instead
+				// of a failure here that we can fall back from.
+				ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, (flags & ~MAP_NORESERVE) | MAP_HUGETLB, -1, 0);
+				if(ptr == MAP_FAILED)
+					lg::warn("mem", "could not map {} bytes from hugetlbfs, using ordinary pages", size);
+			}
+		}
+
+		m_hugetlb = (ptr != MAP_FAILED);
+
+		if(!m_hugetlb)
+		{
+			ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+			if(ptr == MAP_FAILED)
+				lg::fatal("mem", "failed to mmap host region (size {} bytes)", size);
+
+		#if defined(MADV_HUGEPAGE)
+			// only a hint; it doesn't matter if the host doesn't do transparent huge pages.
+			if(size >= HUGE_PAGE_SIZE)
+				madvise(ptr, size, MADV_HUGEPAGE);
+		#endif
+		}
 
 		m_ptr = reinterpret_cast<uint8_t*>(ptr);
 	}
@@ -25,4 +56,56 @@ namespace z86
 	{
 		munmap(m_ptr, m_size);
 	}
+
+	uint8_t* HostMmapMemoryRegion::relocate(uint8_t* host)
+	{
+		if(m_size % MemoryController::PAGE_SIZE != 0)
+			return nullptr;
+
+		if(host != nullptr && host == m_ptr)
+			return m_ptr;
+
+		// moving it "anywhere" still needs a place to move it to.
+		void* dest = host;
+		if(dest == nullptr)
+		{
+			dest = mmap(nullptr, m_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			if(dest == MAP_FAILED)
+				return nullptr;
+		}
+
+		// the pages themselves move, so their contents come along without being copied.
+		auto ptr = mremap(m_ptr, m_size, m_size, MREMAP_MAYMOVE | MREMAP_FIXED, dest);
+		if(ptr == MAP_FAILED)
+		{
+			if(host == nullptr)
+				munmap(dest, m_size);
+
+			return nullptr;
+		}
+
+		m_ptr = reinterpret_cast<uint8_t*>(ptr);
+
+		// writes to a read-only region are a bug, even when they don't come through write().
+		if(!m_writable)
+			mprotect(m_ptr, m_size, PROT_READ);
+
+		return m_ptr;
+	}
+
+	size_t HostMmapMemoryRegion::committed()
+	{
+		auto host_page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		auto pages = (m_size + host_page - 1) / host_page;
+
+		auto resident = std::vector<unsigned char>(pages);
+		if(mincore(m_ptr, m_size, resident.data()) != 0)
+			return m_size;
+
+		size_t count = 0;
+		for(auto r : resident)
+			count += (r & 1);
+
+		return std::min(count * host_page, m_size);
+	}
 }
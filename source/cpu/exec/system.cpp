@@ -0,0 +1,96 @@
+// system.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "defs.h"
+#include "cpu/cpu.h"
+#include "cpu/exec.h"
+
+namespace z86
+{
+	using Operand = instrad::x86::Operand;
+	using Instruction = instrad::x86::Instruction;
+	using InstrMods = instrad::x86::InstrModifiers;
+
+	static uint16_t get_port(CPU& cpu, const Operand& op)
+	{
+		if(op.isImmediate())
+			return op.imm() & 0xFF;
+
+		return cpu.dx();
+	}
+
+	void op_in(CPU& cpu, const InstrMods& mods, const Operand& dst, const Operand& src)
+	{
+		auto bits = dst.reg().width();
+		auto value = cpu.portIn(get_port(cpu, src), bits);
+
+		set_operand(cpu, mods, dst, Value(bits, value));
+	}
+
+	void op_out(CPU& cpu, const InstrMods& mods, const Operand& dst, const Operand& src)
+	{
+		auto bits = src.reg().width();
+		auto value = get_operand(cpu, mods, src);
+
+		cpu.portOut(get_port(cpu, dst), bits, static_cast<uint32_t>(value.get()));
+	}
+
+	void op_int(CPU& cpu, uint8_t vector)
+	{
+		cpu.interrupt(vector);
+	}
+
+	void op_into(CPU& cpu)
+	{
+		if(cpu.flags().OF())
+			cpu.interrupt(4);
+	}
+
+	void op_iret(CPU& cpu, const InstrMods& mods)
+	{
+		if(cpu.mode() != CPUMode::Real)
+			lg::fatal("exec", "iret: only real mode is supported");
+
+		bool was_enabled = cpu.flags().IF();
+
+		switch(get_operand_size(cpu, mods))
+		{
+			case 16: {
+				auto ip = cpu.pop16();
+				auto cs = cpu.pop16();
+				cpu.flags().setFrom(cpu.pop16());
+
+				cpu.setSegment(SegReg::CS, cs);
+				cpu.jump(ip);
+			} break;
+
+			case 32: {
+				auto ip = cpu.pop32();
+				auto cs = static_cast<uint16_t>(cpu.pop32());
+				cpu.flags().setFrom(cpu.pop32());
+
+				cpu.setSegment(SegReg::CS, cs);
+				cpu.jump(ip);
+			} break;
+
+			default:
+				assert(false && "invalid operand size");
+		}
+
+		// unlike sti, there's no interrupt shadow here.
+		if(!was_enabled && cpu.flags().IF())
+			cpu.requestInterruptCheck();
+	}
+
+	void op_sti(CPU& cpu)
+	{
+		// TODO: check privs
+		bool was_enabled = cpu.flags().IF();
+		cpu.flags().setIF(true);
+
+		// interrupts are only recognised after the instruction following sti.
+		if(!was_enabled)
+			cpu.inhibitInterrupts(1);
+	}
+}
@@ -0,0 +1,353 @@
+// vector.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "defs.h"
+#include "cpu/cpu.h"
+#include "cpu/exec.h"
+#include "cpu/simd.h"
+
+namespace z86
+{
+	using Operand = instrad::x86::Operand;
+	using Instruction = instrad::x86::Instruction;
+
+	using simd::Binary;
+	using simd::Shift;
+
+	/*
+		the vector unit executes sse and avx instructions directly on the register file in
+		the CPU, by handing the raw bytes to one of the simd kernels (see simd.h), which map
+		onto host instructions where possible.
+
+		legacy sse encodings are destructive (dst = dst OP src) and leave the upper half of
+		the ymm register alone; vex encodings have a separate first source (dst = src OP ext),
+		and the 128-bit forms zero the upper half.
+
+		note: MXCSR is not modelled; all float ops use the host default (round to nearest,
+		exceptions masked), which happens to match the reset state. alignment checks for the
+		aligned moves are not performed either.
+	*/
+
+	static bool is_vector_reg(const Operand& op)
+	{
+		return op.isRegister() && (op.reg().index() & instrad::x86::regs::REG_FLAG_SSE);
+	}
+
+	static void check_operands(CPU& cpu, const Instruction& instr)
+	{
+		auto is_mmx = [](const Operand& op) -> bool {
+			return op.isRegister() && (op.reg().index() & instrad::x86::regs::REG_FLAG_MMX);
+		};
+
+		if(is_mmx(instr.dst()) || is_mmx(instr.src()))
+			lg::fatal("exec", "mmx is not supported: {}", print_att(instr, cpu.ip(), 0, 1));
+	}
+
+	// returns a pointer to the bytes of the operand -- either straight into the register file,
+	// or into `scratch` after reading it from memory. `bytes` must be a multiple of 8.
+	static const uint8_t* load_operand(CPU& cpu, const Operand& op, VectorReg& scratch, size_t bytes)
+	{
+		if(op.isRegister())
+			return cpu.vreg(op.reg()).bytes;
+
+		assert(op.isMemory());
+		auto [ seg, ofs ] = resolve_memory_access(cpu, op.mem());
+
+		for(size_t i = 0; i < bytes; i += 8)
+			scratch.u64[i / 8] = cpu.read64(seg, ofs + i);
+
+		return scratch.bytes;
+	}
+
+	static void store_memory(CPU& cpu, const Operand& op, const uint8_t* value, size_t bytes)
+	{
+		assert(op.isMemory());
+		auto [ seg, ofs ] = resolve_memory_access(cpu, op.mem());
+
+		for(size_t i = 0; i < bytes; i += 8)
+		{
+			uint64_t x = 0;
+			memcpy(&x, value + i, 8);
+			cpu.write64(seg, ofs + i, x);
+		}
+	}
+
+	static inline void zero_upper(VectorReg& reg, size_t bytes, bool vex)
+	{
+		if(vex && bytes == 16)
+			reg.u64[2] = 0, reg.u64[3] = 0;
+	}
+
+	static size_t vector_width(const Operand& a, const Operand& b)
+	{
+		if(is_vector_reg(a)) return a.reg().width() / 8;
+		if(is_vector_reg(b)) return b.reg().width() / 8;
+
+		assert(false && "no vector operand");
+		return 0;
+	}
+
+
+
+	static void op_binary(CPU& cpu, const Instruction& instr, Binary kernel)
+	{
+		check_operands(cpu, instr);
+
+		auto vex = instr.mods().vex.present();
+		auto& dst = instr.dst();
+		auto& a = vex ? instr.src() : instr.dst();
+		auto& b = vex ? instr.ext() : instr.src();
+
+		auto bytes = dst.reg().width() / 8;
+
+		VectorReg s1, s2;
+		auto x = load_operand(cpu, a, s1, bytes);
+		auto y = load_operand(cpu, b, s2, bytes);
+
+		auto& d = cpu.vreg(dst.reg());
+		simd::kernels().get(kernel)(d.bytes, x, y, bytes);
+
+		zero_upper(d, bytes, vex);
+	}
+
+	static void op_unary(CPU& cpu, const Instruction& instr, Binary kernel)
+	{
+		check_operands(cpu, instr);
+
+		auto vex = instr.mods().vex.present();
+		auto& dst = instr.dst();
+
+		auto bytes = dst.reg().width() / 8;
+
+		VectorReg s1;
+		auto x = load_operand(cpu, instr.src(), s1, bytes);
+
+		auto& d = cpu.vreg(dst.reg());
+		simd::kernels().get(kernel)(d.bytes, x, x, bytes);
+
+		zero_upper(d, bytes, vex);
+	}
+
+	static void op_shift(CPU& cpu, const Instruction& instr, Shift kernel)
+	{
+		check_operands(cpu, instr);
+
+		auto vex = instr.mods().vex.present();
+		auto& dst = instr.dst();
+		auto& a = vex ? instr.src() : instr.dst();
+		auto& c = vex ? instr.ext() : instr.src();
+
+		auto bytes = dst.reg().width() / 8;
+
+		// the count is either an imm8, or the low quadword of an xmm/m128.
+		uint64_t count = 0;
+		if(c.isImmediate())
+		{
+			count = c.imm() & 0xFF;
+		}
+		else
+		{
+			VectorReg tmp;
+			memcpy(&count, load_operand(cpu, c, tmp, 8), 8);
+		}
+
+		VectorReg s1;
+		auto x = load_operand(cpu, a, s1, bytes);
+
+		auto& d = cpu.vreg(dst.reg());
+		simd::kernels().get(kernel)(d.bytes, x, count, bytes);
+
+		zero_upper(d, bytes, vex);
+	}
+
+	static void op_move(CPU& cpu, const Instruction& instr)
+	{
+		check_operands(cpu, instr);
+
+		auto vex = instr.mods().vex.present();
+		auto& dst = instr.dst();
+		auto& src = instr.src();
+
+		auto bytes = vector_width(dst, src);
+
+		VectorReg tmp;
+		auto x = load_operand(cpu, src, tmp, bytes);
+
+		if(dst.isRegister())
+		{
+			auto& d = cpu.vreg(dst.reg());
+			memmove(d.bytes, x, bytes);
+
+			zero_upper(d, bytes, vex);
+		}
+		else
+		{
+			store_memory(cpu, dst, x, bytes);
+		}
+	}
+
+	// movd and movq; one side is always an xmm register, and the other is either an
+	// xmm register, a gpr, or memory.
+	static void op_movd_movq(CPU& cpu, const Instruction& instr)
+	{
+		check_operands(cpu, instr);
+
+		auto vex = instr.mods().vex.present();
+		auto& dst = instr.dst();
+		auto& src = instr.src();
+
+		if(is_vector_reg(dst))
+		{
+			uint64_t value = 0;
+			if(is_vector_reg(src))  value = cpu.vreg(src.reg()).u64[0];
+			else                    value = get_operand(cpu, instr.mods(), src).get();
+
+			auto& d = cpu.vreg(dst.reg());
+			d.u64[0] = value;
+			d.u64[1] = 0;
+
+			zero_upper(d, 16, vex);
+		}
+		else
+		{
+			auto value = cpu.vreg(src.reg()).u64[0];
+			auto bits = dst.isRegister() ? dst.reg().width() : dst.mem().bits();
+
+			set_operand(cpu, instr.mods(), dst, Value(bits, value));
+		}
+	}
+
+	static void op_vzero(CPU& cpu, bool all)
+	{
+		for(size_t i = 0; i < 16; i++)
+		{
+			auto& r = cpu.vreg(instrad::x86::regs::getXMM(i));
+			if(all) r.u64[0] = 0, r.u64[1] = 0;
+
+			r.u64[2] = 0;
+			r.u64[3] = 0;
+		}
+	}
+
+
+
+	bool op_vector(CPU& cpu, const Instruction& instr)
+	{
+		using namespace instrad::x86;
+
+		switch(instr.op().id())
+		{
+			case ops::MOVAPS.id():      case ops::VMOVAPS.id():
+			case ops::MOVAPD.id():      case ops::VMOVAPD.id():
+			case ops::MOVUPS.id():      case ops::VMOVUPS.id():
+			case ops::MOVUPD.id():      case ops::VMOVUPD.id():
+			case ops::MOVDQA.id():      case ops::VMOVDQA.id():
+			case ops::MOVDQU.id():      case ops::VMOVDQU.id():
+			case ops::MOVNTPS.id():     case ops::VMOVNTPS.id():
+			case ops::MOVNTPD.id():     case ops::VMOVNTPD.id():
+			case ops::MOVNTDQ.id():     case ops::VMOVNTDQ.id():
+			case ops::LDDQU.id():       case ops::VLDDQU.id():
+				op_move(cpu, instr);
+				return true;
+
+			case ops::MOVD.id():        case ops::VMOVD.id():
+			case ops::MOVQ.id():        case ops::VMOVQ.id():
+				op_movd_movq(cpu, instr);
+				return true;
+
+			case ops::VZEROUPPER.id():  op_vzero(cpu, /* all: */ false);                   return true;
+			case ops::VZEROALL.id():    op_vzero(cpu, /* all: */ true);                    return true;
+
+			case ops::PADDB.id():       case ops::VPADDB.id():      op_binary(cpu, instr, Binary::PADDB);    return true;
+			case ops::PADDW.id():       case ops::VPADDW.id():      op_binary(cpu, instr, Binary::PADDW);    return true;
+			case ops::PADDD.id():       case ops::VPADDD.id():      op_binary(cpu, instr, Binary::PADDD);    return true;
+			case ops::PADDQ.id():       case ops::VPADDQ.id():      op_binary(cpu, instr, Binary::PADDQ);    return true;
+			case ops::PSUBB.id():       case ops::VPSUBB.id():      op_binary(cpu, instr, Binary::PSUBB);    return true;
+			case ops::PSUBW.id():       case ops::VPSUBW.id():      op_binary(cpu, instr, Binary::PSUBW);    return true;
+			case ops::PSUBD.id():       case ops::VPSUBD.id():      op_binary(cpu, instr, Binary::PSUBD);    return true;
+			case ops::PSUBQ.id():       case ops::VPSUBQ.id():      op_binary(cpu, instr, Binary::PSUBQ);    return true;
+			case ops::PADDSB.id():      case ops::VPADDSB.id():     op_binary(cpu, instr, Binary::PADDSB);   return true;
+			case ops::PADDSW.id():      case ops::VPADDSW.id():     op_binary(cpu, instr, Binary::PADDSW);   return true;
+			case ops::PADDUSB.id():     case ops::VPADDUSB.id():    op_binary(cpu, instr, Binary::PADDUSB);  return true;
+			case ops::PADDUSW.id():     case ops::VPADDUSW.id():    op_binary(cpu, instr, Binary::PADDUSW);  return true;
+			case ops::PSUBSB.id():      case ops::VPSUBSB.id():     op_binary(cpu, instr, Binary::PSUBSB);   return true;
+			case ops::PSUBSW.id():      case ops::VPSUBSW.id():     op_binary(cpu, instr, Binary::PSUBSW);   return true;
+			case ops::PSUBUSB.id():     case ops::VPSUBUSB.id():    op_binary(cpu, instr, Binary::PSUBUSB);  return true;
+			case ops::PSUBUSW.id():     case ops::VPSUBUSW.id():    op_binary(cpu, instr, Binary::PSUBUSW);  return true;
+
+			case ops::PAND.id():        case ops::VPAND.id():
+			case ops::ANDPS.id():       case ops::VANDPS.id():
+			case ops::ANDPD.id():       case ops::VANDPD.id():      op_binary(cpu, instr, Binary::PAND);     return true;
+			case ops::PANDN.id():       case ops::VPANDN.id():
+			case ops::ANDNPS.id():      case ops::VANDNPS.id():
+			case ops::ANDNPD.id():      case ops::VANDNPD.id():     op_binary(cpu, instr, Binary::PANDN);    return true;
+			case ops::POR.id():         case ops::VPOR.id():
+			case ops::ORPS.id():        case ops::VORPS.id():
+			case ops::ORPD.id():        case ops::VORPD.id():       op_binary(cpu, instr, Binary::POR);      return true;
+			case ops::PXOR.id():        case ops::VPXOR.id():
+			case ops::XORPS.id():       case ops::VXORPS.id():
+			case ops::XORPD.id():       case ops::VXORPD.id():      op_binary(cpu, instr, Binary::PXOR);     return true;
+
+			case ops::PCMPEQB.id():     case ops::VPCMPEQB.id():    op_binary(cpu, instr, Binary::PCMPEQB);  return true;
+			case ops::PCMPEQW.id():     case ops::VPCMPEQW.id():    op_binary(cpu, instr, Binary::PCMPEQW);  return true;
+			case ops::PCMPEQD.id():     case ops::VPCMPEQD.id():    op_binary(cpu, instr, Binary::PCMPEQD);  return true;
+			case ops::PCMPEQQ.id():     case ops::VPCMPEQQ.id():    op_binary(cpu, instr, Binary::PCMPEQQ);  return true;
+			case ops::PCMPGTB.id():     case ops::VPCMPGTB.id():    op_binary(cpu, instr, Binary::PCMPGTB);  return true;
+			case ops::PCMPGTW.id():     case ops::VPCMPGTW.id():    op_binary(cpu, instr, Binary::PCMPGTW);  return true;
+			case ops::PCMPGTD.id():     case ops::VPCMPGTD.id():    op_binary(cpu, instr, Binary::PCMPGTD);  return true;
+			case ops::PCMPGTQ.id():     case ops::VPCMPGTQ.id():    op_binary(cpu, instr, Binary::PCMPGTQ);  return true;
+
+			case ops::PMULLW.id():      case ops::VPMULLW.id():     op_binary(cpu, instr, Binary::PMULLW);   return true;
+			case ops::PMULHW.id():      case ops::VPMULHW.id():     op_binary(cpu, instr, Binary::PMULHW);   return true;
+			case ops::PMULHUW.id():     case ops::VPMULHUW.id():    op_binary(cpu, instr, Binary::PMULHUW);  return true;
+			case ops::PMULUDQ.id():     case ops::VPMULUDQ.id():    op_binary(cpu, instr, Binary::PMULUDQ);  return true;
+			case ops::PMULLD.id():      case ops::VPMULLD.id():     op_binary(cpu, instr, Binary::PMULLD);   return true;
+
+			case ops::PMINUB.id():      case ops::VPMINUB.id():     op_binary(cpu, instr, Binary::PMINUB);   return true;
+			case ops::PMINUW.id():      case ops::VPMINUW.id():     op_binary(cpu, instr, Binary::PMINUW);   return true;
+			case ops::PMINUD.id():      case ops::VPMINUD.id():     op_binary(cpu, instr, Binary::PMINUD);   return true;
+			case ops::PMINSB.id():      case ops::VPMINSB.id():     op_binary(cpu, instr, Binary::PMINSB);   return true;
+			case ops::PMINSW.id():      case ops::VPMINSW.id():     op_binary(cpu, instr, Binary::PMINSW);   return true;
+			case ops::PMINSD.id():      case ops::VPMINSD.id():     op_binary(cpu, instr, Binary::PMINSD);   return true;
+			case ops::PMAXUB.id():      case ops::VPMAXUB.id():     op_binary(cpu, instr, Binary::PMAXUB);   return true;
+			case ops::PMAXUW.id():      case ops::VPMAXUW.id():     op_binary(cpu, instr, Binary::PMAXUW);   return true;
+			case ops::PMAXUD.id():      case ops::VPMAXUD.id():     op_binary(cpu, instr, Binary::PMAXUD);   return true;
+			case ops::PMAXSB.id():      case ops::VPMAXSB.id():     op_binary(cpu, instr, Binary::PMAXSB);   return true;
+			case ops::PMAXSW.id():      case ops::VPMAXSW.id():     op_binary(cpu, instr, Binary::PMAXSW);   return true;
+			case ops::PMAXSD.id():      case ops::VPMAXSD.id():     op_binary(cpu, instr, Binary::PMAXSD);   return true;
+			case ops::PAVGB.id():       case ops::VPAVGB.id():      op_binary(cpu, instr, Binary::PAVGB);    return true;
+			case ops::PAVGW.id():       case ops::VPAVGW.id():      op_binary(cpu, instr, Binary::PAVGW);    return true;
+
+			case ops::ADDPS.id():       case ops::VADDPS.id():      op_binary(cpu, instr, Binary::ADDPS);    return true;
+			case ops::SUBPS.id():       case ops::VSUBPS.id():      op_binary(cpu, instr, Binary::SUBPS);    return true;
+			case ops::MULPS.id():       case ops::VMULPS.id():      op_binary(cpu, instr, Binary::MULPS);    return true;
+			case ops::DIVPS.id():       case ops::VDIVPS.id():      op_binary(cpu, instr, Binary::DIVPS);    return true;
+			case ops::MINPS.id():       case ops::VMINPS.id():      op_binary(cpu, instr, Binary::MINPS);    return true;
+			case ops::MAXPS.id():       case ops::VMAXPS.id():      op_binary(cpu, instr, Binary::MAXPS);    return true;
+			case ops::ADDPD.id():       case ops::VADDPD.id():      op_binary(cpu, instr, Binary::ADDPD);    return true;
+			case ops::SUBPD.id():       case ops::VSUBPD.id():      op_binary(cpu, instr, Binary::SUBPD);    return true;
+			case ops::MULPD.id():       case ops::VMULPD.id():      op_binary(cpu, instr, Binary::MULPD);    return true;
+			case ops::DIVPD.id():       case ops::VDIVPD.id():      op_binary(cpu, instr, Binary::DIVPD);    return true;
+			case ops::MINPD.id():       case ops::VMINPD.id():      op_binary(cpu, instr, Binary::MINPD);    return true;
+			case ops::MAXPD.id():       case ops::VMAXPD.id():      op_binary(cpu, instr, Binary::MAXPD);    return true;
+
+			case ops::SQRTPS.id():      case ops::VSQRTPS.id():     op_unary(cpu, instr, Binary::SQRTPS);    return true;
+			case ops::SQRTPD.id():      case ops::VSQRTPD.id():     op_unary(cpu, instr, Binary::SQRTPD);    return true;
+
+			case ops::PSLLW.id():       case ops::VPSLLW.id():      op_shift(cpu, instr, Shift::PSLLW);      return true;
+			case ops::PSLLD.id():       case ops::VPSLLD.id():      op_shift(cpu, instr, Shift::PSLLD);      return true;
+			case ops::PSLLQ.id():       case ops::VPSLLQ.id():      op_shift(cpu, instr, Shift::PSLLQ);      return true;
+			case ops::PSRLW.id():       case ops::VPSRLW.id():      op_shift(cpu, instr, Shift::PSRLW);      return true;
+			case ops::PSRLD.id():       case ops::VPSRLD.id():      op_shift(cpu, instr, Shift::PSRLD);      return true;
+			case ops::PSRLQ.id():       case ops::VPSRLQ.id():      op_shift(cpu, instr, Shift::PSRLQ);      return true;
+			case ops::PSRAW.id():       case ops::VPSRAW.id():      op_shift(cpu, instr, Shift::PSRAW);      return true;
+			case ops::PSRAD.id():       case ops::VPSRAD.id():      op_shift(cpu, instr, Shift::PSRAD);      return true;
+			case ops::PSLLDQ.id():      case ops::VPSLLDQ.id():     op_shift(cpu, instr, Shift::PSLLDQ);     return true;
+			case ops::PSRLDQ.id():      case ops::VPSRLDQ.id():     op_shift(cpu, instr, Shift::PSRLDQ);     return true;
+
+			default:
+				return false;
+		}
+	}
+}
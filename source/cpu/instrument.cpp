@@ -0,0 +1,43 @@
+// instrument.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "defs.h"
+#include "cpu/instrument.h"
+
+#if Z86_INSTRUMENT
+
+namespace z86
+{
+	// plugins can be added from static initialisers, so this can't be a global.
+	static std::vector<InstrumentationPlugin*>& plugins()
+	{
+		static std::vector<InstrumentationPlugin*> list;
+		return list;
+	}
+
+	void PluginInstrumentation::add_plugin(InstrumentationPlugin* plugin)
+	{
+		plugins().push_back(plugin);
+	}
+
+	void PluginInstrumentation::retire(CPU& cpu, const instrad::x86::Instruction& instr, uint16_t cs, uint64_t ip)
+	{
+		for(auto p : plugins())
+			p->retire(cpu, instr, cs, ip);
+	}
+
+	void PluginInstrumentation::memory(CPU& cpu, const MemoryAccess& access)
+	{
+		for(auto p : plugins())
+			p->memory(cpu, access);
+	}
+
+	void PluginInstrumentation::transfer(CPU& cpu, const ControlTransfer& transfer)
+	{
+		for(auto p : plugins())
+			p->transfer(cpu, transfer);
+	}
+}
+
+#endif
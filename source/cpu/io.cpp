@@ -0,0 +1,50 @@
+// io.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "defs.h"
+#include "cpu/io.h"
+
+namespace z86
+{
+	IOPortController::IOPortController() : m_ports(0x10000, nullptr)
+	{
+	}
+
+	void IOPortController::attach(uint16_t first, size_t count, IODevice* device)
+	{
+		if(first + count > 0x10000)
+			lg::fatal("io", "port range {04x}+{} out of bounds", first, count);
+
+		for(size_t i = 0; i < count; i++)
+		{
+			if(m_ports[first + i] != nullptr)
+				lg::fatal("io", "port {04x} is already mapped", first + i);
+
+			m_ports[first + i] = device;
+		}
+	}
+
+	void IOPortController::detach(uint16_t first, size_t count)
+	{
+		for(size_t i = 0; i < count && first + i < 0x10000; i++)
+			m_ports[first + i] = nullptr;
+	}
+
+	uint32_t IOPortController::in(uint16_t port, int bits)
+	{
+		if(auto dev = m_ports[port]; dev != nullptr)
+			return dev->in(port, bits);
+
+		lg::dbglog("io", "in from unmapped port {04x}", port);
+		return (bits == 32 ? 0xFFFF'FFFF : (1u << bits) - 1);
+	}
+
+	void IOPortController::out(uint16_t port, int bits, uint32_t value)
+	{
+		if(auto dev = m_ports[port]; dev != nullptr)
+			return dev->out(port, bits, value);
+
+		lg::dbglog("io", "out to unmapped port {04x} (value {x})", port, value);
+	}
+}
@@ -0,0 +1,298 @@
+// flat.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+
+#include "defs.h"
+#include "cpu/mem.h"
+#include "instrad/x86/decode.h"
+
+namespace z86
+{
+#if defined(__x86_64__) && defined(__linux__)
+
+	// the handler can't take locks, so the controllers with flat mappings live in a fixed table.
+	static constexpr size_t MAX_FLAT_CONTROLLERS = 16;
+	static std::atomic<MemoryController*> flat_controllers[MAX_FLAT_CONTROLLERS];
+
+	static struct sigaction old_action;
+	static std::once_flag install_handler;
+
+	// indexed by instrad's register numbers (0=ax, 1=cx, ... 8=r8, etc).
+	static constexpr int GREGS[] = {
+		REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+		REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15
+	};
+
+	static uint64_t get_register(const gregset_t& gregs, const instrad::x86::Register& reg, size_t width = 64)
+	{
+		if(!reg.present())
+			return 0;
+
+		auto idx = reg.index();
+		if(idx & instrad::x86::regs::REG_FLAG_HI_BYTE)
+			return (gregs[GREGS[idx & 0x3]] >> 8) & 0xFF;
+
+		auto value = static_cast<uint64_t>(gregs[GREGS[idx & 0xF]]);
+		return width == 64 ? value : value & ((1ull << width) - 1);
+	}
+
+	static void set_register(gregset_t& gregs, const instrad::x86::Register& reg, size_t width, uint64_t value)
+	{
+		auto idx = reg.index();
+		if(idx & instrad::x86::regs::REG_FLAG_HI_BYTE)
+		{
+			auto& r = gregs[GREGS[idx & 0x3]];
+			r = (r & ~0xFF00ll) | ((value & 0xFF) << 8);
+			return;
+		}
+
+		// as with the real thing, writing the low 32 bits clears the upper ones.
+		auto& r = gregs[GREGS[idx & 0xF]];
+		switch(width)
+		{
+			case 8:  r = (r & ~0xFFll) | (value & 0xFF); break;
+			case 16: r = (r & ~0xFFFFll) | (value & 0xFFFF); break;
+			case 32: r = value & 0xFFFF'FFFF; break;
+			case 64: r = value; break;
+		}
+	}
+
+	// instrad decodes every non-byte `mov` in long mode as 64 bits, so get the operand size
+	// from the prefixes ourselves: 0x66 makes it 16, REX.W makes it 64, and otherwise it's 32.
+	static size_t operand_width(const uint8_t* rip, const instrad::x86::Register& reg)
+	{
+		if(reg.width() == 8)
+			return 8;
+
+		bool opsize = false;
+		for(; *rip == 0x66 || *rip == 0x67 || *rip == 0xF2 || *rip == 0xF3; rip++)
+			opsize |= (*rip == 0x66);
+
+		if((*rip & 0xF0) == 0x40 && (*rip & 0x08))
+			return 64;
+
+		return opsize ? 16 : 32;
+	}
+
+	bool MemoryController::handleFault(void* addr, void* context)
+	{
+		auto fault = reinterpret_cast<uint8_t*>(addr);
+
+		MemoryController* mc = nullptr;
+		for(auto& slot : flat_controllers)
+		{
+			auto m = slot.load(std::memory_order_acquire);
+			if(m && m->m_flat <= fault && fault < m->m_flat + FLAT_SIZE + FLAT_GUARD)
+			{
+				mc = m;
+				break;
+			}
+		}
+
+		if(mc == nullptr)
+			return false;
+
+		// the fault is synchronous, and only ever comes from the accessors in memory.cpp, so from
+		// here on it's safe to call back into ordinary code (and the regions).
+		auto& gregs = reinterpret_cast<ucontext_t*>(context)->uc_mcontext.gregs;
+		auto rip = reinterpret_cast<const uint8_t*>(gregs[REG_RIP]);
+
+		auto buf = instrad::Buffer(rip, 15);
+		auto instr = instrad::x86::read(buf, instrad::x86::ExecMode::Long);
+
+		// those are all `mov reg, [reg]` or `mov [reg], reg`.
+		bool load = instr.dst().isRegister() && instr.src().isMemory();
+		bool store = instr.dst().isMemory() && instr.src().isRegister();
+
+		if(instr.op() != instrad::x86::ops::MOV || !(load || store))
+			lg::fatal("mem", "unexpected fault at {p} (rip = {p})", addr, (void*) rip);
+
+		auto& mem = (load ? instr.src() : instr.dst()).mem();
+		auto& reg = (load ? instr.dst() : instr.src()).reg();
+
+		auto ea = get_register(gregs, mem.base()) + get_register(gregs, mem.index()) * mem.scale() + mem.displacement();
+		auto phys = PhysAddr(ea - reinterpret_cast<uint64_t>(mc->m_flat));
+
+		auto width = operand_width(rip, reg);
+
+		if(load)    set_register(gregs, reg, width, mc->region_read(phys, width / 8));
+		else        mc->region_write(phys, width / 8, get_register(gregs, reg, width));
+
+		gregs[REG_RIP] += instr.length();
+		return true;
+	}
+
+	static void segv_handler(int sig, siginfo_t* info, void* context)
+	{
+		// not ours, so do whatever would have happened without us.
+		if(!MemoryController::handleFault(info->si_addr, context))
+		{
+			if(old_action.sa_flags & SA_SIGINFO)
+			{
+				old_action.sa_sigaction(sig, info, context);
+			}
+			else if(old_action.sa_handler != SIG_IGN && old_action.sa_handler != SIG_DFL)
+			{
+				old_action.sa_handler(sig);
+			}
+			else
+			{
+				// returning re-runs the instruction, which faults again -- this time for real.
+				sigaction(SIGSEGV, &old_action, nullptr);
+			}
+		}
+	}
+
+	bool MemoryController::setFlatMapping()
+	{
+		if(m_flat != nullptr)
+			return true;
+
+		// huge pages only stay huge if they land on a huge page boundary, so over-reserve and trim.
+		constexpr auto align = HostMmapMemoryRegion::HUGE_PAGE_SIZE;
+
+		auto ptr = mmap(nullptr, FLAT_SIZE + FLAT_GUARD + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+			-1, 0);
+		if(ptr == MAP_FAILED)
+		{
+			lg::warn("mem", "could not reserve {} bytes for the flat mapping", FLAT_SIZE + FLAT_GUARD);
+			return false;
+		}
+
+		auto start = reinterpret_cast<uintptr_t>(ptr);
+		auto base = reinterpret_cast<void*>((start + align - 1) & ~(align - 1));
+		auto end = reinterpret_cast<uintptr_t>(base) + FLAT_SIZE + FLAT_GUARD;
+
+		if(base != ptr)
+			munmap(ptr, reinterpret_cast<uintptr_t>(base) - start);
+
+		if(end != start + FLAT_SIZE + FLAT_GUARD + align)
+			munmap(reinterpret_cast<void*>(end), start + FLAT_SIZE + FLAT_GUARD + align - end);
+
+		auto slot = std::find_if(std::begin(flat_controllers), std::end(flat_controllers), [](auto& s) {
+			return s.load() == nullptr;
+		});
+
+		if(slot == std::end(flat_controllers))
+		{
+			lg::warn("mem", "too many flat-mapped memory controllers");
+			munmap(base, FLAT_SIZE + FLAT_GUARD);
+			return false;
+		}
+
+		std::call_once(install_handler, []() {
+			struct sigaction sa = { };
+			sa.sa_sigaction = segv_handler;
+			sa.sa_flags = SA_SIGINFO;
+			sigemptyset(&sa.sa_mask);
+
+			sigaction(SIGSEGV, &sa, &old_action);
+		});
+
+		m_flat = reinterpret_cast<uint8_t*>(base);
+		slot->store(this, std::memory_order_release);
+
+		// a region inside another has to go on top of it, so the bigger ones go first.
+		auto order = std::vector<const RegionMapping*>();
+		for(auto& r : m_regions)
+			order.push_back(&r);
+
+		std::stable_sort(order.begin(), order.end(), [](auto a, auto b) {
+			return a->region->size() > b->region->size();
+		});
+
+		for(auto r : order)
+			this->map_flat(*r);
+
+		return true;
+	}
+
+#else
+
+	bool MemoryController::handleFault(void* addr, void* context)
+	{
+		return false;
+	}
+
+	bool MemoryController::setFlatMapping()
+	{
+		lg::warn("mem", "the flat mapping is only supported on x86-64 linux");
+		return false;
+	}
+
+#endif
+
+	void MemoryController::map_flat(const RegionMapping& r)
+	{
+		// a region that was split up (see addRegion) moves in whole, so its pieces each land at
+		// their physical address; moving the second piece finds it already there.
+		auto base = r.start.addr - r.offset;
+
+		// anything that can't be moved in is left inaccessible, so it goes through the regions.
+		if(r.start.addr % PAGE_SIZE != 0 || base % PAGE_SIZE != 0 || base + r.region->size() > FLAT_SIZE)
+			return;
+
+		if(r.region->relocate(m_flat + base) != nullptr)
+			return;
+
+		// a device inside ram has the ram's pages under it, which have to go.
+		if(r.region->inner()->hostPointer(0, 0) == nullptr)
+		{
+			if(r.length % PAGE_SIZE == 0)
+			{
+				mmap(m_flat + r.start.addr, r.length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+					-1, 0);
+			}
+		}
+		else if(r.region->hostPointer(0, 0) != nullptr)
+		{
+			// it still works if it doesn't move, but every access to it faults.
+			lg::warn("mem", "could not move the region at {x} into the flat mapping", r.start.addr);
+		}
+	}
+
+	void MemoryController::unmap_flat(const RegionMapping& r)
+	{
+		auto base = r.start.addr - r.offset;
+		if(r.start.addr % PAGE_SIZE != 0 || base % PAGE_SIZE != 0 || base + r.region->size() > FLAT_SIZE)
+			return;
+
+		// moving it out leaves a hole in the reservation, so plug it straight away. one that was split
+		// up around a device can't move (the host won't move a mapping with a hole in it), and then
+		// accesses to it keep going straight to it.
+		if(r.region->relocate(nullptr) != nullptr)
+		{
+			mmap(m_flat + base, r.region->size(), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+				-1, 0);
+		}
+		else if(r.region->inner() == r.region && r.region->hostPointer(0, 0) != nullptr)
+		{
+			lg::warn("mem", "could not move the region at {x} out of the flat mapping", r.start.addr);
+		}
+	}
+
+	void MemoryController::unreserve_flat()
+	{
+		if(m_flat == nullptr)
+			return;
+
+	#if defined(__x86_64__) && defined(__linux__)
+		for(auto& slot : flat_controllers)
+		{
+			if(slot.load() == this)
+				slot.store(nullptr, std::memory_order_release);
+		}
+	#endif
+
+		munmap(m_flat, FLAT_SIZE + FLAT_GUARD);
+		m_flat = nullptr;
+	}
+}
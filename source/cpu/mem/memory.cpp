@@ -2,32 +2,75 @@
 // Copyright (c) 2020, zhiayang
 // Licensed under the Apache License Version 2.0.
 
+#include <algorithm>
+
 #include "defs.h"
 #include "cpu/mem.h"
 
 namespace z86
 {
-	MemoryController::MemoryController()
+	MemoryController::MemoryController(size_t ram_size, bool hugetlb)
 	{
-		// the invariant on m_regions is that it is sorted.
-		// for now, create 64k of memory.
+		assert(ram_size > 0 && ram_size % PAGE_SIZE == 0 && ram_size <= MAX_RAM_SIZE);
 
-		auto r = new HostMmapMemoryRegion(0x100000, /* writable: */ true);
+		// the invariant on m_regions is that it is sorted.
+		m_ram = new HostMmapMemoryRegion(ram_size, /* writable: */ true, hugetlb);
 		m_regions.push_back(RegionMapping {
 			.start  = PhysAddr(0),
-			.length = 0x100000,
-			.region = r
+			.length = ram_size,
+			.offset = 0,
+			.region = m_ram
 		});
+
+		m_code_pages = std::make_unique<std::atomic<uint64_t>[]>(CODE_PAGES / 64);
 	}
 
 	MemoryController::~MemoryController()
 	{
+		// a region that was split up is mapped more than once.
+		std::vector<MemoryRegion*> regions;
 		for(auto& reg : this->m_regions)
-			delete reg.region;
+		{
+			if(std::find(regions.begin(), regions.end(), reg.region) == regions.end())
+				regions.push_back(reg.region);
+		}
+
+		for(auto r : regions)
+			delete r;
+
+		this->unreserve_flat();
+	}
+
+	// a locked access is at most 8 bytes, so it touches at most two lines (which can't share a
+	// stripe). always taking them in order of stripe index avoids deadlocks.
+	static std::pair<size_t, size_t> get_stripes(PhysAddr addr, size_t len, size_t line_size, size_t stripes)
+	{
+		assert(len > 0 && len <= line_size);
+
+		auto a = (addr.addr / line_size) % stripes;
+		auto b = ((addr.addr + len - 1) / line_size) % stripes;
+
+		return { std::min(a, b), std::max(a, b) };
+	}
+
+	void MemoryController::lock(PhysAddr addr, size_t len)
+	{
+		auto [ a, b ] = get_stripes(addr, len, LOCK_LINE_SIZE, LOCK_STRIPES);
+
+		m_stripes[a].lock();
+		if(b != a)
+			m_stripes[b].lock();
 	}
 
-	void MemoryController::lock() { }
-	void MemoryController::unlock() { }
+	void MemoryController::unlock(PhysAddr addr, size_t len)
+	{
+		auto [ a, b ] = get_stripes(addr, len, LOCK_LINE_SIZE, LOCK_STRIPES);
+
+		if(b != a)
+			m_stripes[b].unlock();
+
+		m_stripes[a].unlock();
+	}
 
 	static inline bool contains(MemoryController::RegionMapping& region, PhysAddr addr)
 	{
@@ -52,24 +95,252 @@ namespace z86
 
 	void MemoryController::addRegion(PhysAddr start, MemoryRegion* region)
 	{
-		// check overlap with existing regions
+		auto end = start.addr + region->size();
+		auto outer = find_region(m_regions, start);
+
+		// check overlap with existing regions; the only one allowed is being inside another.
 		for(auto& reg : m_regions)
 		{
-			if(contains(reg, start))
+			if(&reg == outer)
+			{
+				if(end > reg.start.addr + reg.length)
+					lg::fatal("mem", "overlapping regions");
+			}
+			else if(reg.start.addr < end && start.addr < reg.start.addr + reg.length)
+			{
 				lg::fatal("mem", "overlapping regions");
+			}
+		}
+
+		if(outer)
+		{
+			// the outer one is cut down to what's before the new region, and what's after it goes
+			// in a mapping of its own.
+			auto after = RegionMapping {
+				.start  = PhysAddr(end),
+				.length = outer->start.addr + outer->length - end,
+				.offset = outer->offset + (end - outer->start.addr),
+				.region = outer->region
+			};
+
+			outer->length = start.addr - outer->start.addr;
+
+			if(after.length > 0)
+				m_regions.push_back(after);
+
+			m_regions.erase(std::remove_if(m_regions.begin(), m_regions.end(), [](const auto& r) {
+				return r.length == 0;
+			}), m_regions.end());
 		}
 
 		m_regions.push_back(RegionMapping {
 			.start  = start,
 			.length = region->size(),
+			.offset = 0,
 			.region = region
 		});
 
 		std::sort(m_regions.begin(), m_regions.end(), [](const auto& a, const auto& b) -> bool {
 			return a.start.addr < b.start.addr;
 		});
+
+		if(m_flat)
+			this->map_flat(*find_region(m_regions, start));
+	}
+
+
+	const MemoryController::RegionMapping* MemoryController::findRegion(PhysAddr addr)
+	{
+		return find_region(m_regions, addr);
+	}
+
+	MemoryRegion* MemoryController::swapRegion(PhysAddr start, MemoryRegion* region)
+	{
+		auto r = find_region(m_regions, start);
+		if(!r || r->start.addr != start.addr || r->region->size() != region->size())
+			lg::fatal("mem", "invalid region swap at {#x}", start.addr);
+
+		if(m_flat)
+			this->unmap_flat(*r);
+
+		auto old = std::exchange(r->region, region);
+
+		if(m_flat)
+			this->map_flat(*r);
+
+		return old;
+	}
+
+	uint8_t* MemoryController::hostPointer(PhysAddr addr, size_t len)
+	{
+		auto r = find_region(m_regions, addr);
+		if(!r || addr.addr + len > r->start.addr + r->length)
+			return nullptr;
+
+		auto ptr = r->region->hostPointer(addr.addr - r->start.addr + r->offset, len);
+		if(ptr != nullptr)
+		{
+			this->track_write(addr, len);
+			this->check_code(addr, len);
+		}
+
+		return ptr;
+	}
+
+	void MemoryController::dmaSpans(PhysAddr addr, size_t len, bool write, std::vector<DmaSpan>& spans)
+	{
+		spans.clear();
+
+		if(write && len > 0)
+		{
+			this->track_write(addr, len);
+			this->check_code(addr, len);
+		}
+
+		auto add_span = [&spans](PhysAddr addr, size_t len, uint8_t* host) {
+			// neighbouring pieces that can't be done directly might as well be one piece.
+			if(host == nullptr && !spans.empty() && !spans.back().direct())
+				spans.back().length += len;
+			else
+				spans.push_back(DmaSpan { .addr = addr, .length = len, .host = host });
+		};
+
+		// this is possible only because regions are sorted.
+		for(auto& region : m_regions)
+		{
+			if(len == 0)
+				break;
+
+			if(region.start.addr + region.length <= addr.addr)
+				continue;
+
+			// a hole before this region.
+			if(region.start.addr > addr.addr)
+			{
+				auto gap = std::min(region.start.addr - addr.addr, len);
+				add_span(addr, gap, nullptr);
+
+				len -= gap;
+				addr.addr += gap;
+
+				if(len == 0)
+					break;
+			}
+
+			auto ofs = addr.addr - region.start.addr;
+			auto done = std::min(region.length - ofs, len);
+			add_span(addr, done, region.region->hostPointer(ofs + region.offset, done));
+
+			len -= done;
+			addr.addr += done;
+		}
+
+		if(len > 0)
+			add_span(addr, len, nullptr);
+	}
+
+	void MemoryController::markCode(PhysAddr addr, size_t len)
+	{
+		assert(len > 0);
+
+		for(auto page = addr.addr / PAGE_SIZE; page <= (addr.addr + len - 1) / PAGE_SIZE; page++)
+		{
+			// most of the time the page is already marked, so don't bother with the atomic op.
+			auto p = page % CODE_PAGES;
+			if(!this->is_code(p))
+				m_code_pages[p / 64].fetch_or(1ull << (p % 64), std::memory_order_relaxed);
+		}
 	}
 
+	size_t MemoryController::addCodeWriteListener(std::function<void (PhysAddr addr, size_t len)> listener)
+	{
+		auto id = m_next_listener++;
+		m_code_listeners.emplace_back(id, std::move(listener));
+
+		return id;
+	}
+
+	void MemoryController::removeCodeWriteListener(size_t id)
+	{
+		m_code_listeners.erase(std::remove_if(m_code_listeners.begin(), m_code_listeners.end(), [id](const auto& l) {
+			return l.first == id;
+		}), m_code_listeners.end());
+	}
+
+	void MemoryController::code_written(PhysAddr addr, size_t len)
+	{
+		for(auto& [ id, fn ] : m_code_listeners)
+			fn(addr, len);
+	}
+
+	void MemoryController::setWriteTracking(bool enable)
+	{
+		m_tracking = enable;
+		m_undo.clear();
+
+		if(enable)  m_written.assign((1ull << 32) / PAGE_SIZE / 64, 0);
+		else        m_written.clear();
+	}
+
+	void MemoryController::save_pages(PhysAddr addr, size_t len)
+	{
+		assert(len > 0);
+
+		auto first = addr.addr / PAGE_SIZE;
+		auto last = (addr.addr + len - 1) / PAGE_SIZE;
+
+		for(auto page = first; page <= last; page++)
+		{
+			if(page >= m_written.size() * 64)
+				lg::fatal("mem", "write tracking only covers the first 4GB");
+
+			auto& word = m_written[page / 64];
+			auto bit = 1ull << (page % 64);
+
+			if(word & bit)
+				continue;
+
+			word |= bit;
+
+			// devices can't be rolled back this way; only ram is saved.
+			auto r = find_region(m_regions, PhysAddr(page * PAGE_SIZE));
+			if(!r || (page + 1) * PAGE_SIZE > r->start.addr + r->length)
+				continue;
+
+			auto ptr = r->region->inner()->hostPointer(page * PAGE_SIZE - r->start.addr + r->offset, PAGE_SIZE);
+			if(ptr == nullptr)
+				continue;
+
+			m_undo.push_back(SavedPage {
+				.addr = page * PAGE_SIZE,
+				.data = std::vector<uint8_t>(ptr, ptr + PAGE_SIZE)
+			});
+		}
+	}
+
+	std::vector<MemoryController::SavedPage> MemoryController::takeUndoLog()
+	{
+		for(auto& p : m_undo)
+		{
+			auto page = p.addr / PAGE_SIZE;
+			m_written[page / 64] &= ~(1ull << (page % 64));
+		}
+
+		return std::move(m_undo);
+	}
+
+	void MemoryController::applyUndoLog(const std::vector<SavedPage>& pages)
+	{
+		for(auto& p : pages)
+		{
+			auto r = find_region(m_regions, PhysAddr(p.addr));
+			assert(r != nullptr);
+
+			memcpy(r->region->inner()->hostPointer(p.addr - r->start.addr + r->offset, p.data.size()), p.data.data(),
+				p.data.size());
+			this->check_code(PhysAddr(p.addr), p.data.size());
+		}
+	}
 
 	void MemoryController::read(PhysAddr addr, uint8_t* buf, size_t len)
 	{
@@ -78,8 +349,9 @@ namespace z86
 		{
 			if(contains(region, addr))
 			{
-				auto done = std::min(region.length, len);
-				region.region->read(addr.addr - region.start.addr, buf, done);
+				auto ofs = addr.addr - region.start.addr;
+				auto done = std::min(region.length - ofs, len);
+				region.region->read(ofs + region.offset, buf, done);
 
 				len -= done;
 				buf += done;
@@ -93,13 +365,20 @@ namespace z86
 
 	void MemoryController::write(PhysAddr addr, const uint8_t* buf, size_t len)
 	{
+		if(len > 0)
+		{
+			this->track_write(addr, len);
+			this->check_code(addr, len);
+		}
+
 		// this is possible only because regions are sorted.
 		for(auto& region : m_regions)
 		{
 			if(contains(region, addr))
 			{
-				auto done = std::min(region.length, len);
-				region.region->write(addr.addr - region.start.addr, buf, done);
+				auto ofs = addr.addr - region.start.addr;
+				auto done = std::min(region.length - ofs, len);
+				region.region->write(ofs + region.offset, buf, done);
 
 				len -= done;
 				buf += done;
@@ -111,67 +390,130 @@ namespace z86
 		}
 	}
 
-	uint8_t MemoryController::read8(PhysAddr addr)
+	// the flat-mapped accesses are each a single mov, with the address in a register, written
+	// out by hand -- so that when one faults, the handler (in flat.cpp) knows what to expect.
+	// (elsewhere there's no flat mapping, so these are never called.)
+	template <typename T>
+	static inline T flat_load(const uint8_t* ptr)
+	{
+		T ret;
+	#if defined(__x86_64__)
+		asm volatile("mov (%1), %0" : "=r"(ret) : "r"(ptr), "m"(*reinterpret_cast<const T*>(ptr)));
+	#else
+		memcpy(&ret, ptr, sizeof(T));
+	#endif
+		return ret;
+	}
+
+	template <typename T>
+	static inline void flat_store(uint8_t* ptr, T value)
+	{
+	#if defined(__x86_64__)
+		asm volatile("mov %1, (%2)" : "=m"(*reinterpret_cast<T*>(ptr)) : "r"(value), "r"(ptr));
+	#else
+		memcpy(ptr, &value, sizeof(T));
+	#endif
+	}
+
+	uint64_t MemoryController::region_read(PhysAddr addr, size_t bytes)
 	{
 		auto r = find_region(m_regions, addr);
 		if(!r) lg::fatal("mem", "out of bounds memory read: {#x}", addr.addr);
 
-		return r->region->read8(addr.addr - r->start.addr);
+		auto ofs = addr.addr - r->start.addr + r->offset;
+		switch(bytes)
+		{
+			case 1: return r->region->read8(ofs);
+			case 2: return r->region->read16(ofs);
+			case 4: return r->region->read32(ofs);
+			case 8: return r->region->read64(ofs);
+		}
+
+		assert(false && "invalid access size");
+		return 0;
 	}
 
-	uint16_t MemoryController::read16(PhysAddr addr)
+	void MemoryController::region_write(PhysAddr addr, size_t bytes, uint64_t value)
 	{
 		auto r = find_region(m_regions, addr);
-		if(!r) lg::fatal("mem", "out of bounds memory read: {#x}", addr.addr);
+		if(!r) lg::fatal("mem", "out of bounds memory write: {#x}", addr.addr);
 
-		return r->region->read16(addr.addr - r->start.addr);
+		auto ofs = addr.addr - r->start.addr + r->offset;
+		switch(bytes)
+		{
+			case 1: r->region->write8(ofs, value); break;
+			case 2: r->region->write16(ofs, value); break;
+			case 4: r->region->write32(ofs, value); break;
+			case 8: r->region->write64(ofs, value); break;
+			default: assert(false && "invalid access size");
+		}
+	}
+
+	uint8_t MemoryController::read8(PhysAddr addr)
+	{
+		if(m_flat)
+			return flat_load<uint8_t>(m_flat + addr.addr);
+
+		return this->region_read(addr, 1);
+	}
+
+	uint16_t MemoryController::read16(PhysAddr addr)
+	{
+		if(m_flat)
+			return flat_load<uint16_t>(m_flat + addr.addr);
+
+		return this->region_read(addr, 2);
 	}
 
 	uint32_t MemoryController::read32(PhysAddr addr)
 	{
-		auto r = find_region(m_regions, addr);
-		if(!r) lg::fatal("mem", "out of bounds memory read: {#x}", addr.addr);
+		if(m_flat)
+			return flat_load<uint32_t>(m_flat + addr.addr);
 
-		return r->region->read32(addr.addr - r->start.addr);
+		return this->region_read(addr, 4);
 	}
 
 	uint64_t MemoryController::read64(PhysAddr addr)
 	{
-		auto r = find_region(m_regions, addr);
-		if(!r) lg::fatal("mem", "out of bounds memory read: {#x}", addr.addr);
+		if(m_flat)
+			return flat_load<uint64_t>(m_flat + addr.addr);
 
-		return r->region->read64(addr.addr - r->start.addr);
+		return this->region_read(addr, 8);
 	}
 
 	void MemoryController::write8(PhysAddr addr, uint8_t value)
 	{
-		auto r = find_region(m_regions, addr);
-		if(!r) lg::fatal("mem", "out of bounds memory write: {#x}", addr.addr);
+		this->track_write(addr, 1);
+		this->check_code(addr, 1);
 
-		r->region->write8(addr.addr - r->start.addr, value);
+		if(m_flat)  flat_store<uint8_t>(m_flat + addr.addr, value);
+		else        this->region_write(addr, 1, value);
 	}
 
 	void MemoryController::write16(PhysAddr addr, uint16_t value)
 	{
-		auto r = find_region(m_regions, addr);
-		if(!r) lg::fatal("mem", "out of bounds memory write: {#x}", addr.addr);
+		this->track_write(addr, 2);
+		this->check_code(addr, 2);
 
-		r->region->write16(addr.addr - r->start.addr, value);
+		if(m_flat)  flat_store<uint16_t>(m_flat + addr.addr, value);
+		else        this->region_write(addr, 2, value);
 	}
 
 	void MemoryController::write32(PhysAddr addr, uint32_t value)
 	{
-		auto r = find_region(m_regions, addr);
-		if(!r) lg::fatal("mem", "out of bounds memory write: {#x}", addr.addr);
+		this->track_write(addr, 4);
+		this->check_code(addr, 4);
 
-		r->region->write16(addr.addr - r->start.addr, value);
+		if(m_flat)  flat_store<uint32_t>(m_flat + addr.addr, value);
+		else        this->region_write(addr, 4, value);
 	}
 
 	void MemoryController::write64(PhysAddr addr, uint64_t value)
 	{
-		auto r = find_region(m_regions, addr);
-		if(!r) lg::fatal("mem", "out of bounds memory write: {#x}", addr.addr);
+		this->track_write(addr, 8);
+		this->check_code(addr, 8);
 
-		r->region->write64(addr.addr - r->start.addr, value);
+		if(m_flat)  flat_store<uint64_t>(m_flat + addr.addr, value);
+		else        this->region_write(addr, 8, value);
 	}
 }
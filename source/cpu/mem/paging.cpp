@@ -22,11 +22,6 @@ namespace z86
 		m_enabled = false;
 	}
 
-	bool PagedMMU::enabled()
-	{
-		return m_enabled;
-	}
-
 	uint8_t  PagedMMU::read8(VirtAddr addr)  { return m_memcon.read8(this->resolve(addr)); }
 	uint16_t PagedMMU::read16(VirtAddr addr) { return m_memcon.read16(this->resolve(addr)); }
 	uint32_t PagedMMU::read32(VirtAddr addr) { return m_memcon.read32(this->resolve(addr)); }
@@ -2,22 +2,79 @@
 // Copyright (c) 2020, zhiayang
 // Licensed under the Apache License Version 2.0.
 
+#include "defs.h"
 #include "cpu/cpu.h"
 #include "cpu/mmu.h"
 
 namespace z86
 {
-	static void load_segment(CPU* cpu, SegmentedMMU::SystemDescriptor* desc, uint16_t sel)
+	using SystemDescriptor = SegmentedMMU::SystemDescriptor;
+
+	static void update_flags(SystemDescriptor* desc)
+	{
+		desc->flat = desc->usable
+			&& desc->base == 0
+			&& desc->limit == 0xFFFF'FFFF
+			&& ((desc->access & SystemDescriptor::ACCESS_CODE) || !(desc->access & SystemDescriptor::ACCESS_EXPAND_DOWN));
+
+		desc->checked = !desc->flat;
+
+		bool code = (desc->access & SystemDescriptor::ACCESS_CODE);
+		desc->read_checked = desc->checked || (code && !(desc->access & SystemDescriptor::ACCESS_READABLE));
+		desc->write_checked = desc->checked || code || !(desc->access & SystemDescriptor::ACCESS_WRITABLE);
+	}
+
+	SystemDescriptor SystemDescriptor::parse(uint64_t raw)
+	{
+		auto desc = SystemDescriptor();
+
+		desc.base   = ((raw >> 16) & 0xFF'FFFF) | (((raw >> 56) & 0xFF) << 24);
+		desc.limit  = (raw & 0xFFFF) | (((raw >> 48) & 0xF) << 16);
+		desc.access = (raw >> 40) & 0xFF;
+		desc.flags  = (raw >> 52) & 0xF;
+
+		if(desc.flags & FLAG_GRANULARITY)
+			desc.limit = (desc.limit << 12) | 0xFFF;
+
+		desc.usable = (desc.access & ACCESS_PRESENT) && (desc.access & ACCESS_NON_SYSTEM);
+		update_flags(&desc);
+
+		return desc;
+	}
+
+	SystemDescriptor SegmentedMMU::fetch_descriptor(uint16_t sel)
+	{
+		// bit 2 of the selector picks the table, and the bottom 2 bits are the RPL.
+		bool local = (sel & 0x4);
+		uint64_t ofs = (sel & ~0x7);
+
+		auto table = (local ? m_ldt_address : m_gdt_address);
+		auto limit = (local ? m_ldt_limit : m_gdt_limit);
+
+		// protection faults are fatal by design: like the other checks in this file, this reports
+		// the exception the cpu would raise and stops, rather than delivering it to the guest.
+		if(ofs + 7 > limit)
+			lg::fatal("smmu", "#GP: selector {04x} exceeds {} limit {x}", sel, local ? "ldt" : "gdt", limit);
+
+		return SystemDescriptor::parse(m_pagedMMU.read64(VirtAddr(table + ofs)));
+	}
+
+	SegmentedMMU::State SegmentedMMU::saveState() const
 	{
-		assert(cpu->mode() == CPUMode::Real);
-		desc->base = sel * 0x10;
-		desc->limit = 0xFFFFFFFF;
+		auto st = State { m_gdt_address, m_gdt_limit, m_ldt_address, m_ldt_limit, { } };
+		std::copy(std::begin(m_segments), std::end(m_segments), std::begin(st.segments));
+
+		return st;
 	}
 
-	static uint64_t resolve_segment(CPU* cpu, SegmentedMMU::SystemDescriptor* desc)
+	void SegmentedMMU::restoreState(const State& st)
 	{
-		assert(cpu->mode() == CPUMode::Real);
-		return desc->base;
+		m_gdt_address = st.gdt_address;
+		m_gdt_limit = st.gdt_limit;
+		m_ldt_address = st.ldt_address;
+		m_ldt_limit = st.ldt_limit;
+
+		std::copy(std::begin(st.segments), std::end(st.segments), std::begin(m_segments));
 	}
 
 	void SegmentedMMU::reset()
@@ -25,30 +82,113 @@ namespace z86
 		// AMD Manual, vol 2, 14.1.5
 		// Fetching the First Instruction
 		// for the code segment, its selector is 0xF000, but the base is 0xFFFF0000. weirdchamp.
-		m_cached_cs.base = 0xFFFF'0000;
-		m_cached_cs.limit = 0xFFFF;
-
-		// the rest are simple.
-		m_cached_ds.base = 0; m_cached_ds.limit = 0xFFFF;
-		m_cached_es.base = 0; m_cached_es.limit = 0xFFFF;
-		m_cached_fs.base = 0; m_cached_fs.limit = 0xFFFF;
-		m_cached_gs.base = 0; m_cached_gs.limit = 0xFFFF;
-		m_cached_ss.base = 0; m_cached_ss.limit = 0xFFFF;
+		// the rest are simple -- base 0, limit 0xFFFF.
+		for(auto& desc : m_segments)
+		{
+			desc.base = 0;
+			desc.limit = 0xFFFF;
+			desc.access = SystemDescriptor::ACCESS_PRESENT | SystemDescriptor::ACCESS_NON_SYSTEM
+				| SystemDescriptor::ACCESS_WRITABLE;
+			desc.flags = 0;
+			desc.usable = true;
+
+			// we start in real mode, so nothing is checked.
+			desc.flat = false;
+			desc.checked = false;
+			desc.read_checked = false;
+			desc.write_checked = false;
+		}
+
+		auto& cs = m_segments[static_cast<size_t>(SegReg::CS)];
+		cs.base = 0xFFFF'0000;
+		cs.access |= SystemDescriptor::ACCESS_CODE;
+
+		// gdtr and ldtr are base 0 with limit 0xFFFF
+		m_gdt_address = 0; m_gdt_limit = 0xFFFF;
+		m_ldt_address = 0; m_ldt_limit = 0xFFFF;
+	}
+
+	void SegmentedMMU::loadGDT(uint64_t base, uint16_t limit)
+	{
+		m_gdt_address = base;
+		m_gdt_limit = limit;
+	}
+
+	void SegmentedMMU::loadLDT(uint16_t sel)
+	{
+		if((sel & ~0x3) == 0)
+		{
+			m_ldt_address = 0;
+			m_ldt_limit = 0;
+			return;
+		}
+
+		// the ldt descriptor must live in the gdt, and it's a system descriptor -- so it
+		// doesn't go through the usual checks.
+		if(sel & 0x4)
+			lg::fatal("smmu", "#GP: ldt selector {04x} refers to the ldt", sel);
+
+		auto d = this->fetch_descriptor(sel);
+		if((d.access & SystemDescriptor::ACCESS_NON_SYSTEM) || (d.access & 0xF) != SystemDescriptor::TYPE_LDT)
+			lg::fatal("smmu", "#GP: selector {04x} is not an ldt descriptor", sel);
+
+		if(!(d.access & SystemDescriptor::ACCESS_PRESENT))
+			lg::fatal("smmu", "#NP: ldt selector {04x} is not present", sel);
+
+		m_ldt_address = d.base;
+		m_ldt_limit = d.limit;
 	}
 
 	void SegmentedMMU::load(SegReg sr, uint16_t sel)
 	{
-		switch(sr)
+		auto& desc = m_segments[static_cast<size_t>(sr)];
+		if(m_cpu.mode() == CPUMode::Real)
 		{
-			case SegReg::CS: return load_segment(&m_cpu, &m_cached_cs, sel);
-			case SegReg::DS: return load_segment(&m_cpu, &m_cached_ds, sel);
-			case SegReg::ES: return load_segment(&m_cpu, &m_cached_es, sel);
-			case SegReg::FS: return load_segment(&m_cpu, &m_cached_fs, sel);
-			case SegReg::GS: return load_segment(&m_cpu, &m_cached_gs, sel);
-			case SegReg::SS: return load_segment(&m_cpu, &m_cached_ss, sel);
+			desc.base = sel * 0x10;
+			desc.limit = 0xFFFFFFFF;
+			desc.usable = true;
+
+			// note: this stays unchecked even after switching to protected mode, until the
+			// segment is reloaded -- which is also what the hardware does with its cached limits.
+			desc.flat = (desc.base == 0);
+			desc.checked = false;
+			desc.read_checked = false;
+			desc.write_checked = false;
+			return;
 		}
 
-		assert(false && "invalid segment reg");
+		// null selectors can be loaded into the data segment registers, but any
+		// access through them faults.
+		if((sel & ~0x3) == 0)
+		{
+			if(sr == SegReg::CS || sr == SegReg::SS)
+				lg::fatal("smmu", "#GP: null selector loaded into {}", sr == SegReg::CS ? "cs" : "ss");
+
+			desc = { };
+			desc.checked = true;
+			desc.read_checked = true;
+			desc.write_checked = true;
+			return;
+		}
+
+		auto d = this->fetch_descriptor(sel);
+		if(!(d.access & SystemDescriptor::ACCESS_NON_SYSTEM))
+			lg::fatal("smmu", "#GP: selector {04x} refers to a system descriptor", sel);
+
+		if(!(d.access & SystemDescriptor::ACCESS_PRESENT))
+			lg::fatal("smmu", "#{}: selector {04x} is not present", sr == SegReg::SS ? "SS" : "NP", sel);
+
+		bool code = (d.access & SystemDescriptor::ACCESS_CODE);
+		if(sr == SegReg::CS && !code)
+			lg::fatal("smmu", "#GP: selector {04x} loaded into cs is not a code segment", sel);
+
+		if(sr == SegReg::SS && (code || !(d.access & SystemDescriptor::ACCESS_WRITABLE)))
+			lg::fatal("smmu", "#GP: selector {04x} loaded into ss is not a writable data segment", sel);
+
+		if(sr != SegReg::CS && code && !(d.access & SystemDescriptor::ACCESS_READABLE))
+			lg::fatal("smmu", "#GP: selector {04x} is an execute-only code segment", sel);
+
+		desc = d;
 	}
 
 	void SegmentedMMU::loadCS(uint16_t sel) { this->load(SegReg::CS, sel); }
@@ -58,28 +198,59 @@ namespace z86
 	void SegmentedMMU::loadGS(uint16_t sel) { this->load(SegReg::GS, sel); }
 	void SegmentedMMU::loadSS(uint16_t sel) { this->load(SegReg::SS, sel); }
 
-	VirtAddr SegmentedMMU::resolve(SegmentedAddr addr)
+	NEVER_INLINE VirtAddr SegmentedMMU::resolve_checked(const SystemDescriptor& desc, SegmentedAddr addr, size_t size,
+		Access access)
 	{
-		switch(addr.reg)
+		if(!desc.usable)
+			lg::fatal("smmu", "#GP: access through a null segment");
+
+		bool code = (desc.access & SystemDescriptor::ACCESS_CODE);
+		if(access == Access::Write && code)
+			lg::fatal("smmu", "#GP: write to offset {x} of a code segment", addr.offset);
+
+		if(access == Access::Write && !(desc.access & SystemDescriptor::ACCESS_WRITABLE))
+			lg::fatal("smmu", "#GP: write to offset {x} of a read-only data segment", addr.offset);
+
+		if(access == Access::Read && code && !(desc.access & SystemDescriptor::ACCESS_READABLE))
+			lg::fatal("smmu", "#GP: read from offset {x} of an execute-only code segment", addr.offset);
+
+		// a flat segment only gets here for the checks above.
+		if(!desc.checked)
+			return VirtAddr(static_cast<uint32_t>(desc.base + addr.offset));
+
+		auto last = addr.offset + size - 1;
+		bool ok = false;
+
+		if(!(desc.access & SystemDescriptor::ACCESS_CODE) && (desc.access & SystemDescriptor::ACCESS_EXPAND_DOWN))
+		{
+			// for expand-down segments, the valid offsets are (limit, upper], where the upper
+			// bound depends on the B bit.
+			uint64_t upper = (desc.flags & SystemDescriptor::FLAG_DEFAULT_32) ? 0xFFFF'FFFF : 0xFFFF;
+			ok = (addr.offset > desc.limit) && (last <= upper);
+		}
+		else
 		{
-			case SegReg::CS: return VirtAddr(resolve_segment(&m_cpu, &m_cached_cs) + addr.offset);
-			case SegReg::DS: return VirtAddr(resolve_segment(&m_cpu, &m_cached_ds) + addr.offset);
-			case SegReg::ES: return VirtAddr(resolve_segment(&m_cpu, &m_cached_es) + addr.offset);
-			case SegReg::FS: return VirtAddr(resolve_segment(&m_cpu, &m_cached_fs) + addr.offset);
-			case SegReg::GS: return VirtAddr(resolve_segment(&m_cpu, &m_cached_gs) + addr.offset);
-			case SegReg::SS: return VirtAddr(resolve_segment(&m_cpu, &m_cached_ss) + addr.offset);
+			ok = (last <= desc.limit);
 		}
 
-		assert(false && "invalid segment reg");
+		if(!ok)
+		{
+			lg::fatal("smmu", "#{}: offset {x} (size {}) outside segment limit {x}",
+				addr.reg == SegReg::SS ? "SS" : "GP", addr.offset, size, desc.limit);
+		}
+
+		return VirtAddr(static_cast<uint32_t>(desc.base + addr.offset));
 	}
 
-	uint8_t  SegmentedMMU::read8(SegmentedAddr addr)  { return m_pagedMMU.read8(this->resolve(addr)); }
-	uint16_t SegmentedMMU::read16(SegmentedAddr addr) { return m_pagedMMU.read16(this->resolve(addr)); }
-	uint32_t SegmentedMMU::read32(SegmentedAddr addr) { return m_pagedMMU.read32(this->resolve(addr)); }
-	uint64_t SegmentedMMU::read64(SegmentedAddr addr) { return m_pagedMMU.read64(this->resolve(addr)); }
+	uint8_t  SegmentedMMU::fetch8(SegmentedAddr addr) { return m_pagedMMU.read8(this->resolve(addr, 1, Access::Execute)); }
+
+	uint8_t  SegmentedMMU::read8(SegmentedAddr addr)  { return m_pagedMMU.read8(this->resolve(addr, 1)); }
+	uint16_t SegmentedMMU::read16(SegmentedAddr addr) { return m_pagedMMU.read16(this->resolve(addr, 2)); }
+	uint32_t SegmentedMMU::read32(SegmentedAddr addr) { return m_pagedMMU.read32(this->resolve(addr, 4)); }
+	uint64_t SegmentedMMU::read64(SegmentedAddr addr) { return m_pagedMMU.read64(this->resolve(addr, 8)); }
 
-	void SegmentedMMU::write8(SegmentedAddr addr, uint8_t value)    { m_pagedMMU.write8(this->resolve(addr), value); }
-	void SegmentedMMU::write16(SegmentedAddr addr, uint16_t value)  { m_pagedMMU.write16(this->resolve(addr), value); }
-	void SegmentedMMU::write32(SegmentedAddr addr, uint32_t value)  { m_pagedMMU.write32(this->resolve(addr), value); }
-	void SegmentedMMU::write64(SegmentedAddr addr, uint64_t value)  { m_pagedMMU.write64(this->resolve(addr), value); }
+	void SegmentedMMU::write8(SegmentedAddr addr, uint8_t value)    { m_pagedMMU.write8(this->resolve(addr, 1, Access::Write), value); }
+	void SegmentedMMU::write16(SegmentedAddr addr, uint16_t value)  { m_pagedMMU.write16(this->resolve(addr, 2, Access::Write), value); }
+	void SegmentedMMU::write32(SegmentedAddr addr, uint32_t value)  { m_pagedMMU.write32(this->resolve(addr, 4, Access::Write), value); }
+	void SegmentedMMU::write64(SegmentedAddr addr, uint64_t value)  { m_pagedMMU.write64(this->resolve(addr, 8, Access::Write), value); }
 }
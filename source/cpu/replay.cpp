@@ -0,0 +1,265 @@
+// replay.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "defs.h"
+#include "cpu/replay.h"
+
+namespace z86
+{
+	static constexpr char MAGIC[8] = { 'z', '8', '6', 'r', 'r', 'l', 'o', 'g' };
+	static constexpr uint8_t VERSION = 1;
+
+	static constexpr uint8_t KIND_END           = 0;
+	static constexpr uint8_t KIND_PORT_IN       = 1;
+	static constexpr uint8_t KIND_INTERRUPT     = 2;
+	static constexpr uint8_t KIND_HOST_TIME     = 3;
+	static constexpr uint8_t KIND_MASK          = 0x0F;
+
+	static constexpr uint8_t FLAG_SAME_PORT     = 0x10;
+	static constexpr uint8_t FLAG_SAME_VALUE    = 0x20;
+
+	static constexpr size_t FLUSH_THRESHOLD     = 64 * 1024;
+
+	static uint64_t zigzag(int64_t x)   { return (static_cast<uint64_t>(x) << 1) ^ static_cast<uint64_t>(x >> 63); }
+	static int64_t unzigzag(uint64_t x) { return static_cast<int64_t>(x >> 1) ^ -static_cast<int64_t>(x & 1); }
+
+	ReplayLog::~ReplayLog()
+	{
+		this->finish();
+	}
+
+	bool ReplayLog::openForRecording(const char* path)
+	{
+		m_mode = Mode::Record;
+		m_file = fopen(path, "wb");
+		if(m_file == nullptr)
+			return false;
+
+		m_buffer.insert(m_buffer.end(), MAGIC, MAGIC + sizeof(MAGIC));
+		m_buffer.push_back(VERSION);
+
+		return true;
+	}
+
+	bool ReplayLog::openForReplay(const char* path)
+	{
+		m_mode = Mode::Replay;
+
+		auto [ buf, len ] = util::readEntireFile(path);
+		if(buf == nullptr)
+			return false;
+
+		auto data = std::vector<uint8_t>(buf, buf + len);
+		delete[] buf;
+
+		return this->decode(data);
+	}
+
+	void ReplayLog::finish()
+	{
+		if(m_file == nullptr)
+			return;
+
+		m_buffer.push_back(KIND_END);
+		this->flush();
+
+		fclose(m_file);
+		m_file = nullptr;
+	}
+
+	void ReplayLog::flush()
+	{
+		if(m_file == nullptr || m_buffer.empty())
+			return;
+
+		fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+		m_buffer.clear();
+	}
+
+	void ReplayLog::write_varint(uint64_t value)
+	{
+		while(value >= 0x80)
+		{
+			m_buffer.push_back((value & 0x7F) | 0x80);
+			value >>= 7;
+		}
+
+		m_buffer.push_back(value);
+	}
+
+	void ReplayLog::write_record(uint8_t tag, uint64_t icount)
+	{
+		assert(icount >= m_last_icount);
+
+		m_buffer.push_back(tag);
+		this->write_varint(icount - m_last_icount);
+
+		m_last_icount = icount;
+	}
+
+	void ReplayLog::recordPortIn(uint64_t icount, uint16_t port, uint32_t value)
+	{
+		uint8_t tag = KIND_PORT_IN;
+		if(port == m_last_port)     tag |= FLAG_SAME_PORT;
+		if(value == m_last_value)   tag |= FLAG_SAME_VALUE;
+
+		this->write_record(tag, icount);
+
+		if(!(tag & FLAG_SAME_PORT))     this->write_varint(port);
+		if(!(tag & FLAG_SAME_VALUE))    this->write_varint(value);
+
+		m_last_port = port;
+		m_last_value = value;
+
+		if(m_buffer.size() >= FLUSH_THRESHOLD)
+			this->flush();
+	}
+
+	void ReplayLog::recordInterrupt(uint64_t icount, uint8_t vector)
+	{
+		this->write_record(KIND_INTERRUPT, icount);
+		this->write_varint(vector);
+
+		if(m_buffer.size() >= FLUSH_THRESHOLD)
+			this->flush();
+	}
+
+	void ReplayLog::recordHostTime(uint64_t icount, uint64_t time)
+	{
+		this->write_record(KIND_HOST_TIME, icount);
+		this->write_varint(zigzag(static_cast<int64_t>(time - m_last_time)));
+
+		m_last_time = time;
+
+		if(m_buffer.size() >= FLUSH_THRESHOLD)
+			this->flush();
+	}
+
+	bool ReplayLog::decode(const std::vector<uint8_t>& data)
+	{
+		size_t pos = 0;
+		bool ok = true;
+
+		auto read_varint = [&]() -> uint64_t {
+			uint64_t ret = 0;
+			for(int shift = 0; shift < 64; shift += 7)
+			{
+				if(pos >= data.size())
+					break;
+
+				auto b = data[pos++];
+				ret |= static_cast<uint64_t>(b & 0x7F) << shift;
+
+				if(!(b & 0x80))
+					return ret;
+			}
+
+			ok = false;
+			return 0;
+		};
+
+		if(data.size() < sizeof(MAGIC) + 1 || memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0)
+		{
+			lg::error("replay", "not a replay log");
+			return false;
+		}
+
+		if(data[sizeof(MAGIC)] != VERSION)
+		{
+			lg::error("replay", "unsupported log version {}", data[sizeof(MAGIC)]);
+			return false;
+		}
+
+		pos = sizeof(MAGIC) + 1;
+
+		uint64_t icount = 0;
+		uint16_t port = 0;
+		uint32_t value = 0;
+		uint64_t time = 0;
+
+		while(ok && pos < data.size())
+		{
+			auto tag = data[pos++];
+			if((tag & KIND_MASK) == KIND_END)
+				return true;
+
+			icount += read_varint();
+
+			switch(tag & KIND_MASK)
+			{
+				case KIND_PORT_IN:
+					if(!(tag & FLAG_SAME_PORT))     port = read_varint();
+					if(!(tag & FLAG_SAME_VALUE))    value = read_varint();
+
+					m_port_ins.push_back(PortIn { icount, port, value });
+					break;
+
+				case KIND_INTERRUPT:
+					m_interrupts.push_back(Interrupt { icount, static_cast<uint8_t>(read_varint()) });
+					break;
+
+				case KIND_HOST_TIME:
+					time += unzigzag(read_varint());
+					m_host_times.push_back(HostTime { icount, time });
+					break;
+
+				default:
+					ok = false;
+					break;
+			}
+		}
+
+		// a log without an end marker is from a run that didn't exit cleanly; everything up to
+		// the point where it was cut off is still usable.
+		if(!ok)
+			lg::warn("replay", "log is truncated or corrupt at offset {}", pos);
+
+		return true;
+	}
+
+	uint32_t ReplayLog::replayPortIn(uint64_t icount, uint16_t port)
+	{
+		if(m_port_in_idx == m_port_ins.size())
+			lg::fatal("replay", "in {04x} at instruction {}: past the end of the log", port, icount);
+
+		auto& ev = m_port_ins[m_port_in_idx++];
+		if(ev.icount != icount || ev.port != port)
+		{
+			lg::fatal("replay", "diverged: in {04x} at instruction {}, but the log has in {04x} at {}",
+				port, icount, ev.port, ev.icount);
+		}
+
+		return ev.value;
+	}
+
+	uint64_t ReplayLog::replayHostTime(uint64_t icount)
+	{
+		if(m_host_time_idx == m_host_times.size())
+			lg::fatal("replay", "host time read at instruction {}: past the end of the log", icount);
+
+		auto& ev = m_host_times[m_host_time_idx++];
+		if(ev.icount != icount)
+			lg::fatal("replay", "diverged: host time read at instruction {}, but the log has {}", icount, ev.icount);
+
+		return ev.time;
+	}
+
+	uint64_t ReplayLog::nextInterrupt() const
+	{
+		if(m_interrupt_idx == m_interrupts.size())
+			return NEVER;
+
+		return m_interrupts[m_interrupt_idx].icount;
+	}
+
+	uint8_t ReplayLog::replayInterrupt(uint64_t icount)
+	{
+		assert(m_interrupt_idx < m_interrupts.size());
+
+		auto& ev = m_interrupts[m_interrupt_idx++];
+		assert(ev.icount == icount);
+
+		return ev.vector;
+	}
+}
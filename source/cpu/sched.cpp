@@ -0,0 +1,92 @@
+// sched.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include <algorithm>
+
+#include "defs.h"
+#include "cpu/sched.h"
+
+namespace z86
+{
+	void Scheduler::reset()
+	{
+		m_now = 0;
+		m_events.clear();
+		m_cancelled.clear();
+	}
+
+	Scheduler::EventId Scheduler::schedule(uint64_t deadline, Callback callback)
+	{
+		auto id = m_next_id++;
+
+		m_events.push_back(Event {
+			.deadline = deadline,
+			.id = id,
+			.callback = std::move(callback)
+		});
+
+		std::push_heap(m_events.begin(), m_events.end(), Later());
+		return id;
+	}
+
+	Scheduler::EventId Scheduler::scheduleIn(uint64_t delay, Callback callback)
+	{
+		return this->schedule(m_now + delay, std::move(callback));
+	}
+
+	void Scheduler::cancel(EventId id)
+	{
+		// the event stays in the heap until it reaches the top; it's cheaper than
+		// searching for it, and cancellation is rare compared to firing.
+		m_cancelled.insert(id);
+	}
+
+	void Scheduler::discard_cancelled()
+	{
+		while(!m_events.empty() && !m_cancelled.empty())
+		{
+			auto it = m_cancelled.find(m_events.front().id);
+			if(it == m_cancelled.end())
+				break;
+
+			m_cancelled.erase(it);
+			std::pop_heap(m_events.begin(), m_events.end(), Later());
+			m_events.pop_back();
+		}
+	}
+
+	uint64_t Scheduler::nextDeadline()
+	{
+		this->discard_cancelled();
+
+		if(m_events.empty())
+			return NEVER;
+
+		return m_events.front().deadline;
+	}
+
+	void Scheduler::advance(uint64_t ticks)
+	{
+		m_now += ticks;
+	}
+
+	void Scheduler::advanceTo(uint64_t time)
+	{
+		if(time > m_now)
+			m_now = time;
+	}
+
+	void Scheduler::runDue()
+	{
+		while(this->nextDeadline() <= m_now)
+		{
+			std::pop_heap(m_events.begin(), m_events.end(), Later());
+
+			auto ev = std::move(m_events.back());
+			m_events.pop_back();
+
+			ev.callback(m_now);
+		}
+	}
+}
@@ -0,0 +1,239 @@
+// avx2.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "cpu/simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+namespace z86::simd
+{
+	// the rest of the emulator is not compiled with -mavx2, so every function here needs
+	// the target attribute; this file is only ever called into if the host supports avx2
+	// (see simd.cpp). note that since avx2 implies sse4.2, the 128-bit path can also use
+	// the sse4 intrinsics that the sse2 backend could not.
+	#define AVX2 __attribute__((target("avx2")))
+
+	#define INT_KERNEL(name, intrin256, intrin128)                                          \
+		AVX2 static void name(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)     \
+		{                                                                                   \
+			if(n == 32)                                                                     \
+			{                                                                               \
+				auto x = _mm256_load_si256(reinterpret_cast<const __m256i*>(a));            \
+				auto y = _mm256_load_si256(reinterpret_cast<const __m256i*>(b));            \
+				_mm256_store_si256(reinterpret_cast<__m256i*>(d), intrin256(x, y));         \
+			}                                                                               \
+			else                                                                            \
+			{                                                                               \
+				auto x = _mm_load_si128(reinterpret_cast<const __m128i*>(a));               \
+				auto y = _mm_load_si128(reinterpret_cast<const __m128i*>(b));               \
+				_mm_store_si128(reinterpret_cast<__m128i*>(d), intrin128(x, y));            \
+			}                                                                               \
+		}
+
+	#define FLT_KERNEL(name, type, suffix, intrin256, intrin128)                            \
+		AVX2 static void name(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)     \
+		{                                                                                   \
+			if(n == 32)                                                                     \
+			{                                                                               \
+				auto x = _mm256_load_##suffix(reinterpret_cast<const type*>(a));            \
+				auto y = _mm256_load_##suffix(reinterpret_cast<const type*>(b));            \
+				_mm256_store_##suffix(reinterpret_cast<type*>(d), intrin256(x, y));         \
+			}                                                                               \
+			else                                                                            \
+			{                                                                               \
+				auto x = _mm_load_##suffix(reinterpret_cast<const type*>(a));               \
+				auto y = _mm_load_##suffix(reinterpret_cast<const type*>(b));               \
+				_mm_store_##suffix(reinterpret_cast<type*>(d), intrin128(x, y));            \
+			}                                                                               \
+		}
+
+	#define SHIFT_KERNEL(name, intrin256, intrin128)                                        \
+		AVX2 static void name(uint8_t* d, const uint8_t* a, uint64_t count, size_t n)       \
+		{                                                                                   \
+			auto c = _mm_set_epi64x(0, static_cast<int64_t>(count));                        \
+			if(n == 32)                                                                     \
+			{                                                                               \
+				auto x = _mm256_load_si256(reinterpret_cast<const __m256i*>(a));            \
+				_mm256_store_si256(reinterpret_cast<__m256i*>(d), intrin256(x, c));         \
+			}                                                                               \
+			else                                                                            \
+			{                                                                               \
+				auto x = _mm_load_si128(reinterpret_cast<const __m128i*>(a));               \
+				_mm_store_si128(reinterpret_cast<__m128i*>(d), intrin128(x, c));            \
+			}                                                                               \
+		}
+
+	AVX2 static inline __m256 sqrt_ps256(__m256 a, __m256)      { return _mm256_sqrt_ps(a); }
+	AVX2 static inline __m256d sqrt_pd256(__m256d a, __m256d)   { return _mm256_sqrt_pd(a); }
+	AVX2 static inline __m128 sqrt_ps128(__m128 a, __m128)      { return _mm_sqrt_ps(a); }
+	AVX2 static inline __m128d sqrt_pd128(__m128d a, __m128d)   { return _mm_sqrt_pd(a); }
+
+	INT_KERNEL(paddb, _mm256_add_epi8, _mm_add_epi8)
+	INT_KERNEL(paddw, _mm256_add_epi16, _mm_add_epi16)
+	INT_KERNEL(paddd, _mm256_add_epi32, _mm_add_epi32)
+	INT_KERNEL(paddq, _mm256_add_epi64, _mm_add_epi64)
+	INT_KERNEL(psubb, _mm256_sub_epi8, _mm_sub_epi8)
+	INT_KERNEL(psubw, _mm256_sub_epi16, _mm_sub_epi16)
+	INT_KERNEL(psubd, _mm256_sub_epi32, _mm_sub_epi32)
+	INT_KERNEL(psubq, _mm256_sub_epi64, _mm_sub_epi64)
+	INT_KERNEL(paddsb, _mm256_adds_epi8, _mm_adds_epi8)
+	INT_KERNEL(paddsw, _mm256_adds_epi16, _mm_adds_epi16)
+	INT_KERNEL(paddusb, _mm256_adds_epu8, _mm_adds_epu8)
+	INT_KERNEL(paddusw, _mm256_adds_epu16, _mm_adds_epu16)
+	INT_KERNEL(psubsb, _mm256_subs_epi8, _mm_subs_epi8)
+	INT_KERNEL(psubsw, _mm256_subs_epi16, _mm_subs_epi16)
+	INT_KERNEL(psubusb, _mm256_subs_epu8, _mm_subs_epu8)
+	INT_KERNEL(psubusw, _mm256_subs_epu16, _mm_subs_epu16)
+	INT_KERNEL(pand, _mm256_and_si256, _mm_and_si128)
+	INT_KERNEL(pandn, _mm256_andnot_si256, _mm_andnot_si128)
+	INT_KERNEL(por, _mm256_or_si256, _mm_or_si128)
+	INT_KERNEL(pxor, _mm256_xor_si256, _mm_xor_si128)
+	INT_KERNEL(pcmpeqb, _mm256_cmpeq_epi8, _mm_cmpeq_epi8)
+	INT_KERNEL(pcmpeqw, _mm256_cmpeq_epi16, _mm_cmpeq_epi16)
+	INT_KERNEL(pcmpeqd, _mm256_cmpeq_epi32, _mm_cmpeq_epi32)
+	INT_KERNEL(pcmpeqq, _mm256_cmpeq_epi64, _mm_cmpeq_epi64)
+	INT_KERNEL(pcmpgtb, _mm256_cmpgt_epi8, _mm_cmpgt_epi8)
+	INT_KERNEL(pcmpgtw, _mm256_cmpgt_epi16, _mm_cmpgt_epi16)
+	INT_KERNEL(pcmpgtd, _mm256_cmpgt_epi32, _mm_cmpgt_epi32)
+	INT_KERNEL(pcmpgtq, _mm256_cmpgt_epi64, _mm_cmpgt_epi64)
+	INT_KERNEL(pmullw, _mm256_mullo_epi16, _mm_mullo_epi16)
+	INT_KERNEL(pmulhw, _mm256_mulhi_epi16, _mm_mulhi_epi16)
+	INT_KERNEL(pmulhuw, _mm256_mulhi_epu16, _mm_mulhi_epu16)
+	INT_KERNEL(pmuludq, _mm256_mul_epu32, _mm_mul_epu32)
+	INT_KERNEL(pmulld, _mm256_mullo_epi32, _mm_mullo_epi32)
+	INT_KERNEL(pminub, _mm256_min_epu8, _mm_min_epu8)
+	INT_KERNEL(pminuw, _mm256_min_epu16, _mm_min_epu16)
+	INT_KERNEL(pminud, _mm256_min_epu32, _mm_min_epu32)
+	INT_KERNEL(pminsb, _mm256_min_epi8, _mm_min_epi8)
+	INT_KERNEL(pminsw, _mm256_min_epi16, _mm_min_epi16)
+	INT_KERNEL(pminsd, _mm256_min_epi32, _mm_min_epi32)
+	INT_KERNEL(pmaxub, _mm256_max_epu8, _mm_max_epu8)
+	INT_KERNEL(pmaxuw, _mm256_max_epu16, _mm_max_epu16)
+	INT_KERNEL(pmaxud, _mm256_max_epu32, _mm_max_epu32)
+	INT_KERNEL(pmaxsb, _mm256_max_epi8, _mm_max_epi8)
+	INT_KERNEL(pmaxsw, _mm256_max_epi16, _mm_max_epi16)
+	INT_KERNEL(pmaxsd, _mm256_max_epi32, _mm_max_epi32)
+	INT_KERNEL(pavgb, _mm256_avg_epu8, _mm_avg_epu8)
+	INT_KERNEL(pavgw, _mm256_avg_epu16, _mm_avg_epu16)
+
+	FLT_KERNEL(addps, float, ps, _mm256_add_ps, _mm_add_ps)
+	FLT_KERNEL(subps, float, ps, _mm256_sub_ps, _mm_sub_ps)
+	FLT_KERNEL(mulps, float, ps, _mm256_mul_ps, _mm_mul_ps)
+	FLT_KERNEL(divps, float, ps, _mm256_div_ps, _mm_div_ps)
+	FLT_KERNEL(minps, float, ps, _mm256_min_ps, _mm_min_ps)
+	FLT_KERNEL(maxps, float, ps, _mm256_max_ps, _mm_max_ps)
+	FLT_KERNEL(sqrtps, float, ps, sqrt_ps256, sqrt_ps128)
+	FLT_KERNEL(addpd, double, pd, _mm256_add_pd, _mm_add_pd)
+	FLT_KERNEL(subpd, double, pd, _mm256_sub_pd, _mm_sub_pd)
+	FLT_KERNEL(mulpd, double, pd, _mm256_mul_pd, _mm_mul_pd)
+	FLT_KERNEL(divpd, double, pd, _mm256_div_pd, _mm_div_pd)
+	FLT_KERNEL(minpd, double, pd, _mm256_min_pd, _mm_min_pd)
+	FLT_KERNEL(maxpd, double, pd, _mm256_max_pd, _mm_max_pd)
+	FLT_KERNEL(sqrtpd, double, pd, sqrt_pd256, sqrt_pd128)
+
+	SHIFT_KERNEL(psllw, _mm256_sll_epi16, _mm_sll_epi16)
+	SHIFT_KERNEL(pslld, _mm256_sll_epi32, _mm_sll_epi32)
+	SHIFT_KERNEL(psllq, _mm256_sll_epi64, _mm_sll_epi64)
+	SHIFT_KERNEL(psrlw, _mm256_srl_epi16, _mm_srl_epi16)
+	SHIFT_KERNEL(psrld, _mm256_srl_epi32, _mm_srl_epi32)
+	SHIFT_KERNEL(psrlq, _mm256_srl_epi64, _mm_srl_epi64)
+	SHIFT_KERNEL(psraw, _mm256_sra_epi16, _mm_sra_epi16)
+	SHIFT_KERNEL(psrad, _mm256_sra_epi32, _mm_sra_epi32)
+
+	#undef INT_KERNEL
+	#undef FLT_KERNEL
+	#undef SHIFT_KERNEL
+	#undef AVX2
+
+	void install_avx2(KernelTable& t)
+	{
+		t.name = "avx2";
+
+		auto set = [&t](Binary k, BinaryKernel fn) { t.binary[static_cast<size_t>(k)] = fn; };
+		auto shf = [&t](Shift k, ShiftKernel fn) { t.shift[static_cast<size_t>(k)] = fn; };
+
+		set(Binary::PADDB, &paddb);
+		set(Binary::PADDW, &paddw);
+		set(Binary::PADDD, &paddd);
+		set(Binary::PADDQ, &paddq);
+		set(Binary::PSUBB, &psubb);
+		set(Binary::PSUBW, &psubw);
+		set(Binary::PSUBD, &psubd);
+		set(Binary::PSUBQ, &psubq);
+		set(Binary::PADDSB, &paddsb);
+		set(Binary::PADDSW, &paddsw);
+		set(Binary::PADDUSB, &paddusb);
+		set(Binary::PADDUSW, &paddusw);
+		set(Binary::PSUBSB, &psubsb);
+		set(Binary::PSUBSW, &psubsw);
+		set(Binary::PSUBUSB, &psubusb);
+		set(Binary::PSUBUSW, &psubusw);
+		set(Binary::PAND, &pand);
+		set(Binary::PANDN, &pandn);
+		set(Binary::POR, &por);
+		set(Binary::PXOR, &pxor);
+		set(Binary::PCMPEQB, &pcmpeqb);
+		set(Binary::PCMPEQW, &pcmpeqw);
+		set(Binary::PCMPEQD, &pcmpeqd);
+		set(Binary::PCMPEQQ, &pcmpeqq);
+		set(Binary::PCMPGTB, &pcmpgtb);
+		set(Binary::PCMPGTW, &pcmpgtw);
+		set(Binary::PCMPGTD, &pcmpgtd);
+		set(Binary::PCMPGTQ, &pcmpgtq);
+		set(Binary::PMULLW, &pmullw);
+		set(Binary::PMULHW, &pmulhw);
+		set(Binary::PMULHUW, &pmulhuw);
+		set(Binary::PMULUDQ, &pmuludq);
+		set(Binary::PMULLD, &pmulld);
+		set(Binary::PMINUB, &pminub);
+		set(Binary::PMINUW, &pminuw);
+		set(Binary::PMINUD, &pminud);
+		set(Binary::PMINSB, &pminsb);
+		set(Binary::PMINSW, &pminsw);
+		set(Binary::PMINSD, &pminsd);
+		set(Binary::PMAXUB, &pmaxub);
+		set(Binary::PMAXUW, &pmaxuw);
+		set(Binary::PMAXUD, &pmaxud);
+		set(Binary::PMAXSB, &pmaxsb);
+		set(Binary::PMAXSW, &pmaxsw);
+		set(Binary::PMAXSD, &pmaxsd);
+		set(Binary::PAVGB, &pavgb);
+		set(Binary::PAVGW, &pavgw);
+
+		set(Binary::ADDPS, &addps);
+		set(Binary::SUBPS, &subps);
+		set(Binary::MULPS, &mulps);
+		set(Binary::DIVPS, &divps);
+		set(Binary::MINPS, &minps);
+		set(Binary::MAXPS, &maxps);
+		set(Binary::SQRTPS, &sqrtps);
+		set(Binary::ADDPD, &addpd);
+		set(Binary::SUBPD, &subpd);
+		set(Binary::MULPD, &mulpd);
+		set(Binary::DIVPD, &divpd);
+		set(Binary::MINPD, &minpd);
+		set(Binary::MAXPD, &maxpd);
+		set(Binary::SQRTPD, &sqrtpd);
+
+		shf(Shift::PSLLW, &psllw);
+		shf(Shift::PSLLD, &pslld);
+		shf(Shift::PSLLQ, &psllq);
+		shf(Shift::PSRLW, &psrlw);
+		shf(Shift::PSRLD, &psrld);
+		shf(Shift::PSRLQ, &psrlq);
+		shf(Shift::PSRAW, &psraw);
+		shf(Shift::PSRAD, &psrad);
+	}
+}
+
+#else
+
+namespace z86::simd
+{
+	void install_avx2(KernelTable& t) { }
+}
+
+#endif
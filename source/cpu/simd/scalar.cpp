@@ -0,0 +1,307 @@
+// scalar.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#include "cpu/simd.h"
+
+namespace z86::simd
+{
+	template <typename T, typename Fn>
+	static inline void lanes(uint8_t* dst, const uint8_t* a, const uint8_t* b, size_t bytes, Fn fn)
+	{
+		for(size_t i = 0; i < bytes; i += sizeof(T))
+		{
+			T x; memcpy(&x, a + i, sizeof(T));
+			T y; memcpy(&y, b + i, sizeof(T));
+
+			T r = fn(x, y);
+			memcpy(dst + i, &r, sizeof(T));
+		}
+	}
+
+	template <typename T>
+	static inline T saturate(int64_t x)
+	{
+		if(x < std::numeric_limits<T>::min()) return std::numeric_limits<T>::min();
+		if(x > std::numeric_limits<T>::max()) return std::numeric_limits<T>::max();
+		return static_cast<T>(x);
+	}
+
+	template <typename T>
+	static inline T mask(bool x)
+	{
+		return x ? static_cast<T>(~static_cast<T>(0)) : 0;
+	}
+
+	// x86 min/max return the second operand if either one is a NaN (or if both are zero),
+	// which is *not* what std::fmin and friends do.
+	template <typename T> static inline T fmin_x86(T a, T b) { return a < b ? a : b; }
+	template <typename T> static inline T fmax_x86(T a, T b) { return a > b ? a : b; }
+
+	template <typename T>
+	static void add(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<T>(d, a, b, n, [](T x, T y) -> T { return x + y; });
+	}
+
+	template <typename T>
+	static void sub(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<T>(d, a, b, n, [](T x, T y) -> T { return x - y; });
+	}
+
+	template <typename T>
+	static void adds(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<T>(d, a, b, n, [](T x, T y) -> T { return saturate<T>(int64_t(x) + int64_t(y)); });
+	}
+
+	template <typename T>
+	static void subs(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<T>(d, a, b, n, [](T x, T y) -> T { return saturate<T>(int64_t(x) - int64_t(y)); });
+	}
+
+	template <typename T>
+	static void cmpeq(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<T>(d, a, b, n, [](T x, T y) -> T { return mask<T>(x == y); });
+	}
+
+	template <typename T>
+	static void cmpgt(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		using S = std::make_signed_t<T>;
+		lanes<T>(d, a, b, n, [](T x, T y) -> T { return mask<T>(S(x) > S(y)); });
+	}
+
+	template <typename T>
+	static void min(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<T>(d, a, b, n, [](T x, T y) -> T { return x < y ? x : y; });
+	}
+
+	template <typename T>
+	static void max(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<T>(d, a, b, n, [](T x, T y) -> T { return x > y ? x : y; });
+	}
+
+	template <typename T>
+	static void avg(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<T>(d, a, b, n, [](T x, T y) -> T { return static_cast<T>((uint32_t(x) + uint32_t(y) + 1) >> 1); });
+	}
+
+	template <typename T>
+	static void mul(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		// a uint16_t would be promoted to (signed) int, and 0xFFFF * 0xFFFF overflows that.
+		lanes<T>(d, a, b, n, [](T x, T y) -> T {
+			if constexpr (std::is_integral_v<T>)
+				return static_cast<T>(uint32_t(x) * uint32_t(y));
+			else
+				return x * y;
+		});
+	}
+
+	template <typename T>
+	static void div(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<T>(d, a, b, n, [](T x, T y) -> T { return x / y; });
+	}
+
+	template <typename T>
+	static void fmin(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<T>(d, a, b, n, [](T x, T y) -> T { return fmin_x86(x, y); });
+	}
+
+	template <typename T>
+	static void fmax(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<T>(d, a, b, n, [](T x, T y) -> T { return fmax_x86(x, y); });
+	}
+
+	template <typename T>
+	static void sqrt(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<T>(d, a, b, n, [](T x, T) -> T { return std::sqrt(x); });
+	}
+
+	static void pand(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<uint64_t>(d, a, b, n, [](uint64_t x, uint64_t y) -> uint64_t { return x & y; });
+	}
+
+	static void pandn(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<uint64_t>(d, a, b, n, [](uint64_t x, uint64_t y) -> uint64_t { return ~x & y; });
+	}
+
+	static void por(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<uint64_t>(d, a, b, n, [](uint64_t x, uint64_t y) -> uint64_t { return x | y; });
+	}
+
+	static void pxor(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<uint64_t>(d, a, b, n, [](uint64_t x, uint64_t y) -> uint64_t { return x ^ y; });
+	}
+
+	static void pmulhw(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<int16_t>(d, a, b, n, [](int16_t x, int16_t y) -> int16_t { return (int32_t(x) * int32_t(y)) >> 16; });
+	}
+
+	static void pmulhuw(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<uint16_t>(d, a, b, n, [](uint16_t x, uint16_t y) -> uint16_t { return (uint32_t(x) * uint32_t(y)) >> 16; });
+	}
+
+	static void pmuludq(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)
+	{
+		lanes<uint64_t>(d, a, b, n, [](uint64_t x, uint64_t y) -> uint64_t {
+			return uint64_t(uint32_t(x)) * uint64_t(uint32_t(y));
+		});
+	}
+
+
+
+	template <typename T>
+	static void shift_left(uint8_t* d, const uint8_t* a, uint64_t count, size_t n)
+	{
+		lanes<T>(d, a, a, n, [count](T x, T) -> T { return count >= sizeof(T) * 8 ? 0 : T(x << count); });
+	}
+
+	template <typename T>
+	static void shift_right(uint8_t* d, const uint8_t* a, uint64_t count, size_t n)
+	{
+		lanes<T>(d, a, a, n, [count](T x, T) -> T { return count >= sizeof(T) * 8 ? 0 : T(x >> count); });
+	}
+
+	template <typename T>
+	static void shift_right_arith(uint8_t* d, const uint8_t* a, uint64_t count, size_t n)
+	{
+		// arithmetic shifts saturate the count instead of producing 0.
+		using S = std::make_signed_t<T>;
+		auto c = std::min<uint64_t>(count, sizeof(T) * 8 - 1);
+		lanes<T>(d, a, a, n, [c](T x, T) -> T { return T(S(x) >> c); });
+	}
+
+	static void pslldq(uint8_t* d, const uint8_t* a, uint64_t count, size_t n)
+	{
+		for(size_t lane = 0; lane < n; lane += 16)
+		{
+			uint8_t tmp[16] = { };
+			for(size_t i = count; i < 16; i++)
+				tmp[i] = a[lane + i - count];
+
+			memcpy(d + lane, tmp, 16);
+		}
+	}
+
+	static void psrldq(uint8_t* d, const uint8_t* a, uint64_t count, size_t n)
+	{
+		for(size_t lane = 0; lane < n; lane += 16)
+		{
+			uint8_t tmp[16] = { };
+			for(size_t i = 0; i + count < 16; i++)
+				tmp[i] = a[lane + i + count];
+
+			memcpy(d + lane, tmp, 16);
+		}
+	}
+
+	void install_scalar(KernelTable& t)
+	{
+		t.name = "scalar";
+
+		auto set = [&t](Binary k, BinaryKernel fn) { t.binary[static_cast<size_t>(k)] = fn; };
+		auto shf = [&t](Shift k, ShiftKernel fn) { t.shift[static_cast<size_t>(k)] = fn; };
+
+		set(Binary::PADDB, &add<uint8_t>);
+		set(Binary::PADDW, &add<uint16_t>);
+		set(Binary::PADDD, &add<uint32_t>);
+		set(Binary::PADDQ, &add<uint64_t>);
+		set(Binary::PSUBB, &sub<uint8_t>);
+		set(Binary::PSUBW, &sub<uint16_t>);
+		set(Binary::PSUBD, &sub<uint32_t>);
+		set(Binary::PSUBQ, &sub<uint64_t>);
+
+		set(Binary::PADDSB, &adds<int8_t>);
+		set(Binary::PADDSW, &adds<int16_t>);
+		set(Binary::PADDUSB, &adds<uint8_t>);
+		set(Binary::PADDUSW, &adds<uint16_t>);
+		set(Binary::PSUBSB, &subs<int8_t>);
+		set(Binary::PSUBSW, &subs<int16_t>);
+		set(Binary::PSUBUSB, &subs<uint8_t>);
+		set(Binary::PSUBUSW, &subs<uint16_t>);
+
+		set(Binary::PAND, &pand);
+		set(Binary::PANDN, &pandn);
+		set(Binary::POR, &por);
+		set(Binary::PXOR, &pxor);
+
+		set(Binary::PCMPEQB, &cmpeq<uint8_t>);
+		set(Binary::PCMPEQW, &cmpeq<uint16_t>);
+		set(Binary::PCMPEQD, &cmpeq<uint32_t>);
+		set(Binary::PCMPEQQ, &cmpeq<uint64_t>);
+		set(Binary::PCMPGTB, &cmpgt<uint8_t>);
+		set(Binary::PCMPGTW, &cmpgt<uint16_t>);
+		set(Binary::PCMPGTD, &cmpgt<uint32_t>);
+		set(Binary::PCMPGTQ, &cmpgt<uint64_t>);
+
+		set(Binary::PMULLW, &mul<uint16_t>);
+		set(Binary::PMULLD, &mul<uint32_t>);
+		set(Binary::PMULHW, &pmulhw);
+		set(Binary::PMULHUW, &pmulhuw);
+		set(Binary::PMULUDQ, &pmuludq);
+
+		set(Binary::PMINUB, &min<uint8_t>);
+		set(Binary::PMINUW, &min<uint16_t>);
+		set(Binary::PMINUD, &min<uint32_t>);
+		set(Binary::PMINSB, &min<int8_t>);
+		set(Binary::PMINSW, &min<int16_t>);
+		set(Binary::PMINSD, &min<int32_t>);
+		set(Binary::PMAXUB, &max<uint8_t>);
+		set(Binary::PMAXUW, &max<uint16_t>);
+		set(Binary::PMAXUD, &max<uint32_t>);
+		set(Binary::PMAXSB, &max<int8_t>);
+		set(Binary::PMAXSW, &max<int16_t>);
+		set(Binary::PMAXSD, &max<int32_t>);
+		set(Binary::PAVGB, &avg<uint8_t>);
+		set(Binary::PAVGW, &avg<uint16_t>);
+
+		set(Binary::ADDPS, &add<float>);
+		set(Binary::SUBPS, &sub<float>);
+		set(Binary::MULPS, &mul<float>);
+		set(Binary::DIVPS, &div<float>);
+		set(Binary::MINPS, &fmin<float>);
+		set(Binary::MAXPS, &fmax<float>);
+		set(Binary::SQRTPS, &sqrt<float>);
+		set(Binary::ADDPD, &add<double>);
+		set(Binary::SUBPD, &sub<double>);
+		set(Binary::MULPD, &mul<double>);
+		set(Binary::DIVPD, &div<double>);
+		set(Binary::MINPD, &fmin<double>);
+		set(Binary::MAXPD, &fmax<double>);
+		set(Binary::SQRTPD, &sqrt<double>);
+
+		shf(Shift::PSLLW, &shift_left<uint16_t>);
+		shf(Shift::PSLLD, &shift_left<uint32_t>);
+		shf(Shift::PSLLQ, &shift_left<uint64_t>);
+		shf(Shift::PSRLW, &shift_right<uint16_t>);
+		shf(Shift::PSRLD, &shift_right<uint32_t>);
+		shf(Shift::PSRLQ, &shift_right<uint64_t>);
+		shf(Shift::PSRAW, &shift_right_arith<uint16_t>);
+		shf(Shift::PSRAD, &shift_right_arith<uint32_t>);
+		shf(Shift::PSLLDQ, &pslldq);
+		shf(Shift::PSRLDQ, &psrldq);
+	}
+}
@@ -0,0 +1,31 @@
+// simd.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "defs.h"
+#include "cpu/simd.h"
+
+namespace z86::simd
+{
+	static KernelTable make_table()
+	{
+		auto table = KernelTable();
+		install_scalar(table);
+
+	#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+
+		if(__builtin_cpu_supports("sse2")) install_sse2(table);
+		if(__builtin_cpu_supports("avx2")) install_avx2(table);
+	#endif
+
+		lg::dbglog("simd", "using {} kernels", table.name);
+		return table;
+	}
+
+	const KernelTable& kernels()
+	{
+		static const KernelTable table = make_table();
+		return table;
+	}
+}
@@ -0,0 +1,195 @@
+// sse2.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "cpu/simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <emmintrin.h>
+
+namespace z86::simd
+{
+	// sse2 is baseline on x86_64, so this can be compiled without any target attributes.
+	// kernels that need sse4.1 or later (pmulld, pminsb, pcmpeqq, ...) are not overridden
+	// here, and stay on the scalar path unless the avx2 backend is installed.
+
+	#define INT_KERNEL(name, intrin)                                                        \
+		static void name(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)          \
+		{                                                                                   \
+			for(size_t i = 0; i < n; i += 16)                                               \
+			{                                                                               \
+				auto x = _mm_load_si128(reinterpret_cast<const __m128i*>(a + i));           \
+				auto y = _mm_load_si128(reinterpret_cast<const __m128i*>(b + i));           \
+				_mm_store_si128(reinterpret_cast<__m128i*>(d + i), intrin(x, y));           \
+			}                                                                               \
+		}
+
+	#define FLT_KERNEL(name, type, suffix, intrin)                                          \
+		static void name(uint8_t* d, const uint8_t* a, const uint8_t* b, size_t n)          \
+		{                                                                                   \
+			for(size_t i = 0; i < n; i += 16)                                               \
+			{                                                                               \
+				auto x = _mm_load_##suffix(reinterpret_cast<const type*>(a + i));           \
+				auto y = _mm_load_##suffix(reinterpret_cast<const type*>(b + i));           \
+				_mm_store_##suffix(reinterpret_cast<type*>(d + i), intrin(x, y));           \
+			}                                                                               \
+		}
+
+	#define SHIFT_KERNEL(name, intrin)                                                      \
+		static void name(uint8_t* d, const uint8_t* a, uint64_t count, size_t n)            \
+		{                                                                                   \
+			auto c = _mm_set_epi64x(0, static_cast<int64_t>(count));                        \
+			for(size_t i = 0; i < n; i += 16)                                               \
+			{                                                                               \
+				auto x = _mm_load_si128(reinterpret_cast<const __m128i*>(a + i));           \
+				_mm_store_si128(reinterpret_cast<__m128i*>(d + i), intrin(x, c));           \
+			}                                                                               \
+		}
+
+	static inline __m128 sqrt_ps(__m128 a, __m128)      { return _mm_sqrt_ps(a); }
+	static inline __m128d sqrt_pd(__m128d a, __m128d)   { return _mm_sqrt_pd(a); }
+
+	INT_KERNEL(paddb, _mm_add_epi8)
+	INT_KERNEL(paddw, _mm_add_epi16)
+	INT_KERNEL(paddd, _mm_add_epi32)
+	INT_KERNEL(paddq, _mm_add_epi64)
+	INT_KERNEL(psubb, _mm_sub_epi8)
+	INT_KERNEL(psubw, _mm_sub_epi16)
+	INT_KERNEL(psubd, _mm_sub_epi32)
+	INT_KERNEL(psubq, _mm_sub_epi64)
+	INT_KERNEL(paddsb, _mm_adds_epi8)
+	INT_KERNEL(paddsw, _mm_adds_epi16)
+	INT_KERNEL(paddusb, _mm_adds_epu8)
+	INT_KERNEL(paddusw, _mm_adds_epu16)
+	INT_KERNEL(psubsb, _mm_subs_epi8)
+	INT_KERNEL(psubsw, _mm_subs_epi16)
+	INT_KERNEL(psubusb, _mm_subs_epu8)
+	INT_KERNEL(psubusw, _mm_subs_epu16)
+	INT_KERNEL(pand, _mm_and_si128)
+	INT_KERNEL(pandn, _mm_andnot_si128)
+	INT_KERNEL(por, _mm_or_si128)
+	INT_KERNEL(pxor, _mm_xor_si128)
+	INT_KERNEL(pcmpeqb, _mm_cmpeq_epi8)
+	INT_KERNEL(pcmpeqw, _mm_cmpeq_epi16)
+	INT_KERNEL(pcmpeqd, _mm_cmpeq_epi32)
+	INT_KERNEL(pcmpgtb, _mm_cmpgt_epi8)
+	INT_KERNEL(pcmpgtw, _mm_cmpgt_epi16)
+	INT_KERNEL(pcmpgtd, _mm_cmpgt_epi32)
+	INT_KERNEL(pmullw, _mm_mullo_epi16)
+	INT_KERNEL(pmulhw, _mm_mulhi_epi16)
+	INT_KERNEL(pmulhuw, _mm_mulhi_epu16)
+	INT_KERNEL(pmuludq, _mm_mul_epu32)
+	INT_KERNEL(pminub, _mm_min_epu8)
+	INT_KERNEL(pminsw, _mm_min_epi16)
+	INT_KERNEL(pmaxub, _mm_max_epu8)
+	INT_KERNEL(pmaxsw, _mm_max_epi16)
+	INT_KERNEL(pavgb, _mm_avg_epu8)
+	INT_KERNEL(pavgw, _mm_avg_epu16)
+
+	FLT_KERNEL(addps, float, ps, _mm_add_ps)
+	FLT_KERNEL(subps, float, ps, _mm_sub_ps)
+	FLT_KERNEL(mulps, float, ps, _mm_mul_ps)
+	FLT_KERNEL(divps, float, ps, _mm_div_ps)
+	FLT_KERNEL(minps, float, ps, _mm_min_ps)
+	FLT_KERNEL(maxps, float, ps, _mm_max_ps)
+	FLT_KERNEL(sqrtps, float, ps, sqrt_ps)
+	FLT_KERNEL(addpd, double, pd, _mm_add_pd)
+	FLT_KERNEL(subpd, double, pd, _mm_sub_pd)
+	FLT_KERNEL(mulpd, double, pd, _mm_mul_pd)
+	FLT_KERNEL(divpd, double, pd, _mm_div_pd)
+	FLT_KERNEL(minpd, double, pd, _mm_min_pd)
+	FLT_KERNEL(maxpd, double, pd, _mm_max_pd)
+	FLT_KERNEL(sqrtpd, double, pd, sqrt_pd)
+
+	SHIFT_KERNEL(psllw, _mm_sll_epi16)
+	SHIFT_KERNEL(pslld, _mm_sll_epi32)
+	SHIFT_KERNEL(psllq, _mm_sll_epi64)
+	SHIFT_KERNEL(psrlw, _mm_srl_epi16)
+	SHIFT_KERNEL(psrld, _mm_srl_epi32)
+	SHIFT_KERNEL(psrlq, _mm_srl_epi64)
+	SHIFT_KERNEL(psraw, _mm_sra_epi16)
+	SHIFT_KERNEL(psrad, _mm_sra_epi32)
+
+	#undef INT_KERNEL
+	#undef FLT_KERNEL
+	#undef SHIFT_KERNEL
+
+	void install_sse2(KernelTable& t)
+	{
+		t.name = "sse2";
+
+		auto set = [&t](Binary k, BinaryKernel fn) { t.binary[static_cast<size_t>(k)] = fn; };
+		auto shf = [&t](Shift k, ShiftKernel fn) { t.shift[static_cast<size_t>(k)] = fn; };
+
+		set(Binary::PADDB, &paddb);
+		set(Binary::PADDW, &paddw);
+		set(Binary::PADDD, &paddd);
+		set(Binary::PADDQ, &paddq);
+		set(Binary::PSUBB, &psubb);
+		set(Binary::PSUBW, &psubw);
+		set(Binary::PSUBD, &psubd);
+		set(Binary::PSUBQ, &psubq);
+		set(Binary::PADDSB, &paddsb);
+		set(Binary::PADDSW, &paddsw);
+		set(Binary::PADDUSB, &paddusb);
+		set(Binary::PADDUSW, &paddusw);
+		set(Binary::PSUBSB, &psubsb);
+		set(Binary::PSUBSW, &psubsw);
+		set(Binary::PSUBUSB, &psubusb);
+		set(Binary::PSUBUSW, &psubusw);
+		set(Binary::PAND, &pand);
+		set(Binary::PANDN, &pandn);
+		set(Binary::POR, &por);
+		set(Binary::PXOR, &pxor);
+		set(Binary::PCMPEQB, &pcmpeqb);
+		set(Binary::PCMPEQW, &pcmpeqw);
+		set(Binary::PCMPEQD, &pcmpeqd);
+		set(Binary::PCMPGTB, &pcmpgtb);
+		set(Binary::PCMPGTW, &pcmpgtw);
+		set(Binary::PCMPGTD, &pcmpgtd);
+		set(Binary::PMULLW, &pmullw);
+		set(Binary::PMULHW, &pmulhw);
+		set(Binary::PMULHUW, &pmulhuw);
+		set(Binary::PMULUDQ, &pmuludq);
+		set(Binary::PMINUB, &pminub);
+		set(Binary::PMINSW, &pminsw);
+		set(Binary::PMAXUB, &pmaxub);
+		set(Binary::PMAXSW, &pmaxsw);
+		set(Binary::PAVGB, &pavgb);
+		set(Binary::PAVGW, &pavgw);
+
+		set(Binary::ADDPS, &addps);
+		set(Binary::SUBPS, &subps);
+		set(Binary::MULPS, &mulps);
+		set(Binary::DIVPS, &divps);
+		set(Binary::MINPS, &minps);
+		set(Binary::MAXPS, &maxps);
+		set(Binary::SQRTPS, &sqrtps);
+		set(Binary::ADDPD, &addpd);
+		set(Binary::SUBPD, &subpd);
+		set(Binary::MULPD, &mulpd);
+		set(Binary::DIVPD, &divpd);
+		set(Binary::MINPD, &minpd);
+		set(Binary::MAXPD, &maxpd);
+		set(Binary::SQRTPD, &sqrtpd);
+
+		shf(Shift::PSLLW, &psllw);
+		shf(Shift::PSLLD, &pslld);
+		shf(Shift::PSLLQ, &psllq);
+		shf(Shift::PSRLW, &psrlw);
+		shf(Shift::PSRLD, &psrld);
+		shf(Shift::PSRLQ, &psrlq);
+		shf(Shift::PSRAW, &psraw);
+		shf(Shift::PSRAD, &psrad);
+	}
+}
+
+#else
+
+namespace z86::simd
+{
+	void install_sse2(KernelTable& t) { }
+}
+
+#endif
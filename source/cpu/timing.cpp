@@ -0,0 +1,474 @@
+// timing.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "defs.h"
+#include "cpu/timing.h"
+
+namespace z86
+{
+	using Operand = instrad::x86::Operand;
+	using MemoryRef = instrad::x86::MemoryRef;
+	using Instruction = instrad::x86::Instruction;
+
+	namespace regs = instrad::x86::regs;
+	namespace ops = instrad::x86::ops;
+
+	// cycles on the 8086, 80186 and 80386, in that order. for the 8086, forms with a memory
+	// operand don't include the effective address.
+	struct Row
+	{
+		uint16_t c[3];
+	};
+
+	// the forms of a two-operand instruction, as laid out in intel's tables.
+	struct Forms
+	{
+		Row rr;     // reg, reg
+		Row rm;     // reg, mem
+		Row mr;     // mem, reg
+		Row ri;     // reg, imm
+		Row mi;     // mem, imm
+	};
+
+	constexpr auto ALU  = Forms { { 3, 3, 2 }, { 9, 10, 6 }, { 16, 10, 7 }, { 4, 4, 2 }, { 17, 16, 7 } };
+	constexpr auto CMP  = Forms { { 3, 3, 2 }, { 9, 10, 6 }, { 9, 10, 5 },  { 4, 3, 2 }, { 10, 10, 5 } };
+	constexpr auto TEST = Forms { { 3, 3, 2 }, { 9, 10, 5 }, { 9, 10, 5 },  { 5, 4, 2 }, { 11, 10, 5 } };
+	constexpr auto MOV  = Forms { { 2, 2, 2 }, { 8, 12, 4 }, { 9, 9, 2 },   { 4, 4, 2 }, { 10, 12, 2 } };
+
+	// the 80486's, as none of the others have them.
+	constexpr auto XADD     = Forms { { 3, 3, 3 }, { 4, 4, 4 }, { 4, 4, 4 }, { 3, 3, 3 }, { 4, 4, 4 } };
+	constexpr auto CMPXCHG  = Forms { { 6, 6, 6 }, { 7, 7, 7 }, { 7, 7, 7 }, { 6, 6, 6 }, { 7, 7, 7 } };
+
+	// the forms of a multiply or divide, by the size of the operand, averaged over the range that
+	// depends on the values. the 8086 and 80186 don't have 32-bit operands; they're given the
+	// 16-bit times.
+	struct Sizes
+	{
+		Row r8, r16, r32;
+		Row m8, m16, m32;
+	};
+
+	constexpr auto MUL  = Sizes { { 74, 27, 12 },  { 126, 36, 17 }, { 126, 36, 24 }, { 80, 33, 15 },  { 132, 42, 20 }, { 132, 42, 27 } };
+	constexpr auto IMUL = Sizes { { 89, 27, 12 },  { 141, 36, 17 }, { 141, 36, 24 }, { 95, 33, 15 },  { 147, 42, 20 }, { 147, 42, 27 } };
+	constexpr auto DIV  = Sizes { { 85, 29, 14 },  { 153, 38, 22 }, { 153, 38, 38 }, { 91, 35, 17 },  { 159, 44, 25 }, { 159, 44, 41 } };
+	constexpr auto IDIV = Sizes { { 107, 48, 19 }, { 175, 57, 27 }, { 175, 57, 43 }, { 113, 54, 22 }, { 181, 63, 30 }, { 181, 63, 46 } };
+
+	// a string instruction on its own, and with a REP prefix: the cycles to start, and then the
+	// cycles for each repetition.
+	struct Strings
+	{
+		Row once;
+		Row rep;
+		Row per;
+	};
+
+	constexpr auto MOVS = Strings { { 18, 9, 7 },   { 9, 8, 7 }, { 17, 8, 4 } };
+	constexpr auto STOS = Strings { { 11, 10, 4 },  { 9, 6, 5 }, { 10, 9, 5 } };
+	constexpr auto LODS = Strings { { 12, 10, 5 },  { 9, 6, 5 }, { 13, 11, 5 } };
+	constexpr auto CMPS = Strings { { 22, 22, 10 }, { 9, 5, 5 }, { 22, 22, 9 } };
+	constexpr auto SCAS = Strings { { 15, 15, 7 },  { 9, 5, 5 }, { 15, 15, 8 } };
+
+	// for anything that isn't in the tables.
+	constexpr auto SIMPLE = Row { 3, 3, 2 };
+
+
+	// the 8086's effective address calculation.
+	static uint32_t ea_8086(const MemoryRef& mem)
+	{
+		auto& base = mem.base();
+		auto& index = mem.index();
+
+		// [bp] can only be encoded with a displacement (of zero).
+		bool disp = (mem.displacement() != 0) || (base == regs::BP && !index.present());
+
+		uint32_t cycles = 0;
+		if(!base.present() && !index.present())
+		{
+			cycles = 6;
+		}
+		else if(base.present() && index.present())
+		{
+			bool fast = (base == regs::BP && index == regs::DI) || (base == regs::BX && index == regs::SI);
+			cycles = (fast ? 7 : 8) + (disp ? 4 : 0);
+		}
+		else
+		{
+			cycles = (disp ? 9 : 5);
+		}
+
+		return cycles + (mem.segment().present() ? 2 : 0);
+	}
+
+	static uint32_t ea_cost(size_t m, const MemoryRef& mem)
+	{
+		if(m == 0)
+			return ea_8086(mem);
+
+		// the 80186 does it in hardware, and the 80386 only needs a cycle for an index.
+		if(m == 2 && mem.base().present() && mem.index().present())
+			return 1;
+
+		return 0;
+	}
+
+	static const MemoryRef* memory_operand(const Instruction& instr)
+	{
+		if(instr.operandCount() >= 1 && instr.dst().isMemory())
+			return &instr.dst().mem();
+
+		if(instr.operandCount() >= 2 && instr.src().isMemory())
+			return &instr.src().mem();
+
+		return nullptr;
+	}
+
+	static bool is_segment(const Operand& op)
+	{
+		return op.isRegister() && op.reg().present() && (op.reg().index() & regs::REG_FLAG_SEGMENT);
+	}
+
+	static uint32_t two_operands(size_t m, const Instruction& instr, const Forms& f)
+	{
+		auto& dst = instr.dst();
+		auto& src = instr.src();
+
+		if(dst.isMemory())
+			return (src.isImmediate() ? f.mi : f.mr).c[m] + ea_cost(m, dst.mem());
+
+		if(src.isMemory())
+			return f.rm.c[m] + ea_cost(m, src.mem());
+
+		return (src.isImmediate() ? f.ri : f.rr).c[m];
+	}
+
+	// reg, mem; the effective address is added for the 8086.
+	static uint32_t one_operand(size_t m, const Operand& op, const Row& reg, const Row& mem)
+	{
+		if(op.isMemory())
+			return mem.c[m] + ea_cost(m, op.mem());
+
+		return reg.c[m];
+	}
+
+	// near relative, near indirect (reg, mem), far direct, far indirect.
+	static uint32_t transfer(size_t m, const Operand& dst, const Row& rel, const Row& reg, const Row& mem,
+		const Row& far, const Row& far_mem)
+	{
+		if(dst.isFarOffset())
+			return dst.far().isMemory() ? far_mem.c[m] + ea_cost(m, dst.far().memory()) : far.c[m];
+
+		if(dst.isRelativeOffset())
+			return rel.c[m];
+
+		return one_operand(m, dst, reg, mem);
+	}
+
+	static int operand_bits(const Operand& op)
+	{
+		if(op.isRegister())
+			return op.reg().width();
+
+		if(op.isMemory())
+			return op.mem().bits();
+
+		return 16;
+	}
+
+	static uint32_t multiply(size_t m, const Operand& op, const Sizes& s)
+	{
+		switch(operand_bits(op))
+		{
+			case 8:     return one_operand(m, op, s.r8, s.m8);
+			case 32:    return one_operand(m, op, s.r32, s.m32);
+			default:    return one_operand(m, op, s.r16, s.m16);
+		}
+	}
+
+	// by 1 (D0, D1), by cl (D2, D3), or by an immediate (C0, C1; not on the 8086). on the 80386,
+	// rotates through the carry take the same time whatever the count.
+	static InstrCost shift(size_t m, const Instruction& instr, bool carry)
+	{
+		auto& dst = instr.dst();
+		auto opcode = instr.mods().opcode;
+
+		if(opcode == 0xD0 || opcode == 0xD1)
+		{
+			return { one_operand(m, dst, carry ? Row { 2, 2, 9 } : Row { 2, 2, 3 },
+				carry ? Row { 15, 15, 10 } : Row { 15, 15, 7 }) };
+		}
+
+		auto base = one_operand(m, dst, carry ? Row { 8, 5, 9 } : Row { 8, 5, 3 },
+			carry ? Row { 20, 17, 10 } : Row { 20, 17, 7 });
+
+		auto per = Row { 4, 1, 0 }.c[m];
+
+		if(opcode == 0xD2 || opcode == 0xD3)
+			return InstrCost { base, 0, per, (m == 0 ? InstrCost::Count::CL : InstrCost::Count::MaskedCL) };
+
+		return { base + per * static_cast<uint32_t>(instr.src().imm() & 0x1F) };
+	}
+
+	// movs and cmps share their mnemonics (and ops) with sse instructions; only A4-AF are strings.
+	static bool is_string(uint8_t opcode)
+	{
+		return 0xA4 <= opcode && opcode <= 0xAF && opcode != 0xA8 && opcode != 0xA9;
+	}
+
+	static InstrCost string(size_t m, const Instruction& instr, const Strings& s)
+	{
+		if(instr.repPrefix() || instr.repnzPrefix())
+			return InstrCost { s.rep.c[m], 0, s.per.c[m], InstrCost::Count::Rep };
+
+		return { s.once.c[m] };
+	}
+
+	static InstrCost simple(size_t m, const Instruction& instr)
+	{
+		if(auto mem = memory_operand(instr); mem != nullptr)
+			return { SIMPLE.c[m] + ea_cost(m, *mem) };
+
+		return { SIMPLE.c[m] };
+	}
+
+	static InstrCost model_cost(size_t m, const Instruction& instr)
+	{
+		auto& dst = instr.dst();
+		auto& src = instr.src();
+		auto opcode = instr.mods().opcode;
+
+		auto cost = [m](const Row& r) {
+			return InstrCost { r.c[m] };
+		};
+
+		// the taken cost is on top of the not-taken one.
+		auto branch = [m](const Row& not_taken, const Row& taken) {
+			return InstrCost { not_taken.c[m], static_cast<uint32_t>(taken.c[m] - not_taken.c[m]) };
+		};
+
+		switch(instr.op().id())
+		{
+			case ops::ADD.id():
+			case ops::ADC.id():
+			case ops::SUB.id():
+			case ops::SBB.id():
+			case ops::AND.id():
+			case ops::OR.id():
+			case ops::XOR.id():
+				return { two_operands(m, instr, ALU) };
+
+			case ops::CMP.id():     return { two_operands(m, instr, CMP) };
+			case ops::TEST.id():    return { two_operands(m, instr, TEST) };
+			case ops::XADD.id():    return { two_operands(m, instr, XADD) };
+			case ops::CMPXCHG.id(): return { two_operands(m, instr, CMPXCHG) };
+
+			case ops::MOV.id():
+				// to and from the accumulator, with just an address (A0-A3).
+				if(0xA0 <= opcode && opcode <= 0xA3)
+					return cost(opcode < 0xA2 ? Row { 10, 8, 4 } : Row { 10, 9, 2 });
+
+				if(is_segment(dst))
+					return { one_operand(m, src, Row { 2, 2, 2 }, Row { 8, 9, 5 }) };
+
+				if(is_segment(src))
+					return { one_operand(m, dst, Row { 2, 2, 2 }, Row { 9, 11, 2 }) };
+
+				return { two_operands(m, instr, MOV) };
+
+			case ops::INC.id():
+			case ops::DEC.id():
+				// the 8086 has a one-byte form for 16-bit registers only.
+				if(dst.isRegister() && dst.reg().width() == 8)
+					return cost(Row { 3, 3, 2 });
+
+				return { one_operand(m, dst, Row { 2, 3, 2 }, Row { 15, 15, 6 }) };
+
+			case ops::PUSH.id():
+				if(is_segment(dst))
+					return cost(Row { 10, 9, 2 });
+
+				if(dst.isImmediate())
+					return cost(Row { 11, 10, 2 });
+
+				return { one_operand(m, dst, Row { 11, 10, 2 }, Row { 16, 16, 5 }) };
+
+			case ops::POP.id():
+				if(is_segment(dst))
+					return cost(Row { 8, 8, 7 });
+
+				return { one_operand(m, dst, Row { 8, 10, 4 }, Row { 17, 20, 5 }) };
+
+			case ops::XCHG.id():
+				if(dst.isMemory() || src.isMemory())
+					return { ea_cost(m, *memory_operand(instr)) + Row { 17, 17, 5 }.c[m] };
+
+				// the one-byte form, with the accumulator.
+				if(0x91 <= opcode && opcode <= 0x97)
+					return cost(Row { 3, 3, 3 });
+
+				return cost(Row { 4, 4, 3 });
+
+			case ops::MUL.id():     return { multiply(m, dst, MUL) };
+			case ops::DIV.id():     return { multiply(m, dst, DIV) };
+			case ops::IDIV.id():    return { multiply(m, dst, IDIV) };
+
+			case ops::IMUL.id():
+				// the two- and three-operand forms are the 80186's (with an immediate) and the
+				// 80386's; the 8086 is given the 80186's time.
+				if(instr.operandCount() >= 2)
+					return { one_operand(m, src, Row { 24, 24, 17 }, Row { 31, 31, 20 }) };
+
+				return { multiply(m, dst, IMUL) };
+
+			case ops::ROL.id():
+			case ops::ROR.id():
+			case ops::SHL.id():
+			case ops::SHR.id():
+			case ops::SAL.id():
+			case ops::SAR.id():
+				return shift(m, instr, /* carry: */ false);
+
+			case ops::RCL.id():
+			case ops::RCR.id():
+				return shift(m, instr, /* carry: */ true);
+
+			case ops::NEG.id():
+			case ops::NOT.id():
+				return { one_operand(m, dst, Row { 3, 3, 2 }, Row { 16, 10, 6 }) };
+
+			case ops::LEA.id():
+				return { one_operand(m, src, Row { 2, 6, 2 }, Row { 2, 6, 2 }) };
+
+			case ops::CBW.id():
+			case ops::CWDE.id():    return cost(Row { 2, 2, 3 });
+			case ops::CWD.id():
+			case ops::CDQ.id():     return cost(Row { 5, 4, 2 });
+
+			case ops::MOVSD.id():
+			case ops::CMPSD.id():
+				if(!is_string(opcode))
+					return simple(m, instr);
+
+				return string(m, instr, instr.op() == ops::MOVSD ? MOVS : CMPS);
+
+			case ops::MOVS.id():
+			case ops::MOVSB.id():
+			case ops::MOVSW.id():   return string(m, instr, MOVS);
+			case ops::CMPS.id():
+			case ops::CMPSB.id():
+			case ops::CMPSW.id():   return string(m, instr, CMPS);
+			case ops::STOS.id():
+			case ops::STOSB.id():
+			case ops::STOSW.id():
+			case ops::STOSD.id():   return string(m, instr, STOS);
+			case ops::LODS.id():
+			case ops::LODSB.id():
+			case ops::LODSW.id():
+			case ops::LODSD.id():   return string(m, instr, LODS);
+			case ops::SCAS.id():
+			case ops::SCASB.id():
+			case ops::SCASW.id():
+			case ops::SCASD.id():   return string(m, instr, SCAS);
+
+			case ops::DAA.id():
+			case ops::DAS.id():     return cost(Row { 4, 4, 4 });
+			case ops::AAA.id():
+			case ops::AAS.id():     return cost(Row { 8, 8, 4 });
+			case ops::AAM.id():     return cost(Row { 83, 19, 17 });
+			case ops::AAD.id():     return cost(Row { 60, 15, 19 });
+
+			case ops::JMP.id():
+				return { transfer(m, dst, Row { 15, 14, 7 }, Row { 11, 11, 7 }, Row { 18, 17, 10 },
+					Row { 15, 14, 12 }, Row { 24, 26, 17 }) };
+
+			case ops::CALL.id():
+				return { transfer(m, dst, Row { 19, 15, 7 }, Row { 16, 13, 7 }, Row { 21, 19, 10 },
+					Row { 28, 23, 17 }, Row { 37, 38, 22 }) };
+
+			case ops::RET.id():
+				return cost(instr.operandCount() > 0 ? Row { 12, 18, 10 } : Row { 8, 16, 10 });
+
+			case ops::RETF.id():
+				return cost(instr.operandCount() > 0 ? Row { 17, 25, 18 } : Row { 18, 22, 18 });
+
+			case ops::JO.id():
+			case ops::JNO.id():
+			case ops::JS.id():
+			case ops::JNS.id():
+			case ops::JZ.id():
+			case ops::JNZ.id():
+			case ops::JB.id():
+			case ops::JNB.id():
+			case ops::JA.id():
+			case ops::JNA.id():
+			case ops::JL.id():
+			case ops::JGE.id():
+			case ops::JG.id():
+			case ops::JLE.id():
+			case ops::JP.id():
+			case ops::JNP.id():
+				return branch(Row { 4, 4, 3 }, Row { 16, 13, 7 });
+
+			case ops::JCXZ.id():
+				return branch(Row { 6, 5, 5 }, Row { 18, 16, 9 });
+
+			case ops::LOOP.id():    return branch(Row { 5, 6, 11 }, Row { 17, 16, 11 });
+			case ops::LOOPZ.id():   return branch(Row { 6, 6, 11 }, Row { 18, 16, 11 });
+			case ops::LOOPNZ.id():  return branch(Row { 5, 6, 11 }, Row { 19, 16, 11 });
+
+			// with the port in dx, or as an immediate.
+			case ops::IN.id():
+				return cost(src.isImmediate() ? Row { 10, 10, 12 } : Row { 8, 8, 13 });
+
+			case ops::OUT.id():
+				return cost(dst.isImmediate() ? Row { 10, 9, 10 } : Row { 8, 7, 11 });
+
+			case ops::INT.id():     return cost(Row { 51, 47, 37 });
+			case ops::INT3.id():    return cost(Row { 52, 45, 33 });
+			case ops::INTO.id():    return branch(Row { 4, 4, 3 }, Row { 53, 48, 35 });
+			case ops::IRET.id():    return cost(Row { 24, 28, 22 });
+
+			case ops::STI.id():
+			case ops::CLI.id():     return cost(Row { 2, 2, 3 });
+
+			case ops::CMC.id():
+			case ops::STC.id():
+			case ops::STD.id():
+			case ops::CLC.id():
+			case ops::CLD.id():     return cost(Row { 2, 2, 2 });
+
+			case ops::LAHF.id():    return cost(Row { 4, 2, 2 });
+			case ops::SAHF.id():    return cost(Row { 4, 3, 3 });
+			case ops::PUSHF.id():   return cost(Row { 10, 9, 4 });
+			case ops::POPF.id():    return cost(Row { 8, 8, 5 });
+
+			default:
+				return simple(m, instr);
+		}
+	}
+
+	InstrCost instruction_cost(CPUModel model, const Instruction& instr)
+	{
+		switch(model)
+		{
+			case CPUModel::I8086:   return model_cost(0, instr);
+			case CPUModel::I80186:  return model_cost(1, instr);
+			case CPUModel::I80386:  return model_cost(2, instr);
+
+			case CPUModel::Flat:
+			default:
+				return InstrCost { };
+		}
+	}
+
+	bool parse_cpu_model(const char* name, CPUModel* model)
+	{
+		if(strcmp(name, "flat") == 0)       *model = CPUModel::Flat;
+		else if(strcmp(name, "8086") == 0)  *model = CPUModel::I8086;
+		else if(strcmp(name, "80186") == 0) *model = CPUModel::I80186;
+		else if(strcmp(name, "80386") == 0) *model = CPUModel::I80386;
+		else                                return false;
+
+		return true;
+	}
+}
@@ -0,0 +1,116 @@
+// bench.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include <chrono>
+
+#include "defs.h"
+#include "cpu/cpu.h"
+#include "devices/bench.h"
+
+namespace z86
+{
+	void BenchMarkers::attach(IOPortController& io)
+	{
+		io.attach(BASE_PORT, 3, this);
+	}
+
+	BenchMarkers::Counters BenchMarkers::now()
+	{
+		// the `out` doing the marking has already been counted, but not yet run; the clock is as
+		// of its start, and it makes no memory accesses.
+		auto c = Counters();
+		c.instructions = m_cpu.instructionCount() - 1;
+		c.ticks = m_cpu.scheduler().now();
+		c.nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+		c.accesses = m_cpu.memoryAccessCount();
+
+		return c;
+	}
+
+	void BenchMarkers::begin(uint8_t id)
+	{
+		auto& r = m_regions[id];
+		if(r.open)
+		{
+			lg::warn("bench", "region {} began again at {04x}:{04x} without ending; restarting it", id,
+				m_cpu.cs(), m_cpu.ip());
+		}
+
+		if(r.name.empty() && !m_next_name.empty())
+			r.name = std::move(m_next_name);
+
+		m_next_name.clear();
+
+		r.open = true;
+		r.start = this->now();
+	}
+
+	void BenchMarkers::end(uint8_t id)
+	{
+		auto end = this->now();
+
+		auto& r = m_regions[id];
+		if(!r.open)
+		{
+			lg::warn("bench", "region {} ended at {04x}:{04x} without beginning", id, m_cpu.cs(), m_cpu.ip());
+			return;
+		}
+
+		auto ticks = end.ticks - r.start.ticks;
+
+		r.open = false;
+		r.runs++;
+		r.total.instructions += end.instructions - r.start.instructions;
+		r.total.ticks += ticks;
+		r.total.nanos += end.nanos - r.start.nanos;
+		r.total.accesses += end.accesses - r.start.accesses;
+		r.min_ticks = std::min(r.min_ticks, ticks);
+	}
+
+	void BenchMarkers::summarise()
+	{
+		for(size_t i = 0; i < NUM_REGIONS; i++)
+		{
+			auto& r = m_regions[i];
+			if(r.runs == 0 && !r.open)
+				continue;
+
+			auto name = r.name.empty() ? zpr::sprint("region {}", i) : r.name;
+			if(r.runs == 0)
+			{
+				lg::log("bench", "{}: never ended", name);
+				continue;
+			}
+
+			auto& t = r.total;
+			lg::log("bench", "{}: {} run(s); {} instrs, {} ticks, {} ns, {} mem accesses", name, r.runs,
+				t.instructions, t.ticks, t.nanos, t.accesses);
+
+			if(r.runs > 1)
+			{
+				lg::log("bench", "{}: per run {} instrs, {} ticks (min {}), {} ns, {} mem accesses", name,
+					t.instructions / r.runs, t.ticks / r.runs, r.min_ticks, t.nanos / r.runs, t.accesses / r.runs);
+			}
+
+			if(r.open)
+				lg::log("bench", "{}: still open at the end", name);
+		}
+	}
+
+	uint32_t BenchMarkers::in(uint16_t port, int bits)
+	{
+		return (port == BASE_PORT ? BASE_PORT : 0);
+	}
+
+	void BenchMarkers::out(uint16_t port, int bits, uint32_t value)
+	{
+		switch(port - BASE_PORT)
+		{
+			case 0: this->begin(value & 0xFF); break;
+			case 1: this->end(value & 0xFF); break;
+			case 2: m_next_name += static_cast<char>(value & 0xFF); break;
+		}
+	}
+}
@@ -0,0 +1,537 @@
+// bios.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "defs.h"
+#include "cpu/cpu.h"
+#include "devices/vga.h"
+#include "devices/bios.h"
+#include "devices/disk.h"
+
+namespace z86
+{
+	// the parts of the bios data area that the video services keep up to date.
+	static constexpr uint32_t BDA_VIDEO_MODE    = 0x449;
+	static constexpr uint32_t BDA_COLUMNS       = 0x44A;
+	static constexpr uint32_t BDA_PAGE_SIZE     = 0x44C;
+	static constexpr uint32_t BDA_PAGE_OFFSET   = 0x44E;
+	static constexpr uint32_t BDA_CURSOR        = 0x450;   // one word per page: row in the high byte
+	static constexpr uint32_t BDA_CURSOR_SHAPE  = 0x460;
+	static constexpr uint32_t BDA_ACTIVE_PAGE   = 0x462;
+	static constexpr uint32_t BDA_LAST_ROW      = 0x484;
+
+	static constexpr size_t NUM_PAGES = 8;
+	static constexpr size_t PAGE_SIZE = 0x1000;
+
+	// a day, in ticks of the pit's channel 0 (at its slowest).
+	static constexpr uint64_t TICKS_PER_DAY = 0x1800B0;
+
+	// ud2; iret; nop
+	static constexpr uint8_t TRAP_CODE[BiosHLE::TRAP_SIZE] = { 0x0F, 0x0B, 0xCF, 0x90 };
+
+	BiosHLE::BiosHLE(MemoryController& memory) : m_memory(memory)
+	{
+	}
+
+	bool BiosHLE::select(const char* list)
+	{
+		auto services = std::bitset<256>();
+		if(strcmp(list, "all") == 0)
+		{
+			for(auto v : { VIDEO, DISK, KEYBOARD, TIME })
+				services.set(v);
+		}
+		else
+		{
+			for(const char* p = list; *p; )
+			{
+				char* end = nullptr;
+				auto v = strtoul(p, &end, 16);
+				if(end == p || (*end != ',' && *end != 0))
+					return false;
+
+				if(v != VIDEO && v != DISK && v != KEYBOARD && v != TIME)
+					return false;
+
+				services.set(v);
+				p = (*end == ',' ? end + 1 : end);
+			}
+		}
+
+		m_services = services;
+		return true;
+	}
+
+	void BiosHLE::install()
+	{
+		for(size_t v = 0; v < 256; v++)
+		{
+			if(!m_services.test(v))
+				continue;
+
+			auto ofs = TRAP_OFFSET + v * TRAP_SIZE;
+			m_memory.write(PhysAddr(TRAP_SEGMENT * 16 + ofs), TRAP_CODE, TRAP_SIZE);
+
+			m_memory.write16(PhysAddr(v * 4), ofs);
+			m_memory.write16(PhysAddr(v * 4 + 2), TRAP_SEGMENT);
+		}
+
+		if(m_services.test(VIDEO))
+			this->set_mode(0x03, /* clear: */ true);
+	}
+
+	bool BiosHLE::trap(CPU& cpu)
+	{
+		if(cpu.mode() != CPUMode::Real)
+			return false;
+
+		uint64_t base = TRAP_SEGMENT * 16 + TRAP_OFFSET;
+		auto addr = cpu.cs() * 16 + ((cpu.ip() - 2) & 0xFFFF);
+
+		if(addr < base || addr >= base + 256 * TRAP_SIZE || (addr - base) % TRAP_SIZE != 0)
+			return false;
+
+		auto vector = (addr - base) / TRAP_SIZE;
+		if(!m_services.test(vector))
+			return false;
+
+		auto lk = std::lock_guard<std::mutex>(m_lock);
+		switch(vector)
+		{
+			case VIDEO:     this->video(cpu); break;
+			case DISK:      this->disk(cpu); break;
+			case KEYBOARD:  this->keyboard(cpu); break;
+			case TIME:      this->time(cpu); break;
+			default:        assert(false);
+		}
+
+		return true;
+	}
+
+	// the flags that the trap's iret will restore are at ss:sp+4.
+	static void set_return_flags(CPU& cpu, bool carry)
+	{
+		auto flags = cpu.read16(SegReg::SS, cpu.sp() + 4);
+		cpu.write16(SegReg::SS, cpu.sp() + 4, carry ? (flags | 0x01) : (flags & ~0x01));
+	}
+
+	static void set_return_zero(CPU& cpu, bool zero)
+	{
+		auto flags = cpu.read16(SegReg::SS, cpu.sp() + 4);
+		cpu.write16(SegReg::SS, cpu.sp() + 4, zero ? (flags | 0x40) : (flags & ~0x40));
+	}
+
+	static uint8_t to_bcd(int x)
+	{
+		return ((x / 10) << 4) | (x % 10);
+	}
+
+
+
+	void BiosHLE::set_mode(uint8_t mode, bool clear)
+	{
+		m_memory.write8(PhysAddr(BDA_VIDEO_MODE), mode);
+		m_memory.write16(PhysAddr(BDA_COLUMNS), TEXT_COLUMNS);
+		m_memory.write16(PhysAddr(BDA_PAGE_SIZE), PAGE_SIZE);
+		m_memory.write16(PhysAddr(BDA_PAGE_OFFSET), 0);
+		m_memory.write16(PhysAddr(BDA_CURSOR_SHAPE), 0x0607);
+		m_memory.write8(PhysAddr(BDA_ACTIVE_PAGE), 0);
+		m_memory.write8(PhysAddr(BDA_LAST_ROW), TEXT_ROWS - 1);
+
+		for(size_t i = 0; i < NUM_PAGES; i++)
+			this->set_cursor(i, 0);
+
+		if(clear)
+		{
+			for(size_t i = 0; i < NUM_PAGES * PAGE_SIZE; i += 2)
+				m_memory.write16(PhysAddr(TEXT_BUFFER + i), 0x0720);
+		}
+	}
+
+	// the pages each have a cursor, but the one that's shown is the active page's.
+	void BiosHLE::set_cursor(uint8_t page, uint16_t pos)
+	{
+		page %= NUM_PAGES;
+		m_memory.write16(PhysAddr(BDA_CURSOR + 2 * page), pos);
+
+		if(m_display && page == m_memory.read8(PhysAddr(BDA_ACTIVE_PAGE)))
+			m_display->setCursor(page * PAGE_SIZE / 2 + (pos >> 8) * TEXT_COLUMNS + (pos & 0xFF));
+	}
+
+	void BiosHLE::scroll(uint8_t top, uint8_t left, uint8_t bottom, uint8_t right, int lines, uint8_t attr)
+	{
+		auto page = m_memory.read8(PhysAddr(BDA_ACTIVE_PAGE)) % NUM_PAGES;
+		auto cell = [&](size_t row, size_t col) {
+			return PhysAddr(TEXT_BUFFER + page * PAGE_SIZE + 2 * (row * TEXT_COLUMNS + col));
+		};
+
+		bottom = std::min(bottom, uint8_t(TEXT_ROWS - 1));
+		right = std::min(right, uint8_t(TEXT_COLUMNS - 1));
+		if(top > bottom || left > right)
+			return;
+
+		int height = bottom - top + 1;
+		if(lines == 0 || std::abs(lines) >= height)
+			lines = height;
+
+		// up moves rows towards the top, so it copies from the top down; down is the other way.
+		for(int i = 0; i < height; i++)
+		{
+			size_t row = (lines > 0 ? top + i : bottom - i);
+			int from = int(row) + lines;
+
+			for(size_t col = left; col <= right; col++)
+			{
+				if(from < top || from > bottom)
+					m_memory.write16(cell(row, col), (attr << 8) | ' ');
+				else
+					m_memory.write16(cell(row, col), m_memory.read16(cell(from, col)));
+			}
+		}
+	}
+
+	void BiosHLE::write_chars(uint8_t page, uint8_t ch, int attr, size_t count)
+	{
+		page %= NUM_PAGES;
+
+		auto pos = m_memory.read16(PhysAddr(BDA_CURSOR + 2 * page));
+		auto cell = (pos >> 8) * TEXT_COLUMNS + (pos & 0xFF);
+
+		for(size_t i = 0; i < count && cell + i < TEXT_ROWS * TEXT_COLUMNS; i++)
+		{
+			auto addr = PhysAddr(TEXT_BUFFER + page * PAGE_SIZE + 2 * (cell + i));
+			if(attr < 0)    m_memory.write8(addr, ch);
+			else            m_memory.write16(addr, (attr << 8) | ch);
+		}
+	}
+
+	void BiosHLE::teletype(uint8_t page, uint8_t ch, int attr)
+	{
+		page %= NUM_PAGES;
+
+		auto pos = m_memory.read16(PhysAddr(BDA_CURSOR + 2 * page));
+		size_t row = (pos >> 8);
+		size_t col = (pos & 0xFF);
+
+		switch(ch)
+		{
+			case '\a':  break;
+			case '\b':  if(col > 0) col--; break;
+			case '\r':  col = 0; break;
+			case '\n':  row++; break;
+
+			default:
+				this->write_chars(page, ch, attr, 1);
+				col++;
+				break;
+		}
+
+		if(col >= TEXT_COLUMNS)
+		{
+			col = 0;
+			row++;
+		}
+
+		if(row >= TEXT_ROWS)
+		{
+			this->scroll(0, 0, TEXT_ROWS - 1, TEXT_COLUMNS - 1, 1, 0x07);
+			row = TEXT_ROWS - 1;
+		}
+
+		this->set_cursor(page, (row << 8) | col);
+
+		// the host sees lines, not the carriage returns before them.
+		if(m_display == nullptr && ch != '\r')
+		{
+			fputc(ch, stdout);
+			fflush(stdout);
+		}
+	}
+
+	void BiosHLE::video(CPU& cpu)
+	{
+		auto function = cpu.ah();
+		auto page = cpu.bh();
+
+		switch(function)
+		{
+			// set video mode; only the text modes are supported.
+			case 0x00: {
+				auto mode = cpu.al() & 0x7F;
+				if(mode != 0x02 && mode != 0x03)
+				{
+					lg::warn("bios", "INT 10h: unsupported video mode {02x}", mode);
+					break;
+				}
+
+				this->set_mode(mode, /* clear: */ !(cpu.al() & 0x80));
+				break;
+			}
+
+			case 0x01:
+				m_memory.write16(PhysAddr(BDA_CURSOR_SHAPE), cpu.cx());
+				break;
+
+			case 0x02:
+				this->set_cursor(page, cpu.dx());
+				break;
+
+			case 0x03:
+				cpu.dx() = m_memory.read16(PhysAddr(BDA_CURSOR + 2 * (page % NUM_PAGES)));
+				cpu.cx() = m_memory.read16(PhysAddr(BDA_CURSOR_SHAPE));
+				break;
+
+			// scroll up or down: al = lines (0 clears), bh = attribute for the new lines,
+			// ch, cl = top left, dh, dl = bottom right.
+			case 0x06:
+			case 0x07: {
+				int lines = (function == 0x06 ? cpu.al() : -int(cpu.al()));
+				this->scroll(cpu.ch(), cpu.cl(), cpu.dh(), cpu.dl(), lines, cpu.bh());
+				break;
+			}
+
+			case 0x08: {
+				auto pos = m_memory.read16(PhysAddr(BDA_CURSOR + 2 * (page % NUM_PAGES)));
+				auto cell = (pos >> 8) * TEXT_COLUMNS + (pos & 0xFF);
+				cpu.ax() = m_memory.read16(PhysAddr(TEXT_BUFFER + (page % NUM_PAGES) * PAGE_SIZE + 2 * cell));
+				break;
+			}
+
+			case 0x09:  this->write_chars(page, cpu.al(), cpu.bl(), cpu.cx()); break;
+			case 0x0A:  this->write_chars(page, cpu.al(), -1, cpu.cx()); break;
+
+			// teletype output always goes to the active page.
+			case 0x0E:
+				this->teletype(m_memory.read8(PhysAddr(BDA_ACTIVE_PAGE)), cpu.al(), -1);
+				break;
+
+			case 0x0F:
+				cpu.al() = m_memory.read8(PhysAddr(BDA_VIDEO_MODE));
+				cpu.ah() = TEXT_COLUMNS;
+				cpu.bh() = m_memory.read8(PhysAddr(BDA_ACTIVE_PAGE));
+				break;
+
+			// write string: al bit 0 = move the cursor, bit 1 = the string has (char, attribute)
+			// pairs; bl = attribute, cx = length, dh, dl = where, es:bp = the string.
+			case 0x13: {
+				auto cursor = PhysAddr(BDA_CURSOR + 2 * (page % NUM_PAGES));
+				auto saved = m_memory.read16(cursor);
+				bool attrs = (cpu.al() & 0x02);
+
+				this->set_cursor(page, cpu.dx());
+
+				auto str = PhysAddr(cpu.es() * 16 + cpu.bp());
+				for(size_t i = 0; i < cpu.cx(); i++)
+				{
+					auto ch = m_memory.read8(PhysAddr(str.addr + (attrs ? 2 * i : i)));
+					auto attr = (attrs ? m_memory.read8(PhysAddr(str.addr + 2 * i + 1)) : cpu.bl());
+
+					this->teletype(page, ch, attr);
+				}
+
+				if(!(cpu.al() & 0x01))
+					this->set_cursor(page, saved);
+
+				break;
+			}
+
+			default:
+				lg::warn("bios", "unsupported INT 10h function {02x}", function);
+				break;
+		}
+	}
+
+	void BiosHLE::disk(CPU& cpu)
+	{
+		if(m_disk == nullptr)
+		{
+			cpu.ah() = 0x01;
+			return set_return_flags(cpu, /* carry: */ true);
+		}
+
+		auto call = BlockDevice::BiosCall { };
+		call.regs[BlockDevice::BiosCall::AX] = cpu.ax();
+		call.regs[BlockDevice::BiosCall::BX] = cpu.bx();
+		call.regs[BlockDevice::BiosCall::CX] = cpu.cx();
+		call.regs[BlockDevice::BiosCall::DX] = cpu.dx();
+		call.regs[BlockDevice::BiosCall::SI] = cpu.si();
+		call.regs[BlockDevice::BiosCall::ES] = cpu.es();
+		call.regs[BlockDevice::BiosCall::DS] = cpu.ds();
+
+		m_disk->biosDisk(call);
+
+		cpu.ax() = call.regs[BlockDevice::BiosCall::AX];
+		cpu.bx() = call.regs[BlockDevice::BiosCall::BX];
+		cpu.cx() = call.regs[BlockDevice::BiosCall::CX];
+		cpu.dx() = call.regs[BlockDevice::BiosCall::DX];
+
+		set_return_flags(cpu, call.carry);
+	}
+
+	// just enough of the scan codes (set 1) for what programs tend to look at.
+	static uint8_t scan_code(uint8_t ch)
+	{
+		switch(ch)
+		{
+			case 0x1B:  return 0x01;
+			case '\b':  return 0x0E;
+			case '\t':  return 0x0F;
+			case '\r':  return 0x1C;
+			case ' ':   return 0x39;
+			default:    return 0;
+		}
+	}
+
+	bool BiosHLE::poll_key()
+	{
+		if(m_key >= 0)
+			return true;
+
+		if(m_eof)
+			return false;
+
+		auto pfd = pollfd { .fd = STDIN_FILENO, .events = POLLIN, .revents = 0 };
+		if(poll(&pfd, 1, 0) <= 0)
+			return false;
+
+		uint8_t ch = 0;
+		auto n = read(STDIN_FILENO, &ch, 1);
+		if(n <= 0)
+		{
+			m_eof = true;
+			return false;
+		}
+
+		// the terminal gives us newlines, but the enter key is a carriage return.
+		if(ch == '\n')
+			ch = '\r';
+
+		m_key = (scan_code(ch) << 8) | ch;
+		return true;
+	}
+
+	void BiosHLE::keyboard(CPU& cpu)
+	{
+		auto function = cpu.ah();
+		switch(function)
+		{
+			// wait for a key; without one, run the ud2 again. like a real bios, the wait is done
+			// with interrupts enabled, halted until the next one (usually the timer) so stdin is
+			// only polled once per interrupt. with nothing scheduled, halting would never wake
+			// up, so just spin. at the end of the input, there won't ever be a key, so give back
+			// nothing instead of hanging.
+			case 0x00:
+			case 0x10:
+				if(this->poll_key())
+				{
+					cpu.ax() = m_key;
+					m_key = -1;
+				}
+				else if(m_eof)
+				{
+					cpu.ax() = 0;
+				}
+				else
+				{
+					cpu.jump(cpu.ip() - 2);
+					cpu.flags().setIF(true);
+
+					if(cpu.scheduler().nextDeadline() != Scheduler::NEVER)
+						cpu.halt();
+					else
+						cpu.requestInterruptCheck();
+				}
+				break;
+
+			// is there a key? zf is clear (with it in ax) if there is.
+			case 0x01:
+			case 0x11:
+				if(this->poll_key())
+				{
+					cpu.ax() = m_key;
+					set_return_zero(cpu, false);
+				}
+				else
+				{
+					set_return_zero(cpu, true);
+				}
+				break;
+
+			// shift flags; there aren't any.
+			case 0x02:
+			case 0x12:
+				cpu.al() = 0;
+				break;
+
+			default:
+				lg::warn("bios", "unsupported INT 16h function {02x}", function);
+				break;
+		}
+	}
+
+	void BiosHLE::time(CPU& cpu)
+	{
+		auto function = cpu.ah();
+		auto now = cpu.scheduler().now();
+		auto ticks_per_tick = PIT::TICKS_PER_COUNT * 0x10000;
+
+		switch(function)
+		{
+			// read the tick count into cx:dx; al is set if midnight has passed since the last read.
+			case 0x00: {
+				auto ticks = m_ticks_base + (now - std::min(now, m_ticks_set_at)) / ticks_per_tick;
+				auto days = ticks / TICKS_PER_DAY;
+
+				cpu.al() = (days > m_days_seen ? 1 : 0);
+				m_days_seen = days;
+
+				ticks %= TICKS_PER_DAY;
+				cpu.cx() = (ticks >> 16);
+				cpu.dx() = (ticks & 0xFFFF);
+				break;
+			}
+
+			case 0x01:
+				m_ticks_base = (uint32_t(cpu.cx()) << 16) | cpu.dx();
+				m_ticks_set_at = now;
+				m_days_seen = 0;
+				break;
+
+			// the real-time clock: time in ch, cl, dh (hours, minutes, seconds) and date in ch, cl,
+			// dh, dl (century, year, month, day), all in bcd.
+			case 0x02:
+			case 0x04: {
+				auto host = time_t(cpu.hostTime() / 1'000'000'000);
+				auto tm = (struct tm) { };
+				localtime_r(&host, &tm);
+
+				if(function == 0x02)
+				{
+					cpu.ch() = to_bcd(tm.tm_hour);
+					cpu.cl() = to_bcd(tm.tm_min);
+					cpu.dh() = to_bcd(tm.tm_sec);
+					cpu.dl() = (tm.tm_isdst > 0 ? 1 : 0);
+				}
+				else
+				{
+					cpu.ch() = to_bcd((1900 + tm.tm_year) / 100);
+					cpu.cl() = to_bcd(tm.tm_year % 100);
+					cpu.dh() = to_bcd(tm.tm_mon + 1);
+					cpu.dl() = to_bcd(tm.tm_mday);
+				}
+
+				set_return_flags(cpu, /* carry: */ false);
+				break;
+			}
+
+			default:
+				lg::warn("bios", "unsupported INT 1Ah function {02x}", function);
+				set_return_flags(cpu, /* carry: */ true);
+				break;
+		}
+	}
+}
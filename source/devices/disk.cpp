@@ -0,0 +1,563 @@
+// disk.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "defs.h"
+#include "devices/disk.h"
+
+namespace z86
+{
+	static constexpr char OVERLAY_MAGIC[8] = { 'z', '8', '6', 'o', 'v', 'l', 'a', 'y' };
+	static constexpr uint32_t OVERLAY_VERSION = 1;
+	static constexpr size_t OVERLAY_BITMAP = 0x1000;
+
+	struct OverlayHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t cluster_size;
+		uint64_t base_size;
+		uint64_t clusters;
+		uint64_t data_offset;
+	};
+
+	static size_t round_up(size_t x, size_t align)
+	{
+		return ((x + align - 1) / align) * align;
+	}
+
+	BlockDevice::BlockDevice(MemoryController& memory) : m_memory(memory)
+	{
+	}
+
+	BlockDevice::~BlockDevice()
+	{
+		if(m_image == nullptr)
+			return;
+
+		this->flush();
+
+		if(m_overlay != nullptr)
+		{
+			munmap(m_overlay, m_overlay_size);
+			close(m_overlay_fd);
+		}
+
+		munmap(m_image, m_size);
+		close(m_fd);
+	}
+
+	bool BlockDevice::open(const char* path)
+	{
+		assert(m_image == nullptr);
+		return this->map_image(path, /* readonly: */ false);
+	}
+
+	bool BlockDevice::openWithOverlay(const char* base, const char* overlay)
+	{
+		assert(m_image == nullptr);
+		if(!this->map_image(base, /* readonly: */ true))
+			return false;
+
+		if(!this->map_overlay(overlay))
+		{
+			munmap(m_image, m_size);
+			close(m_fd);
+
+			m_image = nullptr;
+			return false;
+		}
+
+		m_readonly = false;
+		return true;
+	}
+
+	bool BlockDevice::map_image(const char* path, bool readonly)
+	{
+		m_readonly = readonly;
+
+		auto fd = (readonly ? -1 : ::open(path, O_RDWR));
+		if(fd < 0)
+		{
+			fd = ::open(path, O_RDONLY);
+			m_readonly = true;
+		}
+
+		if(fd < 0)
+		{
+			lg::warn("disk", "could not open '{}'", path);
+			return false;
+		}
+
+		struct stat st;
+		if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < SECTOR_SIZE)
+		{
+			lg::warn("disk", "'{}' is not a disk image (it must be at least one sector)", path);
+			close(fd);
+			return false;
+		}
+
+		auto size = static_cast<size_t>(st.st_size);
+		auto ptr = mmap(nullptr, size, PROT_READ | (m_readonly ? 0 : PROT_WRITE), MAP_SHARED, fd, 0);
+		if(ptr == MAP_FAILED)
+		{
+			lg::warn("disk", "could not map '{}'", path);
+			close(fd);
+			return false;
+		}
+
+		if(m_readonly && !readonly)
+			lg::warn("disk", "'{}' is not writable, so the disk is read-only", path);
+
+		m_fd = fd;
+		m_size = size;
+		m_image = reinterpret_cast<uint8_t*>(ptr);
+
+		return true;
+	}
+
+	bool BlockDevice::map_overlay(const char* path)
+	{
+		auto clusters = (m_size + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+		auto bitmap_size = round_up(round_up(clusters, 64) / 8, MemoryController::PAGE_SIZE);
+		auto data_offset = round_up(OVERLAY_BITMAP + bitmap_size, CLUSTER_SIZE);
+		auto size = data_offset + clusters * CLUSTER_SIZE;
+
+		auto fd = ::open(path, O_RDWR | O_CREAT, 0644);
+		if(fd < 0)
+		{
+			lg::warn("disk", "could not open or create the overlay '{}'", path);
+			return false;
+		}
+
+		auto fail = [&](const char* why) -> bool {
+			lg::warn("disk", "overlay '{}': {}", path, why);
+			close(fd);
+			return false;
+		};
+
+		struct stat st;
+		if(fstat(fd, &st) != 0)
+			return fail("could not stat");
+
+		auto header = OverlayHeader { };
+		if(st.st_size == 0)
+		{
+			// a new one. the file is sparse, so this is all that gets written.
+			memcpy(header.magic, OVERLAY_MAGIC, sizeof(header.magic));
+			header.version = OVERLAY_VERSION;
+			header.cluster_size = CLUSTER_SIZE;
+			header.base_size = m_size;
+			header.clusters = clusters;
+			header.data_offset = data_offset;
+
+			if(pwrite(fd, &header, sizeof(header), 0) != sizeof(header) || ftruncate(fd, size) != 0)
+				return fail("could not create");
+		}
+		else
+		{
+			if(pread(fd, &header, sizeof(header), 0) != sizeof(header))
+				return fail("could not read the header");
+
+			if(memcmp(header.magic, OVERLAY_MAGIC, sizeof(header.magic)) != 0 || header.version != OVERLAY_VERSION)
+				return fail("not an overlay");
+
+			if(header.cluster_size != CLUSTER_SIZE || header.clusters != clusters || header.data_offset != data_offset
+				|| static_cast<size_t>(st.st_size) != size)
+				return fail("corrupt header");
+
+			if(header.base_size != m_size)
+				return fail("made for a base image of a different size");
+		}
+
+		auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(ptr == MAP_FAILED)
+			return fail("could not map");
+
+		m_overlay_fd = fd;
+		m_overlay_size = size;
+		m_overlay = reinterpret_cast<uint8_t*>(ptr);
+		m_bitmap = reinterpret_cast<uint64_t*>(m_overlay + OVERLAY_BITMAP);
+		m_clusters = m_overlay + data_offset;
+
+		return true;
+	}
+
+	uint8_t* BlockDevice::locate(size_t ofs, size_t& len, bool write)
+	{
+		if(m_overlay == nullptr)
+			return m_image + ofs;
+
+		auto cluster = ofs / CLUSTER_SIZE;
+		auto within = ofs % CLUSTER_SIZE;
+		len = std::min(len, CLUSTER_SIZE - within);
+
+		auto& word = m_bitmap[cluster / 64];
+		auto bit = (1ull << (cluster % 64));
+
+		if(!(word & bit) && !write)
+			return m_image + ofs;
+
+		auto data = m_clusters + cluster * CLUSTER_SIZE;
+		if(!(word & bit))
+		{
+			// the base might end partway into the last cluster.
+			if(len < CLUSTER_SIZE)
+			{
+				auto start = cluster * CLUSTER_SIZE;
+				memcpy(data, m_image + start, std::min(CLUSTER_SIZE, m_size - start));
+			}
+
+			word |= bit;
+		}
+
+		return data + within;
+	}
+
+	void BlockDevice::attach(IOPortController& io)
+	{
+		io.attach(BASE_PORT, NUM_PORTS, this);
+	}
+
+	bool BlockDevice::transfer(uint64_t lba, size_t count, PhysAddr buffer, bool write)
+	{
+		if(m_image == nullptr || lba > this->sectors() || count > this->sectors() - lba)
+			return false;
+
+		if(write && m_readonly)
+			return false;
+
+		if(count == 0)
+			return true;
+
+		auto ofs = lba * SECTOR_SIZE;
+		auto len = count * SECTOR_SIZE;
+
+		// reading from the disk writes to memory, and vice versa.
+		m_memory.dmaSpans(buffer, len, /* write: */ !write, m_spans);
+
+		auto pos = ofs;
+		for(auto& s : m_spans)
+		{
+			for(size_t done = 0; done < s.length; )
+			{
+				auto n = s.length - done;
+				auto image = this->locate(pos, n, write);
+
+				if(s.direct())
+				{
+					if(write)   memcpy(image, s.host + done, n);
+					else        memcpy(s.host + done, image, n);
+				}
+				else
+				{
+					auto addr = PhysAddr(s.addr.addr + done);
+
+					if(write)   m_memory.read(addr, image, n);
+					else        m_memory.write(addr, image, n);
+				}
+
+				done += n;
+				pos += n;
+			}
+		}
+
+		if(write)
+		{
+			m_dirty_start = std::min(m_dirty_start, ofs);
+			m_dirty_end = std::max(m_dirty_end, ofs + len);
+			m_unflushed = true;
+
+			if(m_dirty_end - m_dirty_start >= WRITE_BATCH)
+				this->write_back();
+		}
+		else
+		{
+			this->read_ahead(lba, count);
+		}
+
+		return true;
+	}
+
+	void BlockDevice::read_ahead(uint64_t lba, size_t count)
+	{
+		auto sequential = (lba == m_next_sector);
+		m_next_sector = lba + count;
+
+		if(!sequential)
+		{
+			m_read_ahead = READ_AHEAD_MIN;
+			m_read_ahead_end = 0;
+			return;
+		}
+
+		// only ask again once the reads have eaten into the window; each time, it doubles.
+		auto end = m_next_sector * SECTOR_SIZE;
+		if(end + m_read_ahead / 2 <= m_read_ahead_end)
+			return;
+
+		auto start = std::max(end, m_read_ahead_end) & ~(MemoryController::PAGE_SIZE - 1);
+		auto stop = std::min(end + m_read_ahead, m_size);
+
+		if(start < stop)
+			madvise(m_image + start, stop - start, MADV_WILLNEED);
+
+		m_read_ahead_end = stop;
+		m_read_ahead = std::min(m_read_ahead * 2, READ_AHEAD_MAX);
+	}
+
+	void BlockDevice::write_back()
+	{
+		if(m_dirty_start >= m_dirty_end)
+			return;
+
+		// start writing the batch out, but don't wait for it. the overlay's clusters are at the same
+		// offsets as in the disk, just further along.
+	#if defined(__linux__)
+		auto fd = (m_overlay ? m_overlay_fd : m_fd);
+		auto shift = (m_overlay ? static_cast<size_t>(m_clusters - m_overlay) : 0);
+		sync_file_range(fd, shift + m_dirty_start, m_dirty_end - m_dirty_start, SYNC_FILE_RANGE_WRITE);
+	#else
+		auto base = (m_overlay ? m_clusters : m_image);
+		auto start = m_dirty_start & ~(MemoryController::PAGE_SIZE - 1);
+		msync(base + start, m_dirty_end - start, MS_ASYNC);
+	#endif
+
+		m_dirty_start = SIZE_MAX;
+		m_dirty_end = 0;
+	}
+
+	void BlockDevice::flush()
+	{
+		if(!m_unflushed)
+			return;
+
+		this->write_back();
+
+		if(m_overlay)   msync(m_overlay, m_overlay_size, MS_SYNC);
+		else            msync(m_image, m_size, MS_SYNC);
+
+		m_unflushed = false;
+	}
+
+	void BlockDevice::biosDisk(BiosCall& call)
+	{
+		auto& ax = call.regs[BiosCall::AX];
+		auto& bx = call.regs[BiosCall::BX];
+		auto& cx = call.regs[BiosCall::CX];
+		auto& dx = call.regs[BiosCall::DX];
+		auto& carry = call.carry;
+
+		uint8_t function = (ax >> 8);
+		uint8_t drive = (dx & 0xFF);
+
+		auto done = [&](uint8_t status) {
+			ax = (ax & 0xFF) | (status << 8);
+			carry = (status != 0);
+			m_bios_status = status;
+		};
+
+		// "get status" is the one that doesn't change it.
+		if(function == 0x01)
+		{
+			ax = (ax & 0xFF) | (m_bios_status << 8);
+			carry = (m_bios_status != 0);
+			return;
+		}
+
+		// 0x01: invalid function (or drive); 0x03: write protected; 0x04: sector not found.
+		if(drive != 0x80 || m_image == nullptr)
+			return done(0x01);
+
+		auto cylinders = std::clamp(this->sectors() / (HEADS * SECTORS_PER_TRACK), uint64_t(1), uint64_t(1024));
+		auto real_mode = [](uint16_t seg, uint16_t ofs) { return PhysAddr(seg * 16 + ofs); };
+
+		switch(function)
+		{
+			case 0x00:
+				return done(0);
+
+			// read or write sectors: al = count, ch = cylinder (low 8 bits), cl = sector (and bits 8-9
+			// of the cylinder, in its top 2 bits), dh = head, es:bx = buffer.
+			case 0x02:
+			case 0x03: {
+				size_t count = (ax & 0xFF);
+				size_t cylinder = (cx >> 8) | ((cx & 0xC0) << 2);
+				size_t sector = (cx & 0x3F);
+				size_t head = (dx >> 8);
+
+				if(sector == 0 || sector > SECTORS_PER_TRACK || head >= HEADS)
+					return done(0x04);
+
+				auto lba = (uint64_t(cylinder) * HEADS + head) * SECTORS_PER_TRACK + sector - 1;
+				auto buffer = real_mode(call.regs[BiosCall::ES], bx);
+
+				if(function == 0x03 && m_readonly)
+					return done(0x03);
+
+				if(!this->transfer(lba, count, buffer, function == 0x03))
+					return done(0x04);
+
+				return done(0);
+			}
+
+			// get drive parameters.
+			case 0x08: {
+				auto max_cyl = cylinders - 1;
+
+				cx = ((max_cyl & 0xFF) << 8) | ((max_cyl >> 2) & 0xC0) | SECTORS_PER_TRACK;
+				dx = ((HEADS - 1) << 8) | 1;
+				bx = 0;
+				ax = 0;
+				return done(0);
+			}
+
+			// get disk type: a hard disk, with cx:dx sectors.
+			case 0x15: {
+				auto n = std::min(this->sectors(), uint64_t(UINT32_MAX));
+				cx = (n >> 16);
+				dx = (n & 0xFFFF);
+
+				ax = 0x0300;
+				carry = false;
+				m_bios_status = 0;
+				return;
+			}
+
+			// extensions installation check: version 1.x, with the extended read and write functions.
+			case 0x41: {
+				if(bx != 0x55AA)
+					return done(0x01);
+
+				bx = 0xAA55;
+				cx = 0x0001;
+				ax = 0x0100;
+				carry = false;
+				m_bios_status = 0;
+				return;
+			}
+
+			// extended read or write, with the disk address packet at ds:si:
+			//     u8 size, u8 0, u16 count, u16 buffer offset, u16 buffer segment, u64 lba
+			case 0x42:
+			case 0x43: {
+				auto dap = real_mode(call.regs[BiosCall::DS], call.regs[BiosCall::SI]);
+
+				auto count = m_memory.read16(PhysAddr(dap.addr + 2));
+				auto buffer = real_mode(m_memory.read16(PhysAddr(dap.addr + 6)), m_memory.read16(PhysAddr(dap.addr + 4)));
+				auto lba = m_memory.read64(PhysAddr(dap.addr + 8));
+
+				if(function == 0x43 && m_readonly)
+					return done(0x03);
+
+				// on failure, the count says how many were done; which is none.
+				if(!this->transfer(lba, count, buffer, function == 0x43))
+				{
+					m_memory.write16(PhysAddr(dap.addr + 2), 0);
+					return done(0x04);
+				}
+
+				return done(0);
+			}
+
+			// extended get drive parameters, into the buffer at ds:si:
+			//     u16 size, u16 flags, u32 cylinders, u32 heads, u32 sectors per track, u64 sectors,
+			//     u16 bytes per sector
+			case 0x48: {
+				auto buf = real_mode(call.regs[BiosCall::DS], call.regs[BiosCall::SI]);
+				if(m_memory.read16(buf) < 0x1A)
+					return done(0x01);
+
+				m_memory.write16(PhysAddr(buf.addr + 0x00), 0x1A);
+				m_memory.write16(PhysAddr(buf.addr + 0x02), 0);
+				m_memory.write32(PhysAddr(buf.addr + 0x04), cylinders);
+				m_memory.write32(PhysAddr(buf.addr + 0x08), HEADS);
+				m_memory.write32(PhysAddr(buf.addr + 0x0C), SECTORS_PER_TRACK);
+				m_memory.write64(PhysAddr(buf.addr + 0x10), this->sectors());
+				m_memory.write16(PhysAddr(buf.addr + 0x18), SECTOR_SIZE);
+				return done(0);
+			}
+
+			default:
+				lg::warn("disk", "unsupported INT 13h function {02x}", function);
+				return done(0x01);
+		}
+	}
+
+	uint32_t BlockDevice::in(uint16_t port, int bits)
+	{
+		auto reg = port - BASE_PORT;
+		auto mask = (bits == 8 ? 0xFF : 0xFFFF);
+
+		if(reg & 1)
+			return mask;
+
+		uint32_t value = 0xFFFF;
+		switch(reg)
+		{
+			case 0x00:  value = std::min(this->sectors(), uint64_t(UINT32_MAX)) & 0xFFFF; break;
+			case 0x02:  value = std::min(this->sectors(), uint64_t(UINT32_MAX)) >> 16; break;
+			case 0x04:  value = m_count; break;
+			case 0x06:  value = m_buffer & 0xFFFF; break;
+			case 0x08:  value = m_buffer >> 16; break;
+			case 0x0A:  value = (m_error ? 1 : 0); break;
+			case 0x0C:  value = (m_boot ? 1 : 0); break;
+
+			case 0x1E:  value = (m_bios.carry ? 1 : 0); break;
+
+			default:
+				if(0x10 <= reg && reg < 0x10 + 2 * BiosCall::NUM_REGS)
+					value = m_bios.regs[(reg - 0x10) / 2];
+				break;
+		}
+
+		return value & mask;
+	}
+
+	void BlockDevice::out(uint16_t port, int bits, uint32_t value)
+	{
+		auto reg = port - BASE_PORT;
+		if(reg & 1)
+			return;
+
+		// a byte write only changes the low byte.
+		auto set = [bits, value](auto& r, int shift) {
+			uint32_t mask = (bits == 8 ? 0xFF : 0xFFFF) << shift;
+			r = (r & ~mask) | ((value << shift) & mask);
+		};
+
+		switch(reg)
+		{
+			case 0x00:  set(m_lba, 0); break;
+			case 0x02:  set(m_lba, 16); break;
+			case 0x04:  set(m_count, 0); break;
+			case 0x06:  set(m_buffer, 0); break;
+			case 0x08:  set(m_buffer, 16); break;
+
+			case 0x0A:
+				switch(value & 0xFF)
+				{
+					case 1:     m_error = !this->transfer(m_lba, m_count, PhysAddr(m_buffer), /* write: */ false); break;
+					case 2:     m_error = !this->transfer(m_lba, m_count, PhysAddr(m_buffer), /* write: */ true); break;
+					case 3:     this->flush(); m_error = false; break;
+					default:    m_error = true; break;
+				}
+				break;
+
+			case 0x1E:
+				if((value & 0xFF) == 0x13)  this->biosDisk(m_bios);
+				else                        m_bios.carry = true;
+				break;
+
+			default:
+				if(0x10 <= reg && reg < 0x10 + 2 * BiosCall::NUM_REGS)
+					set(m_bios.regs[(reg - 0x10) / 2], 0);
+				break;
+		}
+	}
+}
@@ -0,0 +1,217 @@
+// pic.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "defs.h"
+#include "cpu/cpu.h"
+#include "devices/pic.h"
+
+namespace z86
+{
+	// returns the irq (0-7) that this chip would signal, or -1.
+	static int highest_request(uint8_t irr, uint8_t isr, uint8_t imr)
+	{
+		uint8_t req = irr & ~imr;
+		if(req == 0)
+			return -1;
+
+		int irq = __builtin_ctz(req);
+
+		// anything in service at the same or a higher priority blocks it.
+		if(isr & ((2u << irq) - 1))
+			return -1;
+
+		return irq;
+	}
+
+	PIC::PIC(CPU& cpu) : m_cpu(cpu)
+	{
+		this->reset();
+	}
+
+	void PIC::reset()
+	{
+		// until the guest initialises the chips, behave as if the BIOS had programmed the
+		// usual PC vectors, but leave every line masked.
+		m_master = Chip();
+		m_slave = Chip();
+
+		m_master.base = 0x08;
+		m_slave.base = 0x70;
+	}
+
+	void PIC::attach(IOPortController& io)
+	{
+		io.attach(MASTER_PORT, 2, this);
+		io.attach(SLAVE_PORT, 2, this);
+	}
+
+	void PIC::update()
+	{
+		// the slave's output is wired to the master's IRQ2.
+		if(highest_request(m_slave.irr, m_slave.isr, m_slave.imr) >= 0)
+			m_master.irr |= 0x4;
+		else
+			m_master.irr &= ~0x4;
+
+		if(this->pending())
+			m_cpu.requestInterruptCheck();
+	}
+
+	void PIC::raise(int irq)
+	{
+		assert(0 <= irq && irq < 16);
+
+		if(irq < 8) m_master.irr |= (1 << irq);
+		else        m_slave.irr |= (1 << (irq - 8));
+
+		this->update();
+	}
+
+	void PIC::lower(int irq)
+	{
+		assert(0 <= irq && irq < 16);
+
+		if(irq < 8) m_master.irr &= ~(1 << irq);
+		else        m_slave.irr &= ~(1 << (irq - 8));
+
+		this->update();
+	}
+
+	bool PIC::pending()
+	{
+		return highest_request(m_master.irr, m_master.isr, m_master.imr) >= 0;
+	}
+
+	uint8_t PIC::acknowledge()
+	{
+		auto ack = [](Chip& chip, int irq) -> uint8_t {
+			chip.irr &= ~(1 << irq);
+			if(!chip.auto_eoi)
+				chip.isr |= (1 << irq);
+
+			return chip.base + irq;
+		};
+
+		// if the request went away between pending() and now, the 8259 gives a
+		// spurious IRQ7 (without setting the ISR).
+		auto irq = highest_request(m_master.irr, m_master.isr, m_master.imr);
+		if(irq < 0)
+			return m_master.base + 7;
+
+		uint8_t vector = 0;
+		if(irq == 2)
+		{
+			auto sirq = highest_request(m_slave.irr, m_slave.isr, m_slave.imr);
+			if(sirq < 0)
+			{
+				vector = m_slave.base + 7;
+			}
+			else
+			{
+				ack(m_master, 2);
+				vector = ack(m_slave, sirq);
+			}
+		}
+		else
+		{
+			vector = ack(m_master, irq);
+		}
+
+		this->update();
+		return vector;
+	}
+
+	uint32_t PIC::chip_in(Chip& chip, uint16_t port)
+	{
+		if(port & 1)
+			return chip.imr;
+
+		return chip.read_isr ? chip.isr : chip.irr;
+	}
+
+	void PIC::chip_out(Chip& chip, uint16_t port, uint8_t value)
+	{
+		if(port & 1)
+		{
+			switch(chip.init_step)
+			{
+				case 0:
+					// OCW1
+					chip.imr = value;
+					break;
+
+				case 2:
+					// ICW2: vector base
+					chip.base = value & 0xF8;
+					chip.init_step = 3;
+					break;
+
+				case 3:
+					// ICW3: cascade wiring, which is fixed for us.
+					chip.init_step = chip.need_icw4 ? 4 : 0;
+					break;
+
+				case 4:
+					// ICW4: we only care about auto-EOI; 8086 mode is assumed.
+					chip.auto_eoi = (value & 0x2);
+					chip.init_step = 0;
+					break;
+			}
+		}
+		else if(value & 0x10)
+		{
+			// ICW1: start initialisation.
+			chip.irr = 0;
+			chip.isr = 0;
+			chip.imr = 0;
+			chip.read_isr = false;
+			chip.auto_eoi = false;
+			chip.need_icw4 = (value & 0x1);
+			chip.init_step = 2;
+		}
+		else if(value & 0x08)
+		{
+			// OCW3: we only support selecting the register that's read back.
+			if(value & 0x2)
+				chip.read_isr = (value & 0x1);
+		}
+		else
+		{
+			// OCW2
+			switch(value >> 5)
+			{
+				case 0x1:   // non-specific EOI
+					if(chip.isr != 0)
+						chip.isr &= ~(1 << __builtin_ctz(chip.isr));
+					break;
+
+				case 0x3:   // specific EOI
+					chip.isr &= ~(1 << (value & 0x7));
+					break;
+
+				default:
+					lg::dbglog("pic", "unsupported OCW2 {02x}", value);
+					break;
+			}
+		}
+
+		this->update();
+	}
+
+	uint32_t PIC::in(uint16_t port, int bits)
+	{
+		if((port & ~1) == MASTER_PORT)
+			return this->chip_in(m_master, port);
+
+		return this->chip_in(m_slave, port);
+	}
+
+	void PIC::out(uint16_t port, int bits, uint32_t value)
+	{
+		if((port & ~1) == MASTER_PORT)
+			return this->chip_out(m_master, port, value & 0xFF);
+
+		return this->chip_out(m_slave, port, value & 0xFF);
+	}
+}
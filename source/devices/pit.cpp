@@ -0,0 +1,295 @@
+// pit.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "defs.h"
+#include "devices/pic.h"
+#include "devices/pit.h"
+
+namespace z86
+{
+	PIT::PIT(Scheduler& sched, PIC& pic) : m_sched(sched), m_pic(pic)
+	{
+		this->reset();
+	}
+
+	PIT::State PIT::saveState() const
+	{
+		auto st = State { };
+		std::copy(std::begin(m_channels), std::end(m_channels), std::begin(st.channels));
+
+		return st;
+	}
+
+	void PIT::restoreState(const State& st)
+	{
+		std::copy(std::begin(st.channels), std::end(st.channels), std::begin(m_channels));
+	}
+
+	void PIT::reset()
+	{
+		// unlike the pic, don't pretend the BIOS set up channel 0 -- a free-running timer
+		// would keep the scheduler busy, and a halted guest would never be seen as stuck.
+		for(auto& ch : m_channels)
+		{
+			if(ch.event_pending)
+				m_sched.cancel(ch.event);
+
+			ch = Channel();
+		}
+	}
+
+	void PIT::attach(IOPortController& io)
+	{
+		io.attach(BASE_PORT, 4, this);
+	}
+
+	uint64_t PIT::elapsed(const Channel& ch)
+	{
+		return (m_sched.now() - ch.start) / TICKS_PER_COUNT;
+	}
+
+	uint16_t PIT::count(int channel)
+	{
+		assert(0 <= channel && channel < 3);
+
+		auto& ch = m_channels[channel];
+		if(!ch.loaded)
+			return 0;
+
+		auto n = ch.reload;
+		auto e = this->elapsed(ch);
+
+		switch(ch.mode)
+		{
+			case 2:
+				return (n - (e % n)) & 0xFFFF;
+
+			case 3: {
+				// the counter goes down by two, and reloads at the end of each half.
+				auto phase = e % n;
+				auto half = (n + 1) / 2;
+				auto within = (phase < half ? phase : phase - half);
+
+				return (n - 2 * within) & 0xFFFF;
+			}
+
+			default:
+				// modes 0 and 4 don't reload; the counter wraps around and keeps going.
+				return (n - e) & 0xFFFF;
+		}
+	}
+
+	bool PIT::output(int channel)
+	{
+		assert(0 <= channel && channel < 3);
+
+		auto& ch = m_channels[channel];
+		if(!ch.loaded)
+			return ch.mode != 0;
+
+		auto n = ch.reload;
+		auto e = this->elapsed(ch);
+
+		switch(ch.mode)
+		{
+			case 0: return e >= n;
+			case 2: return (e % n) != n - 1;
+			case 3: return (e % n) < (n + 1) / 2;
+			case 4: return e != n;
+		}
+
+		return true;
+	}
+
+	void PIT::schedule_irq(uint64_t deadline)
+	{
+		auto& ch = m_channels[0];
+
+		ch.event_pending = true;
+		ch.event = m_sched.schedule(deadline, [this, deadline](uint64_t) {
+			auto& ch = m_channels[0];
+			ch.event_pending = false;
+
+			m_pic.raise(0);
+
+			// schedule from the deadline and not from `now`, so the period doesn't drift.
+			if(ch.mode == 2 || ch.mode == 3)
+				this->schedule_irq(deadline + ch.reload * TICKS_PER_COUNT);
+		});
+	}
+
+	void PIT::load(int idx, uint32_t value)
+	{
+		auto& ch = m_channels[idx];
+
+		// note: in modes 2 and 3 a new count should only take effect at the end of the
+		// current period; we restart immediately instead, which nothing seems to mind.
+		ch.reload = (value == 0 ? 0x10000 : value);
+		ch.start = m_sched.now();
+		ch.loaded = true;
+
+		if(idx != 0)
+			return;
+
+		if(ch.event_pending)
+			m_sched.cancel(ch.event);
+
+		ch.event_pending = false;
+
+		// irq0 is edge-triggered, so it fires when the output goes high: at terminal count in
+		// modes 0, 2 and 3, and one count after it (at the end of the strobe) in mode 4.
+		auto counts = ch.reload + (ch.mode == 4 ? 1 : 0);
+		this->schedule_irq(ch.start + counts * TICKS_PER_COUNT);
+	}
+
+	void PIT::latch_count(int idx)
+	{
+		auto& ch = m_channels[idx];
+
+		// further latches are ignored until the latched value has been read.
+		if(ch.latched_bytes > 0)
+			return;
+
+		ch.latch = this->count(idx);
+		ch.latched_bytes = (ch.access == 3 ? 2 : 1);
+	}
+
+	void PIT::latch_status(int idx)
+	{
+		auto& ch = m_channels[idx];
+		if(ch.status_latched)
+			return;
+
+		ch.status = (this->output(idx) ? 0x80 : 0)
+			| (ch.loaded ? 0 : 0x40)
+			| (ch.access << 4)
+			| (ch.mode << 1);
+
+		ch.status_latched = true;
+	}
+
+	void PIT::command(uint8_t value)
+	{
+		auto sel = value >> 6;
+
+		if(sel == 3)
+		{
+			// read-back (8254 only). the latch bits are active-low.
+			for(int i = 0; i < 3; i++)
+			{
+				if(!(value & (2 << i)))
+					continue;
+
+				if(!(value & 0x20)) this->latch_count(i);
+				if(!(value & 0x10)) this->latch_status(i);
+			}
+
+			return;
+		}
+
+		auto& ch = m_channels[sel];
+
+		auto access = (value >> 4) & 0x3;
+		if(access == 0)
+			return this->latch_count(sel);
+
+		if(value & 0x1)
+			lg::dbglog("pit", "bcd counting is not supported");
+
+		// modes 6 and 7 are aliases for 2 and 3. without a gate input, 1 and 5 can't be
+		// triggered, so treat them like 0 and 4.
+		auto mode = (value >> 1) & 0x7;
+		if(mode > 5)
+			mode -= 4;
+
+		if(mode == 1 || mode == 5)
+			mode -= 1;
+
+		// writing the control word stops the channel until it gets a new count.
+		if(ch.event_pending)
+			m_sched.cancel(ch.event);
+
+		ch.event_pending = false;
+		ch.mode = mode;
+		ch.access = access;
+		ch.loaded = false;
+		ch.write_msb = false;
+		ch.read_msb = false;
+		ch.latched_bytes = 0;
+		ch.status_latched = false;
+	}
+
+	uint32_t PIT::in(uint16_t port, int bits)
+	{
+		auto idx = port - BASE_PORT;
+		if(idx == 3)
+			return 0xFF;
+
+		auto& ch = m_channels[idx];
+		if(ch.status_latched)
+		{
+			ch.status_latched = false;
+			return ch.status;
+		}
+
+		uint16_t value = 0;
+		bool msb = false;
+
+		if(ch.latched_bytes > 0)
+		{
+			value = ch.latch;
+			msb = (ch.access == 2) || (ch.access == 3 && ch.latched_bytes == 1);
+
+			ch.latched_bytes--;
+		}
+		else
+		{
+			value = this->count(idx);
+			msb = (ch.access == 2) || (ch.access == 3 && ch.read_msb);
+
+			if(ch.access == 3)
+				ch.read_msb = !ch.read_msb;
+		}
+
+		return msb ? (value >> 8) : (value & 0xFF);
+	}
+
+	void PIT::out(uint16_t port, int bits, uint32_t value)
+	{
+		auto idx = port - BASE_PORT;
+		if(idx == 3)
+			return this->command(value & 0xFF);
+
+		auto& ch = m_channels[idx];
+		value &= 0xFF;
+
+		switch(ch.access)
+		{
+			case 1:
+				this->load(idx, value);
+				break;
+
+			case 2:
+				this->load(idx, value << 8);
+				break;
+
+			case 3:
+				if(!ch.write_msb)
+				{
+					ch.write_lsb = value;
+					ch.write_msb = true;
+				}
+				else
+				{
+					ch.write_msb = false;
+					this->load(idx, ch.write_lsb | (value << 8));
+				}
+				break;
+
+			default:
+				lg::dbglog("pit", "write to channel {} before it was programmed", idx);
+				break;
+		}
+	}
+}
@@ -0,0 +1,488 @@
+// serial.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "defs.h"
+#include "devices/pic.h"
+#include "devices/serial.h"
+
+namespace z86
+{
+	HostOutput::HostOutput() : m_ring(new uint8_t[CAPACITY])
+	{
+	}
+
+	HostOutput::~HostOutput()
+	{
+		this->close();
+	}
+
+	bool HostOutput::open(const char* path, const char* name)
+	{
+		assert(m_fd < 0);
+
+		if(strcmp(path, "-") == 0)
+		{
+			m_fd = STDOUT_FILENO;
+			m_owned = false;
+		}
+		else
+		{
+			m_fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			m_owned = true;
+		}
+
+		if(m_fd < 0)
+			return false;
+
+		m_name = name;
+		m_stopping = false;
+		m_thread = std::thread([this]() { this->flush_loop(); });
+
+		return true;
+	}
+
+	void HostOutput::close()
+	{
+		if(m_fd < 0)
+			return;
+
+		{
+			auto lk = std::lock_guard<std::mutex>(m_lock);
+			m_stopping = true;
+		}
+
+		m_wake.notify_one();
+		m_thread.join();
+
+		// whatever came after the last flush.
+		this->write_out();
+
+		auto bytes = this->bytes();
+		if(bytes > 0)
+		{
+			auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_first_byte).count();
+			lg::log(m_name, "{} byte(s) in {} write(s), {} bytes/s", bytes, m_host_writes,
+				static_cast<uint64_t>(secs > 0 ? static_cast<double>(bytes) / secs : 0.0));
+		}
+
+		if(m_owned)
+			::close(m_fd);
+
+		m_fd = -1;
+	}
+
+	void HostOutput::wait_for_space()
+	{
+		// only if the host can't keep up; the flusher takes everything at once, so this is rare.
+		while(m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_acquire) == CAPACITY)
+		{
+			m_wake.notify_one();
+			std::this_thread::yield();
+		}
+	}
+
+	void HostOutput::flush_loop()
+	{
+		auto lk = std::unique_lock<std::mutex>(m_lock);
+		while(!m_stopping)
+		{
+			m_wake.wait_for(lk, std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+			if(m_stopping)
+				break;
+
+			lk.unlock();
+			this->write_out();
+			lk.lock();
+		}
+	}
+
+	void HostOutput::write_out()
+	{
+		auto head = m_head.load(std::memory_order_acquire);
+		auto tail = m_tail.load(std::memory_order_relaxed);
+		if(head == tail)
+			return;
+
+		// the part up to the end of the ring, and the part that wrapped around to the start.
+		auto start = tail % CAPACITY;
+		auto len = head - tail;
+		auto first = std::min(len, CAPACITY - start);
+
+		struct iovec iov[2] = {
+			{ .iov_base = &m_ring[start], .iov_len = first },
+			{ .iov_base = &m_ring[0], .iov_len = len - first },
+		};
+
+		auto vec = &iov[0];
+		int count = (len > first ? 2 : 1);
+
+		while(count > 0)
+		{
+			auto n = writev(m_fd, vec, count);
+			if(n < 0 && errno == EINTR)
+				continue;
+
+			m_host_writes++;
+			if(n < 0)
+			{
+				lg::warn(m_name, "write failed: {}; output is being lost", strerror(errno));
+				break;
+			}
+
+			// a short write; carry on from where it stopped.
+			auto done = static_cast<size_t>(n);
+			while(count > 0 && done >= vec->iov_len)
+			{
+				done -= vec->iov_len;
+				vec++;
+				count--;
+			}
+
+			if(count > 0)
+			{
+				vec->iov_base = static_cast<uint8_t*>(vec->iov_base) + done;
+				vec->iov_len -= done;
+			}
+		}
+
+		m_tail.store(head, std::memory_order_release);
+	}
+
+
+
+
+	// register offsets from BASE_PORT, and their bits.
+	namespace regs
+	{
+		constexpr uint16_t DATA = 0;    // RBR (in), THR (out); DLL with DLAB
+		constexpr uint16_t IER  = 1;    // DLM with DLAB
+		constexpr uint16_t IIR  = 2;    // IIR (in), FCR (out)
+		constexpr uint16_t LCR  = 3;
+		constexpr uint16_t MCR  = 4;
+		constexpr uint16_t LSR  = 5;
+		constexpr uint16_t MSR  = 6;
+		constexpr uint16_t SCR  = 7;
+
+		constexpr uint8_t IER_RX    = 0x01;
+		constexpr uint8_t IER_THRE  = 0x02;
+
+		constexpr uint8_t IIR_NONE  = 0x01;
+		constexpr uint8_t IIR_THRE  = 0x02;
+		constexpr uint8_t IIR_RX    = 0x04;
+
+		constexpr uint8_t LCR_DLAB  = 0x80;
+
+		constexpr uint8_t MCR_OUT2  = 0x08;     // gates the irq line, on a PC
+		constexpr uint8_t MCR_LOOP  = 0x10;
+
+		constexpr uint8_t LSR_DR    = 0x01;
+		constexpr uint8_t LSR_THRE  = 0x20;
+		constexpr uint8_t LSR_TEMT  = 0x40;
+	}
+
+	SerialPort::SerialPort(Scheduler& sched, PIC& pic, HostOutput& output)
+		: m_sched(sched), m_pic(pic), m_output(output)
+	{
+	}
+
+	SerialPort::~SerialPort()
+	{
+		if(m_input_thread.joinable())
+		{
+			m_input_stopping = true;
+			m_input_thread.join();
+		}
+
+		if(m_input_owned)
+			close(m_input_fd);
+	}
+
+	void SerialPort::attach(IOPortController& io)
+	{
+		io.attach(BASE_PORT, 8, this);
+	}
+
+	bool SerialPort::openInput(const char* path)
+	{
+		assert(m_input_fd < 0);
+
+		if(strcmp(path, "-") == 0)
+		{
+			m_input_fd = STDIN_FILENO;
+			m_input_owned = false;
+		}
+		else
+		{
+			m_input_fd = open(path, O_RDONLY);
+			m_input_owned = true;
+		}
+
+		if(m_input_fd < 0)
+			return false;
+
+		m_input_thread = std::thread([this]() { this->input_loop(); });
+		return true;
+	}
+
+	void SerialPort::input_loop()
+	{
+		while(!m_input_stopping.load(std::memory_order_relaxed))
+		{
+			auto head = m_input_head.load(std::memory_order_relaxed);
+			auto space = INPUT_CAPACITY - (head - m_input_tail.load(std::memory_order_acquire));
+
+			// the guest isn't reading; wait for it.
+			if(space == 0)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				continue;
+			}
+
+			// wake up now and then to see if we should stop.
+			auto pfd = pollfd { .fd = m_input_fd, .events = POLLIN, .revents = 0 };
+			if(poll(&pfd, 1, 50) <= 0)
+				continue;
+
+			// up to the end of the ring; the rest goes in on the next time around.
+			auto start = head % INPUT_CAPACITY;
+			auto n = ::read(m_input_fd, &m_input[start], std::min(space, INPUT_CAPACITY - start));
+			if(n < 0 && (errno == EINTR || errno == EAGAIN))
+				continue;
+
+			if(n <= 0)
+			{
+				m_input_eof.store(true, std::memory_order_release);
+				break;
+			}
+
+			m_input_head.store(head + n, std::memory_order_release);
+		}
+	}
+
+	bool SerialPort::data_ready()
+	{
+		if(m_mcr & regs::MCR_LOOP)
+			return m_loopback_count > 0;
+
+		return m_input_head.load(std::memory_order_acquire) != m_input_tail.load(std::memory_order_relaxed);
+	}
+
+	uint8_t SerialPort::receive()
+	{
+		if(m_mcr & regs::MCR_LOOP)
+		{
+			if(m_loopback_count == 0)
+				return 0;
+
+			auto byte = m_loopback[0];
+			memmove(&m_loopback[0], &m_loopback[1], --m_loopback_count);
+			return byte;
+		}
+
+		if(!this->data_ready())
+			return 0;
+
+		auto tail = m_input_tail.load(std::memory_order_relaxed);
+		auto byte = m_input[tail % INPUT_CAPACITY];
+		m_input_tail.store(tail + 1, std::memory_order_release);
+
+		return byte;
+	}
+
+	uint8_t SerialPort::interrupt_id()
+	{
+		if((m_ier & regs::IER_RX) && this->data_ready())
+			return regs::IIR_RX;
+
+		if((m_ier & regs::IER_THRE) && m_thre_pending)
+			return regs::IIR_THRE;
+
+		return regs::IIR_NONE;
+	}
+
+	void SerialPort::update_irq()
+	{
+		bool want = (m_mcr & regs::MCR_OUT2) && this->interrupt_id() != regs::IIR_NONE;
+		if(want && !m_irq)
+			m_pic.raise(IRQ);
+		else if(!want && m_irq)
+			m_pic.lower(IRQ);
+
+		m_irq = want;
+	}
+
+	void SerialPort::update_rx_polling()
+	{
+		// nothing will ever arrive once the input is at its end (and has been read).
+		bool input_left = (m_input_fd >= 0) && !(m_input_eof.load(std::memory_order_acquire)
+			&& !this->data_ready());
+
+		bool want = (m_ier & regs::IER_RX) && !(m_mcr & regs::MCR_LOOP) && input_left;
+		if(want && !m_rx_polling)
+		{
+			m_rx_polling = true;
+			m_rx_event = m_sched.scheduleIn(RX_POLL_TICKS, [this](uint64_t) {
+				m_rx_polling = false;
+				this->update_irq();
+				this->update_rx_polling();
+			});
+		}
+		else if(!want && m_rx_polling)
+		{
+			m_sched.cancel(m_rx_event);
+			m_rx_polling = false;
+		}
+	}
+
+	uint32_t SerialPort::in(uint16_t port, int bits)
+	{
+		uint8_t value = 0;
+		switch(port - BASE_PORT)
+		{
+			case regs::DATA:
+				if(m_lcr & regs::LCR_DLAB)
+					return m_divisor & 0xFF;
+
+				value = this->receive();
+
+				// if there's more, the next byte comes in right away; drop the line, so that
+				// the pic sees a new edge for it.
+				if(m_irq)
+				{
+					m_pic.lower(IRQ);
+					m_irq = false;
+				}
+				break;
+
+			case regs::IER:
+				if(m_lcr & regs::LCR_DLAB)
+					return m_divisor >> 8;
+
+				return m_ier;
+
+			case regs::IIR:
+				// reading the IIR is what acknowledges a THRE interrupt.
+				value = this->interrupt_id();
+				if(value == regs::IIR_THRE)
+					m_thre_pending = false;
+
+				// the fifos are there if they were enabled.
+				if(m_fcr & 0x01)
+					value |= 0xC0;
+
+				break;
+
+			case regs::LCR:
+				return m_lcr;
+
+			case regs::MCR:
+				return m_mcr;
+
+			case regs::LSR:
+				return regs::LSR_THRE | regs::LSR_TEMT | (this->data_ready() ? regs::LSR_DR : 0);
+
+			case regs::MSR:
+				// in loopback, the modem's outputs (DTR, RTS, OUT1, OUT2) come back as its inputs (DSR,
+				// CTS, RI, DCD); otherwise, there's always something on the other end.
+				if(m_mcr & regs::MCR_LOOP)
+					return ((m_mcr & 0x01) << 5) | ((m_mcr & 0x02) << 3) | ((m_mcr & 0x0C) << 4);
+
+				return 0xB0;
+
+			case regs::SCR:
+				return m_scratch;
+		}
+
+		this->update_irq();
+		return value;
+	}
+
+	void SerialPort::out(uint16_t port, int bits, uint32_t value)
+	{
+		value &= 0xFF;
+		switch(port - BASE_PORT)
+		{
+			case regs::DATA:
+				if(m_lcr & regs::LCR_DLAB)
+				{
+					m_divisor = (m_divisor & 0xFF00) | value;
+					return;
+				}
+
+				if(m_mcr & regs::MCR_LOOP)
+				{
+					// a full fifo loses the newest byte, like an overrun would.
+					if(m_loopback_count < std::size(m_loopback))
+						m_loopback[m_loopback_count++] = value;
+				}
+				else
+				{
+					m_output.put(value);
+				}
+
+				// the byte is sent instantly, so THR empties again right away; drop the line first,
+				// so that the pic sees a new edge.
+				m_thre_pending = false;
+				this->update_irq();
+				m_thre_pending = true;
+				break;
+
+			case regs::IER:
+				if(m_lcr & regs::LCR_DLAB)
+				{
+					m_divisor = (m_divisor & 0x00FF) | (value << 8);
+					return;
+				}
+
+				// enabling the THRE interrupt with an empty THR causes one straight away.
+				if(!(m_ier & regs::IER_THRE) && (value & regs::IER_THRE))
+					m_thre_pending = true;
+
+				m_ier = (value & 0x0F);
+				break;
+
+			case regs::IIR:
+				m_fcr = value;
+				break;
+
+			case regs::LCR:
+				m_lcr = value;
+				return;
+
+			case regs::MCR:
+				m_mcr = (value & 0x1F);
+				break;
+
+			case regs::SCR:
+				m_scratch = value;
+				return;
+		}
+
+		this->update_irq();
+		this->update_rx_polling();
+	}
+
+
+
+
+	void DebugConsole::attach(IOPortController& io)
+	{
+		io.attach(PORT, 1, this);
+	}
+
+	uint32_t DebugConsole::in(uint16_t port, int bits)
+	{
+		return PORT;
+	}
+
+	void DebugConsole::out(uint16_t port, int bits, uint32_t value)
+	{
+		m_output.put(value & 0xFF);
+	}
+}
@@ -0,0 +1,293 @@
+// vga.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include <chrono>
+
+#include "defs.h"
+#include "devices/vga.h"
+
+namespace z86
+{
+	// code page 437, for the characters that aren't plain ascii.
+	static constexpr uint16_t CP437_LOW[0x20] = {
+		0x0020, 0x263A, 0x263B, 0x2665, 0x2666, 0x2663, 0x2660, 0x2022, 0x25D8, 0x25CB, 0x25D9, 0x2642, 0x2640, 0x266A, 0x266B, 0x263C,
+		0x25BA, 0x25C4, 0x2195, 0x203C, 0x00B6, 0x00A7, 0x25AC, 0x21A8, 0x2191, 0x2193, 0x2192, 0x2190, 0x221F, 0x2194, 0x25B2, 0x25BC,
+	};
+
+	static constexpr uint16_t CP437_HIGH[0x80] = {
+		0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7, 0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+		0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9, 0x00FF, 0x00D6, 0x00DC, 0x00A2, 0x00A3, 0x00A5, 0x20A7, 0x0192,
+		0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA, 0x00BF, 0x2310, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+		0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556, 0x2555, 0x2563, 0x2551, 0x2557, 0x255D, 0x255C, 0x255B, 0x2510,
+		0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x255E, 0x255F, 0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x2567,
+		0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256B, 0x256A, 0x2518, 0x250C, 0x2588, 0x2584, 0x258C, 0x2590, 0x2580,
+		0x03B1, 0x00DF, 0x0393, 0x03C0, 0x03A3, 0x03C3, 0x00B5, 0x03C4, 0x03A6, 0x0398, 0x03A9, 0x03B4, 0x221E, 0x03C6, 0x03B5, 0x2229,
+		0x2261, 0x00B1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00F7, 0x2248, 0x00B0, 0x2219, 0x00B7, 0x221A, 0x207F, 0x00B2, 0x25A0, 0x00A0,
+	};
+
+	static void append_utf8(std::string& out, uint8_t ch)
+	{
+		uint32_t cp = ch;
+		if(ch < 0x20)           cp = CP437_LOW[ch];
+		else if(ch == 0x7F)     cp = 0x2302;
+		else if(ch >= 0x80)     cp = CP437_HIGH[ch - 0x80];
+
+		if(cp < 0x80)
+		{
+			out += static_cast<char>(cp);
+		}
+		else if(cp < 0x800)
+		{
+			out += static_cast<char>(0xC0 | (cp >> 6));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else
+		{
+			out += static_cast<char>(0xE0 | (cp >> 12));
+			out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		}
+	}
+
+	// the vga's colours are blue, green, red; ansi's are red, green, blue. blinking is not done,
+	// so the top bit of the background is ignored.
+	static void append_attribute(std::string& out, uint8_t attr)
+	{
+		constexpr int ansi[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+
+		auto fg = ansi[attr & 7] + ((attr & 0x08) ? 90 : 30);
+		auto bg = ansi[(attr >> 4) & 7] + 40;
+
+		out += zpr::sprint("\x1b[0;{};{}m", fg, bg);
+	}
+
+
+
+	VgaText::VgaText() : MemoryRegion(MEMORY_SIZE)
+	{
+		// blank, in grey on black.
+		for(size_t i = 0; i < MEMORY_SIZE; i += 2)
+		{
+			m_text[i + 0] = ' ';
+			m_text[i + 1] = 0x07;
+		}
+	}
+
+	VgaText::~VgaText()
+	{
+		this->stopRendering();
+	}
+
+	void VgaText::attach(IOPortController& io)
+	{
+		io.attach(CRTC_INDEX, 2, this);
+	}
+
+	void VgaText::mark_dirty(uint64_t offset, size_t len)
+	{
+		// the release makes sure that whoever takes the bit sees the write.
+		for(auto line = offset / LINE_SIZE; line <= (offset + len - 1) / LINE_SIZE; line++)
+			m_dirty[line / 64].fetch_or(1ull << (line % 64), std::memory_order_release);
+	}
+
+	void VgaText::read(uint64_t offset, void* buf, size_t len)
+	{
+		assert(offset + len <= MEMORY_SIZE);
+		memcpy(buf, m_text + offset, len);
+	}
+
+	void VgaText::write(uint64_t offset, const void* buf, size_t len)
+	{
+		assert(offset + len <= MEMORY_SIZE);
+		if(len == 0)
+			return;
+
+		memcpy(m_text + offset, buf, len);
+		this->mark_dirty(offset, len);
+	}
+
+	void VgaText::setCursor(uint16_t cell)
+	{
+		m_crtc[0x0E] = (cell >> 8);
+		m_crtc[0x0F] = (cell & 0xFF);
+		m_cursor.store(cell, std::memory_order_relaxed);
+	}
+
+	uint32_t VgaText::in(uint16_t port, int bits)
+	{
+		if(port == CRTC_INDEX)
+			return m_crtc_index;
+
+		return (m_crtc_index < sizeof(m_crtc) ? m_crtc[m_crtc_index] : 0xFF);
+	}
+
+	void VgaText::out(uint16_t port, int bits, uint32_t value)
+	{
+		// a 16-bit out to the index port sets the index and writes the data in one go.
+		if(port == CRTC_INDEX)
+		{
+			m_crtc_index = (value & 0xFF);
+			if(bits == 8)
+				return;
+
+			value >>= 8;
+		}
+
+		if(m_crtc_index >= sizeof(m_crtc))
+			return;
+
+		m_crtc[m_crtc_index] = (value & 0xFF);
+		switch(m_crtc_index)
+		{
+			case 0x0A:
+				m_cursor_hidden.store(value & 0x20, std::memory_order_relaxed);
+				break;
+
+			case 0x0C:
+			case 0x0D:
+				m_start.store((m_crtc[0x0C] << 8) | m_crtc[0x0D], std::memory_order_relaxed);
+				break;
+
+			case 0x0E:
+			case 0x0F:
+				m_cursor.store((m_crtc[0x0E] << 8) | m_crtc[0x0F], std::memory_order_relaxed);
+				break;
+		}
+	}
+
+	void VgaText::startRendering(FILE* out)
+	{
+		this->stopRendering();
+
+		m_out = out;
+		m_stopping = false;
+		m_redraw = true;
+
+		// clear the terminal, and hide its cursor while drawing.
+		fputs("\x1b[0m\x1b[2J\x1b[?25l", m_out);
+		fflush(m_out);
+
+		m_thread = std::thread([this]() { this->render_loop(); });
+	}
+
+	void VgaText::stopRendering()
+	{
+		if(!m_thread.joinable())
+			return;
+
+		{
+			auto lk = std::lock_guard<std::mutex>(m_lock);
+			m_stopping = true;
+		}
+
+		m_wake.notify_one();
+		m_thread.join();
+
+		// whatever happened since the last frame.
+		this->render();
+
+		fprintf(m_out, "\x1b[0m\x1b[%zu;1H\x1b[?25h", ROWS + 1);
+		fflush(m_out);
+
+		lg::log("vga", "{} frame(s), {} cell(s) drawn", m_frames, m_cells_drawn);
+	}
+
+	void VgaText::render_loop()
+	{
+		auto lk = std::unique_lock<std::mutex>(m_lock);
+		while(!m_stopping)
+		{
+			m_wake.wait_for(lk, std::chrono::milliseconds(REFRESH_INTERVAL_MS));
+			if(m_stopping)
+				break;
+
+			lk.unlock();
+			this->render();
+			lk.lock();
+		}
+	}
+
+	void VgaText::render()
+	{
+		uint64_t dirty[std::size(m_dirty)];
+		for(size_t i = 0; i < std::size(m_dirty); i++)
+			dirty[i] = m_dirty[i].exchange(0, std::memory_order_acquire);
+
+		auto is_dirty = [&dirty](size_t line) { return dirty[line / 64] & (1ull << (line % 64)); };
+
+		auto start = m_start.load(std::memory_order_relaxed);
+		if(start != m_shown_start)
+		{
+			m_shown_start = start;
+			m_redraw = true;
+		}
+
+		m_frame.clear();
+
+		// where the terminal's cursor is, and the attribute it's drawing with (-1 if not known).
+		int at = -1;
+		int attr = -1;
+
+		for(size_t row = 0; row < ROWS; row++)
+		{
+			// the screen wraps around at the end of text memory, so a row can span two lines of it.
+			auto first = (start * 2 + row * LINE_SIZE) % MEMORY_SIZE;
+			auto last = (first + LINE_SIZE - 1) % MEMORY_SIZE;
+
+			if(!m_redraw && !is_dirty(first / LINE_SIZE) && !is_dirty(last / LINE_SIZE))
+				continue;
+
+			for(size_t col = 0; col < COLUMNS; col++)
+			{
+				auto ofs = (first + col * 2) % MEMORY_SIZE;
+				auto cell = static_cast<uint16_t>(m_text[ofs] | (m_text[ofs + 1] << 8));
+
+				auto idx = static_cast<int>(row * COLUMNS + col);
+				if(!m_redraw && m_shown[idx] == cell)
+					continue;
+
+				m_shown[idx] = cell;
+				m_cells_drawn++;
+
+				if(at != idx)
+					m_frame += zpr::sprint("\x1b[{};{}H", row + 1, col + 1);
+
+				if(attr != (cell >> 8))
+				{
+					attr = (cell >> 8);
+					append_attribute(m_frame, attr);
+				}
+
+				// past the last column, where the terminal's cursor ends up depends on the terminal.
+				append_utf8(m_frame, cell & 0xFF);
+				at = (col + 1 < COLUMNS ? idx + 1 : -1);
+			}
+		}
+
+		m_redraw = false;
+
+		// put the terminal's cursor where the guest's is, if it's on the screen.
+		auto cursor = static_cast<int>(m_cursor.load(std::memory_order_relaxed)) - static_cast<int>(start);
+		if(m_cursor_hidden.load(std::memory_order_relaxed) || cursor < 0 || cursor >= int(ROWS * COLUMNS))
+			cursor = -1;
+
+		if(m_frame.empty() && cursor == m_shown_cursor)
+			return;
+
+		// don't let the cursor be seen jumping around while the cells are drawn.
+		if(!m_frame.empty())
+			m_frame.insert(0, "\x1b[?25l");
+
+		if(cursor >= 0)
+			m_frame += zpr::sprint("\x1b[{};{}H\x1b[?25h", cursor / COLUMNS + 1, cursor % COLUMNS + 1);
+		else
+			m_frame += "\x1b[?25l";
+
+		m_shown_cursor = cursor;
+		m_frames++;
+
+		fwrite(m_frame.data(), 1, m_frame.size(), m_out);
+		fflush(m_out);
+	}
+}
@@ -0,0 +1,572 @@
+// gdbstub.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include <atomic>
+#include <thread>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "defs.h"
+#include "gdbstub.h"
+#include "cpu/checkpoint.h"
+
+namespace z86
+{
+	static constexpr size_t NUM_REGS = 16;
+	static constexpr uint8_t INTERRUPT_CHAR = 0x03;
+
+	// gdb's order for the segment registers.
+	static constexpr SegReg GDB_SEGMENTS[] = { SegReg::CS, SegReg::SS, SegReg::DS, SegReg::ES, SegReg::FS, SegReg::GS };
+
+	static void append_hex(std::string& out, uint64_t value, size_t bytes)
+	{
+		// little endian, like the target.
+		for(size_t i = 0; i < bytes; i++)
+			out += zpr::sprint("{02x}", (value >> (i * 8)) & 0xFF);
+	}
+
+	static uint32_t parse_le32(const char* hex)
+	{
+		uint32_t ret = 0;
+		for(size_t i = 0; i < 4; i++)
+		{
+			char byte[3] = { hex[i * 2], hex[i * 2 + 1], 0 };
+			ret |= static_cast<uint32_t>(strtoul(byte, nullptr, 16)) << (i * 8);
+		}
+
+		return ret;
+	}
+
+	GdbStub::GdbStub(CPU& cpu, Checkpoints* checkpoints) : m_cpu(cpu), m_checkpoints(checkpoints), m_breakpoints(cpu)
+	{
+	}
+
+	GdbStub::~GdbStub()
+	{
+		if(m_conn != -1)        close(m_conn);
+		if(m_listener != -1)    close(m_listener);
+	}
+
+	bool GdbStub::listen(const char* where)
+	{
+		char* end = nullptr;
+		auto port = strtoul(where, &end, 10);
+
+		if(*where != 0 && *end == 0)
+		{
+			if(port == 0 || port > 65535)
+				return false;
+
+			m_listener = socket(AF_INET, SOCK_STREAM, 0);
+			if(m_listener == -1)
+				return false;
+
+			int yes = 1;
+			setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+			sockaddr_in addr = { };
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons(port);
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+			if(bind(m_listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+				return false;
+		}
+		else
+		{
+			sockaddr_un addr = { };
+			if(strlen(where) >= sizeof(addr.sun_path))
+				return false;
+
+			m_listener = socket(AF_UNIX, SOCK_STREAM, 0);
+			if(m_listener == -1)
+				return false;
+
+			addr.sun_family = AF_UNIX;
+			strcpy(addr.sun_path, where);
+			unlink(where);
+
+			if(bind(m_listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+				return false;
+		}
+
+		if(::listen(m_listener, 1) != 0)
+			return false;
+
+		lg::log("gdb", "waiting for gdb on {}", where);
+		return true;
+	}
+
+	void GdbStub::serve()
+	{
+		m_conn = accept(m_listener, nullptr, nullptr);
+		if(m_conn == -1)
+		{
+			lg::error("gdb", "accept failed");
+			return;
+		}
+
+		// packets are small and each one waits for a reply; this fails harmlessly for unix sockets.
+		int yes = 1;
+		setsockopt(m_conn, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+		lg::log("gdb", "connected");
+
+		bool detach = false;
+		std::string packet;
+		while(!detach && this->read_packet(packet))
+		{
+			if(packet == "QStartNoAckMode")
+			{
+				// the reply to this one is still acknowledged.
+				this->send_packet("OK");
+				m_ack = false;
+				continue;
+			}
+
+			auto reply = this->handle(packet, detach);
+
+			// 'k' has no reply; the connection just goes away.
+			if(packet[0] != 'k')
+				this->send_packet(reply);
+		}
+
+		close(m_conn);
+		m_conn = -1;
+
+		lg::log("gdb", "disconnected");
+
+		// on detach, the guest carries on without us.
+		if(detach && packet[0] == 'D')
+		{
+			m_breakpoints.clear();
+			m_cpu.runUntil(Scheduler::NEVER);
+		}
+	}
+
+	int GdbStub::read_char()
+	{
+		if(m_inpos == m_inbuf.size())
+		{
+			char buf[4096];
+			auto n = recv(m_conn, buf, sizeof(buf), 0);
+			if(n <= 0)
+				return -1;
+
+			m_inbuf.assign(buf, n);
+			m_inpos = 0;
+		}
+
+		return static_cast<uint8_t>(m_inbuf[m_inpos++]);
+	}
+
+	bool GdbStub::read_packet(std::string& packet)
+	{
+		while(true)
+		{
+			// acks, and interrupts while we're already stopped, are ignored.
+			int c = 0;
+			while((c = this->read_char()) != '$')
+			{
+				if(c < 0)
+					return false;
+			}
+
+			packet.clear();
+
+			uint8_t sum = 0;
+			while((c = this->read_char()) != '#')
+			{
+				if(c < 0)
+					return false;
+
+				packet += static_cast<char>(c);
+				sum += c;
+			}
+
+			char check[3] = { 0, 0, 0 };
+			for(size_t i = 0; i < 2; i++)
+			{
+				if((c = this->read_char()) < 0)
+					return false;
+
+				check[i] = c;
+			}
+
+			bool ok = (strtoul(check, nullptr, 16) == sum);
+			if(m_ack)
+				send(m_conn, ok ? "+" : "-", 1, MSG_NOSIGNAL);
+
+			if(ok && !packet.empty())
+				return true;
+		}
+	}
+
+	void GdbStub::send_packet(const std::string& data)
+	{
+		uint8_t sum = 0;
+		for(char c : data)
+			sum += c;
+
+		auto msg = zpr::sprint("${}#{02x}", data, sum);
+
+		while(true)
+		{
+			send(m_conn, msg.data(), msg.size(), MSG_NOSIGNAL);
+			if(!m_ack)
+				return;
+
+			int c = 0;
+			while((c = this->read_char()) != '+' && c != '-')
+			{
+				if(c < 0)
+					return;
+			}
+
+			if(c == '+')
+				return;
+		}
+	}
+
+	std::string GdbStub::handle(const std::string& packet, bool& detach)
+	{
+		auto args = packet.c_str() + 1;
+
+		switch(packet[0])
+		{
+			case '?':
+				return "S05";
+
+			case 'g':
+				return this->read_registers();
+
+			case 'G': {
+				for(size_t i = 0; i < NUM_REGS && strlen(args) >= (i + 1) * 8; i++)
+					this->write_register(i, parse_le32(args + i * 8));
+
+				return "OK";
+			}
+
+			case 'p': {
+				auto idx = strtoul(args, nullptr, 16);
+				if(idx >= NUM_REGS)
+					return "";
+
+				return this->read_registers().substr(idx * 8, 8);
+			}
+
+			case 'P': {
+				char* end = nullptr;
+				auto idx = strtoul(args, &end, 16);
+				if(*end != '=' || strlen(end + 1) < 8)
+					return "E01";
+
+				return this->write_register(idx, parse_le32(end + 1)) ? "OK" : "E01";
+			}
+
+			case 'm': {
+				char* end = nullptr;
+				auto addr = strtoull(args, &end, 16);
+				auto len = strtoull(end + 1, nullptr, 16);
+
+				return this->read_memory(addr, len);
+			}
+
+			case 'M': {
+				char* end = nullptr;
+				auto addr = strtoull(args, &end, 16);
+				auto len = strtoull(end + 1, &end, 16);
+
+				if(*end != ':' || strlen(end + 1) != len * 2)
+					return "E01";
+
+				return this->write_memory(addr, end + 1) ? "OK" : "E14";
+			}
+
+			case 'c':
+			case 's': {
+				// gdb can say where to resume from.
+				if(*args != 0)
+					m_cpu.jump(strtoull(args, nullptr, 16));
+
+				return this->resume(packet[0] == 's');
+			}
+
+			case 'b':
+				if(packet == "bs" || packet == "bc")
+					return this->reverse(packet == "bs");
+
+				return "";
+
+			case 'Z':
+			case 'z': {
+				char* end = nullptr;
+				auto type = strtoul(args, &end, 16);
+				auto addr = strtoull(end + 1, &end, 16);
+				auto len = strtoull(end + 1, nullptr, 16);
+				bool insert = (packet[0] == 'Z');
+
+				// software and hardware breakpoints are the same thing to us.
+				if(type == 0 || type == 1)
+				{
+					if(insert)  m_breakpoints.addBreakpoint(addr);
+					else        m_breakpoints.removeBreakpoint(addr);
+
+					return "OK";
+				}
+
+				using Watch = Breakpoints::Watch;
+				if(type > 4)
+					return "";
+
+				auto kind = (type == 2 ? Watch::Write : type == 3 ? Watch::Read : Watch::Access);
+				auto phys = m_cpu.pmmu().resolve(VirtAddr(addr));
+
+				bool ok = insert
+					? m_breakpoints.addWatchpoint(addr, phys, len, kind)
+					: m_breakpoints.removeWatchpoint(phys, len, kind);
+
+				return ok ? "OK" : "E01";
+			}
+
+			// there's only the one thread.
+			case 'H':
+			case 'T':
+				return "OK";
+
+			case 'D':
+			case 'k':
+				detach = true;
+				return "OK";
+
+			case 'q':
+				if(packet.find("qSupported") == 0)
+				{
+					auto ret = std::string("PacketSize=4000;QStartNoAckMode+");
+					if(m_checkpoints)
+						ret += ";ReverseStep+;ReverseContinue+";
+
+					return ret;
+				}
+				else if(packet == "qAttached")      return "1";
+				else if(packet == "qC")             return "QC1";
+				else if(packet == "qfThreadInfo")   return "m1";
+				else if(packet == "qsThreadInfo")   return "l";
+				else if(packet == "qOffsets")       return "Text=0;Data=0;Bss=0";
+
+				return "";
+
+			default:
+				return "";
+		}
+	}
+
+	std::string GdbStub::resume(bool step)
+	{
+		m_breakpoints.clearHit();
+
+		// an interrupt that arrived along with the last packet.
+		auto pending = m_inbuf.find(static_cast<char>(INTERRUPT_CHAR), m_inpos);
+		if(pending != std::string::npos)
+		{
+			m_inbuf.erase(pending, 1);
+			m_cpu.stop();
+		}
+
+		// while the cpu runs on this thread, watch for gdb's interrupt on another. anything else
+		// that arrives is kept for read_packet().
+		std::atomic<bool> done = false;
+		std::string extra;
+
+		auto watcher = std::thread([&]() {
+			while(!done.load())
+			{
+				auto pfd = pollfd { .fd = m_conn, .events = POLLIN, .revents = 0 };
+				if(poll(&pfd, 1, /* ms: */ 50) <= 0)
+					continue;
+
+				char c = 0;
+				if(recv(m_conn, &c, 1, 0) <= 0)
+				{
+					m_cpu.stop();
+					break;
+				}
+
+				if(c == INTERRUPT_CHAR) m_cpu.stop();
+				else                    extra += c;
+			}
+		});
+
+		bool reached = m_cpu.runUntil(step ? m_cpu.instructionCount() + 1 : Scheduler::NEVER);
+
+		done = true;
+		watcher.join();
+
+		m_inbuf.erase(0, m_inpos);
+		m_inbuf += extra;
+		m_inpos = 0;
+
+		bool interrupted = m_cpu.stopRequested();
+		m_cpu.clearStopRequest();
+
+		auto& hit = m_breakpoints.lastHit();
+		if(hit.kind != Breakpoints::Hit::Kind::None || (step && reached))
+			return this->stop_reply(false, hit);
+
+		if(interrupted)
+			return "S02";
+
+		// the cpu stopped by itself (eg. halted with interrupts off), so the "process" has exited.
+		lg::log("gdb", "cpu stopped at {04x}:{04x}", m_cpu.cs(), m_cpu.ip());
+		return "W00";
+	}
+
+	std::string GdbStub::reverse(bool step)
+	{
+		if(!m_checkpoints)
+			return "E01";
+
+		m_breakpoints.clearHit();
+
+		bool ok = false;
+		auto hit = Breakpoints::Hit();
+
+		if(step)
+		{
+			ok = m_checkpoints->reverseStep();
+		}
+		else
+		{
+			// going backwards, a watchpoint stops the cpu just before the instruction that touched
+			// it. the replay finds the latest such instruction, so remember its hit for the reply.
+			uint64_t watch_at = Scheduler::NEVER;
+			auto watch_hit = Breakpoints::Hit();
+
+			m_breakpoints.setReplaying(true);
+			ok = m_checkpoints->reverseContinue([this](CPU& cpu) -> bool {
+				return m_breakpoints.isBreakpoint(cpu.smmu().descriptor(SegReg::CS).base + cpu.ip());
+			}, [&](CPU& cpu) -> bool {
+				if(m_breakpoints.lastHit().kind != Breakpoints::Hit::Kind::Watchpoint)
+					return false;
+
+				watch_at = cpu.instructionCount() - 1;
+				watch_hit = m_breakpoints.lastHit();
+				m_breakpoints.clearHit();
+				return true;
+			});
+
+			m_breakpoints.setReplaying(false);
+			m_breakpoints.clearHit();
+
+			if(ok && m_cpu.instructionCount() == watch_at)
+				hit = watch_hit;
+		}
+
+		return this->stop_reply(!ok, hit);
+	}
+
+	std::string GdbStub::stop_reply(bool ran_out, const Breakpoints::Hit& hit)
+	{
+		if(ran_out)
+			return "T05replaylog:begin;";
+
+		if(hit.kind != Breakpoints::Hit::Kind::Watchpoint)
+			return "S05";
+
+		using Watch = Breakpoints::Watch;
+		auto kind = (hit.watch == Watch::Write ? "watch" : hit.watch == Watch::Read ? "rwatch" : "awatch");
+
+		return zpr::sprint("T05{}:{x};", kind, hit.addr);
+	}
+
+	std::string GdbStub::read_registers()
+	{
+		std::string ret;
+
+		uint32_t gprs[] = {
+			m_cpu.eax(), m_cpu.ecx(), m_cpu.edx(), m_cpu.ebx(),
+			m_cpu.esp(), m_cpu.ebp(), m_cpu.esi(), m_cpu.edi()
+		};
+
+		for(auto r : gprs)
+			append_hex(ret, r, 4);
+
+		append_hex(ret, m_cpu.ip(), 4);
+		append_hex(ret, m_cpu.flags().eflags(), 4);
+
+		for(auto sr : GDB_SEGMENTS)
+			append_hex(ret, m_cpu.segment(sr), 4);
+
+		return ret;
+	}
+
+	bool GdbStub::write_register(size_t idx, uint32_t value)
+	{
+		switch(idx)
+		{
+			case 0: m_cpu.eax() = value; break;
+			case 1: m_cpu.ecx() = value; break;
+			case 2: m_cpu.edx() = value; break;
+			case 3: m_cpu.ebx() = value; break;
+			case 4: m_cpu.esp() = value; break;
+			case 5: m_cpu.ebp() = value; break;
+			case 6: m_cpu.esi() = value; break;
+			case 7: m_cpu.edi() = value; break;
+			case 8: m_cpu.jump(value); break;
+			case 9: m_cpu.flags().setFrom(value); break;
+
+			default:
+				if(idx >= NUM_REGS)
+					return false;
+
+				m_cpu.setSegment(GDB_SEGMENTS[idx - 10], static_cast<uint16_t>(value));
+				break;
+		}
+
+		return true;
+	}
+
+	std::string GdbStub::read_memory(uint64_t addr, size_t len)
+	{
+		std::string ret;
+		for(size_t i = 0; i < len; i++)
+		{
+			auto phys = m_cpu.pmmu().resolve(VirtAddr(addr + i));
+			if(m_cpu.memory().findRegion(phys) == nullptr)
+				break;
+
+			append_hex(ret, m_cpu.memory().read8(phys), 1);
+		}
+
+		// a short read is fine, but not an empty one.
+		if(ret.empty() && len > 0)
+			return "E14";
+
+		return ret;
+	}
+
+	bool GdbStub::write_memory(uint64_t addr, const std::string& hex)
+	{
+		auto& mem = m_cpu.memory();
+		for(size_t i = 0; i < hex.size() / 2; i++)
+		{
+			auto phys = m_cpu.pmmu().resolve(VirtAddr(addr + i));
+
+			// only ram can be written; not rom, and not devices.
+			auto r = mem.findRegion(phys);
+			if(r == nullptr || r->region->inner()->hostPointer(phys.addr - r->start.addr + r->offset, 1) == nullptr)
+				return false;
+
+			mem.write8(phys, static_cast<uint8_t>(strtoul(hex.substr(i * 2, 2).c_str(), nullptr, 16)));
+		}
+
+		return true;
+	}
+}
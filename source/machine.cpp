@@ -0,0 +1,103 @@
+// machine.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "defs.h"
+#include "machine.h"
+
+namespace z86
+{
+	Machine::Machine(size_t num_cpus, size_t ram_size, bool hugetlb) : m_memory(ram_size, hugetlb), m_threads(num_cpus)
+	{
+		assert(num_cpus > 0);
+
+		for(size_t i = 0; i < num_cpus; i++)
+		{
+			m_cpus.push_back(std::make_unique<CPU>(m_memory, i));
+			m_smp.push_back(std::make_unique<SmpControl>(*this, i));
+
+			m_cpus.back()->ports().attach(SMP_PORT, 2, m_smp.back().get());
+		}
+	}
+
+	Machine::~Machine()
+	{
+		for(auto& t : m_threads)
+		{
+			if(t.joinable())
+				t.join();
+		}
+	}
+
+	void Machine::run()
+	{
+		{
+			std::lock_guard<std::mutex> lk(m_lock);
+			m_threads[0] = std::thread([this]() {
+				m_cpus[0]->start();
+			});
+		}
+
+		m_threads[0].join();
+
+		// no more cpus can be started after this, so m_threads can be used without the lock.
+		{
+			std::lock_guard<std::mutex> lk(m_lock);
+			m_stopping = true;
+		}
+
+		for(size_t i = 1; i < m_cpus.size(); i++)
+		{
+			if(!m_threads[i].joinable())
+				continue;
+
+			m_cpus[i]->stop();
+			m_threads[i].join();
+		}
+	}
+
+	void Machine::startProcessor(size_t idx, uint8_t vector)
+	{
+		std::lock_guard<std::mutex> lk(m_lock);
+
+		if(idx == 0 || idx >= m_cpus.size())
+		{
+			lg::warn("smp", "cannot start cpu {}", idx);
+			return;
+		}
+
+		if(m_stopping)
+			return;
+
+		// like a real SIPI, it's ignored by a cpu that's already running.
+		if(m_threads[idx].joinable())
+		{
+			lg::warn("smp", "cpu {} is already running", idx);
+			return;
+		}
+
+		lg::log("smp", "starting cpu {} at {04x}:0000", idx, vector << 8);
+
+		auto cs = static_cast<uint16_t>(vector << 8);
+		m_threads[idx] = std::thread([this, idx, cs]() {
+			m_cpus[idx]->start(cs, 0);
+		});
+	}
+
+	uint32_t Machine::SmpControl::in(uint16_t port, int bits)
+	{
+		if(port == SMP_PORT)
+			return m_machine.cpuCount();
+
+		return m_cpu;
+	}
+
+	void Machine::SmpControl::out(uint16_t port, int bits, uint32_t value)
+	{
+		if(port == SMP_PORT)
+			m_target = value & 0xFF;
+
+		else
+			m_machine.startProcessor(m_target, value & 0xFF);
+	}
+}
@@ -7,15 +7,48 @@
 #include "defs.h"
 #include "instrad/x86/decode.h"
 
+#include "machine.h"
 #include "cpu/cpu.h"
 #include "cpu/mem.h"
+#include "cpu/checkpoint.h"
+#include "cpu/coverage.h"
+#include "devices/disk.h"
+#include "devices/vga.h"
+#include "devices/bench.h"
+#include "devices/serial.h"
+#include "devices/bios.h"
+
+#include "gdbstub.h"
 
 
 static void print_usage()
 {
-	zpr::println("usage: ./z86 --rom <rom> --program <program>");
-	zpr::println("    --rom <rom>           mandatory: specify a path to the ROM file");
-	zpr::println("    --program <program>   mandatory: specify a path to program file");
+	zpr::println("usage: ./z86 --rom <rom> (--program <program> | --disk <image>)");
+	zpr::println("    --rom <rom>                 mandatory: specify a path to the ROM file");
+	zpr::println("    --program <program>         specify a path to program file, loaded at 0x7C00");
+	zpr::println("    --disk <image>              attach a disk image (see devices/disk.h); without --program, boot from it");
+	zpr::println("    --overlay <file>            leave the disk image alone, and write to <file> instead (made if needed)");
+	zpr::println("    --hle <list|all>            do these bios services (eg. 10,13,16,1a) in the host; see devices/bios.h");
+	zpr::println("    --vga <file|->              draw the text screen (see devices/vga.h) on <file>, or the terminal");
+	zpr::println("    --serial <file|->           send COM1 output (see devices/serial.h) to <file>, or stdout");
+	zpr::println("    --serial-input <file|->     feed COM1 with <file>, or stdin");
+	zpr::println("    --debugcon <file|->         send port 0xE9 output to <file>, or stdout");
+	zpr::println("    --cpus <n>                  run with <n> cpus (default 1); see machine.h for starting them");
+	zpr::println("    --cpu-model <model>         time instructions like a flat (default), 8086, 80186 or 80386 (see cpu/timing.h)");
+	zpr::println("    --record <log>              record nondeterministic inputs (port reads, interrupts) to <log>");
+	zpr::println("    --replay <log>              replay a run recorded with --record");
+	zpr::println("    --checkpoint-interval <n>   take a checkpoint (for reverse execution) every <n> instructions");
+	zpr::println("    --checkpoint-budget <mb>    memory for checkpoints, in megabytes (default 256)");
+	zpr::println("    --gdb <port|path>           wait for gdb to connect on a loopback port or unix socket");
+	zpr::println("    --ram <mb>                  guest ram, in megabytes (default 1); only what is used takes host memory");
+	zpr::println("    --hugetlb                   back guest ram with hugetlbfs pages (needs a size in multiples of 2MB)");
+	zpr::println("    --flat-memory               map guest memory flat into the host (see MemoryController::setFlatMapping)");
+	zpr::println("    --halt-exits                stop at the first HLT, instead of waiting for an interrupt");
+	zpr::println("    --realtime                  while halted, wait in real time for the next event");
+	zpr::println("    --bench                     time the regions marked by the guest (see devices/bench.h)");
+	zpr::println("    --listing <lst>@<addr>      a nasm listing (nasm -l) of code loaded at physical <addr>, for --coverage");
+	zpr::println("    --coverage <file>           write which lines of the listings ran (see cpu/coverage.h), as lcov, or html");
+	zpr::println("                                if <file> ends in .html; can be given more than once");
 }
 
 int main(int argc, char** argv)
@@ -30,6 +63,31 @@ int main(int argc, char** argv)
 
 	const char* rom_path = nullptr;
 	const char* prog_path = nullptr;
+	const char* record_path = nullptr;
+	const char* replay_path = nullptr;
+	const char* gdb_addr = nullptr;
+	const char* disk_path = nullptr;
+	const char* overlay_path = nullptr;
+	const char* hle_list = nullptr;
+	const char* vga_path = nullptr;
+	const char* serial_path = nullptr;
+	const char* serial_input_path = nullptr;
+	const char* debugcon_path = nullptr;
+
+	bool realtime = false;
+	bool halt_exits = false;
+	bool bench = false;
+	bool flat_memory = false;
+	bool hugetlb = false;
+	size_t num_cpus = 1;
+	CPUModel cpu_model = CPUModel::Flat;
+	size_t ram_size = MemoryController::DEFAULT_RAM_SIZE;
+
+	std::vector<const char*> coverage_paths;
+	std::vector<std::pair<std::string, uint64_t>> listings;
+
+	uint64_t checkpoint_interval = 0;
+	size_t checkpoint_budget = 256;
 
 	for(int i = 1; i < argc; i++)
 	{
@@ -51,6 +109,146 @@ int main(int argc, char** argv)
 		{
 			get_path(&prog_path);
 		}
+		else if(strcmp(argv[i], "--disk") == 0)
+		{
+			get_path(&disk_path);
+		}
+		else if(strcmp(argv[i], "--overlay") == 0)
+		{
+			get_path(&overlay_path);
+		}
+		else if(strcmp(argv[i], "--hle") == 0)
+		{
+			get_path(&hle_list);
+		}
+		else if(strcmp(argv[i], "--vga") == 0)
+		{
+			get_path(&vga_path);
+		}
+		else if(strcmp(argv[i], "--serial") == 0)
+		{
+			get_path(&serial_path);
+		}
+		else if(strcmp(argv[i], "--serial-input") == 0)
+		{
+			get_path(&serial_input_path);
+		}
+		else if(strcmp(argv[i], "--debugcon") == 0)
+		{
+			get_path(&debugcon_path);
+		}
+		else if(strcmp(argv[i], "--record") == 0)
+		{
+			get_path(&record_path);
+		}
+		else if(strcmp(argv[i], "--replay") == 0)
+		{
+			get_path(&replay_path);
+		}
+		else if(strcmp(argv[i], "--gdb") == 0)
+		{
+			get_path(&gdb_addr);
+		}
+		else if(strcmp(argv[i], "--cpus") == 0)
+		{
+			const char* count = nullptr;
+			get_path(&count);
+
+			num_cpus = strtoul(count, nullptr, 0);
+			if(num_cpus == 0 || num_cpus > 256)
+			{
+				zpr::fprintln(stderr, "invalid cpu count '{}'", count);
+				exit(1);
+			}
+		}
+		else if(strcmp(argv[i], "--cpu-model") == 0)
+		{
+			const char* model = nullptr;
+			get_path(&model);
+
+			if(!parse_cpu_model(model, &cpu_model))
+			{
+				zpr::fprintln(stderr, "invalid cpu model '{}'", model);
+				exit(1);
+			}
+		}
+		else if(strcmp(argv[i], "--checkpoint-interval") == 0 || strcmp(argv[i], "--checkpoint-budget") == 0)
+		{
+			bool is_interval = (strcmp(argv[i], "--checkpoint-interval") == 0);
+
+			const char* num = nullptr;
+			get_path(&num);
+
+			auto value = strtoull(num, nullptr, 0);
+			if(value == 0)
+			{
+				zpr::fprintln(stderr, "invalid value '{}' for '{}'", num, argv[i - 1]);
+				exit(1);
+			}
+
+			if(is_interval) checkpoint_interval = value;
+			else            checkpoint_budget = value;
+		}
+		else if(strcmp(argv[i], "--ram") == 0)
+		{
+			const char* size = nullptr;
+			get_path(&size);
+
+			auto mb = strtoull(size, nullptr, 0);
+			if(mb == 0 || mb > MemoryController::MAX_RAM_SIZE / (1024 * 1024))
+			{
+				zpr::fprintln(stderr, "invalid ram size '{}' (at most {} MB)", size,
+					MemoryController::MAX_RAM_SIZE / (1024 * 1024));
+				exit(1);
+			}
+
+			ram_size = mb * 1024 * 1024;
+		}
+		else if(strcmp(argv[i], "--hugetlb") == 0)
+		{
+			hugetlb = true;
+		}
+		else if(strcmp(argv[i], "--flat-memory") == 0)
+		{
+			flat_memory = true;
+		}
+		else if(strcmp(argv[i], "--halt-exits") == 0)
+		{
+			halt_exits = true;
+		}
+		else if(strcmp(argv[i], "--realtime") == 0)
+		{
+			realtime = true;
+		}
+		else if(strcmp(argv[i], "--bench") == 0)
+		{
+			bench = true;
+		}
+		else if(strcmp(argv[i], "--coverage") == 0)
+		{
+			const char* path = nullptr;
+			get_path(&path);
+
+			coverage_paths.push_back(path);
+		}
+		else if(strcmp(argv[i], "--listing") == 0)
+		{
+			const char* arg = nullptr;
+			get_path(&arg);
+
+			// the path is everything before the last '@'.
+			auto at = strrchr(arg, '@');
+			char* end = nullptr;
+			auto base = (at ? strtoull(at + 1, &end, 0) : 0);
+
+			if(at == nullptr || at == arg || end == at + 1 || *end != 0 || base >= (1ULL << 32))
+			{
+				zpr::fprintln(stderr, "expected '<listing>@<address>' after '--listing', not '{}'", arg);
+				exit(1);
+			}
+
+			listings.emplace_back(std::string(arg, at - arg), base);
+		}
 		else
 		{
 			zpr::fprintln(stderr, "unknown argument '{}'", argv[i]);
@@ -59,35 +257,239 @@ int main(int argc, char** argv)
 	}
 
 	if(rom_path == nullptr)  lg::fatal("z86", "rom missing");
-	if(prog_path == nullptr) lg::fatal("z86", "program missing");
+	if(prog_path == nullptr && disk_path == nullptr)
+		lg::fatal("z86", "program missing");
 
 	auto [ rom_ptr, rom_len ]   = util::readEntireFile(rom_path);
-	auto [ prog_ptr, prog_len ] = util::readEntireFile(prog_path);
 
 	if(!rom_ptr || rom_len == 0)
 		lg::fatal("z86", "invalid rom");
 
-	if(!prog_ptr || prog_len == 0)
-		lg::fatal("z86", "invalid program");
+	// with more than one cpu, the interleaving of their memory accesses isn't recorded.
+	if((record_path || replay_path) && num_cpus > 1)
+		lg::fatal("z86", "--record and --replay only work with one cpu");
+
+	// checkpoints track writes to memory from a single thread.
+	if(checkpoint_interval > 0 && num_cpus > 1)
+		lg::fatal("z86", "checkpoints only work with one cpu");
+
+	if(gdb_addr && num_cpus > 1)
+		lg::fatal("z86", "--gdb only works with one cpu");
 
-	auto cpu = z86::CPU();
+	if(overlay_path && !disk_path)
+		lg::fatal("z86", "--overlay needs a --disk");
+
+	if(record_path && replay_path)
+		lg::fatal("z86", "--record and --replay are mutually exclusive");
+
+	if(!listings.empty() && coverage_paths.empty())
+		lg::fatal("z86", "--listing needs a --coverage");
+
+	if(!coverage_paths.empty() && listings.empty())
+		lg::fatal("z86", "--coverage needs at least one --listing");
+
+	if(serial_input_path && !serial_path)
+		lg::fatal("z86", "--serial-input needs a --serial");
+
+	// going back re-reads the port, and the input has moved on by then.
+	if(serial_input_path && checkpoint_interval > 0 && !replay_path)
+		lg::fatal("z86", "serial input can only be used with checkpoints when replaying");
+
+	auto replay_log = ReplayLog();
+	if(record_path && !replay_log.openForRecording(record_path))
+		lg::fatal("z86", "could not open '{}' for recording", record_path);
+
+	if(replay_path && !replay_log.openForReplay(replay_path))
+		lg::fatal("z86", "could not read replay log '{}'", replay_path);
+
+	auto machine = z86::Machine(num_cpus, ram_size, hugetlb);
 	auto rom = new HostMmapMemoryRegion(rom_len, /* readonly: */ true);
 	rom->write(0, rom_ptr, rom_len);
 
-	cpu.memory().addRegion(PhysAddr(0xFFFF0000), rom);
-	cpu.memory().write(PhysAddr(0x7C00), prog_ptr, prog_len);
+	machine.memory().addRegion(PhysAddr(0xFFFF0000), rom);
+
+	// text memory is in the middle of ram, which carries on around it.
+	FILE* vga_out = nullptr;
+	VgaText* vga = nullptr;
+	if(vga_path)
+	{
+		vga_out = (strcmp(vga_path, "-") == 0 ? stdout : fopen(vga_path, "w"));
+		if(vga_out == nullptr)
+			lg::fatal("z86", "could not open '{}'", vga_path);
+
+		vga = new VgaText();
+		machine.memory().addRegion(PhysAddr(VgaText::BASE_ADDR), vga);
+		vga->attach(machine.cpu(0).ports());
+	}
+
+	// if it can't be done, we just carry on without it.
+	if(flat_memory)
+		machine.memory().setFlatMapping();
+
+	if(prog_path)
+	{
+		auto [ prog_ptr, prog_len ] = util::readEntireFile(prog_path);
+		if(!prog_ptr || prog_len == 0)
+			lg::fatal("z86", "invalid program");
+
+		machine.memory().write(PhysAddr(0x7C00), prog_ptr, prog_len);
+		delete[] prog_ptr;
+	}
 
 	delete[] rom_ptr;
-	delete[] prog_ptr;
 
-	cpu.start();
+	// only the bootstrap processor gets to see the disk.
+	auto disk = BlockDevice(machine.memory());
+	if(disk_path)
+	{
+		if(overlay_path ? !disk.openWithOverlay(disk_path, overlay_path) : !disk.open(disk_path))
+			lg::fatal("z86", "invalid disk image '{}'", disk_path);
+
+		disk.setBoot(prog_path == nullptr);
+		disk.attach(machine.cpu(0).ports());
+	}
+
+	// like the disk, these are only on the bootstrap processor. if the serial port and the debug
+	// console go to the same place, they share the buffer, so their output stays in order.
+	auto serial_out = HostOutput();
+	auto debugcon_out = HostOutput();
+	auto serial = SerialPort(machine.cpu(0).scheduler(), machine.cpu(0).pic(), serial_out);
+	auto debugcon = DebugConsole(debugcon_path && serial_path && strcmp(debugcon_path, serial_path) == 0
+		? serial_out : debugcon_out);
+
+	if(serial_path)
+	{
+		if(!serial_out.open(serial_path, "serial"))
+			lg::fatal("z86", "could not open '{}'", serial_path);
+
+		// when replaying, what the guest reads comes from the log.
+		if(serial_input_path && !replay_path && !serial.openInput(serial_input_path))
+			lg::fatal("z86", "could not open '{}'", serial_input_path);
+
+		serial.attach(machine.cpu(0).ports());
+	}
+
+	if(debugcon_path)
+	{
+		if(!serial_out.isOpen() || strcmp(debugcon_path, serial_path) != 0)
+		{
+			if(!debugcon_out.open(debugcon_path, "debugcon"))
+				lg::fatal("z86", "could not open '{}'", debugcon_path);
+		}
+
+		debugcon.attach(machine.cpu(0).ports());
+	}
+
+	auto bench_markers = BenchMarkers(machine.cpu(0));
+	if(bench)
+		bench_markers.attach(machine.cpu(0).ports());
+
+	// this goes in before the rom runs, which leaves the vectors alone.
+	auto bios = BiosHLE(machine.memory());
+	if(hle_list)
+	{
+		if(!bios.select(hle_list))
+			lg::fatal("z86", "invalid list of bios services '{}'", hle_list);
+
+		if(bios.selected(BiosHLE::KEYBOARD) && (record_path || replay_path))
+			lg::fatal("z86", "the keyboard service can't be recorded or replayed");
+
+		if(disk_path)
+			bios.setDisk(&disk);
+
+		bios.setDisplay(vga);
+
+		bios.install();
+	}
+
+	std::unique_ptr<Coverage> coverage;
+	if(!coverage_paths.empty())
+	{
+		coverage = std::make_unique<Coverage>();
+		for(auto& [ path, base ] : listings)
+		{
+			if(!coverage->addListing(path, base))
+				lg::fatal("z86", "could not read listing '{}'", path);
+		}
+	}
+
+	for(size_t i = 0; i < machine.cpuCount(); i++)
+	{
+		if(coverage)
+			machine.cpu(i).setCoverage(coverage.get());
+
+		if(hle_list)
+			machine.cpu(i).setBios(&bios);
+
+		machine.cpu(i).setModel(cpu_model);
+		machine.cpu(i).setRealtime(realtime);
+		machine.cpu(i).setHaltExits(halt_exits);
+	}
+
+	if(record_path || replay_path)
+		machine.cpu(0).setReplayLog(&replay_log);
+
+	std::unique_ptr<Checkpoints> checkpoints;
+	if(checkpoint_interval > 0)
+		checkpoints = std::make_unique<Checkpoints>(machine.cpu(0), checkpoint_interval, checkpoint_budget * 1024 * 1024);
+
+	if(vga)
+		vga->startRendering(vga_out);
+
+	if(gdb_addr)
+	{
+		auto stub = GdbStub(machine.cpu(0), checkpoints.get());
+		if(!stub.listen(gdb_addr))
+			lg::fatal("z86", "could not listen on '{}'", gdb_addr);
+
+		machine.cpu(0).reset();
+		stub.serve();
+	}
+	else
+	{
+		machine.run();
+	}
+
+	replay_log.finish();
+
+	if(vga)
+	{
+		vga->stopRendering();
+		if(vga_out != stdout)
+			fclose(vga_out);
+	}
+
+	serial_out.close();
+	debugcon_out.close();
+
+	if(bench)
+		bench_markers.summarise();
+
+	if(coverage)
+	{
+		coverage->summarise();
+		for(auto path : coverage_paths)
+		{
+			if(!coverage->write(path))
+				lg::error("z86", "could not write coverage to '{}'", path);
+		}
+	}
+
+	if(checkpoints)
+	{
+		lg::log("z86", "{} checkpoint(s) back to instruction {}, using {} KB", checkpoints->count(),
+			checkpoints->earliest(), checkpoints->memoryUsed() / 1024);
+	}
+
+	lg::log("z86", "ram: {} KB committed of {} KB", machine.memory().ramCommitted() / 1024,
+		machine.memory().ramSize() / 1024);
 
 
 
 	// after cpu is done, dump the first 256 bytes of memory to a file.
 	{
 		auto buf = new uint8_t[256];
-		cpu.memory().read(PhysAddr(0), buf, 256);
+		machine.memory().read(PhysAddr(0), buf, 256);
 
 		auto f = fopen("mem.bin", "w");
 		fwrite(buf, 1, 256, f);
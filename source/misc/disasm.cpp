@@ -49,8 +49,11 @@ namespace z86
 					return segment + zpr::sprint("{#x}", mem.displacement());
 
 				std::string tmp = segment;
-				if(mem.displacement() != 0)
-					tmp += zpr::sprint("{#x}", mem.displacement());
+				// 8-bit displacements are sign-extended, so show them as negative.
+				if(auto disp = static_cast<int64_t>(mem.displacement()); disp < 0)
+					tmp += zpr::sprint("-{#x}", -disp);
+				else if(disp != 0)
+					tmp += zpr::sprint("{#x}", disp);
 
 				tmp += "(";
 
@@ -219,8 +222,10 @@ namespace z86
 				if(mem.scale() != 1)
 					tmp += zpr::sprint(" * {}", mem.scale());
 
-				if(mem.displacement() != 0)
-					tmp += zpr::sprint(" + {#x}", mem.displacement());
+				if(auto disp = static_cast<int64_t>(mem.displacement()); disp < 0)
+					tmp += zpr::sprint(" - {#x}", -disp);
+				else if(disp != 0)
+					tmp += zpr::sprint(" + {#x}", disp);
 
 				tmp += "]";
 				return tmp;
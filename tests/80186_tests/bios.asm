@@ -0,0 +1,89 @@
+;00: 03 50 00 00 0a 05 48 1f  48 1f 00 00 7a 38 36 20
+;10: 01 00 45 23 00 00
+; z86: --hle 10,13,16,1a --disk tests/80186_tests/bios.bin --overlay build/bios.ovl
+; the bios services done in the host: the video mode (10h/0fh), the cursor before and after
+; moving it (10h/03h and 02h), characters written at the cursor (10h/09h) as they are in the
+; text buffer, a disk read of this test's own image (13h/02h), the tick count just after it
+; was set (1ah/01h and 00h), and the shift flags (16h/02h), which doesn't wait for input.
+
+[bits 16]
+start:
+
+; the services' irets go back to a real-mode cs, so run from the copy at 0x7c00.
+jmp 0x07C0:main
+main:
+
+xor ax,ax
+mov ds,ax
+mov es,ax
+mov ss,ax
+mov sp,0x400
+
+mov ah,0x0F
+int 0x10
+mov [0x00],ax
+
+mov ah,0x03
+mov bh,0
+int 0x10
+mov [0x02],dx
+
+; row 5, column 10; then two 'H's, white on blue.
+mov ah,0x02
+mov bh,0
+mov dx,0x050A
+int 0x10
+mov ax,0x0948
+mov bx,0x001F
+mov cx,2
+int 0x10
+mov ah,0x03
+mov bh,0
+int 0x10
+mov [0x04],dx
+
+mov ax,0xB800
+mov es,ax
+mov ax,[es:(5*80+10)*2]
+mov [0x06],ax
+mov ax,[es:(5*80+10)*2+2]
+mov [0x08],ax
+xor ax,ax
+mov es,ax
+
+; c/h/s 0/0/3 is sector 2, which starts with "z86 bios".
+mov ax,0x0201
+mov bx,0x600
+mov cx,0x0003
+mov dx,0x0080
+int 0x13
+sbb bl,bl
+mov [0x0A],bl
+mov [0x0B],ah
+mov ax,[0x600]
+mov [0x0C],ax
+mov ax,[0x602]
+mov [0x0E],ax
+
+mov ah,0x01
+mov cx,0x0001
+mov dx,0x2345
+int 0x1A
+mov ah,0x00
+int 0x1A
+mov [0x10],cx
+mov [0x12],dx
+mov [0x14],al
+
+mov ah,0x02
+int 0x16
+mov [0x15],al
+
+hlt
+
+times 0x400-($-$$) db 0
+db "z86 bios"
+
+times 0xFFF0-($-$$) db 0
+jmp start
+db 0xFF
@@ -0,0 +1,44 @@
+;00: ea fa
+; z86: --cpu-model 8086
+; the 8086's cost model, timed with the pit: channel 2 counts down from 0xffff while a loop
+; runs 100 times, and is latched after it. from the load of the count to the latch, that's
+;   out (10) + mov cx (4) + 100 * (add 3, mov [mem],ax 10, inc [mem] 15+6, dec 2, jnz 4+12)
+;   - 12 (the last jnz isn't taken) + mov al (4) = 5206 cycles,
+; or 1301 whole counts of the pit (at 4 cycles each).
+
+[bits 16]
+start:
+
+xor ax,ax
+mov ds,ax
+mov ss,ax
+mov sp,0x400
+mov bx,3
+
+; channel 2: lsb then msb, mode 0, 0xffff counts.
+mov al,0xB0
+out 0x43,al
+mov al,0xFF
+out 0x42,al
+out 0x42,al
+
+mov cx,100
+again:
+add ax,bx
+mov [0x100],ax
+inc word [0x102]
+dec cx
+jnz again
+
+mov al,0x80
+out 0x43,al
+in al,0x42
+mov [0x00],al
+in al,0x42
+mov [0x01],al
+
+hlt
+
+times 0xFFF0-($-$$) db 0
+jmp start
+db 0xFF
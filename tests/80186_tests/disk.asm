@@ -0,0 +1,131 @@
+;00: 7f 00 00 00 00 00 00 00  7a 38 36 20 64 69 73 6b
+;10: 34 12 78 56 bc 9a f0 de
+; z86: --disk tests/80186_tests/disk.bin --overlay build/disk.ovl
+; the block device, with this test's own image as the disk (and the writes going to an overlay):
+; the size of the disk, a read of sector 2 through the controller, a write of sector 3, then an
+; INT 13h read (through the ports the rom's handler uses) of sector 3 back, and a flush. the
+; statuses are at 02-06, and the data read at 08 and 10.
+
+[bits 16]
+
+DISK_LBA        equ 0x1E0
+DISK_COUNT      equ 0x1E4
+DISK_BUFFER     equ 0x1E6
+DISK_COMMAND    equ 0x1EA
+DISK_AX         equ 0x1F0
+DISK_BX         equ 0x1F2
+DISK_CX         equ 0x1F4
+DISK_DX         equ 0x1F6
+DISK_ES         equ 0x1FA
+DISK_CALL       equ 0x1FE
+
+start:
+
+xor ax,ax
+mov ds,ax
+mov es,ax
+mov ss,ax
+mov sp,0x400
+
+; the size, in sectors.
+mov dx,DISK_LBA
+in ax,dx
+mov [0x00],ax
+
+; read sector 2 to 0x600.
+mov ax,2
+mov dx,DISK_LBA
+out dx,ax
+xor ax,ax
+mov dx,DISK_LBA+2
+out dx,ax
+mov ax,1
+mov dx,DISK_COUNT
+out dx,ax
+mov ax,0x600
+mov dx,DISK_BUFFER
+out dx,ax
+xor ax,ax
+mov dx,DISK_BUFFER+2
+out dx,ax
+mov al,1
+mov dx,DISK_COMMAND
+out dx,al
+in al,dx
+mov [0x02],al
+
+mov ax,[0x600]
+mov [0x08],ax
+mov ax,[0x602]
+mov [0x0A],ax
+mov ax,[0x604]
+mov [0x0C],ax
+mov ax,[0x606]
+mov [0x0E],ax
+
+; write sector 3 from 0x800.
+mov word [0x800],0x1234
+mov word [0x802],0x5678
+mov word [0x804],0x9ABC
+mov word [0x806],0xDEF0
+mov ax,3
+mov dx,DISK_LBA
+out dx,ax
+mov ax,0x800
+mov dx,DISK_BUFFER
+out dx,ax
+mov al,2
+mov dx,DISK_COMMAND
+out dx,al
+in al,dx
+mov [0x03],al
+
+; INT 13h, ah=02: read one sector at c/h/s 0/0/4 (lba 3) to 0000:0a00.
+mov ax,0x0201
+mov dx,DISK_AX
+out dx,ax
+mov ax,0xA00
+mov dx,DISK_BX
+out dx,ax
+mov ax,0x0004
+mov dx,DISK_CX
+out dx,ax
+mov ax,0x0080
+mov dx,DISK_DX
+out dx,ax
+xor ax,ax
+mov dx,DISK_ES
+out dx,ax
+mov dx,DISK_CALL
+mov al,0x13
+out dx,al
+in al,dx
+mov [0x04],al
+mov dx,DISK_AX
+in ax,dx
+mov [0x05],ah
+
+mov ax,[0xA00]
+mov [0x10],ax
+mov ax,[0xA02]
+mov [0x12],ax
+mov ax,[0xA04]
+mov [0x14],ax
+mov ax,[0xA06]
+mov [0x16],ax
+
+; flush.
+mov al,3
+mov dx,DISK_COMMAND
+out dx,al
+in al,dx
+mov [0x06],al
+
+hlt
+
+times 0x400-($-$$) db 0
+db "z86 disk"
+
+times 0xFFF0-($-$$) db 0
+jmp start
+db 0xFF
@@ -0,0 +1,45 @@
+;00: 78 56 34 12 00 00 02 00  ff ff ff ff 00 00 01 00
+;10: 00 00 03 00 34 12 aa aa  34 12 55 55 a0 00 00 00
+;20: 01 00 01 00 03 01 03 01
+; 32-bit operands in 16-bit code, with the operand size prefix (66h); the memory operand has to
+; be as wide as the register or immediate it goes with. also push and pop of a word in memory.
+
+[bits 16]
+start:
+
+mov sp,160
+
+mov dword[0],012345678h         ; mov mem32, imm32
+
+mov ebx,00001ffffh
+add ebx,1                       ; carries into the upper half
+mov dword[4],ebx                ; mov mem32, reg32
+
+mov dword[8],0fffffffeh
+add dword[8],1                  ; add mem32, imm8 (sign-extended)
+
+mov dword[12],00000ffffh
+inc dword[12]                   ; inc mem32
+
+mov dword[16],00001ffffh
+mov ecx,000010001h
+add dword[16],ecx               ; add mem32, reg32
+
+; push and pop only move a word, and only move sp by 2.
+mov word[20],01234h
+mov word[22],0aaaah
+mov dword[24],055555555h
+push word[20]
+pop word[24]
+mov word[28],sp
+
+mov eax,000010001h
+mov dword[32],eax
+mov dword[36],001010101h
+add dword[36],eax
+add dword[36],000010001h        ; add mem32, imm32
+hlt
+
+times 0xFFF0-($-$$) db 0
+jmp start
+db 0xFF
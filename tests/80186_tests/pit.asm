@@ -0,0 +1,93 @@
+;00: 00 00 00 00 00 00 00 00  00 00 00 00 00 00 00 00
+;10: 05 00 e6 03 b4 00 2a 12
+; pit: channel 0 in mode 2 as the timer, counted by the irq0 handler; channel 0's count latched
+; just after the fifth interrupt, its read-back status, and a latched count of channel 2 (which
+; has no irq) part way through a mode 0 count. the counts follow the virtual clock, so they only
+; depend on how many instructions ran (at a cycle each) since the channels were loaded.
+
+[bits 16]
+start:
+
+; the interrupt handler has to return to a real-mode cs, so run from the copy at 0x7c00.
+jmp 0x07C0:main
+main:
+
+xor ax,ax
+mov ds,ax
+mov ss,ax
+mov sp,0x400
+
+mov word [8*4],irq0
+mov word [8*4+2],0x07C0
+
+; channel 0: lsb then msb, mode 2, 1000 counts.
+mov al,0x34
+out 0x43,al
+mov al,0xE8
+out 0x40,al
+mov al,0x03
+out 0x40,al
+
+; irq0 is vector 8, as on a pc, and the only one unmasked.
+mov al,0x11
+out 0x20,al
+mov al,0x08
+out 0x21,al
+mov al,0x04
+out 0x21,al
+mov al,0x01
+out 0x21,al
+mov al,0xFE
+out 0x21,al
+
+sti
+wait_irq:
+cmp word [0x10],5
+jb wait_irq
+cli
+
+; latch channel 0's count.
+mov al,0x00
+out 0x43,al
+in al,0x40
+mov [0x12],al
+in al,0x40
+mov [0x13],al
+
+; read back channel 0's status, but not its count.
+mov al,0xE2
+out 0x43,al
+in al,0x40
+mov [0x14],al
+
+; channel 2: lsb then msb, mode 0, 0x1234 counts.
+mov al,0xB0
+out 0x43,al
+mov al,0x34
+out 0x42,al
+mov al,0x12
+out 0x42,al
+
+mov cx,20
+spin:
+dec cx
+jnz spin
+
+mov al,0x80
+out 0x43,al
+in al,0x42
+mov [0x16],al
+in al,0x42
+mov [0x17],al
+
+hlt
+
+irq0:
+inc word [0x10]
+mov al,0x20
+out 0x20,al
+iret
+
+times 0xFFF0-($-$$) db 0
+jmp start
+db 0xFF
@@ -0,0 +1,82 @@
+;00: e8 03 10 00 40 00 00 00  61 00 c2 00 22 01 83 01
+;10: e3 01 44 02 a4 02 05 03
+; z86:
+; z86: --record build/replay.log
+; z86: --replay build/replay.log
+; record and replay: a counting loop (which also reads a port) is interrupted by the timer, and
+; the handler notes the count at each of the first eight interrupts. the test runs straight,
+; then recording, then replaying the recording -- and all three must leave the same memory.
+
+[bits 16]
+start:
+
+; the interrupt handler has to return to a real-mode cs, so run from the copy at 0x7c00.
+jmp 0x07C0:main
+main:
+
+xor ax,ax
+mov ds,ax
+mov ss,ax
+mov sp,0x400
+
+mov word [8*4],irq0
+mov word [8*4+2],0x07C0
+
+; channel 0: lsb then msb, mode 2, 100 counts.
+mov al,0x34
+out 0x43,al
+mov al,100
+out 0x40,al
+mov al,0
+out 0x40,al
+
+; irq0 is vector 8, and the only one unmasked.
+mov al,0x11
+out 0x20,al
+mov al,0x08
+out 0x21,al
+mov al,0x04
+out 0x21,al
+mov al,0x01
+out 0x21,al
+mov al,0xFE
+out 0x21,al
+
+sti
+mov cx,1000
+count:
+inc word [0x00]
+in al,0x21
+dec cx
+jnz count
+cli
+
+mov al,0x00
+out 0x43,al
+in al,0x40
+mov [0x04],al
+in al,0x40
+mov [0x05],al
+
+hlt
+
+irq0:
+push ax
+push bx
+mov bx,[0x02]
+cmp bx,16
+jae irq0_done
+mov ax,[0x00]
+mov [bx+0x08],ax
+add bx,2
+mov [0x02],bx
+irq0_done:
+mov al,0x20
+out 0x20,al
+pop bx
+pop ax
+iret
+
+times 0xFFF0-($-$$) db 0
+jmp start
+db 0xFF
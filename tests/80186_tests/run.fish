@@ -1,27 +1,64 @@
 #!/usr/bin/env fish
 
+# each test's coverage goes in build/coverage, and they're put together at the end.
+mkdir -p build/coverage
+rm -f build/coverage/*.info
+
 for asm in tests/80186_tests/*.asm
 	set rom (noext $asm)".bin"
+	set lst (noext $asm)".lst"
 	set res (dirname $asm)"/res_"(basename (noext $rom))".out"
 
-	nasm -f bin -o $rom $asm
+	nasm -f bin -l $lst -o $rom $asm
 
 	set sz (wc -c $res | awk '{print $1}')
 
-	printf "testing "(basename $rom)
-	build/z86 --rom $rom --program $rom
-	if test $status -ne 0
-		printf ":\tERROR\n"
-		break
+	# a test can ask for extra arguments with a `; z86: <args>` line; with more than one, it
+	# runs once for each, and every run has to leave the same memory behind.
+	set runs (string replace -rf '^; z86:\s*' '' < $asm)
+	if test (count $runs) -eq 0
+		set runs ""
 	end
 
-	head -c $sz mem.bin > .mem.bin
-	diff .mem.bin $res > /dev/null
-	if test $status -ne 0
-		printf ":\t\033[1m\033[31mFAILED\033[0m\n"
+	# files that the runs make (eg. logs or overlays) are named after the test, in build/, and
+	# are started afresh each time.
+	set scratch build/(basename (noext $asm)).*
+	rm -f $scratch
+
+	set failed 0
+	for run in $runs
+		printf "testing "(basename $rom)
+		if test -n "$run"
+			printf " ($run)"
+		end
+
+		# the tests run from the rom, which starts at 0xFFFF0000.
+		build/z86 --rom $rom --program $rom --halt-exits --listing $lst@0xFFFF0000 \
+			--coverage build/coverage/(basename (noext $asm))".info" (string split -n ' ' -- $run)
+		if test $status -ne 0
+			printf ":\tERROR\n"
+			set failed 1
+			break
+		end
+
+		head -c $sz mem.bin > .mem.bin
+		diff .mem.bin $res > /dev/null
+		if test $status -ne 0
+			printf ":\t\033[1m\033[31mFAILED\033[0m\n"
+			set failed 1
+			break
+		else
+			printf ":\t\033[1m\033[32mPASSED\033[0m\n"
+			rm .mem.bin
+		end
+	end
+
+	if test $failed -ne 0
 		break
-	else
-		printf ":\t\033[1m\033[32mPASSED\033[0m\n"
-		rm .mem.bin
 	end
 end
+
+cat build/coverage/*.info > build/coverage/80186.info
+if command -q genhtml
+	genhtml -q -o build/coverage/html build/coverage/80186.info
+end
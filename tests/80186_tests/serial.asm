@@ -0,0 +1,133 @@
+;00: 0c 00 03 5a 60 30 61 41  42 60 01 c1 3b 30 30 3a
+;10: e9
+; z86: --serial build/serial.out --serial-input tests/80186_tests/serial.asm --debugcon build/serial.out
+; z86: --serial build/serial.out --serial-input tests/80186_tests/serial.asm --debugcon build/serial.out --record build/serial.log
+; z86: --serial build/serial.out --debugcon build/serial.out --replay build/serial.log
+; the uart (COM1) and the debug console: the divisor latch, line control and scratch registers;
+; in loopback, the modem status, and two bytes sent and received back, with the line status
+; around them; the interrupt id before and after enabling the fifos. then the first four bytes
+; of this file, from --serial-input, and the debug console's id. it runs straight, recording,
+; and replaying (without the input file).
+
+[bits 16]
+
+COM1_DATA       equ 0x3F8
+COM1_IER        equ 0x3F9
+COM1_IIR        equ 0x3FA
+COM1_LCR        equ 0x3FB
+COM1_MCR        equ 0x3FC
+COM1_LSR        equ 0x3FD
+COM1_MSR        equ 0x3FE
+COM1_SCR        equ 0x3FF
+DEBUGCON        equ 0xE9
+
+start:
+
+xor ax,ax
+mov ds,ax
+mov ss,ax
+mov sp,0x400
+
+; the divisor, through the latch.
+mov dx,COM1_LCR
+mov al,0x83
+out dx,al
+mov dx,COM1_DATA
+mov al,0x0C
+out dx,al
+mov dx,COM1_IER
+mov al,0x00
+out dx,al
+mov dx,COM1_DATA
+in al,dx
+mov [0x00],al
+mov dx,COM1_IER
+in al,dx
+mov [0x01],al
+mov dx,COM1_LCR
+mov al,0x03
+out dx,al
+in al,dx
+mov [0x02],al
+
+mov dx,COM1_SCR
+mov al,0x5A
+out dx,al
+in al,dx
+mov [0x03],al
+
+; loopback, with dtr and rts: they come back as dsr and cts.
+mov dx,COM1_MCR
+mov al,0x13
+out dx,al
+mov dx,COM1_LSR
+in al,dx
+mov [0x04],al
+mov dx,COM1_MSR
+in al,dx
+mov [0x05],al
+
+mov dx,COM1_DATA
+mov al,'A'
+out dx,al
+mov al,'B'
+out dx,al
+mov dx,COM1_LSR
+in al,dx
+mov [0x06],al
+mov dx,COM1_DATA
+in al,dx
+mov [0x07],al
+in al,dx
+mov [0x08],al
+mov dx,COM1_LSR
+in al,dx
+mov [0x09],al
+
+mov dx,COM1_IIR
+in al,dx
+mov [0x0A],al
+mov al,0x01
+out dx,al
+in al,dx
+mov [0x0B],al
+
+; out of loopback; wait for each of four bytes of input.
+mov dx,COM1_MCR
+mov al,0x03
+out dx,al
+mov bx,0x0C
+receive:
+mov dx,COM1_LSR
+in al,dx
+test al,0x01
+jz receive
+mov dx,COM1_DATA
+in al,dx
+mov [bx],al
+inc bx
+cmp bx,0x10
+jb receive
+
+mov dx,COM1_DATA
+mov al,'o'
+out dx,al
+mov al,'k'
+out dx,al
+mov al,10
+out dx,al
+
+in al,DEBUGCON
+mov [0x10],al
+mov al,'o'
+out DEBUGCON,al
+mov al,'k'
+out DEBUGCON,al
+mov al,10
+out DEBUGCON,al
+
+hlt
+
+times 0xFFF0-($-$$) db 0
+jmp start
+db 0xFF
@@ -0,0 +1,45 @@
+;00: 11 11 01 00 03 00
+; self-modifying code: the loop below rewrites an immediate and an opcode in itself after
+; they have already been executed (and decoded) once; the new versions must be what runs.
+; the rom image is also loaded at 0:7c00, and the loop runs from that (writable) copy.
+use16
+
+start:
+mov ax,0
+mov ds,ax
+mov ss,ax
+mov sp,01000h
+jmp 0:(07c00h+body)
+
+body:
+mov cx,4
+mov di,1
+mov bx,0
+mov dx,0
+mov si,0
+
+again:
+patch1:
+mov ax,1                            ; the immediate becomes 10h, 100h, 1000h
+add bx,ax
+patch2:
+inc dx                              ; becomes inc si after the first time
+add di,di
+add di,di
+add di,di
+add di,di
+mov word[07c00h+patch1+1],di
+mov byte[07c00h+patch2],46h
+dec cx
+jnz again
+
+mov word[0],bx
+mov word[2],dx
+mov word[4],si
+hlt
+
+rb 65520-$
+jmp start
+
+rb 65535-$
+db 0ffh
@@ -0,0 +1,99 @@
+;00: 00 01 06 14 00 00 00 00  20 20 64 52 80 7e fe 7f
+;10: 00 00 03 04 7f 8f 9f ef  10 20 30 40 7f 7f 00 00
+;20: 01 00 09 60 00 40 00 24  00 01 90 5a 01 00 01 00
+;30: fe ff 00 01 70 31 0c 01  00 00 4b 01 01 40 ff 3f
+;40: ff ff fc 10 7f 70 60 10  ef 00 34 12 01 80 00 7f
+;50: 00 00 b0 41 00 00 10 3f  00 00 c6 42 00 00 c0 3d
+;60: 00 00 c0 3f 00 00 00 c0  00 00 00 40 00 00 00 3e
+;70: 00 00 00 00 00 00 f8 3f  00 00 00 00 00 00 08 c0
+;80: f0 ff 30 00 00 08 00 06  00 01 40 23 10 00 f0 ff
+;90: ff ff 00 02 10 0e 0c 02  02 00 46 02 00 f0 ff 0f
+;a0: ff 01 08 00 38 30 08 00  00 1a 09 00 c0 ff 3f 00
+;b0: 00 00 00 01 02 03 04 80  90 a0 f0 10 20 30 00 00
+;c0: ef cd ab 89 00 00 00 00  ff ff 03 10 00 00 00 00
+;d0: 10 00 34 12 01 80 ff 7f  00 00 00 00 00 00 00 00
+;e0: 80 90 a0 f0 00 00 00 00
+; sse: packed integer arithmetic (with pmullw of 0xffff * 0xffff, which mustn't overflow a
+; signed int anywhere), packed float and double, immediate shifts of lanes and of the whole
+; register, and movd/movq between xmm registers, general registers and memory.
+
+[bits 16]
+start:
+
+mov sp,0x400
+
+movdqu xmm0,[cs:ia]
+movdqu xmm1,[cs:ib]
+
+; packed integer
+movdqa xmm2,xmm0
+paddb xmm2,xmm1                 ; wraps
+movdqu [0x00],xmm2
+movdqa xmm2,xmm0
+paddusb xmm2,xmm1               ; saturates
+psubw xmm2,xmm1
+movdqu [0x10],xmm2
+movdqa xmm2,xmm1
+pmullw xmm2,xmm1
+movdqu [0x20],xmm2
+movdqa xmm2,xmm1
+pmulhuw xmm2,xmm1
+movdqu [0x30],xmm2
+movdqa xmm2,xmm0
+pcmpeqb xmm2,xmm1
+pxor xmm2,xmm1
+movdqu [0x40],xmm2
+
+; packed float and double
+movups xmm3,[cs:fa]
+movups xmm4,[cs:fb]
+movaps xmm5,xmm3
+addps xmm5,xmm4
+mulps xmm5,xmm3
+movups [0x50],xmm5
+sqrtps xmm5,xmm3
+minps xmm5,xmm4
+movups [0x60],xmm5
+movupd xmm6,[cs:qa]
+movapd xmm7,xmm6
+addpd xmm7,xmm6
+divpd xmm7,[cs:qb]
+movupd [0x70],xmm7
+
+; shifts
+movdqa xmm2,xmm1
+psllw xmm2,4
+movdqu [0x80],xmm2
+movdqa xmm2,xmm1
+psraw xmm2,3                    ; keeps the sign
+movdqu [0x90],xmm2
+movdqa xmm2,xmm1
+psrld xmm2,9
+movdqu [0xa0],xmm2
+movdqa xmm2,xmm0
+pslldq xmm2,5                   ; bytes, not bits
+psrldq xmm2,2
+movdqu [0xb0],xmm2
+
+; movd and movq zero the rest of the register
+mov eax,0x89abcdef
+movd xmm2,eax
+movd ebx,xmm1
+movq [0xc0],xmm2
+mov dword[0xc8],ebx
+movq xmm2,[cs:ib+8]
+movdqu [0xd0],xmm2
+movd xmm2,[cs:ia+4]
+movq [0xe0],xmm2
+hlt
+
+ia: db 0x01,0x02,0x03,0x04,0x80,0x90,0xa0,0xf0,0x10,0x20,0x30,0x40,0x7f,0xfe,0xff,0x00
+ib: db 0xff,0xff,0x03,0x10,0x80,0x70,0x60,0x10,0x10,0x00,0x34,0x12,0x01,0x80,0xff,0x7f
+fa: dd 4.0,2.25,9.0,0.25
+fb: dd 1.5,-2.0,2.0,0.125
+qa: dq 3.0,-0.75
+qb: dq 4.0,0.5
+
+times 0xFFF0-($-$$) db 0
+jmp start
+db 0xFF
@@ -0,0 +1,105 @@
+// atomics.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+// measures locked instructions under contention: several cpus (each on its own host thread)
+// running `lock inc dword [bx]` in a loop, either all on the same dword, or each on its own
+// cache line. the split variants straddle two cache lines, so they take the striped-lock
+// fallback instead of a host atomic. after every run the counters are checked, so that a
+// lost update fails the benchmark instead of just making it faster.
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "defs.h"
+#include "cpu/cpu.h"
+
+using namespace z86;
+
+static constexpr uint64_t ITERATIONS = 0x10000;
+
+static constexpr uint64_t CODE_BASE = 0x1000;
+static constexpr uint64_t DATA_BASE = 0x8000;
+
+// the code for cpu n lives at CODE_BASE + n*0x100, so it starts at (CODE_BASE >> 4) + n*0x10 : 0
+static void write_code(MemoryController& mem, size_t cpu, uint16_t addr, bool locked)
+{
+	uint8_t code[] = {
+		0xBB, (uint8_t) (addr & 0xFF), (uint8_t) (addr >> 8),   // mov bx, addr
+		0xB9, 0x00, 0x00,                                       // mov cx, 0
+		(uint8_t) (locked ? 0xF0 : 0x3E), 0x66, 0xFF, 0x07,     // loop: lock (or ds:) inc dword [bx]
+		0x49,                                                   // dec cx
+		0x75, 0xF9,                                             // jnz loop
+		0xF4,                                                   // hlt
+	};
+
+	mem.write(PhysAddr(CODE_BASE + cpu * 0x100), code, sizeof(code));
+}
+
+static uint64_t counter_addr(size_t cpu, bool shared, bool split)
+{
+	return DATA_BASE + (shared ? 0 : cpu * 0x80) + (split ? 0x3F : 0);
+}
+
+static double measure(size_t threads, bool locked, bool shared, bool split)
+{
+	auto mem = MemoryController();
+
+	std::vector<std::unique_ptr<CPU>> cpus;
+	for(size_t i = 0; i < threads; i++)
+	{
+		write_code(mem, i, counter_addr(i, shared, split), locked);
+
+		cpus.push_back(std::make_unique<CPU>(mem, i));
+		cpus.back()->setHaltExits(true);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> workers;
+	for(size_t i = 0; i < threads; i++)
+	{
+		workers.emplace_back([&cpus, i]() {
+			cpus[i]->start((CODE_BASE >> 4) + i * 0x10, 0);
+		});
+	}
+
+	for(auto& w : workers)
+		w.join();
+
+	auto end = std::chrono::steady_clock::now();
+	auto secs = std::chrono::duration<double>(end - start).count();
+
+	// a shared counter gets every cpu's increments; otherwise each has its own.
+	for(size_t i = 0; i < (shared ? 1 : threads); i++)
+	{
+		auto expected = (shared ? threads : 1) * ITERATIONS;
+		auto count = mem.read32(PhysAddr(counter_addr(i, shared, split)));
+		if(count != expected)
+		{
+			zpr::fprintln(stderr, "{} thread(s){}{}{}: counter {} is {#x}, expected {#x}", threads,
+				locked ? ", locked" : "", shared ? ", shared" : "", split ? ", split" : "", i, count, expected);
+			exit(1);
+		}
+	}
+
+	return (threads * ITERATIONS) / secs / 1e6;
+}
+
+int main()
+{
+	// with fewer host threads than this, the numbers mostly measure oversubscription.
+	zpr::println("host threads: {}", std::thread::hardware_concurrency());
+
+	for(size_t threads = 1; threads <= 4; threads *= 2)
+	{
+		zpr::println("{} thread(s):", threads);
+		zpr::println("  inc (unlocked):           {.2f} Mops/s", measure(threads, false, false, false));
+		zpr::println("  lock inc, own line:       {.2f} Mops/s", measure(threads, true, false, false));
+		zpr::println("  lock inc, shared dword:   {.2f} Mops/s", measure(threads, true, true, false));
+		zpr::println("  lock inc, split, own:     {.2f} Mops/s", measure(threads, true, false, true));
+		zpr::println("  lock inc, split, shared:  {.2f} Mops/s", measure(threads, true, true, true));
+	}
+}
@@ -0,0 +1,119 @@
+// dma.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+// measures a device moving a file (which should be in the page cache) to and from guest ram, in
+// 64k transfers: either through a bounce buffer and MemoryController::read() / write(), or with
+// preadv / pwritev straight into the spans from MemoryController::dmaSpans().
+
+#include <chrono>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "defs.h"
+#include "cpu/mem.h"
+
+using namespace z86;
+
+static constexpr size_t FILE_SIZE = 64 * 1024 * 1024;
+static constexpr size_t TRANSFER_SIZE = 64 * 1024;
+static constexpr size_t PASSES = 8;
+
+static constexpr size_t RAM_SIZE = 128 * 1024 * 1024;
+
+static void bounce(MemoryController& mem, int fd, bool to_guest, size_t ofs)
+{
+	static uint8_t buf[TRANSFER_SIZE];
+
+	if(to_guest)
+	{
+		if(pread(fd, buf, TRANSFER_SIZE, ofs) != TRANSFER_SIZE)
+			lg::fatal("bench", "pread failed");
+
+		mem.write(PhysAddr(ofs), buf, TRANSFER_SIZE);
+	}
+	else
+	{
+		mem.read(PhysAddr(ofs), buf, TRANSFER_SIZE);
+
+		if(pwrite(fd, buf, TRANSFER_SIZE, ofs) != TRANSFER_SIZE)
+			lg::fatal("bench", "pwrite failed");
+	}
+}
+
+static void direct(MemoryController& mem, int fd, bool to_guest, size_t ofs)
+{
+	static std::vector<MemoryController::DmaSpan> spans;
+	static std::vector<iovec> iovs;
+
+	mem.dmaSpans(PhysAddr(ofs), TRANSFER_SIZE, /* write: */ to_guest, spans);
+
+	// it's all ram here, so there's no need to handle the other spans.
+	iovs.clear();
+	for(auto& s : spans)
+	{
+		if(!s.direct())
+			lg::fatal("bench", "unexpected mmio span at {#x}", s.addr.addr);
+
+		iovs.push_back(iovec { .iov_base = s.host, .iov_len = s.length });
+	}
+
+	auto n = to_guest ? preadv(fd, iovs.data(), iovs.size(), ofs) : pwritev(fd, iovs.data(), iovs.size(), ofs);
+	if(n != TRANSFER_SIZE)
+		lg::fatal("bench", "transfer failed");
+}
+
+static double measure(MemoryController& mem, int fd, bool to_guest, decltype(&direct) fn)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	for(size_t pass = 0; pass < PASSES; pass++)
+	{
+		for(size_t ofs = 0; ofs < FILE_SIZE; ofs += TRANSFER_SIZE)
+			fn(mem, fd, to_guest, ofs);
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	auto secs = std::chrono::duration<double>(end - start).count();
+
+	return (double) (FILE_SIZE * PASSES) / (1024 * 1024) / secs;
+}
+
+int main()
+{
+	char path[] = "/tmp/z86-dma-XXXXXX";
+	int fd = mkstemp(path);
+	if(fd < 0)
+		lg::fatal("bench", "could not create a temporary file");
+
+	unlink(path);
+
+	auto memory = MemoryController(RAM_SIZE);
+
+	// fill the file (and the page cache), then touch all of the guest ram once.
+	{
+		auto buf = std::vector<uint8_t>(TRANSFER_SIZE, 0xAA);
+		for(size_t ofs = 0; ofs < FILE_SIZE; ofs += TRANSFER_SIZE)
+		{
+			if(pwrite(fd, buf.data(), TRANSFER_SIZE, ofs) != TRANSFER_SIZE)
+				lg::fatal("bench", "could not write the temporary file");
+
+			memory.write(PhysAddr(ofs), buf.data(), TRANSFER_SIZE);
+		}
+	}
+
+	auto bounce_in = measure(memory, fd, /* to_guest: */ true, bounce);
+	auto direct_in = measure(memory, fd, /* to_guest: */ true, direct);
+	auto bounce_out = measure(memory, fd, /* to_guest: */ false, bounce);
+	auto direct_out = measure(memory, fd, /* to_guest: */ false, direct);
+
+	close(fd);
+
+	zpr::println("file -> guest (bounce buffer): {.1f} MB/s", bounce_in);
+	zpr::println("file -> guest (dma spans):     {.1f} MB/s", direct_in);
+	zpr::println("guest -> file (bounce buffer): {.1f} MB/s", bounce_out);
+	zpr::println("guest -> file (dma spans):     {.1f} MB/s", direct_out);
+}
@@ -0,0 +1,98 @@
+// memory.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+// measures MemoryController::read32() and write32() on plain ram, looking up the region on
+// every access versus going through the flat mapping; and, with the flat mapping, the cost of
+// an access to a device (which faults, and is done by the signal handler).
+
+#include <chrono>
+
+#include "defs.h"
+#include "cpu/mem.h"
+
+using namespace z86;
+
+static constexpr size_t ITERATIONS = 50'000'000;
+static constexpr size_t DEVICE_ITERATIONS = 200'000;
+
+static constexpr uint64_t DEVICE_BASE = 0x100000;
+
+// reads back the offset, and remembers the last value written.
+struct TestDevice : MemoryRegion
+{
+	TestDevice() : MemoryRegion(0x1000) { }
+
+	virtual void read(uint64_t offset, void* buf, size_t len) override
+	{
+		memcpy(buf, &offset, len);
+	}
+
+	virtual void write(uint64_t offset, const void* buf, size_t len) override
+	{
+		last = 0;
+		memcpy(&last, buf, len);
+	}
+
+	uint64_t last = 0;
+};
+
+static double measure(MemoryController& mem, uint64_t base, uint64_t mask, size_t iterations)
+{
+	uint64_t sum = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	for(size_t i = 0; i < iterations; i++)
+	{
+		auto addr = PhysAddr(base + ((i * 4) & mask));
+		mem.write32(addr, i);
+		sum += mem.read32(addr);
+	}
+
+	auto end = std::chrono::steady_clock::now();
+
+	// keep the loop from being optimised away.
+	if(sum == 1) zpr::println("");
+
+	return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+int main()
+{
+	auto memory = MemoryController();
+
+	auto device = new TestDevice();
+	memory.addRegion(PhysAddr(DEVICE_BASE), device);
+
+	auto lookup = measure(memory, 0, 0xFFFF, ITERATIONS);
+
+	if(!memory.setFlatMapping())
+		return 1;
+
+	auto flat = measure(memory, 0, 0xFFFF, ITERATIONS);
+	auto faulting = measure(memory, DEVICE_BASE, 0xFFF, DEVICE_ITERATIONS);
+
+	// make sure the handler got the sizes and registers right.
+	memory.write8(PhysAddr(DEVICE_BASE), 0xAB);
+	bool ok = (device->last == 0xAB);
+
+	memory.write16(PhysAddr(DEVICE_BASE), 0xABCD);
+	ok &= (device->last == 0xABCD);
+
+	memory.write32(PhysAddr(DEVICE_BASE), 0xABCD'EF01);
+	ok &= (device->last == 0xABCD'EF01);
+
+	memory.write64(PhysAddr(DEVICE_BASE), 0x1122'3344'5566'7788);
+	ok &= (device->last == 0x1122'3344'5566'7788);
+
+	ok &= (memory.read8(PhysAddr(DEVICE_BASE + 0x12)) == 0x12);
+	ok &= (memory.read16(PhysAddr(DEVICE_BASE + 0x345)) == 0x345);
+	ok &= (memory.read32(PhysAddr(DEVICE_BASE + 0x9AB)) == 0x9AB);
+	ok &= (memory.read64(PhysAddr(DEVICE_BASE + 0x678)) == 0x678);
+
+	zpr::println("ram (region lookup):  {.2f} ns/access", lookup / 2);
+	zpr::println("ram (flat):           {.2f} ns/access", flat / 2);
+	zpr::println("device (flat, fault): {.2f} ns/access{}", faulting / 2, ok ? "" : " -- WRONG VALUES");
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+// segments.cpp
+// Copyright (c) 2020, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+// measures the cost of SegmentedMMU::resolve() for a flat segment (which should be a
+// single branch) versus a non-flat one (which goes through the limit checks).
+
+#include <chrono>
+
+#include "defs.h"
+#include "cpu/cpu.h"
+
+using namespace z86;
+
+static constexpr size_t ITERATIONS = 50'000'000;
+
+static uint64_t make_descriptor(uint32_t base, uint32_t limit, uint8_t access, uint8_t flags)
+{
+	uint64_t ret = 0;
+	ret |= (limit & 0xFFFF);
+	ret |= (uint64_t) (base & 0xFF'FFFF) << 16;
+	ret |= (uint64_t) access << 40;
+	ret |= (uint64_t) ((limit >> 16) & 0xF) << 48;
+	ret |= (uint64_t) (flags & 0xF) << 52;
+	ret |= (uint64_t) ((base >> 24) & 0xFF) << 56;
+
+	return ret;
+}
+
+static double measure(SegmentedMMU& smmu, SegReg sr)
+{
+	uint64_t sum = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	for(size_t i = 0; i < ITERATIONS; i++)
+		sum += smmu.resolve(SegmentedAddr(sr, i & 0xFFFF), 4).addr;
+
+	auto end = std::chrono::steady_clock::now();
+
+	// keep the loop from being optimised away.
+	if(sum == 1) zpr::println("");
+
+	return std::chrono::duration<double, std::nano>(end - start).count() / ITERATIONS;
+}
+
+int main()
+{
+	auto memory = MemoryController();
+	auto cpu = CPU(memory);
+	cpu.reset();
+
+	// null, flat 4GB data, and a 1MB data segment based at 0x10000.
+	uint64_t gdt[] = {
+		0,
+		make_descriptor(0, 0xFFFFF, 0x92, 0xC),
+		make_descriptor(0x10000, 0xFFFFF, 0x92, 0x4),
+	};
+
+	cpu.memory().write(PhysAddr(0x1000), reinterpret_cast<uint8_t*>(gdt), sizeof(gdt));
+
+	auto& smmu = cpu.smmu();
+	smmu.loadGDT(0x1000, sizeof(gdt) - 1);
+
+	cpu.setMode(CPUMode::Prot);
+	cpu.setSegment(SegReg::DS, 0x08);
+	cpu.setSegment(SegReg::ES, 0x10);
+
+	auto flat = measure(smmu, SegReg::DS);
+	auto nonflat = measure(smmu, SegReg::ES);
+
+	zpr::println("resolve (flat):      {.2f} ns/access", flat);
+	zpr::println("resolve (non-flat):  {.2f} ns/access", nonflat);
+}
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+
+# reverse execution through the gdb stub, with checkpoints: runs the replay test (which takes
+# timer interrupts) to the second interrupt, goes back to the first with reverse-continue, and
+# steps forward and back. the memory and registers must be as they were the first time round,
+# and running on to the end must leave the test's usual result.
+
+import os
+import socket
+import subprocess
+import sys
+import time
+
+TESTS = "tests/80186_tests"
+OUT = "build/gdb"
+SOCK = os.path.abspath(f"{OUT}/reverse.sock")
+
+# where the rom is also loaded (and where it runs from).
+PROGRAM = 0x7C00
+
+
+class Stub:
+	def __init__(self, path):
+		self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+		self.sock.connect(path)
+		self.buf = b""
+
+	def recv(self):
+		while True:
+			i = self.buf.find(b"$")
+			j = self.buf.find(b"#", i)
+			if i >= 0 and j >= 0 and len(self.buf) >= j + 3:
+				packet = self.buf[i + 1:j]
+				self.buf = self.buf[j + 3:]
+				self.sock.sendall(b"+")
+				return packet.decode()
+
+			data = self.sock.recv(4096)
+			if not data:
+				raise EOFError("the stub went away")
+
+			self.buf += data
+
+	def cmd(self, packet):
+		data = packet.encode()
+		self.sock.sendall(b"$%s#%02x" % (data, sum(data) & 0xFF))
+		reply = self.recv()
+		self.buf = self.buf.lstrip(b"+")
+		return reply
+
+
+def check(what, got, expected):
+	if got != expected:
+		print(f"reverse: {what}: expected {expected!r}, got {got!r}")
+		print("testing reverse:\t\033[1m\033[31mFAILED\033[0m")
+		sys.exit(1)
+
+
+def main():
+	os.makedirs(OUT, exist_ok=True)
+
+	rom = os.path.abspath(f"{OUT}/replay.bin")
+	subprocess.run(["nasm", "-f", "bin", "-o", rom, f"{TESTS}/replay.asm"], check=True)
+
+	if os.path.exists(SOCK):
+		os.unlink(SOCK)
+
+	z86 = subprocess.Popen([os.path.abspath("build/z86"), "--rom", rom, "--program", rom, "--halt-exits",
+		"--checkpoint-interval", "64", "--gdb", SOCK], cwd=OUT, stdout=subprocess.DEVNULL)
+
+	# wait for the stub to start listening.
+	stub = None
+	for _ in range(100):
+		try:
+			stub = Stub(SOCK)
+			break
+		except OSError:
+			time.sleep(0.05)
+
+	if stub is None:
+		check("connecting", "nothing", SOCK)
+
+	# the test points vector 8 at its irq0 handler first thing, so find it there.
+	check("watchpoint", stub.cmd("Z2,22,2"), "OK")
+	check("vector 8 written", stub.cmd("c")[:3], "T05")
+	check("remove watchpoint", stub.cmd("z2,22,2"), "OK")
+
+	vector = bytes.fromhex(stub.cmd("m20,2"))
+	irq0 = f"{PROGRAM + int.from_bytes(vector, 'little'):x}"
+
+	check("breakpoint", stub.cmd(f"Z0,{irq0},1"), "OK")
+	check("first interrupt", stub.cmd("c"), "S05")
+
+	regs = stub.cmd("g")
+	mem = stub.cmd("m0,400")
+
+	check("second interrupt", stub.cmd("c"), "S05")
+	check("reverse-continue", stub.cmd("bc"), "S05")
+	check("registers after reverse-continue", stub.cmd("g"), regs)
+	check("memory after reverse-continue", stub.cmd("m0,400"), mem)
+
+	for _ in range(3):
+		check("step", stub.cmd("s"), "S05")
+
+	for _ in range(3):
+		check("reverse-step", stub.cmd("bs"), "S05")
+
+	check("registers after reverse-step", stub.cmd("g"), regs)
+	check("memory after reverse-step", stub.cmd("m0,400"), mem)
+
+	check("remove breakpoint", stub.cmd(f"z0,{irq0},1"), "OK")
+	check("run to the end", stub.cmd("c"), "W00")
+
+	stub.sock.close()
+	check("exit status", z86.wait(timeout=10), 0)
+
+	with open(f"{TESTS}/res_replay.out", "rb") as f:
+		expected = f.read()
+
+	with open(f"{OUT}/mem.bin", "rb") as f:
+		check("result", f.read(len(expected)), expected)
+
+	print("testing reverse:\t\033[1m\033[32mPASSED\033[0m")
+
+
+if __name__ == "__main__":
+	main()